@@ -3,6 +3,22 @@
 #include <streambuf>
 #include <direct.h>
 
+// the first length characters hidden in a PNG, decoding only the rows that hide them
+static std::string PNGExtractText(const std::string& file, size_t length)
+{
+	std::string text;
+	std::vector<NDI_BYTE> vecRowsBMP = Nexus_Converter::PNG2BMPRows(file.c_str(), length);
+	if (!vecRowsBMP.empty())
+	{
+		_mkdir("TEMP");
+		nexuspng::save_file(vecRowsBMP, "TEMP\\header.bmp");
+		text = Nexus::BMPExtractTextFromFile("TEMP\\header.bmp", length);
+		remove("TEMP\\header.bmp");
+		_rmdir("TEMP");
+	}
+	return text;
+}
+
 auto main(int argc, char* argv[]) -> int
 {
 
@@ -12,6 +28,8 @@ auto main(int argc, char* argv[]) -> int
 	std::string input4 = "";
 	std::string input5 = "";
 	std::string input6 = "";
+	std::string input7 = "";
+	std::string input8 = "";
 
 	if (argc >= 2) { input1 = argv[1]; }
 	if (argc >= 3) { input2 = argv[2]; }
@@ -19,6 +37,8 @@ auto main(int argc, char* argv[]) -> int
 	if (argc >= 5) { input4 = argv[4]; }
 	if (argc >= 6) { input5 = argv[5]; }
 	if (argc >= 7) { input6 = argv[6]; }
+	if (argc >= 8) { input7 = argv[7]; }
+	if (argc >= 9) { input8 = argv[8]; }
 
 	if (argc == 1) { input1 = "-h"; }
 
@@ -26,14 +46,36 @@ auto main(int argc, char* argv[]) -> int
 	{
 		std::cout << std::endl;
 		std::cout << "Nexus Data Injector Usage: " << std::endl << std::endl;
-		std::cout << "Inject       : Nexus -i [Image Format] [Input Image] [Input Data] [Output Image] [Optional Password]" << std::endl;
-		std::cout << "Retrieve     : Nexus -r [Image Format] [Input Image] [Output Data] [Optional Password]" << std::endl;
+		std::cout << "Inject       : Nexus -i [Image Format] [Input Image] [Input Data] [Output Image] [Optional Password] [Optional -k] [Optional -z, -f or -u] [Optional -x] [Optional -g]" << std::endl;
+		std::cout << "Update       : Nexus -u [Image Format] [Image] [Input Data] [Password] [Optional Offset]" << std::endl;
+		std::cout << "Retrieve     : Nexus -r [Image Format] [Input Image] [Output Data] [Optional Password] [Optional Offset] [Optional Length] [Optional -k]" << std::endl;
+		std::cout << "Shard        : Nexus -s [Image Format] [Input Data] [Password] [Cover 1] [Output 1] [Cover 2] [Output 2] ... [Optional -k] [Optional -z or -f]" << std::endl;
+		std::cout << "Join         : Nexus -j [Image Format] [Output Data] [Password] [Image 1] [Image 2] ..." << std::endl;
+		std::cout << "Volume       : Nexus -v [Image Format] [Input Image] [Output Image] [Password] [File 1] [File 2] ... [Optional -k] [Optional -z or -f]" << std::endl;
+		std::cout << "Entries      : Nexus -e [Image Format] [Input Image] [Password] [Optional Entry Name] [Optional Output Data]" << std::endl;
 		std::cout << "Convert      : Nexus -c [Output Format] [Input Image] [Output Image]" << std::endl;
 		std::cout << "Compress     : Nexus -p [Format In Use] [Input Image] [Output Image]" << std::endl;
 		std::cout << "Help Menu    : Nexus -h" << std::endl;
 		std::cout << "About        : Nexus -a" << std::endl;
 		std::cout << "Changelog    : Nexus -l" << std::endl << std::endl;
 		std::cout << "Example      : Nexus -i png image.png secret.text output.png AwesomePassword!" << std::endl << std::endl;
+		std::cout << "-k           : Lets Retrieve with -k reject a wrong password right away, at the cost of revealing it is wrong." << std::endl;
+		std::cout << "               Without it, a wrong password gives a random output file, and nothing in the image" << std::endl;
+		std::cout << "               shows there is data in it to anyone without the password." << std::endl;
+		std::cout << "-z, -f       : Compresses the data before encrypting it, -z with Deflate, -f faster but less." << std::endl;
+		std::cout << "               Data that doesn't compress is left as it is. Needs a Password." << std::endl;
+		std::cout << "Offset       : Retrieves only the data from the given byte on, or Length bytes of it, reading" << std::endl;
+		std::cout << "               just the part of the image that hides them." << std::endl;
+		std::cout << "Shard        : Splits data too large for one image over several, in proportion to their size." << std::endl;
+		std::cout << "               Join takes the images in any order. Both work on all cores." << std::endl;
+		std::cout << "-u           : Lets Update change the data in place later, appending to it or, from Offset on," << std::endl;
+		std::cout << "               writing over it, at the cost of the digest of the whole data. Needs a Password." << std::endl;
+		std::cout << "-x           : Scatters the data over the whole image in an order drawn from the Password," << std::endl;
+		std::cout << "               instead of filling it from the top. Retrieve finds it by itself, but not an Offset." << std::endl;
+		std::cout << "-g           : Stores a PNG in segments, so that Inject into it with -g again or Update only compress" << std::endl;
+		std::cout << "               the ones that change. The segments show the image was made by Nexus." << std::endl;
+		std::cout << "Volume       : Hides several files in one image. Entries lists them, or retrieves the named one," << std::endl;
+		std::cout << "               reading just the part of the image that hides the list and that file." << std::endl << std::endl;
 		return false;
 	}
 
@@ -49,6 +91,19 @@ auto main(int argc, char* argv[]) -> int
 		std::cout << "1.2.0: Added Support for \".PNG\" format." << std::endl;
 		std::cout << "1.2.2: Added lossless Compression (DEPTH)." << std::endl;
 		std::cout << "1.2.4: Added Binary Data Support." << std::endl;
+		std::cout << "1.2.6: PNG Compression now uses optimal parsing for the smallest files." << std::endl;
+		std::cout << "1.3.0: Encryption now uses ChaCha20-Poly1305, images from older versions can still be read." << std::endl;
+		std::cout << "     : Encrypted data is split in chunks, decrypted on all cores, a part can be retrieved alone." << std::endl;
+		std::cout << "     : Retrieved data is checked against a BLAKE3 digest of the whole text." << std::endl;
+		std::cout << "     : Encrypted data can be compressed first, taking fewer pixels of the image." << std::endl;
+		std::cout << "     : Data can be split over several images and joined again." << std::endl;
+		std::cout << "     : Several files can be hidden in one image and retrieved one at a time." << std::endl;
+		std::cout << "     : Data can be appended to or changed in place, encrypting only the chunks that change." << std::endl;
+		std::cout << "     : Encrypted data can be scattered over the whole image in an order drawn from the password." << std::endl;
+		std::cout << "     : PNG images with alpha hide data in it too, 16-bit PNG images stay 16-bit." << std::endl;
+		std::cout << "     : Grayscale PNG images hide data in their gray and stay grayscale, at a third of the room." << std::endl;
+		std::cout << "     : Images with a palette hide data by swapping colors that are next to each other by brightness, and stay indexed." << std::endl;
+		std::cout << "     : Encrypted data no longer starts with a readable mark, nothing shows it is there without the password." << std::endl;
 		return false;
 	}
 
@@ -59,12 +114,12 @@ auto main(int argc, char* argv[]) -> int
 		std::cout << std::endl;
 		std::cout << "About Nexus Data Injector: " << std::endl;
 		std::cout << "Nexus is a Steganography tool, used to hide data within bitmap Images with ease" << std::endl;
-		std::cout << "What makes Nexus unique is its ability to use a powerful custom made encryption" << std::endl;
-		std::cout << "Algorithm that is made only for this application." << std::endl;
+		std::cout << "The hidden data can be protected with a password, using the authenticated" << std::endl;
+		std::cout << "ChaCha20-Poly1305 encryption." << std::endl;
 		std::cout << "As of yet the supported image formats are \"BMP\" \"PNG\" However PNG has to be con" << std::endl;
 		std::cout << "verted to BMP first and then back to PNG when the operation is done." << std::endl;
 		std::cout << std::endl;
-		std::cout << "Nexus Data Injector [Version 1.2.5]" << std::endl;
+		std::cout << "Nexus Data Injector [Version 1.3.0]" << std::endl;
 		std::cout << "(C) 2017 Nirex. All rights Reseved." << std::endl;
 		std::cout << "Email: Nirex.0 [at] Gmail [dot] Com" << std::endl << std::endl;
 		return false;
@@ -87,7 +142,7 @@ auto main(int argc, char* argv[]) -> int
 			nexuspng::save_file(vecNewBMP, "TEMP\\tmp.bmp");
 
 			std::cout << "[PHASE 2]" << std::endl;
-			std::vector<NDI_BYTE> vecNewPNG = Nexus_Converter::BMP2PNG("TEMP\\tmp.bmp");
+			std::vector<NDI_BYTE> vecNewPNG = Nexus_Converter::BMP2PNG("TEMP\\tmp.bmp", true);
 			nexuspng::save_file(vecNewPNG, input4.c_str());
 
 			remove("TEMP\\tmp.bmp");
@@ -149,74 +204,335 @@ auto main(int argc, char* argv[]) -> int
 	// input4 = inputData
 	// input5 = outputImage
 	// input6 = optPassword
+	// the rest = optKeyCheck, optCompression or optPatchable, optScattered and optSegmented
 	if (input1 == "-i")
 	{
 		std::cout << std::endl;
+		nexuspng::State coverState;
+		std::string coverFile = input3;
 		if (input2 == "png")
 		{
 			std::cout << "[CONVERTING THE PNG FILE TO BMP]" << std::endl;
-			std::vector<NDI_BYTE> vecNewBMP = Nexus_Converter::PNG2BMP(input3.c_str());
+			std::vector<NDI_BYTE> vecNewBMP = Nexus_Converter::PNG2BMP(input3.c_str(), &coverState, true);
 			_mkdir("TEMP");
 			nexuspng::save_file(vecNewBMP, "TEMP\\tmp.bmp");
 			input3 = "TEMP\\tmp.bmp";
 		}
 
-		// Read The image
-		std::cout << "[READING IMAGE]" << std::endl;
+		// Read The image, a BMP cover is only read as a whole when it can't be changed in place
 		BMP inputImage;
-		inputImage.ReadFromFile(input3.c_str());
+		if (input2 == "png")
+		{
+			std::cout << "[READING IMAGE]" << std::endl;
+			inputImage.ReadFromFile(input3.c_str());
+		}
 
-		// Read Data From The File
+		// Open The Data File, it is read a piece at a time while being hidden
 		std::cout << "[READING DATA]" << std::endl;
 		std::ifstream dataFile(input4, ::std::ios::binary);
+		dataFile.seekg(0, std::ios::end);
+		size_t dataLength = (size_t)dataFile.tellg();
+		dataFile.seekg(0, std::ios::beg);
+		bool keyCheck = false, patchable = false, scattered = false, segmented = false;
+		Entropy::Compression compression = Entropy::Uncompressed;
+		for (int i = 7; i < argc; i++)
+		{
+			std::string input = argv[i];
+			if (input == "-k") { keyCheck = true; }
+			else if (input == "-z") { compression = Entropy::Deflate; }
+			else if (input == "-f") { compression = Entropy::Fast; }
+			else if (input == "-u") { patchable = true; }
+			else if (input == "-x") { scattered = true; }
+			else if (input == "-g") { segmented = true; }
+		}
+		if (scattered && input6 == "")
+		{
+			std::cout << "[SCATTERING NEEDS A PASSWORD, THE DATA GOES FROM THE TOP]" << std::endl;
+			scattered = false;
+		}
+		if (scattered && patchable)
+		{
+			std::cout << "[SCATTERED DATA CAN'T BE UPDATED]" << std::endl;
+			patchable = false;
+		}
+
+		// Patchable data is changed a chunk at a time, which compressed data can't be
+		if (patchable && compression != Entropy::Uncompressed)
+		{
+			std::cout << "[DATA THAT CAN BE UPDATED IS NOT COMPRESSED]" << std::endl;
+			compression = Entropy::Uncompressed;
+		}
 
-		// Turn Read Data into a std::string
-		std::string data((std::istreambuf_iterator<char>(dataFile)),
-			std::istreambuf_iterator<char>());
+		// Compressed data is held as a whole, the Password is needed to record how it was compressed
+		std::istringstream compressedData;
+		std::istream* data = &dataFile;
+		if (input6 != "" && compression != Entropy::Uncompressed)
+		{
+			std::cout << "[COMPRESSING DATA]" << std::endl;
+			std::string text((std::istreambuf_iterator<char>(dataFile)), std::istreambuf_iterator<char>());
+			std::string compressed;
+			compression = Entropy::Compress(text, compression, compressed);
+			if (compression == Entropy::Uncompressed)
+			{
+				std::cout << "[DATA DOES NOT COMPRESS, LEAVING IT AS IT IS]" << std::endl;
+			}
+			dataLength = compressed.length();
+			compressedData.str(compressed);
+			data = &compressedData;
+		}
 
-		// Encrypt The data if the Password Is given
+		// The data is encrypted on the way into the image if the Password Is given
 		if (input6 != "")
 		{
-			// Encrypt The Data
 			std::cout << "[ENCRYPTING DATA]" << std::endl;
-			std::string EncryptedData = Entropy::Nexus_Encrypt(data, input6);
-
-			// Inject The data into the bits of the Image and Write it back into a new Image
-			std::cout << "[CREATING OUTPUT IMAGE]" << std::endl;
+		}
 
-			if (input2 == "png")
+		// Inject The data into the bits of the Image and Write it back into a new Image
+		std::cout << "[CREATING OUTPUT IMAGE]" << std::endl;
+		if (scattered)
+		{
+			// Scattered data reaches every row, so the whole image is read and written
+			if (input2 != "png")
+			{
+				std::cout << "[READING IMAGE]" << std::endl;
+				inputImage.ReadFromFile(input3.c_str());
+			}
+			if (!Nexus::BMPEmbedScattered(*data, dataLength, input6, keyCheck, inputImage, compression))
+			{
+				std::cout << "[THE DATA DOES NOT FIT IN THE IMAGE]" << std::endl;
+			}
+			else if (input2 == "png")
 			{
 				std::cout << "[CONVERTING THE BMP FILE TO PNG]" << std::endl;
-				Nexus::BMPEmbedText(EncryptedData, inputImage).WriteToFile("TEMP\\tmp.bmp");
-				std::vector<NDI_BYTE> vecNewPNG = Nexus_Converter::BMP2PNG("TEMP\\tmp.bmp");
+				inputImage.WriteToFile("TEMP\\tmp.bmp");
+				std::vector<NDI_BYTE> vecNewPNG = Nexus_Converter::BMP2PNGPatch("TEMP\\tmp.bmp", coverFile.c_str(), inputImage.GetHeight(), coverState, segmented);
 				nexuspng::save_file(vecNewPNG, input5.c_str());
-				remove("TEMP\\tmp.bmp");
-				_rmdir("TEMP");
 			}
 			else
 			{
-				Nexus::BMPEmbedText(EncryptedData, inputImage).WriteToFile(input5.c_str());
+				inputImage.WriteToFile(input5.c_str());
 			}
-		}
-		else
-		{
-			// Inject The data into the bits of the Image and Write it back into a new Image
-			std::cout << "[CREATING OUTPUT IMAGE]" << std::endl;
 			if (input2 == "png")
 			{
-				std::cout << "[CONVERTING THE BMP FILE TO PNG]" << std::endl;
-				Nexus::BMPEmbedText(data, inputImage).WriteToFile("TEMP\\tmp.bmp");
-				std::vector<NDI_BYTE> vecNewPNG = Nexus_Converter::BMP2PNG("TEMP\\tmp.bmp");
-				nexuspng::save_file(vecNewPNG, input5.c_str());
 				remove("TEMP\\tmp.bmp");
 				_rmdir("TEMP");
 			}
-			else
+		}
+		else if (input2 == "png")
+		{
+			std::cout << "[CONVERTING THE BMP FILE TO PNG]" << std::endl;
+			Nexus::BMPEmbedStream(*data, dataLength, input6, keyCheck, inputImage, compression, patchable);
+			inputImage.WriteToFile("TEMP\\tmp.bmp");
+			size_t hiddenLength = input6 != "" ? Entropy::EncryptedLength(dataLength, patchable) : dataLength;
+			int dirtyRows = Nexus::BMPEmbedRows(hiddenLength, inputImage.GetWidth(), inputImage.GetHeight(), Nexus::CarrierElements(inputImage));
+			std::vector<NDI_BYTE> vecNewPNG = Nexus_Converter::BMP2PNGPatch("TEMP\\tmp.bmp", coverFile.c_str(), dirtyRows, coverState, segmented);
+			nexuspng::save_file(vecNewPNG, input5.c_str());
+			remove("TEMP\\tmp.bmp");
+			_rmdir("TEMP");
+		}
+		else if (!Nexus::BMPEmbedStreamInFile(*data, dataLength, input6, keyCheck, input3.c_str(), input5.c_str(), compression, patchable))
+		{
+			std::cout << "[READING IMAGE]" << std::endl;
+			inputImage.ReadFromFile(input3.c_str());
+			data->clear();
+			data->seekg(0, std::ios::beg);
+			Nexus::BMPEmbedStream(*data, dataLength, input6, keyCheck, inputImage, compression, patchable);
+			inputImage.WriteToFile(input5.c_str());
+		}
+		std::cout << "[DONE]" << std::endl;
+	}
+
+	// SHARD
+	// input1 = option
+	// input2 = imageFormat
+	// input3 = inputData
+	// input4 = password
+	// the rest = coverImage and outputImage pairs, optKeyCheck and optCompression
+	if (input1 == "-s")
+	{
+		std::cout << std::endl;
+		std::vector<std::string> images, covers, outputs;
+		bool keyCheck = false;
+		Entropy::Compression compression = Entropy::Uncompressed;
+		for (int i = 5; i < argc; i++)
+		{
+			std::string input = argv[i];
+			if (input == "-k") { keyCheck = true; }
+			else if (input == "-z") { compression = Entropy::Deflate; }
+			else if (input == "-f") { compression = Entropy::Fast; }
+			else { images.push_back(input); }
+		}
+		if (input4 == "" || images.empty() || images.size() % 2 != 0)
+		{
+			std::cout << "Shard: Nexus -s [Image Format] [Input Data] [Password] [Cover 1] [Output 1] ... [Optional -k] [Optional -z or -f]" << std::endl;
+			return false;
+		}
+		for (size_t i = 0; i < images.size(); i += 2)
+		{
+			covers.push_back(images[i]);
+			outputs.push_back(images[i + 1]);
+		}
+
+		// The whole data is read, then every image gets its shard on a core of its own
+		std::cout << "[READING DATA]" << std::endl;
+		std::ifstream dataFile(input3, ::std::ios::binary);
+		std::string data((std::istreambuf_iterator<char>(dataFile)), std::istreambuf_iterator<char>());
+		std::cout << "[HIDING " << covers.size() << " SHARDS]" << std::endl;
+		if (!Nexus::EmbedShardsInFiles(data, input4, keyCheck, compression, input2, covers, outputs))
+		{
+			std::cout << "[THE DATA DOES NOT FIT IN THE IMAGES OR AN IMAGE CAN'T BE USED]" << std::endl;
+		}
+		std::cout << "[DONE]" << std::endl;
+		return false;
+	}
+
+	// JOIN
+	// input1 = option
+	// input2 = imageFormat
+	// input3 = outputData
+	// input4 = password
+	// the rest = the images with the shards, in any order
+	if (input1 == "-j")
+	{
+		std::cout << std::endl;
+		std::vector<std::string> images(argv + (argc > 5 ? 5 : argc), argv + argc);
+		if (input4 == "" || images.empty())
+		{
+			std::cout << "Join: Nexus -j [Image Format] [Output Data] [Password] [Image 1] [Image 2] ..." << std::endl;
+			return false;
+		}
+		std::cout << "[RETRIEVING " << images.size() << " SHARDS]" << std::endl;
+		std::ofstream dataFile(input3, ::std::ios::binary);
+		if (!Nexus::ExtractShardsFromFiles(input2, images, input4, dataFile))
+		{
+			std::cout << "[WRONG PASSWORD, OR A SHARD IS DAMAGED, MISSING OR FROM OTHER DATA]" << std::endl;
+		}
+		std::cout << "[DONE]" << std::endl;
+		return false;
+	}
+
+	// VOLUME
+	// input1 = option
+	// input2 = imageFormat
+	// input3 = inputImage
+	// input4 = outputImage
+	// input5 = password
+	// the rest = the files, optKeyCheck and optCompression
+	if (input1 == "-v")
+	{
+		std::cout << std::endl;
+		std::vector<std::string> files, names, contents;
+		bool keyCheck = false;
+		Entropy::Compression compression = Entropy::Uncompressed;
+		for (int i = 6; i < argc; i++)
+		{
+			std::string input = argv[i];
+			if (input == "-k") { keyCheck = true; }
+			else if (input == "-z") { compression = Entropy::Deflate; }
+			else if (input == "-f") { compression = Entropy::Fast; }
+			else { files.push_back(input); }
+		}
+		if (input5 == "" || files.empty())
+		{
+			std::cout << "Volume: Nexus -v [Image Format] [Input Image] [Output Image] [Password] [File 1] [File 2] ... [Optional -k] [Optional -z or -f]" << std::endl;
+			return false;
+		}
+
+		// Each file is an entry named after it, without its folders
+		std::cout << "[READING " << files.size() << " FILES]" << std::endl;
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			std::ifstream dataFile(files[i], ::std::ios::binary);
+			if (!dataFile)
+			{
+				std::cout << "[CAN'T READ " << files[i] << "]" << std::endl;
+				return false;
+			}
+			names.push_back(files[i].substr(files[i].find_last_of("\\/") + 1));
+			contents.push_back(std::string((std::istreambuf_iterator<char>(dataFile)), std::istreambuf_iterator<char>()));
+		}
+		std::cout << "[HIDING THE VOLUME]" << std::endl;
+		if (!Nexus::EmbedVolumeInFile(names, contents, input5, keyCheck, compression, input2, input3, input4))
+		{
+			std::cout << "[THE FILES DO NOT FIT IN THE IMAGE OR THE IMAGE CAN'T BE USED]" << std::endl;
+		}
+		std::cout << "[DONE]" << std::endl;
+		return false;
+	}
+
+	// ENTRIES
+	// input1 = option
+	// input2 = imageFormat
+	// input3 = inputImage
+	// input4 = password
+	// input5 = optEntryName
+	// input6 = optOutputData
+	if (input1 == "-e")
+	{
+		std::cout << std::endl;
+		if (input4 == "")
+		{
+			std::cout << "Entries: Nexus -e [Image Format] [Input Image] [Password] [Optional Entry Name] [Optional Output Data]" << std::endl;
+			return false;
+		}
+
+		// Without a name the entries are listed, with one only that entry is retrieved
+		if (input5 == "")
+		{
+			std::vector<Entropy::VolumeEntry> entries;
+			if (!Nexus::ReadVolumeFromFile(input2, input3, input4, entries))
 			{
-				Nexus::BMPEmbedText(data, inputImage).WriteToFile(input5.c_str());
+				std::cout << "[WRONG PASSWORD OR NO VOLUME IN THE IMAGE]" << std::endl;
+				return false;
 			}
+			for (size_t i = 0; i < entries.size(); i++)
+			{
+				std::cout << entries[i].name << " : " << entries[i].size << " bytes" << std::endl;
+			}
+			return false;
+		}
+		std::cout << "[RETRIEVING " << input5 << "]" << std::endl;
+		std::string data;
+		if (!Nexus::ExtractEntryFromFile(input2, input3, input4, input5, data))
+		{
+			std::cout << "[WRONG PASSWORD, NO SUCH ENTRY OR IT IS DAMAGED]" << std::endl;
+			return false;
 		}
+		std::ofstream dataFile(input6 != "" ? input6 : input5, ::std::ios::binary);
+		dataFile.write(data.data(), data.length());
 		std::cout << "[DONE]" << std::endl;
+		return false;
+	}
+
+	// UPDATE
+	// input1 = option
+	// input2 = imageFormat
+	// input3 = image
+	// input4 = inputData
+	// input5 = password
+	// input6 = optOffset
+	if (input1 == "-u")
+	{
+		std::cout << std::endl;
+		if (input5 == "")
+		{
+			std::cout << "Update: Nexus -u [Image Format] [Image] [Input Data] [Password] [Optional Offset]" << std::endl;
+			return false;
+		}
+
+		// Only the chunks the data goes in are encrypted again, the image is changed in place
+		std::cout << "[READING DATA]" << std::endl;
+		std::ifstream dataFile(input4, ::std::ios::binary);
+		std::string data((std::istreambuf_iterator<char>(dataFile)), std::istreambuf_iterator<char>());
+		std::cout << (input6 != "" ? "[WRITING OVER THE HIDDEN DATA]" : "[APPENDING TO THE HIDDEN DATA]") << std::endl;
+		bool updated = input6 != "" ? Nexus::PatchFile(input2, input3, input5, (size_t)std::stoull(input6), data)
+			: Nexus::AppendToFile(input2, input3, input5, data);
+		if (!updated)
+		{
+			std::cout << "[WRONG PASSWORD, DATA NOT HIDDEN WITH -u, OFFSET AFTER THE END OR NO ROOM LEFT]" << std::endl;
+		}
+		std::cout << "[DONE]" << std::endl;
+		return false;
 	}
 
 	// RETRIEVE
@@ -225,13 +541,97 @@ auto main(int argc, char* argv[]) -> int
 	// input3 = inputImage
 	// input4 = outputData
 	// input5 = optPassword
+	// input6 = optOffset
+	// input7 = optLength
 	if (input1 == "-r")
 	{
 		std::cout << std::endl;
+		bool keyCheck = false;
+		std::vector<std::string> range;
+		for (int i = 6; i < argc; i++)
+		{
+			std::string input = argv[i];
+			if (input == "-k") { keyCheck = true; }
+			else { range.push_back(input); }
+		}
+		input6 = range.size() > 0 ? range[0] : "";
+		input7 = range.size() > 1 ? range[1] : "";
+
+		// Only the part of the image that hides the wanted part of the data is read
+		if (input6 != "")
+		{
+			size_t offset = (size_t)std::stoull(input6);
+			size_t length = input7 != "" ? (size_t)std::stoull(input7) : (size_t)-1;
+			std::string rangeFile = input3;
+			if (input2 == "png")
+			{
+				// The rows of a PNG are decoded from the top down to the last one that is needed, all of them without
+				// a Length or when the data is compressed, which is only decompressed as a whole
+				std::cout << "[CONVERTING THE PNG FILE TO BMP]" << std::endl;
+				std::vector<NDI_BYTE> vecNewBMP;
+				bool compressed = input5 != ""
+					&& Entropy::DetectCompression(PNGExtractText(input3, Entropy::HeaderLength), input5) != Entropy::Uncompressed;
+				if (length < (size_t)-1 / 16 && offset < (size_t)-1 / 16 && !compressed)
+				{
+					size_t end = (offset + length + Entropy::ChunkSize - 1) / Entropy::ChunkSize * Entropy::ChunkSize;
+					// patchable data, with a nonce in each chunk, takes the most characters for the same text
+					vecNewBMP = Nexus_Converter::PNG2BMPRows(input3.c_str(), input5 != "" ? Entropy::EncryptedLength(end, true) : offset + length);
+				}
+				else
+				{
+					vecNewBMP = Nexus_Converter::PNG2BMP(input3.c_str(), NULL, true);
+				}
+				_mkdir("TEMP");
+				nexuspng::save_file(vecNewBMP, "TEMP\\tmp.bmp");
+				rangeFile = "TEMP\\tmp.bmp";
+			}
+
+			std::cout << "[RETRIEVING POSSIBLE DATA]" << std::endl;
+			std::string part;
+			if (Nexus::BMPExtractRangeFromFile(rangeFile.c_str(), input5, offset, length, part))
+			{
+				std::cout << "[CREATING OUTPUT FILE]" << std::endl;
+				std::ofstream dataFile(input4, ::std::ios::binary);
+				dataFile.write(part.data(), part.length());
+			}
+			else
+			{
+				std::cout << "[WRONG PASSWORD OR DAMAGED DATA]" << std::endl;
+			}
+
+			if (input2 == "png")
+			{
+				remove("TEMP\\tmp.bmp");
+				_rmdir("TEMP");
+			}
+			std::cout << "[DONE]" << std::endl;
+			return false;
+		}
+
+		// Data with a key check tells a wrong password from the first rows, before the whole image is read,
+		// when -k says it has one
+		if (input5 != "")
+		{
+			std::string header;
+			if (input2 == "png")
+			{
+				header = PNGExtractText(input3, Entropy::KeyCheckLength);
+			}
+			else
+			{
+				header = Nexus::BMPExtractTextFromFile(input3.c_str(), Entropy::KeyCheckLength);
+			}
+			if (Entropy::CheckKey(header, input5, keyCheck) == Entropy::KeyWrong)
+			{
+				std::cout << "[WRONG PASSWORD]" << std::endl;
+				return false;
+			}
+		}
+
 		if (input2 == "png")
 		{
 			std::cout << "[CONVERTING THE PNG FILE TO BMP]" << std::endl;
-			std::vector<NDI_BYTE> vecNewBMP = Nexus_Converter::PNG2BMP(input3.c_str());
+			std::vector<NDI_BYTE> vecNewBMP = Nexus_Converter::PNG2BMP(input3.c_str(), NULL, true);
 			_mkdir("TEMP");
 			nexuspng::save_file(vecNewBMP, "TEMP\\tmp.bmp");
 			input3 = "TEMP\\tmp.bmp";
@@ -241,41 +641,38 @@ auto main(int argc, char* argv[]) -> int
 		BMP inputImage;
 		inputImage.ReadFromFile(input3.c_str());
 
-		// Retrieve The data from the bits of the Image
+		// Retrieve The data from the bits of the Image, decrypting it on the way if the Password Is given
 		std::cout << "[RETRIEVING POSSIBLE DATA]" << std::endl;
-		std::string data = Nexus::BMPExtractText(inputImage);
-		std::ofstream dataFile(input4, ::std::ios::binary);
-
-		// Decrypt The data if the Password Is given
 		if (input5 != "")
 		{
 			std::cout << "[DECRYPTING POSSIBLE DATA]" << std::endl;
-			std::string DecryptedData = Entropy::Nexus_Decrypt(data, input5);
-
-			// Write the Data into the output file
-			std::cout << "[CREATING OUTPUT FILE]" << std::endl;
-			dataFile << DecryptedData;
-			dataFile.close();
+		}
+		std::cout << "[CREATING OUTPUT FILE]" << std::endl;
+		std::ofstream dataFile(input4, ::std::ios::binary);
+		bool authentic = Nexus::BMPExtractStream(inputImage, input5, dataFile);
+		dataFile.close();
 
-			if (input2 == "png")
+		// What was written before the data turned out not to be authentic is thrown away
+		if (!authentic)
+		{
+			std::ofstream replacedFile(input4, ::std::ios::binary | ::std::ios::trunc);
+			std::string header = Nexus::BMPExtractText(inputImage, Entropy::KeyCheckLength);
+			if (Entropy::CheckKey(header, input5, keyCheck) == Entropy::KeyUnknown)
 			{
-				remove("TEMP\\tmp.bmp");
-				_rmdir("TEMP");
+				// Without a key check, a wrong password gets an output file like any other
+				replacedFile << Entropy::Decoy();
 			}
-		}
-		else
-		{
-			// Write the Data into the output file
-			std::cout << "[CREATING OUTPUT FILE]" << std::endl;
-			dataFile << data;
-			dataFile.close();
-
-			if (input2 == "png")
+			else
 			{
-				remove("TEMP\\tmp.bmp");
-				_rmdir("TEMP");
+				std::cout << "[WRONG PASSWORD OR DAMAGED DATA]" << std::endl;
 			}
 		}
+
+		if (input2 == "png")
+		{
+			remove("TEMP\\tmp.bmp");
+			_rmdir("TEMP");
+		}
 		std::cout << "[DONE]" << std::endl;
 	}
 
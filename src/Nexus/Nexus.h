@@ -17,6 +17,8 @@
 #include <vector>
 #include <sstream>
 #include <iterator>
+#include <memory>
+#include <unordered_map>
 
 #ifndef _Nexus_
 #define _Nexus_
@@ -55,11 +57,12 @@
 #include "Nexus_Bitmap.h"
 #include "Nexus_BitmapUtils.h"
 #include "Nexus_EInjectionState.h"
-#include "Nexus_Injector.h"
+#include "Nexus_Crypto.h"
 #include "Nexus_Entropy.h"
+#include "Nexus_Injector.h"
 #include "Nexus_StringUtils.h"
-#include "Nexus_Converter.h"
 #include "Nexus_PNG.h"
+#include "Nexus_Converter.h"
 
 #ifndef _Nexus_Version_
 #define _Nexus_Version_ 1.2.2
@@ -8,6 +8,8 @@ class BMP
 private:
 
 	int BitDepth;
+	bool AlphaChannel;
+	bool Grayscale;
 	int Width;
 	int Height;
 	Pixel** Pixels;
@@ -33,10 +35,30 @@ private:
 	bool Write1bitRow(NDI_BYTE* Buffer, int BufferSize, int Row);
 
 	NDI_BYTE FindClosestColor(Pixel& input);
+	// writes the headers and color table of a file of the image, but with FileHeight rows, and gives
+	// the size of the whole file
+	void WriteHeader(FILE* fp, int FileHeight, NDI_DWORD& FileSize);
+	// the index of each color of the table, by its red, green and blue, while the image is written,
+	// so that a color of the table is found right away
+	std::unordered_map<NDI_DWORD, NDI_BYTE> ColorIndex;
+	// and, for the colors that aren't in it, the colors of the table that can be nearest to a color in
+	// each box of 8 by 8 by 8 colors (see AppendNearColors), so that only those are compared; those of a box
+	// are in NearColors from its NearColorStart to its NearColorEnd, once a color in it was looked up
+	std::vector<NDI_BYTE> NearColors;
+	std::vector<int> NearColorStart, NearColorEnd;
+	void IndexColors(void);
 
 public:
 
 	int GetBitDepth(void);
+	// a 32 bit image can keep the alpha of its pixels, which is written with a version 4 header
+	// that has an alpha mask; without one, the fourth byte of a pixel means nothing
+	bool HasAlphaChannel(void);
+	void SetAlphaChannel(bool Alpha);
+	// a 24 or 32 bit image whose pixels are all gray says so with a color table of the 256 grays, which
+	// at these depths is only a hint for displays
+	bool IsGrayscale(void);
+	void SetGrayscale(bool Gray);
 	int GetWidth(void);
 	int GetHeight(void);
 	int GetNumberOfColors(void);
@@ -58,9 +80,57 @@ public:
 	bool SetBitDepth(int NewDepth);
 	bool WriteToFile(const char* FileName);
 	bool ReadFromFile(const char* FileName);
+	// reads NumberOfRows rows from FirstRow (counted from the top) of an uncompressed 8, 24 or 32 bit file
+	// (a 32 bit one can have bit fields in the usual order, with an alpha channel);
+	// the image gets their size, and the color table, alpha channel and grayscale table of the file
+	bool ReadRowsFromFile(const char* FileName, int FirstRow, int NumberOfRows);
+	// writes the rows of the image over the rows from FirstRow of an existing file of the same width, depth,
+	// alpha channel and grayscale table; an 8 bit one must have the color table of the image
+	bool WriteRowsToFile(const char* FileName, int FirstRow);
+	// writes a file of the width, depth, alpha channel, grayscale table and color table of the image, but
+	// FileHeight rows, whose pixels are zeros until WriteRowsToFile writes them
+	bool WriteHeaderToFile(const char* FileName, int FileHeight);
 
 	Pixel GetColor(int ColorNumber);
 	bool SetColor(int ColorNumber, Pixel NewColor);
 };
 
+// the pixels of a BMP as planes, one of each of blue, green, red and alpha, 64 byte aligned, so that work on one
+// channel or bit of the pixels is a loop over bytes next to each other; the samples of a plane are in the order
+// of the pixels of the BMP, column by column, pixel i, j at i * GetHeight() + j. The pixels are loaded from a BMP
+// and stored back into it once the work is done
+class BMPPlanes
+{
+public:
+	enum Channel { Blue, Green, Red, Alpha };
+
+	BMPPlanes();
+	BMPPlanes(BMP& Input);
+	// the planes of the pixels of Input
+	void Load(BMP& Input);
+	// stores the planes into the pixels of Output, which must be of the same size
+	bool Store(BMP& Output) const;
+
+	int GetWidth(void) const;
+	int GetHeight(void) const;
+	// the GetWidth() * GetHeight() samples of a channel
+	NDI_BYTE* Plane(int channel);
+	const NDI_BYTE* Plane(int channel) const;
+
+	// bit (0 is the lowest) of every sample of channel into Bits, sample n in bit n % 8 of byte n / 8
+	void GetBitPlane(int channel, int bit, std::vector<NDI_BYTE>& Bits) const;
+	// sets bit of every sample of channel to the one in Bits, laid out as GetBitPlane gives it
+	bool SetBitPlane(int channel, int bit, const std::vector<NDI_BYTE>& Bits);
+	// how many samples of channel have each of the 256 values
+	void Histogram(int channel, size_t Counts[256]) const;
+
+private:
+	int Width;
+	int Height;
+	// the bytes from a plane to the next, a multiple of 64, and from the buffer to the first one
+	size_t Stride;
+	size_t Offset;
+	std::vector<NDI_BYTE> Buffer;
+};
+
 #endif
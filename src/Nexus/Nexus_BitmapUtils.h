@@ -16,7 +16,63 @@ void RangedPixelToPixelCopyTransparent(
 	BMP& To, int ToX, int ToY,
 	Pixel& Transparent);
 bool CreateGrayscaleColorTable(BMP& InputImage);
+// makes the color table of a 1, 4 or 8 bit image the colors that best stand for its pixels, by median cut
+// of a histogram of their colors with 5 bits of red, green and blue, counted on all cores
+bool CreateOptimalColorTable(BMP& InputImage);
+// sets every pixel of a 1, 4 or 8 bit image to the color of its table nearest to the middle of the pixel's box of
+// 8 by 8 by 8 colors (an inverse color map), which it is then written with right away; with Dither, the difference is spread to the pixels to the right and below (Floyd-Steinberg).
+// The rows are mapped on all cores, dithered ones as a wavefront that gives the same image as one row after another
+bool QuantizeToColorTable(BMP& InputImage, bool Dither = false);
 
-bool Rescale(BMP& InputImage, char mode, int NewDimension);
+// resizes the image to 24 bits: mode 'P' to NewDimension percent, 'W' or 'H' to a width or height of NewDimension
+// pixels keeping its proportions, 'F' to fit NewDimension pixels on its longer side. The filter is 'B' (bilinear),
+// 'A' (the average of the area of each new pixel), 'C' (bicubic) or 'L' (Lanczos-3), which are sharper and,
+// like 'A', don't alias when the image shrinks
+bool Rescale(BMP& InputImage, char mode, int NewDimension, char filter = 'B');
+
+// a chain of operations on Source, recorded and then run in one pass over bands of rows of the result, on all
+// cores: each band goes through all the operations while it is in cache, so no image the size of the result or
+// in between operations is made, only the result itself, or not even that when it is written to a file.
+// Source must stay as it is until the chain has run
+class BMPPipeline
+{
+public:
+	BMPPipeline(BMP& Source);
+	// keeps the columns FromL to FromR and the rows FromT to FromB (or FromB to FromT) that are in the image
+	BMPPipeline& Crop(int FromL, int FromR, int FromB, int FromT);
+	// scales to NewWidth by NewHeight, as Rescale does with filter 'B'
+	BMPPipeline& Resize(int NewWidth, int NewHeight);
+	// makes the pixels gray, by their luminance, and the result a grayscale image (BMP::IsGrayscale)
+	BMPPipeline& Grayscale(void);
+
+	// the size of the result
+	int GetWidth(void) const;
+	int GetHeight(void) const;
+	// runs the chain into Output, of BitDepth 24, or 32 with the alpha channel of Source
+	bool Run(BMP& Output, int BitDepth = 24);
+	// runs the chain into an uncompressed BMP file of BitDepth 24 or 32, writing each band once it is done;
+	// BMPEmbedStreamInFile can then hide data in it, reading and writing only the rows that hide it
+	bool WriteToFile(const char* FileName, int BitDepth = 24);
+
+private:
+	// a crop ('C') from Left, Top, a resize ('R') with the old rows and columns of each new one and their
+	// weights (see RescaleBilinear), or making gray ('G'); Width and Height are the size after it
+	struct Operation
+	{
+		char Type;
+		int Left, Top, Width, Height;
+		std::vector<int> Rows, RowWeights, Columns, ColumnWeights;
+	};
+
+	// the Width by Height pixels from Left, Top of the image after the first Count operations, row by row
+	void Produce(size_t Count, int Left, int Top, int Width, int Height, std::vector<Pixel>& Out) const;
+	// the rows of a band, which holds about BandPixels pixels
+	int BandRows(void) const;
+	static const int BandPixels = 1 << 16;
+
+	BMP& Source;
+	bool Gray;
+	std::vector<Operation> Operations;
+};
 
 #endif
@@ -1,9 +1,41 @@
 #include "Nexus.h"
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+// SameFile tells two paths to one file apart by the identity of the file the system gives
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// the blends of Rescale use SSE2 on x86, and its filters AVX2 when Nexus_Crypto::HasAVX2 tells the processor has it
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NEXUS_BMP_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NEXUS_BMP_TARGET_SSE2 __attribute__((target("sse2")))
+#define NEXUS_BMP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define NEXUS_BMP_TARGET_SSE2
+#define NEXUS_BMP_TARGET_AVX2
+#endif
 
 /* These functions are defined in Nexus_Converter.h */
 
 // BMP to PNG
-unsigned Nexus_Converter::decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, unsigned& h, const std::vector<NDI_BYTE>& bmp)
+unsigned Nexus_Converter::decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, unsigned& h, bool& alpha, const std::vector<NDI_BYTE>& bmp)
 {
 	static const unsigned MINHEADER = 54; //minimum BMP header size
 
@@ -14,8 +46,15 @@ unsigned Nexus_Converter::decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, u
 	w = bmp[18] + bmp[19] * 256;
 	h = bmp[22] + bmp[23] * 256;
 	//read number of channels from BMP header
-	if (bmp[28] != 24 && bmp[28] != 32) return 2; //only 24-bit and 32-bit BMPs are supported.
+	if (bmp[28] != 8 && bmp[28] != 24 && bmp[28] != 32) return 2; //only 8-bit, 24-bit and 32-bit BMPs are supported.
 	unsigned numChannels = bmp[28] / 8;
+	//a 32-bit BMP has alpha if it has a version 4 or 5 header with bit fields that include an alpha mask
+	unsigned infoSize = bmp[14] + 256 * bmp[15];
+	alpha = numChannels == 4 && bmp[30] == 3 && infoSize >= 56 && bmp.size() >= 70
+		&& bmp[66] == 0 && bmp[67] == 0 && bmp[68] == 0 && bmp[69] == 255;
+	//an 8-bit BMP is uncompressed indexes into the color table between the header and the pixels
+	if (numChannels == 1 && (bmp[30] != 0 || pixeloffset < 14 + infoSize)) return 2;
+	unsigned numColors = numChannels == 1 ? (pixeloffset - 14 - infoSize) / 4 : 0;
 
 	//The amount of scanline bytes is width of image times channels, with extra bytes added if needed
 	//to make it a multiple of 4 bytes.
@@ -30,7 +69,7 @@ unsigned Nexus_Converter::decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, u
 	/*
 	There are 3 differences between BMP and the raw image buffer for nexusPNG:
 	-it's upside down
-	-it's in BGR instead of RGB format (or BRGA instead of RGBA)
+	-it's in BGR instead of RGB format (or BGRA instead of RGBA)
 	-each scanline has padding bytes to make it a multiple of 4 if needed
 	The 2D for loop below does all these 3 conversions at once.
 	*/
@@ -41,7 +80,16 @@ unsigned Nexus_Converter::decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, u
 			unsigned bmpos = pixeloffset + (h - y - 1) * scanlineBytes + numChannels * x;
 			//pixel start byte position in the new raw image
 			unsigned newpos = 4 * y * w + 4 * x;
-			if (numChannels == 3)
+			if (numChannels == 1)
+			{
+				//an index past the end of the table is black
+				unsigned color = bmp[bmpos] < numColors ? 14 + infoSize + 4 * bmp[bmpos] : 0;
+				image[newpos + 0] = color ? bmp[color + 2] : 0; //R
+				image[newpos + 1] = color ? bmp[color + 1] : 0; //G
+				image[newpos + 2] = color ? bmp[color + 0] : 0; //B
+				image[newpos + 3] = 255;                         //A
+			}
+			else if (numChannels == 3)
 			{
 				image[newpos + 0] = bmp[bmpos + 2]; //R
 				image[newpos + 1] = bmp[bmpos + 1]; //G
@@ -50,52 +98,230 @@ unsigned Nexus_Converter::decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, u
 			}
 			else
 			{
-				image[newpos + 0] = bmp[bmpos + 3]; //R
-				image[newpos + 1] = bmp[bmpos + 2]; //G
-				image[newpos + 2] = bmp[bmpos + 1]; //B
-				image[newpos + 3] = bmp[bmpos + 0]; //A
+				image[newpos + 0] = bmp[bmpos + 2]; //R
+				image[newpos + 1] = bmp[bmpos + 1]; //G
+				image[newpos + 2] = bmp[bmpos + 0]; //B
+				image[newpos + 3] = alpha ? bmp[bmpos + 3] : 255; //A
 			}
 		}
 	return 0;
 }
-std::vector<NDI_BYTE> Nexus_Converter::BMP2PNG(const char* BMPfile)
+std::vector<NDI_BYTE> Nexus_Converter::BMP2PNG(const char* BMPfile, bool MaxCompression, const nexuspng::State* Cover)
+{
+	std::vector<unsigned char> bmp;
+	nexuspng::load_file(bmp, BMPfile);
+	std::vector<unsigned char> image;
+	unsigned w, h;
+	bool alpha;
+	unsigned error = decodeBMP(image, w, h, alpha, bmp);
+	std::vector<unsigned char> png;
+	nexuspng::State state;
+	state.encoder.zlibsettings.optimal = MaxCompression ? 1 : 0;
+	if (Cover != NULL && !MaxCompression && !error)
+	{
+		reuseCoverFilters(state, image, w, h, *Cover);
+	}
+	error = nexuspng::encode(png, image, w, h, state);
+	return png;
+}
+
+std::vector<NDI_BYTE> Nexus_Converter::BMP2PNGPatch(const char* BMPfile, const char* CoverPNG, unsigned DirtyRows, const nexuspng::State& Cover,
+	bool Restart)
 {
 	std::vector<unsigned char> bmp;
 	nexuspng::load_file(bmp, BMPfile);
 	std::vector<unsigned char> image;
 	unsigned w, h;
-	unsigned error = decodeBMP(image, w, h, bmp);
+	bool alpha;
+	unsigned error = decodeBMP(image, w, h, alpha, bmp);
+	std::vector<unsigned char> cover;
+	nexuspng::load_file(cover, CoverPNG);
 	std::vector<unsigned char> png;
-	error = nexuspng::encode(png, image, w, h);
+
+	// segments of about 64KB of scanlines, so the next embed only re-encodes the first few of them
+	nexuspng::State state;
+	if (Restart)
+	{
+		state.encoder.restart_rows = 65536 / (w * 4) + 1;
+	}
+	if (!error && Cover.info_png.color.bitdepth == 16)
+	{
+		error = restoreHighBytes(image, w, h, alpha, cover, state);
+	}
+	if (!error && !(IndexedColors(Cover.info_png.color) && restoreIndices(image, w, h, Cover, state) == 0))
+	{
+		reuseCoverFilters(state, image, w, h, Cover);
+	}
+	if (Restart)
+	{
+		error = nexuspng::encode_partial(png, image, w, h, DirtyRows, cover, state);
+	}
+	else
+	{
+		error = nexuspng::encode(png, image, w, h, state);
+	}
 	return png;
 }
 
+unsigned Nexus_Converter::restoreHighBytes(std::vector<NDI_BYTE>& image, unsigned w, unsigned h, bool alpha,
+	const std::vector<NDI_BYTE>& cover, nexuspng::State& state)
+{
+	std::vector<NDI_BYTE> wide;
+	unsigned coverW, coverH;
+	unsigned error = nexuspng::decode(wide, coverW, coverH, cover, LCT_RGBA, 16);
+	if (error || coverW != w || coverH != h)
+	{
+		return error ? error : 1;
+	}
+
+	// the samples are big endian, the low byte comes second; without alpha in the BMP, it is the cover's
+	for (size_t i = 0; i < (size_t)w * h * 4; i++)
+	{
+		if (alpha || i % 4 != 3)
+		{
+			wide[2 * i + 1] = image[i];
+		}
+	}
+	image.swap(wide);
+	state.info_raw.colortype = LCT_RGBA;
+	state.info_raw.bitdepth = 16;
+	return 0;
+}
+
+unsigned Nexus_Converter::restoreIndices(std::vector<NDI_BYTE>& image, unsigned w, unsigned h, const nexuspng::State& Cover,
+	nexuspng::State& state)
+{
+	// the first of the same colors is the one that is used
+	const NexusPNGColorMode& color = Cover.info_png.color;
+	std::unordered_map<NDI_DWORD, NDI_BYTE> index;
+	for (size_t n = color.palettesize; n-- > 0;)
+	{
+		index[((NDI_DWORD)color.palette[4 * n] << 16) | ((NDI_DWORD)color.palette[4 * n + 1] << 8) | color.palette[4 * n + 2]] = (NDI_BYTE)n;
+	}
+	std::vector<NDI_BYTE> indices((size_t)w * h);
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		std::unordered_map<NDI_DWORD, NDI_BYTE>::const_iterator found
+			= index.find(((NDI_DWORD)image[4 * i] << 16) | ((NDI_DWORD)image[4 * i + 1] << 8) | image[4 * i + 2]);
+		if (found == index.end())
+		{
+			return 1;
+		}
+		indices[i] = found->second;
+	}
+
+	unsigned error = nexuspng_color_mode_copy(&state.info_raw, &color);
+	if (!error)
+	{
+		error = nexuspng_color_mode_copy(&state.info_png.color, &color);
+	}
+	if (error)
+	{
+		return error;
+	}
+	image.swap(indices);
+	state.info_raw.bitdepth = 8;
+	state.encoder.auto_convert = 0;
+	if (Cover.numfilters == h)
+	{
+		state.encoder.filter_palette_zero = 0;
+		state.encoder.filter_strategy = LFS_PREDEFINED;
+		state.encoder.predefined_filters = Cover.filters;
+	}
+	return 0;
+}
+
+bool Nexus_Converter::IndexedColors(const NexusPNGColorMode& Color)
+{
+	if (Color.colortype != LCT_PALETTE || Color.palettesize == 0 || Color.palettesize > 256)
+	{
+		return false;
+	}
+	std::vector<NDI_DWORD> colors;
+	for (size_t n = 0; n < Color.palettesize; n++)
+	{
+		colors.push_back(((NDI_DWORD)Color.palette[4 * n] << 16) | ((NDI_DWORD)Color.palette[4 * n + 1] << 8) | Color.palette[4 * n + 2]);
+	}
+	std::sort(colors.begin(), colors.end());
+	return std::adjacent_find(colors.begin(), colors.end()) == colors.end();
+}
+
+void Nexus_Converter::reuseCoverFilters(nexuspng::State& state, const std::vector<NDI_BYTE>& image, unsigned w, unsigned h, const nexuspng::State& Cover)
+{
+	// The embedded image is nearly identical to the cover, so the filters chosen for the cover
+	// still fit it, as long as it is stored in the same color type. The color type is chosen here
+	// once, instead of again by the encoder.
+	if (Cover.numfilters != h)
+	{
+		return;
+	}
+	NexusPNGColorMode mode;
+	nexuspng_color_mode_init(&mode);
+	if (!nexuspng_auto_choose_color(&mode, &image[0], w, h, &state.info_raw)
+		&& mode.colortype == Cover.info_png.color.colortype
+		&& mode.bitdepth == Cover.info_png.color.bitdepth
+		&& !nexuspng_color_mode_copy(&state.info_png.color, &mode))
+	{
+		state.encoder.auto_convert = 0;
+		state.encoder.filter_palette_zero = 0;
+		state.encoder.filter_strategy = LFS_PREDEFINED;
+		state.encoder.predefined_filters = Cover.filters;
+	}
+	nexuspng_color_mode_cleanup(&mode);
+}
+
 // PNG to BMP
-void Nexus_Converter::encodeBMP(std::vector<NDI_BYTE>& bmp, const NDI_BYTE* image, int w, int h)
+void Nexus_Converter::encodeBMP(std::vector<NDI_BYTE>& bmp, const NDI_BYTE* image, int w, int h, bool alpha, bool gray,
+	const NexusPNGColorMode* palette)
 {
-	//3 bytes per pixel used for both input and output.
-	int inputChannels = 3;
-	int outputChannels = 3;
+	//3 bytes per pixel used for both input and output, 4 with alpha, which needs a version 4 header (108 bytes)
+	//a gray image has the 256 grays as its color table after the header, an indexed one is 1 byte per pixel
+	//with the palette as its table, filled up with the first color
+	int inputChannels = alpha ? 4 : 3;
+	int outputChannels = palette ? 1 : alpha ? 4 : 3;
+	int headerSize = alpha ? 14 + 108 : 14 + 40;
+	int pixelOffset = headerSize + (gray || palette ? 256 * 4 : 0);
+	std::unordered_map<NDI_DWORD, NDI_BYTE> index;
+	for (size_t n = palette ? palette->palettesize : 0; n-- > 0;)
+	{
+		index[((NDI_DWORD)palette->palette[4 * n] << 16) | ((NDI_DWORD)palette->palette[4 * n + 1] << 8) | palette->palette[4 * n + 2]] = (NDI_BYTE)n;
+	}
 
 	//bytes 0-13
 	bmp.push_back('B'); bmp.push_back('M'); //0: bfType
 	bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); //2: bfSize; size not yet known for now, filled in later.
 	bmp.push_back(0); bmp.push_back(0); //6: bfReserved1
 	bmp.push_back(0); bmp.push_back(0); //8: bfReserved2
-	bmp.push_back(54 % 256); bmp.push_back(54 / 256); bmp.push_back(0); bmp.push_back(0); //10: bfOffBits (54 header bytes)
+	bmp.push_back(pixelOffset % 256); bmp.push_back(pixelOffset / 256); bmp.push_back(0); bmp.push_back(0); //10: bfOffBits (54 or 122 header bytes, and the table)
 
 																						  //bytes 14-53
-	bmp.push_back(40); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //14: biSize
+	bmp.push_back(headerSize - 14); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //14: biSize
 	bmp.push_back(w % 256); bmp.push_back(w / 256); bmp.push_back(0); bmp.push_back(0); //18: biWidth
 	bmp.push_back(h % 256); bmp.push_back(h / 256); bmp.push_back(0); bmp.push_back(0); //22: biHeight
 	bmp.push_back(1); bmp.push_back(0); //26: biPlanes
 	bmp.push_back(outputChannels * 8); bmp.push_back(0); //28: biBitCount
-	bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //30: biCompression
+	bmp.push_back(alpha ? 3 : 0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //30: biCompression (bit fields with alpha)
 	bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //34: biSizeImage
 	bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //38: biXPelsPerMeter
 	bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //42: biYPelsPerMeter
-	bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //46: biClrUsed
+	bmp.push_back(0); bmp.push_back(gray || palette ? 1 : 0); bmp.push_back(0); bmp.push_back(0);  //46: biClrUsed (256 colors)
 	bmp.push_back(0); bmp.push_back(0); bmp.push_back(0); bmp.push_back(0);  //50: biClrImportant
+	if (alpha)
+	{
+		//bytes 54-121: the red, green, blue and alpha masks, the sRGB color space and its unused end points and gamma
+		const NDI_BYTE masks[20] = { 0, 0, 255, 0, 0, 255, 0, 0, 255, 0, 0, 0, 0, 0, 0, 255, 'B', 'G', 'R', 's' };
+		bmp.insert(bmp.end(), masks, masks + 20);
+		bmp.insert(bmp.end(), 48, 0);
+	}
+	for (int n = 0; gray && n < 256; n++)
+	{
+		bmp.push_back(n); bmp.push_back(n); bmp.push_back(n); bmp.push_back(0);
+	}
+	for (size_t n = 0; palette && n < 256; n++)
+	{
+		const NDI_BYTE* color = &palette->palette[4 * (n < palette->palettesize ? n : 0)];
+		bmp.push_back(color[2]); bmp.push_back(color[1]); bmp.push_back(color[0]); bmp.push_back(0);
+	}
 
 																			 /*
 																			 Convert the input RGBRGBRGB pixel buffer to the BMP pixel buffer format. There are 3 differences with the input buffer:
@@ -112,7 +338,13 @@ void Nexus_Converter::encodeBMP(std::vector<NDI_BYTE>& bmp, const NDI_BYTE* imag
 		int c = 0;
 		for (int x = 0; x < imagerowbytes; x++)
 		{
-			if (x < w * outputChannels)
+			if (x < w * outputChannels && palette)
+			{
+				//every color is one of the palette
+				const NDI_BYTE* color = &image[inputChannels * (w * y + x)];
+				bmp.push_back(index[((NDI_DWORD)color[0] << 16) | ((NDI_DWORD)color[1] << 8) | color[2]]);
+			}
+			else if (x < w * outputChannels)
 			{
 				int inc = c;
 				//Convert RGB(A) into BGR(A)
@@ -132,17 +364,111 @@ void Nexus_Converter::encodeBMP(std::vector<NDI_BYTE>& bmp, const NDI_BYTE* imag
 	bmp[4] = (bmp.size() / 65536) % 256;
 	bmp[5] = bmp.size() / 16777216;
 }
-std::vector<NDI_BYTE> Nexus_Converter::PNG2BMP(const char* PNGFile)
+unsigned Nexus_Converter::PNG2Pixels(std::vector<NDI_BYTE>& Image, unsigned& w, unsigned& h, bool& Alpha, bool& Gray,
+	const std::vector<NDI_BYTE>& PNG, nexuspng::State& State, bool Carrier, unsigned FirstRow, unsigned Rows)
 {
-	const char* infile = PNGFile;
+	Image.clear();
+	Alpha = false;
+	unsigned error = nexuspng_inspect(&w, &h, &State, PNG.empty() ? NULL : &PNG[0], PNG.size());
+	if (error)
+	{
+		return error;
+	}
+	Gray = State.info_png.color.colortype == LCT_GREY || State.info_png.color.colortype == LCT_GREY_ALPHA;
+	if (Rows == 0 || FirstRow + Rows > h)
+	{
+		Rows = FirstRow < h ? h - FirstRow : 0;
+	}
+
+	// the samples are decoded in the depth they are stored in, with the alpha channel if there is one;
+	// whether an image is fully opaque is only known from all of its rows
+	const bool alphaType = nexuspng_is_alpha_type(&State.info_png.color) != 0;
+	const unsigned bytes = State.info_png.color.bitdepth == 16 ? 2 : 1;
+	const unsigned channels = alphaType ? 4 : 3;
+	State.info_raw.colortype = alphaType ? LCT_RGBA : LCT_RGB;
+	State.info_raw.bitdepth = 8 * bytes;
+	std::vector<NDI_BYTE> raw;
+	unsigned decodedFirst = 0;
+	if (alphaType || Rows == h)
+	{
+		error = nexuspng::decode(raw, w, h, State, PNG);
+	}
+	else
+	{
+		error = nexuspng::decode_rows(raw, w, h, State, PNG, FirstRow, Rows);
+		decodedFirst = FirstRow;
+	}
+	if (error)
+	{
+		return error;
+	}
+
+	// hiding a bit only changes the lowest one of an alpha value, so an image is taken as fully opaque
+	// when all of them are the highest value or the one below it, before and after
+	const unsigned pick = Carrier ? bytes - 1 : 0;
+	for (size_t i = 3 * bytes; alphaType && !Alpha && i < raw.size(); i += 4 * bytes)
+	{
+		Alpha = (raw[i] | (bytes == 1 ? 1 : 0)) != 255 || (bytes == 2 && (raw[i + 1] | 1) != 255);
+	}
+
+	// 16 bit samples keep their high byte, or with Carrier their low one, which holds the hidden bits
+	const unsigned outChannels = Alpha ? 4 : 3;
+	Image.resize((size_t)w * Rows * outChannels);
+	for (unsigned y = 0; y < Rows; y++)
+	{
+		const NDI_BYTE* row = &raw[(size_t)(FirstRow + y - decodedFirst) * w * channels * bytes];
+		NDI_BYTE* out = &Image[(size_t)y * w * outChannels];
+		for (unsigned x = 0; x < w; x++)
+		{
+			for (unsigned c = 0; c < outChannels; c++)
+			{
+				out[x * outChannels + c] = row[(x * channels + c) * bytes + pick];
+			}
+		}
+	}
+	return 0;
+}
 
-	std::vector<unsigned char> image; //the raw pixels
+std::vector<NDI_BYTE> Nexus_Converter::PNG2BMP(const char* PNGFile, nexuspng::State* Cover, bool Carrier)
+{
+	std::vector<NDI_BYTE> png, image, bmp;
 	unsigned width, height;
+	bool alpha, gray;
+	nexuspng::State state;
+	nexuspng::State& decoding = Cover != NULL ? *Cover : state;
+	decoding.decoder.remember_filters = Cover != NULL;
+	if (nexuspng::load_file(png, PNGFile) != 0 || PNG2Pixels(image, width, height, alpha, gray, png, decoding, Carrier) != 0)
+	{
+		return bmp;
+	}
+	encodeBMP(bmp, &image[0], width, height, alpha, gray, IndexedColors(decoding.info_png.color) ? &decoding.info_png.color : NULL);
+	return bmp;
+}
 
-	unsigned error = nexuspng::decode(image, width, height, infile, LCT_RGB, 8);
+std::vector<NDI_BYTE> Nexus_Converter::PNG2BMPRows(const char* PNGFile, size_t TextLength)
+{
+	std::vector<NDI_BYTE> png, image, bmp;
+	unsigned width, height;
+	nexuspng::State state;
+	if (nexuspng::load_file(png, PNGFile) != 0 || nexuspng_inspect(&width, &height, &state, png.empty() ? NULL : &png[0], png.size()) != 0)
+	{
+		return bmp;
+	}
 
-	std::vector<NDI_BYTE> bmp;
-	encodeBMP(bmp, &image[0], width, height);
+	// an image with alpha is decoded as a whole, the rows that hide the text are known once it is
+	// known whether its alpha hides bits too; a gray image hides them in its gray alone, and one with a palette
+	// in its colors, unless they don't tell the index
+	bool alpha, gray;
+	const NexusPNGColorType type = state.info_png.color.colortype;
+	const int elements = type == LCT_GREY || type == LCT_PALETTE ? 1 : 3;
+	unsigned rows = nexuspng_is_alpha_type(&state.info_png.color) ? 0 : (unsigned)Nexus::BMPEmbedRows(TextLength, (int)width, (int)height, elements);
+	if (PNG2Pixels(image, width, height, alpha, gray, png, state, true, 0, rows) != 0)
+	{
+		return bmp;
+	}
+	const bool indexed = IndexedColors(state.info_png.color);
+	rows = (unsigned)Nexus::BMPEmbedRows(TextLength, (int)width, (int)height, Nexus::CarrierElements(indexed, gray, alpha));
+	encodeBMP(bmp, &image[0], width, rows, alpha, gray, indexed ? &state.info_png.color : NULL);
 	return bmp;
 }
 
@@ -202,2382 +528,6894 @@ bool Nexus_String::cstr_equal(char* first, char* second)
 
 /* These functions are defined in Nexus_Entropy.h */
 
-std::string Entropy::Nexus_Encrypt(std::string text, std::string key)
+// ChaCha20-Poly1305 data of versions 1 to 6 starts with "NXC" and the format version:
+// 1: the key is SHA-256(password)
+// 2: the key comes from PBKDF2, with the salt and iterations after the magic
+// 3: like 2, followed by a key check value that tells a wrong key from the header alone
+// 4: flags, the salt, the iterations and, with EntropyKeyCheckFlag, the key check value;
+//    the tag follows the text instead of coming before it, so the data is made and read in one pass
+// 5: like 4, followed by the chunk size and the text length; the text is split in chunks that are
+//    each followed by their own tag, and the nonce of a chunk is the one in the header xored with
+//    its index and, for the last chunk, a flag, so chunks can't be reordered or dropped;
+//    with EntropyDigestFlag the BLAKE3 digest of the text follows it in the last chunk, and with
+//    EntropyDeflateFlag or EntropyFastFlag the text is compressed
+// 6: like 5 without the nonce in the header, the digest or compression; each chunk starts with a nonce of
+//    its own, used like the one in the header of version 5, and only the last chunk authenticates the text
+//    length, so that a patched chunk is sealed again without the others; a random payload id before the
+//    chunk size is authenticated by every chunk, so chunks can't be moved between data that shares the salt
+// the magic and everything before the nonce are authenticated as associated data
+// 7: no magic, nothing in it can be read without the key: the salt, the key check value (random bytes
+//    without EntropyKeyCheckFlag, so data with and without one look alike), the payload id, then the flags
+//    and the text length, xored with a key stream drawn from the key and the payload id; the iterations
+//    are KeyDerivationIterations and the chunk size ChunkSize. With EntropyPatchableFlag the chunks are
+//    those of version 6, otherwise those of version 5, whose nonce is the start of the payload id.
+//    The magic and version are authenticated with the whole header as if they were there, so the data is
+//    only known to be of version 7, rather than random or Legacy characters, once a chunk decrypts
+static const char EntropyMagic[3] = { 'N', 'X', 'C' };
+static const size_t EntropyMagicSize = 4;
+static const char EntropyPatchableVersion = 6;
+static const char EntropySealedVersion = 7;
+static const NDI_BYTE EntropyKeyCheckFlag = 1;
+static const NDI_BYTE EntropyDigestFlag = 2;
+static const NDI_BYTE EntropyDeflateFlag = 4;
+static const NDI_BYTE EntropyFastFlag = 8;
+static const NDI_BYTE EntropyPatchableFlag = 16;
+static const size_t EntropyPayloadIdSize = 16;
+// the flags and text length that end the header of version 7, which are masked
+static const size_t EntropyMaskedSize = 9;
+
+// version 5 stuffs every EntropyGroupSize bytes on their own, into one character more,
+// so where a byte of the sealed data is hidden doesn't depend on the bytes before it
+static const size_t EntropyGroupSize = 253;
+
+// the bytes between the magic and the nonce, for versions 4 to 6 flags is the first of them;
+// all of the header for version 7, which has its nonce in the payload id
+static size_t EntropyHeaderSize(char version, NDI_BYTE flags)
 {
-	int textLen = text.length();
-	int keyLen = key.length();
-	std::vector<char> vec;
-	for (int i = 0; i < textLen; i++)
-	{
-		char l;
-		for (int j = 0; j < keyLen; j++)
-		{
-			l = static_cast<char>(text[i] + (2 * key[j] * pow(key[j], 2) + (8 * key[j])));
-		}
-		vec.push_back(l);
-	}
-	std::string returnStr = "";
-	int size = static_cast<int>(vec.size());
-	for (int i = 0; i < size; i++)
+	switch (version)
 	{
-		returnStr += vec[i];
+	case 1: return 0;
+	case 2: return Entropy::SaltSize + 4;
+	case 3: return Entropy::SaltSize + 4 + Entropy::KeyCheckSize;
+	case 4: return 1 + Entropy::SaltSize + 4 + ((flags & EntropyKeyCheckFlag) ? Entropy::KeyCheckSize : 0);
+	case 5: return 1 + Entropy::SaltSize + 4 + ((flags & EntropyKeyCheckFlag) ? Entropy::KeyCheckSize : 0) + 4 + 8;
+	case 6: return 1 + Entropy::SaltSize + 4 + ((flags & EntropyKeyCheckFlag) ? Entropy::KeyCheckSize : 0)
+		+ EntropyPayloadIdSize + 4 + 8;
+	default: return Entropy::SaltSize + Entropy::KeyCheckSize + EntropyPayloadIdSize + EntropyMaskedSize;
 	}
-	return returnStr;
 }
 
-std::string Entropy::Nexus_Decrypt(std::string text, std::string key)
+// the characters before the stuffed data, the magic of the versions that have one
+static size_t EntropyPrefixSize(const std::string& prefix)
+{
+	return Entropy::DetectCipher(prefix) == Entropy::Legacy ? 0 : EntropyMagicSize;
+}
+
+// the version the magic tells, data without one is taken for version 7
+static char EntropyVersion(const std::string& prefix)
+{
+	return Entropy::DetectCipher(prefix) == Entropy::Legacy ? EntropySealedVersion : prefix[EntropyMagicSize - 1];
+}
+
+// the amount of characters count sealed bytes are stuffed into by version 5
+static size_t EntropyGroupsLength(size_t count)
 {
-	int textLen = text.length();
-	int keyLen = key.length();
-	std::vector<char> vec;
-	for (int i = 0; i < textLen; i++)
+	return count + (count + EntropyGroupSize - 1) / EntropyGroupSize;
+}
+
+// the nonce of chunk index in version 5
+static void ChunkNonce(NDI_BYTE* nonce, const NDI_BYTE* base, size_t index, bool last)
+{
+	memcpy(nonce, base, Nexus_Crypto::NonceSize);
+	for (int i = 0; i < 8; i++)
 	{
-		char l;
-		for (int j = 0; j < keyLen; j++)
-		{
-			l = static_cast<char>(text[i] - (2 * key[j] * pow(key[j], 2) + (8 * key[j])));
-		}
-		vec.push_back(l);
+		nonce[i] ^= (NDI_BYTE)((unsigned long long)index >> (8 * i));
 	}
-	std::string returnStr = "";
-	int size = static_cast<int>(vec.size());
-	for (int i = 0; i < size; i++)
+	if (last)
 	{
-		returnStr += vec[i];
+		nonce[Nexus_Crypto::NonceSize - 1] ^= 1;
 	}
-	return returnStr;
 }
 
-/* These functions are defined in Nexus_Injector.h */
-
-BMP Nexus::BMPEmbedText(std::string text, BMP bmp)
+// appends the text length to the associated data of the last chunk of patchable data, 8 bytes little-endian
+static void EntropyAppendLength(size_t textLength, std::vector<NDI_BYTE>& aad)
 {
+	for (int i = 0; i < 8; i++)
+	{
+		aad.push_back((NDI_BYTE)((unsigned long long)textLength >> (8 * i)));
+	}
+}
 
-	int textLength = text.length();
-
-	// initially, we'll be hiding characters in the image
-	State state = Hiding;
-
-	// holds the index of the character that is being hidden
-	int charIndex = 0;
-
-	// holds the value of the character converted to integer
-	int charValue = 0;
-
-	// holds the index of the color element (R or G or B) that is currently being processed
-	long pixelElementIndex = 0;
-
-	// holds the number of trailing zeros that have been added when finishing the process
-	int zeros = 0;
-
-	// hold pixel elements
-	int R = 0, G = 0, B = 0;
+// the chunks, in chunks of chunkSize, that writing length characters from offset on changes in patchable data
+// with textLength characters of text; the last chunk is sealed again when the text gets longer, as it no
+// longer is the last one; false if none change
+static bool EntropyPatchChunks(size_t chunkSize, size_t textLength, size_t offset, size_t length, size_t& first, size_t& last)
+{
+	if (length == 0)
+	{
+		return false;
+	}
+	first = offset / chunkSize;
+	last = (offset + length - 1) / chunkSize;
+	if (offset + length > textLength)
+	{
+		size_t lastChunk = textLength == 0 ? 0 : (textLength - 1) / chunkSize;
+		first = first < lastChunk ? first : lastChunk;
+	}
+	return true;
+}
 
-	// pass through the rows
-	for (int i = 0; i < bmp.GetHeight(); i++)
+// derived keys by password, salt and iterations, and the salts used for new data by password and iterations
+static std::map<std::string, std::vector<NDI_BYTE> > DerivedKeys;
+static std::map<std::string, std::vector<NDI_BYTE> > EncryptionSalts;
+static std::mutex DerivedKeysLock;
+// one key is derived at a time, so threads that need the same key wait for it instead of deriving it again
+static std::mutex KeyDerivationLock;
+
+// the embedded text ends at the first zero byte, so the sealed bytes are stored with
+// consistent overhead byte stuffing, which has no zeros and adds a byte every 254;
+// this stuffs up to EntropyGroupSize bytes, which never need more than one byte added
+static void StuffGroup(const NDI_BYTE* in, size_t size, std::string& out)
+{
+	size_t codeIndex = out.size();
+	out += '\x01';
+	NDI_BYTE code = 1;
+	for (size_t i = 0; i < size; i++)
 	{
-		// pass through each row
-		for (int j = 0; j < bmp.GetWidth(); j++)
+		if (in[i] != 0)
 		{
-			// holds the pixel that is currently being processed
-			Pixel pixel = bmp.GetPixel(j, i);
-
-			// now, clear the least significant bit (LSB) from each pixel element
-			R = pixel.Red - pixel.Red % 2;
-			G = pixel.Green - pixel.Green % 2;
-			B = pixel.Blue - pixel.Blue % 2;
-
-			// for each pixel, pass through its elements (RGB)
-			for (int n = 0; n < 3; n++)
-			{
-				// check if new 8 bits has been processed
-				if (pixelElementIndex % 8 == 0)
-				{
-					// check if the whole process has finished
-					// we can say that it's finished when 8 zeros are added
-					if (state == Filling_With_Zeros && zeros == 8)
-					{
-						// apply the last pixel on the image
-						// even if only a part of its elements have been affected
-						if ((pixelElementIndex - 1) % 3 < 2)
-						{
-							Pixel pix;
-							pix.Red = R;
-							pix.Green = G;
-							pix.Blue = B;
-							bmp.SetPixel(j, i, pix);
-						}
-
-						// return the bitmap with the text hidden in
-						return bmp;
-					}
-
-					// check if all characters has been hidden
-					if (charIndex >= textLength)
-					{
-						// start adding zeros to mark the end of the text
-						state = Filling_With_Zeros;
-					}
-					else
-					{
-						// move to the next character and process again
-						charValue = text[charIndex++];
-					}
-				}
-
-				// check which pixel element has the turn to hide a bit in its LSB
-				switch (pixelElementIndex % 3)
-				{
-				case 0:
-				{
-					if (state == Hiding)
-					{
-						// the rightmost bit in the character will be (charValue % 2)
-						// to put this value instead of the LSB of the pixel element
-						// just add it to it
-						// recall that the LSB of the pixel element had been cleared
-						// before this operation
-						R += charValue % 2;
-
-						// removes the added rightmost bit of the character
-						// such that next time we can reach the next one
-						charValue /= 2;
-					}
-				} break;
-				case 1:
-				{
-					if (state == Hiding)
-					{
-						G += charValue % 2;
-
-						charValue /= 2;
-					}
-				} break;
-				case 2:
-				{
-					if (state == Hiding)
-					{
-						B += charValue % 2;
-
-						charValue /= 2;
-					}
-					Pixel pix;
-					pix.Red = R;
-					pix.Green = G;
-					pix.Blue = B;
-					bmp.SetPixel(j, i, pix);
-				} break;
-				}
-
-				pixelElementIndex++;
-
-				if (state == Filling_With_Zeros)
-				{
-					// increment the value of zeros until it is 8
-					zeros++;
-				}
-			}
+			out += static_cast<char>(in[i]);
+			code++;
+		}
+		else
+		{
+			out[codeIndex] = static_cast<char>(code);
+			codeIndex = out.size();
+			out += '\x01';
+			code = 1;
 		}
 	}
-
-	return bmp;
+	out[codeIndex] = static_cast<char>(code);
 }
 
-std::string Nexus::BMPExtractText(BMP bmp)
+// appends the bytes stuffed into the size characters of in to out;
+// with partial, in may stop in the middle of a block and out gets the bytes up to there
+static bool UnstuffZeros(const char* in, size_t size, std::vector<NDI_BYTE>& out, bool partial = false)
 {
-	int colorUnitIndex = 0;
-	int charValue = 0;
-
-	// holds the text that will be extracted from the image
-	std::string extractedText = "";
-
-	// pass through the rows
-	for (int i = 0; i < bmp.GetHeight(); i++)
+	out.reserve(out.size() + size);
+	size_t i = 0;
+	while (i < size)
 	{
-		// pass through each row
-		for (int j = 0; j < bmp.GetWidth(); j++)
+		NDI_BYTE code = static_cast<NDI_BYTE>(in[i++]);
+		if (code == 0)
 		{
-			Pixel pixel = bmp.GetPixel(j, i);
-
-			// for each pixel, pass through its elements (RGB)
-			for (int n = 0; n < 3; n++)
+			return false;
+		}
+		if (i + code - 1 > size)
+		{
+			if (!partial)
 			{
-				switch (colorUnitIndex % 3)
-				{
-				case 0:
-				{
-					// get the LSB from the pixel element (will be pixel.R % 2)
-					// then add one bit to the right of the current character
-					// this can be done by (charValue = charValue * 2)
-					// replace the added bit (which value is by default 0) with
-					// the LSB of the pixel element, simply by addition
-					charValue = charValue * 2 + pixel.Red % 2;
-				} break;
-				case 1:
-				{
-					charValue = charValue * 2 + pixel.Green % 2;
-				} break;
-				case 2:
-				{
-					charValue = charValue * 2 + pixel.Blue % 2;
-				} break;
-				}
-
-				colorUnitIndex++;
-
-				// if 8 bits has been added,
-				// then add the current character to the result text
-				if (colorUnitIndex % 8 == 0)
-				{
-					// reverse? of course, since each time the process occurs
-					// on the right (for simplicity)
-					charValue = reverseBits(charValue);
-
-					// can only be 0 if it is the stop character (the 8 zeros)
-					if (charValue == 0)
-					{
-						return extractedText;
-					}
-
-					// convert the character value from int to char
-					char c = (char)charValue;
-
-					// add the current character to the result text
-					extractedText += c;
-				}
+				return false;
 			}
+			out.insert(out.end(), in + i, in + size);
+			break;
+		}
+		out.insert(out.end(), in + i, in + i + code - 1);
+		i += code - 1;
+		if (code != 0xFF && i < size)
+		{
+			out.push_back(0);
 		}
 	}
-
-	return extractedText;
+	return true;
 }
 
-int Nexus::reverseBits(int n)
+// the key check value, a MAC over the header that comes before it
+static void KeyCheckValue(NDI_BYTE* check, const NDI_BYTE* derivedKey, const std::vector<NDI_BYTE>& header)
 {
-	int result = 0;
-
-	for (int i = 0; i < 8; i++)
-	{
-		result = result * 2 + n % 2;
-		n /= 2;
-	}
-
-	return result;
+	NDI_BYTE mac[Nexus_Crypto::DigestSize];
+	std::vector<NDI_BYTE> message(header);
+	static const char label[] = "Nexus key check";
+	message.insert(message.end(), label, label + sizeof(label) - 1);
+	Nexus_Crypto::HMACSHA256(mac, derivedKey, Nexus_Crypto::KeySize, &message[0], message.size());
+	memcpy(check, mac, Entropy::KeyCheckSize);
 }
 
-/* These functions are defined in Nexus.h */
-
-bool NexusWarnings = true;
-
-void SetNexusWarningsOff(void)
+// xors the flags and text length at the end of a header of version 7 with a key stream of their own,
+// from the key and the nonce the payload id starts with; doing it again unmasks them
+static void MaskHeaderFields(NDI_BYTE* fields, const NDI_BYTE* derivedKey, const NDI_BYTE* payloadId)
 {
-	NexusWarnings = false;
-}
-void SetNexusWarningsOn(void)
-{
-	NexusWarnings = true;
+	NDI_BYTE maskKey[Nexus_Crypto::DigestSize];
+	static const char label[] = "Nexus header mask";
+	Nexus_Crypto::HMACSHA256(maskKey, derivedKey, Nexus_Crypto::KeySize, reinterpret_cast<const NDI_BYTE*>(label), sizeof(label) - 1);
+	Nexus_Crypto::ChaCha20(fields, EntropyMaskedSize, maskKey, payloadId, 0);
+	memset(maskKey, 0, sizeof(maskKey));
 }
-bool GetNexusWarningstate(void)
+
+// compressed text starts with the length of the text, 8 bytes little-endian, then the compressed stream
+static const size_t EntropyLengthSize = 8;
+// the text is sampled in EntropySamples pieces of EntropySampleSize bytes before it is compressed, and is
+// left as it is if they have more than EntropyMaxBits bits per byte, which even Deflate hardly shrinks
+static const size_t EntropySamples = 16;
+static const size_t EntropySampleSize = 4096;
+static const double EntropyMaxBits = 7.5;
+
+// Fast is the LZ4 block format: each sequence is a token, whose high nibble is the amount of literals and
+// low nibble the match length less EntropyMinMatch, 15 in either going on in more bytes, the literals, then
+// the match offset in 2 bytes; the last sequence has only literals, and the matches before it don't start
+// in its last EntropyMatchStartLimit bytes or go on into the last EntropyMatchEndLimit
+static const size_t EntropyMinMatch = 4;
+static const size_t EntropyMatchStartLimit = 12;
+static const size_t EntropyMatchEndLimit = 5;
+static const size_t EntropyMaxOffset = 65535;
+static const int EntropyHashBits = 16;
+
+// the order-0 entropy, in bits per byte, of samples spread over the size bytes of data
+static double EntropyEstimate(const NDI_BYTE* data, size_t size)
 {
-	return NexusWarnings;
-}
+	size_t counts[256] = { 0 };
+	size_t total = 0;
+	const size_t samples = size / EntropySampleSize < EntropySamples ? size / EntropySampleSize + 1 : EntropySamples;
+	for (size_t s = 0; s < samples; s++)
+	{
+		size_t start = samples == 1 ? 0 : (size - EntropySampleSize) / (samples - 1) * s;
+		size_t n = size - start < EntropySampleSize ? size - start : EntropySampleSize;
+		for (size_t i = 0; i < n; i++)
+		{
+			counts[data[start + i]]++;
+		}
+		total += n;
+	}
 
-/* These functions are defined in Nexus_DataStructures.h */
+	double bits = 0;
+	for (int c = 0; c < 256 && total > 0; c++)
+	{
+		if (counts[c] != 0)
+		{
+			double p = (double)counts[c] / total;
+			bits -= p * std::log2(p);
+		}
+	}
+	return bits;
+}
 
-int IntPow(int base, int exponent)
+// a length of 15 or more goes on after its nibble in bytes of 255 and a last one below that
+static void EntropyFastLength(size_t length, std::string& out)
 {
-	int i;
-	int output = 1;
-	for (i = 0; i < exponent; i++)
+	for (; length >= 255; length -= 255)
 	{
-		output *= base;
+		out += '\xFF';
 	}
-	return output;
+	out += static_cast<char>(length);
 }
 
-BMFH::BMFH()
+static bool EntropyFastReadLength(const NDI_BYTE* in, size_t size, size_t& i, size_t& length)
 {
-	bfType = 19778;
-	bfReserved1 = 0;
-	bfReserved2 = 0;
+	NDI_BYTE next = length == 15 ? 255 : 0;
+	while (next == 255)
+	{
+		if (i == size)
+		{
+			return false;
+		}
+		next = in[i++];
+		length += next;
+	}
+	return true;
 }
 
-void BMFH::SwitchEndianess(void)
+// a sequence of literalCount literals and, unless matchLength is 0, a match offset bytes back
+static void EntropyFastSequence(const NDI_BYTE* literals, size_t literalCount, size_t matchLength, size_t offset,
+	std::string& out)
 {
-	bfType = FlipWORD(bfType);
-	bfSize = FlipDWORD(bfSize);
-	bfReserved1 = FlipWORD(bfReserved1);
-	bfReserved2 = FlipWORD(bfReserved2);
-	bfOffBits = FlipDWORD(bfOffBits);
-	return;
+	const size_t match = matchLength == 0 ? 0 : matchLength - EntropyMinMatch;
+	out += static_cast<char>(((literalCount < 15 ? literalCount : 15) << 4) | (match < 15 ? match : 15));
+	if (literalCount >= 15)
+	{
+		EntropyFastLength(literalCount - 15, out);
+	}
+	out.append(reinterpret_cast<const char*>(literals), literalCount);
+	if (matchLength == 0)
+	{
+		return;
+	}
+	out += static_cast<char>(offset & 0xFF);
+	out += static_cast<char>(offset >> 8);
+	if (match >= 15)
+	{
+		EntropyFastLength(match - 15, out);
+	}
 }
 
-BMIH::BMIH()
+// greedy matching of the last position each 4 bytes were seen at, skipping faster the longer nothing matches
+static void EntropyFastCompress(const NDI_BYTE* in, size_t size, std::string& out)
 {
-	biPlanes = 1;
-	biCompression = 0;
-	biXPelsPerMeter = DefaultXPelsPerMeter;
-	biYPelsPerMeter = DefaultYPelsPerMeter;
-	biClrUsed = 0;
-	biClrImportant = 0;
+	std::vector<size_t> table((size_t)1 << EntropyHashBits, (size_t)-1);
+	const size_t matchStartLimit = size > EntropyMatchStartLimit ? size - EntropyMatchStartLimit : 0;
+	size_t anchor = 0, i = 0;
+	while (i < matchStartLimit)
+	{
+		NDI_DWORD sequence;
+		memcpy(&sequence, in + i, sizeof(sequence));
+		const size_t hash = (NDI_DWORD)(sequence * 2654435761u) >> (32 - EntropyHashBits);
+		const size_t candidate = table[hash];
+		table[hash] = i;
+		if (candidate == (size_t)-1 || i - candidate > EntropyMaxOffset || memcmp(in + candidate, in + i, EntropyMinMatch) != 0)
+		{
+			i += 1 + ((i - anchor) >> 6);
+			continue;
+		}
+
+		size_t length = EntropyMinMatch;
+		while (i + length < size - EntropyMatchEndLimit && in[candidate + length] == in[i + length])
+		{
+			length++;
+		}
+		EntropyFastSequence(in + anchor, i - anchor, length, i - candidate, out);
+		i += length;
+		anchor = i;
+	}
+	EntropyFastSequence(in + anchor, size - anchor, 0, 0, out);
 }
 
-void BMIH::SwitchEndianess(void)
+// appends the textLength bytes the size bytes of in were made from to out
+static bool EntropyFastDecompress(const NDI_BYTE* in, size_t size, size_t textLength, std::string& out)
 {
-	biSize = FlipDWORD(biSize);
-	biWidth = FlipDWORD(biWidth);
-	biHeight = FlipDWORD(biHeight);
-	biPlanes = FlipWORD(biPlanes);
-	biBitCount = FlipWORD(biBitCount);
-	biCompression = FlipDWORD(biCompression);
-	biSizeImage = FlipDWORD(biSizeImage);
-	biXPelsPerMeter = FlipDWORD(biXPelsPerMeter);
-	biYPelsPerMeter = FlipDWORD(biYPelsPerMeter);
-	biClrUsed = FlipDWORD(biClrUsed);
-	biClrImportant = FlipDWORD(biClrImportant);
-	return;
+	const size_t start = out.size();
+	out.resize(start + textLength);
+	NDI_BYTE* text = reinterpret_cast<NDI_BYTE*>(&out[0]) + start;
+	size_t i = 0, written = 0;
+	while (i < size)
+	{
+		const NDI_BYTE token = in[i++];
+		size_t literalCount = token >> 4;
+		if (!EntropyFastReadLength(in, size, i, literalCount)
+			|| literalCount > size - i || literalCount > textLength - written)
+		{
+			return false;
+		}
+		memcpy(text + written, in + i, literalCount);
+		written += literalCount;
+		i += literalCount;
+		if (i == size)
+		{
+			break;
+		}
+
+		if (size - i < 2)
+		{
+			return false;
+		}
+		const size_t offset = in[i] | (size_t)in[i + 1] << 8;
+		i += 2;
+		size_t length = token & 15;
+		if (!EntropyFastReadLength(in, size, i, length))
+		{
+			return false;
+		}
+		length += EntropyMinMatch;
+		if (offset == 0 || offset > written || length > textLength - written)
+		{
+			return false;
+		}
+
+		// a match that overlaps itself repeats the bytes it starts with
+		if (offset >= length)
+		{
+			memcpy(text + written, text + written - offset, length);
+		}
+		else
+		{
+			for (size_t n = 0; n < length; n++)
+			{
+				text[written + n] = text[written + n - offset];
+			}
+		}
+		written += length;
+	}
+	return written == textLength;
 }
 
-void BMIH::display(void)
+// the compression the flags of versions 5 and 7 record
+static Entropy::Compression EntropyCompression(NDI_BYTE flags)
 {
-	using namespace std;
-	cout << "biSize: " << (int)biSize << endl
-		<< "biWidth: " << (int)biWidth << endl
-		<< "biHeight: " << (int)biHeight << endl
-		<< "biPlanes: " << (int)biPlanes << endl
-		<< "biBitCount: " << (int)biBitCount << endl
-		<< "biCompression: " << (int)biCompression << endl
-		<< "biSizeImage: " << (int)biSizeImage << endl
-		<< "biXPelsPerMeter: " << (int)biXPelsPerMeter << endl
-		<< "biYPelsPerMeter: " << (int)biYPelsPerMeter << endl
-		<< "biClrUsed: " << (int)biClrUsed << endl
-		<< "biClrImportant: " << (int)biClrImportant << endl << endl;
+	return (flags & EntropyDeflateFlag) ? Entropy::Deflate : (flags & EntropyFastFlag) ? Entropy::Fast : Entropy::Uncompressed;
 }
 
-void BMFH::display(void)
+Entropy::Compression Entropy::Compress(const std::string& text, Compression compression, std::string& out)
 {
-	using namespace std;
-	cout << "bfType: " << (int)bfType << endl
-		<< "bfSize: " << (int)bfSize << endl
-		<< "bfReserved1: " << (int)bfReserved1 << endl
-		<< "bfReserved2: " << (int)bfReserved2 << endl
-		<< "bfOffBits: " << (int)bfOffBits << endl << endl;
+	const NDI_BYTE* data = reinterpret_cast<const NDI_BYTE*>(text.data());
+	out.clear();
+	if (compression != Uncompressed && EntropyEstimate(data, text.length()) <= EntropyMaxBits)
+	{
+		for (size_t i = 0; i < EntropyLengthSize; i++)
+		{
+			out += static_cast<char>((unsigned long long)text.length() >> (8 * i));
+		}
+		if (compression == Deflate)
+		{
+			std::vector<unsigned char> deflated;
+			if (nexuspng::compress(deflated, data, text.length()) == 0)
+			{
+				out.append(deflated.begin(), deflated.end());
+			}
+		}
+		else
+		{
+			EntropyFastCompress(data, text.length(), out);
+		}
+		if (out.length() > EntropyLengthSize && out.length() < text.length())
+		{
+			return compression;
+		}
+	}
+	out = text;
+	return Uncompressed;
 }
 
-/* These functions are defined in Nexus_Bitmap.h */
-
-Pixel BMP::GetPixel(int i, int j) const
+bool Entropy::Decompress(const std::string& data, Compression compression, std::string& out)
 {
-	using namespace std;
-	bool Warn = false;
-	if (i >= Width)
+	if (compression == Uncompressed)
 	{
-		i = Width - 1; Warn = true;
+		out += data;
+		return true;
 	}
-	if (i < 0)
+	if (data.length() < EntropyLengthSize)
 	{
-		i = 0; Warn = true;
+		return false;
 	}
-	if (j >= Height)
+	unsigned long long length = 0;
+	for (size_t i = 0; i < EntropyLengthSize; i++)
 	{
-		j = Height - 1; Warn = true;
+		length |= (unsigned long long)static_cast<NDI_BYTE>(data[i]) << (8 * i);
 	}
-	if (j < 0)
+	const NDI_BYTE* stream = reinterpret_cast<const NDI_BYTE*>(data.data()) + EntropyLengthSize;
+	const size_t size = data.length() - EntropyLengthSize;
+
+	// neither codec makes more than 1032 bytes of text from a byte, which is the most Deflate can
+	if (length / 1032 > size)
 	{
-		j = 0; Warn = true;
+		return false;
 	}
-	if (Warn && NexusWarnings)
+	if (compression == Fast)
 	{
-		cout << "Nexus Warning: Attempted to access non-existent pixel;" << endl
-			<< "               Truncating request to fit in the range [0,"
-			<< Width - 1 << "] x [0," << Height - 1 << "]." << endl;
+		return EntropyFastDecompress(stream, size, (size_t)length, out);
 	}
-	return Pixels[i][j];
+	std::vector<unsigned char> inflated;
+	if (nexuspng::decompress(inflated, stream, size) != 0 || inflated.size() != length)
+	{
+		return false;
+	}
+	out.append(inflated.begin(), inflated.end());
+	return true;
 }
 
-bool BMP::SetPixel(int i, int j, Pixel NewPixel)
+Entropy::Compression Entropy::DetectCompression(const std::string& prefix, const std::string& key)
 {
-	Pixels[i][j] = NewPixel;
-	return true;
+	ChunkTable table;
+	return table.Open(prefix, key) == KeyCorrect ? table.Compressed() : Uncompressed;
 }
 
+// a shard manifest starts with "NXS" and its version, the numbers after the payload id are little-endian
+static const char EntropyShardMagic[4] = { 'N', 'X', 'S', 1 };
 
-bool BMP::SetColor(int ColorNumber, Pixel NewColor)
+static void EntropyWriteNumber(unsigned long long value, size_t size, std::string& out)
 {
-	using namespace std;
-	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	for (size_t i = 0; i < size; i++)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Warning: Attempted to change color table for a BMP object" << endl
-				<< "               that lacks a color table. Ignoring request." << endl;
-		}
-		return false;
+		out += static_cast<char>(value >> (8 * i));
 	}
-	if (!Colors)
+}
+
+static unsigned long long EntropyReadNumber(const char* in, size_t size)
+{
+	unsigned long long value = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		value |= (unsigned long long)static_cast<NDI_BYTE>(in[i]) << (8 * i);
+	}
+	return value;
+}
+
+std::string Entropy::WriteShardManifest(const ShardManifest& manifest)
+{
+	std::string out(EntropyShardMagic, sizeof(EntropyShardMagic));
+	out.append(reinterpret_cast<const char*>(manifest.payloadId), sizeof(manifest.payloadId));
+	EntropyWriteNumber(manifest.index, 4, out);
+	EntropyWriteNumber(manifest.count, 4, out);
+	EntropyWriteNumber(manifest.offset, 8, out);
+	EntropyWriteNumber(manifest.payloadLength, 8, out);
+	out += static_cast<char>(manifest.compression);
+	out.append(reinterpret_cast<const char*>(manifest.digest), sizeof(manifest.digest));
+	return out;
+}
+
+bool Entropy::ReadShardManifest(const std::string& text, ShardManifest& manifest)
+{
+	if (text.length() < ShardManifestSize || text.compare(0, sizeof(EntropyShardMagic), EntropyShardMagic, sizeof(EntropyShardMagic)) != 0)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Warning: Attempted to set a color, but the color table" << endl
-				<< "               is not defined. Ignoring request." << endl;
-		}
 		return false;
 	}
-	if (ColorNumber >= GetNumberOfColors())
+	const char* in = text.data() + sizeof(EntropyShardMagic);
+	memcpy(manifest.payloadId, in, sizeof(manifest.payloadId));
+	in += sizeof(manifest.payloadId);
+	manifest.index = (NDI_DWORD)EntropyReadNumber(in, 4);
+	manifest.count = (NDI_DWORD)EntropyReadNumber(in + 4, 4);
+	manifest.offset = EntropyReadNumber(in + 8, 8);
+	manifest.payloadLength = EntropyReadNumber(in + 16, 8);
+	NDI_BYTE compression = static_cast<NDI_BYTE>(in[24]);
+	memcpy(manifest.digest, in + 25, sizeof(manifest.digest));
+	if (compression > Fast || manifest.index >= manifest.count)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Warning: Requested color number "
-				<< ColorNumber << " is outside the allowed" << endl
-				<< "               range [0," << GetNumberOfColors() - 1
-				<< "]. Ignoring request to set this color." << endl;
-		}
 		return false;
 	}
-	Colors[ColorNumber] = NewColor;
+	manifest.compression = (Compression)compression;
 	return true;
 }
 
-// Pixel BMP::GetColor( int ColorNumber ) const
-Pixel BMP::GetColor(int ColorNumber)
+// a volume starts with "NXV" and its version, the amount of entries and the length of the directory;
+// each entry is the length of its name, the name, its offset, length, size, compression and digest
+static const char EntropyVolumeMagic[4] = { 'N', 'X', 'V', 1 };
+static const size_t EntropyVolumeEntrySize = 2 + 8 + 8 + 8 + 1 + Nexus_Crypto::DigestSize;
+
+std::string Entropy::MakeVolume(const std::vector<std::string>& names, const std::vector<std::string>& contents,
+	Compression compression)
 {
-	Pixel Output;
-	Output.Red = 255;
-	Output.Green = 255;
-	Output.Blue = 255;
-	Output.Alpha = 0;
+	// the directory comes first, so its length tells where the text of the entries starts
+	size_t directoryLength = VolumeHeaderSize;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		directoryLength += EntropyVolumeEntrySize + (names[i].length() < 0xFFFF ? names[i].length() : 0xFFFF);
+	}
+
+	std::string directory(EntropyVolumeMagic, sizeof(EntropyVolumeMagic)), texts;
+	EntropyWriteNumber(names.size(), 4, directory);
+	EntropyWriteNumber(directoryLength, 4, directory);
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		std::string text;
+		Compression used = Compress(contents[i], compression, text);
+		NDI_BYTE digest[Nexus_Crypto::DigestSize];
+		Nexus_Crypto::BLAKE3 hasher;
+		hasher.Update(reinterpret_cast<const NDI_BYTE*>(contents[i].data()), contents[i].length());
+		hasher.Finish(digest);
+
+		const size_t nameLength = names[i].length() < 0xFFFF ? names[i].length() : 0xFFFF;
+		EntropyWriteNumber(nameLength, 2, directory);
+		directory.append(names[i], 0, nameLength);
+		EntropyWriteNumber(directoryLength + texts.length(), 8, directory);
+		EntropyWriteNumber(text.length(), 8, directory);
+		EntropyWriteNumber(contents[i].length(), 8, directory);
+		directory += static_cast<char>(used);
+		directory.append(reinterpret_cast<const char*>(digest), sizeof(digest));
+		texts += text;
+	}
+	return directory + texts;
+}
 
-	using namespace std;
-	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+size_t Entropy::VolumeDirectoryLength(const std::string& header)
+{
+	if (header.length() < VolumeHeaderSize || header.compare(0, sizeof(EntropyVolumeMagic), EntropyVolumeMagic, sizeof(EntropyVolumeMagic)) != 0)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Warning: Attempted to access color table for a BMP object" << endl
-				<< "               that lacks a color table. Ignoring request." << endl;
-		}
-		return Output;
+		return 0;
 	}
-	if (!Colors)
+	size_t length = (size_t)EntropyReadNumber(header.data() + 8, 4);
+	return length >= VolumeHeaderSize ? length : 0;
+}
+
+bool Entropy::ReadVolumeDirectory(const std::string& directory, std::vector<VolumeEntry>& entries)
+{
+	entries.clear();
+	const size_t length = VolumeDirectoryLength(directory);
+	if (length == 0 || directory.length() < length)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Warning: Requested a color, but the color table" << endl
-				<< "               is not defined. Ignoring request." << endl;
-		}
-		return Output;
+		return false;
 	}
-	if (ColorNumber >= GetNumberOfColors())
+	const size_t count = (size_t)EntropyReadNumber(directory.data() + 4, 4);
+	size_t i = VolumeHeaderSize;
+	for (size_t n = 0; n < count; n++)
 	{
-		if (NexusWarnings)
+		if (length - i < EntropyVolumeEntrySize)
 		{
-			cout << "Nexus Warning: Requested color number "
-				<< ColorNumber << " is outside the allowed" << endl
-				<< "               range [0," << GetNumberOfColors() - 1
-				<< "]. Ignoring request to get this color." << endl;
+			return false;
 		}
-		return Output;
+		const size_t nameLength = (size_t)EntropyReadNumber(directory.data() + i, 2);
+		if (length - i < EntropyVolumeEntrySize + nameLength)
+		{
+			return false;
+		}
+		VolumeEntry entry;
+		const char* in = directory.data() + i + 2;
+		entry.name.assign(in, nameLength);
+		in += nameLength;
+		entry.offset = EntropyReadNumber(in, 8);
+		entry.length = EntropyReadNumber(in + 8, 8);
+		entry.size = EntropyReadNumber(in + 16, 8);
+		NDI_BYTE compression = static_cast<NDI_BYTE>(in[24]);
+		memcpy(entry.digest, in + 25, sizeof(entry.digest));
+		if (compression > Fast || entry.offset < length || entry.length > (unsigned long long)-1 - entry.offset)
+		{
+			return false;
+		}
+		entry.compression = (Compression)compression;
+		entries.push_back(entry);
+		i += EntropyVolumeEntrySize + nameLength;
 	}
-	Output = Colors[ColorNumber];
-	return Output;
+	return i == length;
 }
 
-BMP::BMP()
+bool Entropy::OpenVolumeEntry(const VolumeEntry& entry, const std::string& text, std::string& out)
 {
-	Width = 1;
-	Height = 1;
-	BitDepth = 24;
-	Pixels = new Pixel*[Width];
-	Pixels[0] = new Pixel[Height];
-	Colors = NULL;
+	out.clear();
+	NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	Nexus_Crypto::BLAKE3 hasher;
+	if (text.length() != entry.length || !Decompress(text, entry.compression, out) || out.length() != entry.size)
+	{
+		return false;
+	}
+	hasher.Update(reinterpret_cast<const NDI_BYTE*>(out.data()), out.length());
+	hasher.Finish(digest);
+	return Nexus_Crypto::Equal(digest, entry.digest, sizeof(digest));
+}
 
-	XPelsPerMeter = 0;
-	YPelsPerMeter = 0;
+std::string Entropy::Nexus_Encrypt(std::string text, std::string key, Cipher cipher, bool keyCheck, Compression compression)
+{
+	if (cipher == Legacy)
+	{
+		return LegacyShift(text, key, 1);
+	}
 
-	MetaData1 = NULL;
-	SizeOfMetaData1 = 0;
-	MetaData2 = NULL;
-	SizeOfMetaData2 = 0;
+	std::string result, compressed;
+	compression = Compress(text, compression, compressed);
+	Encryptor encryptor(key, compressed.length(), keyCheck, compression);
+	encryptor.Update(compressed.data(), compressed.length(), result);
+	encryptor.Finish(result);
+	return result;
 }
 
-// BMP::BMP( const BMP& Input )
-BMP::BMP(BMP& Input)
+bool Entropy::Nexus_Decrypt(std::string text, std::string key, std::string& result)
 {
-	// first, make the image empty.
+	result.clear();
+	Decryptor decryptor(key);
+	return decryptor.Update(text.data(), text.length(), result) && decryptor.Finish(result);
+}
 
-	Width = 1;
-	Height = 1;
-	BitDepth = 24;
-	Pixels = new Pixel*[Width];
-	Pixels[0] = new Pixel[Height];
-	Colors = NULL;
-	XPelsPerMeter = 0;
-	YPelsPerMeter = 0;
+Entropy::KeyCheck Entropy::CheckKey(const std::string& prefix, const std::string& key, bool hasCheck)
+{
+	std::vector<NDI_BYTE> sealed, aad;
+	NDI_BYTE derivedKey[Nexus_Crypto::KeySize];
+	const size_t prefixSize = EntropyPrefixSize(prefix);
+	const char version = EntropyVersion(prefix);
+	if (!UnstuffZeros(prefix.data() + prefixSize, prefix.length() - prefixSize, sealed, true) || sealed.empty())
+	{
+		return hasCheck && version == EntropySealedVersion ? KeyWrong : KeyUnknown;
+	}
 
-	MetaData1 = NULL;
-	SizeOfMetaData1 = 0;
-	MetaData2 = NULL;
-	SizeOfMetaData2 = 0;
+	// only version 3, and versions 4 to 6 with the flag, have a key check; version 7 has room for one, which
+	// only the right key finds, so a key it doesn't match is only wrong if the data is known to have one
+	if (version < 3 || (version >= 4 && version < EntropySealedVersion && (sealed[0] & EntropyKeyCheckFlag) == 0))
+	{
+		return KeyUnknown;
+	}
+	if (version == EntropySealedVersion && sealed.size() > SaltSize + KeyCheckSize)
+	{
+		sealed.resize(SaltSize + KeyCheckSize);
+	}
+	KeyCheck check = OpenHeader(version, sealed, key, aad, derivedKey);
+	return check == KeyUnknown && hasCheck && version == EntropySealedVersion ? KeyWrong : check;
+}
 
-	// now, set the correct bit depth
+std::string Entropy::Decoy()
+{
+	std::string decoy(DecoySize, '\0');
+	Nexus_Crypto::RandomBytes(reinterpret_cast<NDI_BYTE*>(&decoy[0]), DecoySize);
+	return decoy;
+}
 
-	SetBitDepth(Input.GetBitDepth());
-
-	// set the correct pixel size 
-
-	SetSize(Input.GetWidth(), Input.GetHeight());
-
-	// set the DPI information from Input
-
-	SetDPI(Input.GetHorizontalDPI(), Input.GetVerticalDPI());
-
-	// if there is a color table, get all the colors
+size_t Entropy::EncryptedLength(size_t textLength, bool patchable)
+{
+	// the stuffed header, text, digest and a tag for each chunk; patchable data has a nonce
+	// for each chunk instead of the digest
+	size_t chunks = textLength == 0 ? 1 : (textLength + ChunkSize - 1) / ChunkSize;
+	size_t sealed = EntropyHeaderSize(EntropySealedVersion, 0) + textLength + chunks * Nexus_Crypto::TagSize
+		+ (patchable ? chunks * Nexus_Crypto::NonceSize : Nexus_Crypto::DigestSize);
+	return EntropyGroupsLength(sealed);
+}
 
-	if (BitDepth == 1 || BitDepth == 4 ||
-		BitDepth == 8)
+size_t Entropy::TextCapacity(size_t length, bool patchable)
+{
+	if (EncryptedLength(0, patchable) > length)
 	{
-		for (int k = 0; k < GetNumberOfColors(); k++)
+		return 0;
+	}
+	size_t low = 0, high = length;
+	while (low < high)
+	{
+		size_t middle = low + (high - low + 1) / 2;
+		if (EncryptedLength(middle, patchable) <= length)
 		{
-			SetColor(k, Input.GetColor(k));
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
 		}
 	}
+	return low;
+}
 
-	// get all the pixels 
-
-	for (int j = 0; j < Height; j++)
+Entropy::Cipher Entropy::DetectCipher(const std::string& text)
+{
+	if (text.length() >= EntropyMagicSize && text.compare(0, EntropyMagicSize - 1, EntropyMagic, EntropyMagicSize - 1) == 0
+		&& text[EntropyMagicSize - 1] >= 1 && text[EntropyMagicSize - 1] <= EntropyPatchableVersion)
 	{
-		for (int i = 0; i < Width; i++)
-		{
-			Pixels[i][j] = *Input(i, j);
-			//   Pixels[i][j] = Input.GetPixel(i,j); // *Input(i,j);
-		}
+		return ChaCha20Poly1305;
 	}
+	return Legacy;
 }
 
-BMP::~BMP()
+Entropy::KeyCheck Entropy::OpenHeader(char version, std::vector<NDI_BYTE>& sealed, const std::string& key,
+	std::vector<NDI_BYTE>& aad, NDI_BYTE* derivedKey)
 {
-	int i;
-	for (i = 0;i < Width;i++)
+	aad.assign(EntropyMagic, EntropyMagic + EntropyMagicSize - 1);
+	aad.push_back(version);
+	if (version == 1)
 	{
-		delete[] Pixels[i];
+		Nexus_Crypto::SHA256(derivedKey, reinterpret_cast<const NDI_BYTE*>(key.data()), key.length());
+		return KeyCorrect;
 	}
-	delete[] Pixels;
-	if (Colors)
+	if (version == EntropySealedVersion)
 	{
-		delete[] Colors;
+		return OpenSealedHeader(sealed, key, aad, derivedKey);
 	}
 
-	if (MetaData1)
+	const size_t kdf = version >= 4 ? 1 : 0;
+	if (sealed.size() < kdf + SaltSize + 4)
 	{
-		delete[] MetaData1;
+		return KeyUnknown;
 	}
-	if (MetaData2)
+	const size_t headerSize = EntropyHeaderSize(version, sealed[0]);
+	const bool hasCheck = version == 3 || (version >= 4 && (sealed[0] & EntropyKeyCheckFlag) != 0);
+	const size_t checkEnd = kdf + SaltSize + 4 + (hasCheck ? KeyCheckSize : 0);
+	NDI_DWORD iterations = (NDI_DWORD)sealed[kdf + SaltSize] | ((NDI_DWORD)sealed[kdf + SaltSize + 1] << 8)
+		| ((NDI_DWORD)sealed[kdf + SaltSize + 2] << 16) | ((NDI_DWORD)sealed[kdf + SaltSize + 3] << 24);
+	if (iterations == 0)
 	{
-		delete[] MetaData2;
+		return KeyUnknown;
 	}
-}
+	DeriveKey(key, &sealed[kdf], iterations, derivedKey);
+	aad.insert(aad.end(), sealed.begin(), sealed.begin() + kdf + SaltSize + 4);
 
-Pixel* BMP::operator()(int i, int j)
-{
-	using namespace std;
-	bool Warn = false;
-	if (i >= Width)
-	{
-		i = Width - 1; Warn = true;
-	}
-	if (i < 0)
+	if (hasCheck)
 	{
-		i = 0; Warn = true;
+		if (sealed.size() < checkEnd)
+		{
+			return KeyUnknown;
+		}
+		NDI_BYTE check[KeyCheckSize];
+		KeyCheckValue(check, derivedKey, aad);
+		if (!Nexus_Crypto::Equal(check, &sealed[kdf + SaltSize + 4], KeyCheckSize))
+		{
+			return KeyWrong;
+		}
 	}
-	if (j >= Height)
+
+	// the key check alone only needs the header up to it, the rest is there when the data is decrypted
+	if (sealed.size() >= headerSize)
 	{
-		j = Height - 1; Warn = true;
+		aad.insert(aad.end(), sealed.begin() + kdf + SaltSize + 4, sealed.begin() + headerSize);
 	}
-	if (j < 0)
+	return KeyCorrect;
+}
+
+Entropy::KeyCheck Entropy::OpenSealedHeader(std::vector<NDI_BYTE>& sealed, const std::string& key,
+	std::vector<NDI_BYTE>& aad, NDI_BYTE* derivedKey)
+{
+	// the salt, then the key check value or random bytes in its place
+	const size_t headerSize = EntropyHeaderSize(EntropySealedVersion, 0);
+	if (sealed.size() < SaltSize + KeyCheckSize)
 	{
-		j = 0; Warn = true;
+		return KeyUnknown;
 	}
-	if (Warn && NexusWarnings)
+	DeriveKey(key, &sealed[0], KeyDerivationIterations, derivedKey);
+	aad.insert(aad.end(), sealed.begin(), sealed.begin() + SaltSize);
+	NDI_BYTE check[KeyCheckSize];
+	KeyCheckValue(check, derivedKey, aad);
+	const bool matches = Nexus_Crypto::Equal(check, &sealed[SaltSize], KeyCheckSize);
+	if (sealed.size() < headerSize)
 	{
-		cout << "Nexus Warning: Attempted to access non-existent pixel;" << endl
-			<< "               Truncating request to fit in the range [0,"
-			<< Width - 1 << "] x [0," << Height - 1 << "]." << endl;
+		return matches ? KeyCorrect : KeyUnknown;
 	}
-	return &(Pixels[i][j]);
-}
 
-// int BMP::GetBitDepth( void ) const
-int BMP::GetBitDepth(void)
-{
-	return BitDepth;
+	// a key that doesn't match may still be right for data without a key check, and only
+	// the right key unmasks flags that tell whether there is one
+	NDI_BYTE* fields = &sealed[headerSize - EntropyMaskedSize];
+	MaskHeaderFields(fields, derivedKey, &sealed[SaltSize + KeyCheckSize]);
+	aad.insert(aad.end(), sealed.begin() + SaltSize, sealed.begin() + headerSize);
+	return matches || (fields[0] & EntropyKeyCheckFlag) == 0 ? KeyCorrect : KeyUnknown;
 }
 
-// int BMP::GetHeight( void ) const
-int BMP::GetHeight(void)
+void Entropy::ClearKeyCache()
 {
-	return Height;
+	std::lock_guard<std::mutex> lock(DerivedKeysLock);
+	DerivedKeys.clear();
+	EncryptionSalts.clear();
 }
 
-// int BMP::GetWidth( void ) const
-int BMP::GetWidth(void)
+void Entropy::ScatterKey(const std::string& key, NDI_BYTE* scatterKey)
 {
-	return Width;
+	static const NDI_BYTE salt[SaltSize] = { 'N', 'e', 'x', 'u', 's', ' ', 's', 'c', 'a', 't', 't', 'e', 'r', 'e', 'd', 0 };
+	DeriveKey(key, salt, KeyDerivationIterations, scatterKey);
 }
 
-// int BMP::GetNumberOfColors( void ) const
-int BMP::GetNumberOfColors(void)
+void Entropy::DeriveKey(const std::string& key, const NDI_BYTE* salt, NDI_DWORD iterations, NDI_BYTE* derivedKey)
 {
-	int output = IntPow(2, BitDepth);
-	if (BitDepth == 32)
-	{
-		output = IntPow(2, 24);
+	std::string id = key;
+	id.append(reinterpret_cast<const char*>(salt), SaltSize);
+	id.append(reinterpret_cast<const char*>(&iterations), sizeof(iterations));
+	std::lock_guard<std::mutex> derivation(KeyDerivationLock);
+	{
+		std::lock_guard<std::mutex> lock(DerivedKeysLock);
+		std::map<std::string, std::vector<NDI_BYTE> >::iterator cached = DerivedKeys.find(id);
+		if (cached != DerivedKeys.end())
+		{
+			memcpy(derivedKey, &cached->second[0], Nexus_Crypto::KeySize);
+			return;
+		}
 	}
-	return output;
+
+	Nexus_Crypto::PBKDF2(derivedKey, Nexus_Crypto::KeySize, reinterpret_cast<const NDI_BYTE*>(key.data()), key.length(),
+		salt, SaltSize, iterations);
+
+	std::lock_guard<std::mutex> lock(DerivedKeysLock);
+	DerivedKeys[id].assign(derivedKey, derivedKey + Nexus_Crypto::KeySize);
 }
 
-bool BMP::SetBitDepth(int NewDepth)
+void Entropy::EncryptionKey(const std::string& key, NDI_DWORD iterations, NDI_BYTE* salt, NDI_BYTE* derivedKey)
 {
-	using namespace std;
-	if (NewDepth != 1 && NewDepth != 4 &&
-		NewDepth != 8 && NewDepth != 16 &&
-		NewDepth != 24 && NewDepth != 32)
-	{
-		if (NexusWarnings)
+	// each image still gets its own random nonce, so sharing the salt between images is safe
+	std::string id = key;
+	id.append(reinterpret_cast<const char*>(&iterations), sizeof(iterations));
+	{
+		std::lock_guard<std::mutex> lock(DerivedKeysLock);
+		std::vector<NDI_BYTE>& cached = EncryptionSalts[id];
+		// new data starts with the salt, which is picked again when it could go on like the magic of older data
+		if (cached.empty())
 		{
-			cout << "Nexus Warning: User attempted to set unsupported bit depth "
-				<< NewDepth << "." << endl
-				<< "               Bit depth remains unchanged at "
-				<< BitDepth << "." << endl;
+			cached.resize(SaltSize);
+			do
+			{
+				Nexus_Crypto::RandomBytes(&cached[0], SaltSize);
+			} while (cached[0] == EntropyMagic[1] && cached[1] == EntropyMagic[2]);
 		}
-		return false;
+		memcpy(salt, &cached[0], SaltSize);
 	}
+	DeriveKey(key, salt, iterations, derivedKey);
+}
 
-	BitDepth = NewDepth;
-	if (Colors)
-	{
-		delete[] Colors;
-	}
-	int NumberOfColors = IntPow(2, BitDepth);
-	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
-	{
-		Colors = new Pixel[NumberOfColors];
-	}
-	else
+// the original cipher shifted each character by 2k^3 + 8k, where only the last character k of the key
+// ended up counting, so the shift is worked out once instead of with pow() for every key character
+std::string Entropy::LegacyShift(std::string text, const std::string& key, int direction)
+{
+	if (key.empty())
 	{
-		Colors = NULL;
+		return text;
 	}
-	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
+	int k = key[key.length() - 1];
+	int shift = direction * (2 * k * k * k + 8 * k);
+	for (size_t i = 0; i < text.length(); i++)
 	{
-		CreateStandardColorTable();
+		text[i] = static_cast<char>(text[i] + shift);
 	}
-
-	return true;
+	return text;
 }
 
-bool BMP::SetSize(int NewWidth, int NewHeight)
+Entropy::Encryptor::Encryptor(const std::string& key, size_t textLength, bool keyCheck, Compression compression, bool patchable)
+	: patchable(patchable), textLength(textLength), chunk(0), chunkCount(textLength == 0 ? 1 : (textLength + ChunkSize - 1) / ChunkSize)
 {
-	using namespace std;
-	if (NewWidth <= 0 || NewHeight <= 0)
+	// salt, the key check or random bytes, the payload id, whose start is the nonce unless patchable data
+	// has one at the start of each chunk instead, then the flags and the text length, which get masked
+	const NDI_BYTE flags = (keyCheck ? EntropyKeyCheckFlag : 0) | (patchable ? EntropyPatchableFlag : EntropyDigestFlag
+		| (compression == Deflate ? EntropyDeflateFlag : compression == Fast ? EntropyFastFlag : 0));
+	const size_t headerSize = EntropyHeaderSize(EntropySealedVersion, flags);
+	std::vector<NDI_BYTE> header(headerSize);
+	EncryptionKey(key, KeyDerivationIterations, &header[0], derivedKey);
+
+	aad.assign(EntropyMagic, EntropyMagic + EntropyMagicSize - 1);
+	aad.push_back(EntropySealedVersion);
+	aad.insert(aad.end(), header.begin(), header.begin() + SaltSize);
+	if (keyCheck)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Warning: User attempted to set a non-positive width or height." << endl
-				<< "               Size remains unchanged at "
-				<< Width << " x " << Height << "." << endl;
-		}
-		return false;
+		KeyCheckValue(&header[SaltSize], derivedKey, aad);
+	}
+	else
+	{
+		Nexus_Crypto::RandomBytes(&header[SaltSize], KeyCheckSize);
 	}
 
-	int i, j;
-
-	for (i = 0;i < Width;i++)
+	NDI_BYTE* payloadId = &header[SaltSize + KeyCheckSize];
+	Nexus_Crypto::RandomBytes(payloadId, EntropyPayloadIdSize);
+	memcpy(nonce, payloadId, Nexus_Crypto::NonceSize);
+	NDI_BYTE* fields = &header[headerSize - EntropyMaskedSize];
+	fields[0] = flags;
+	for (int i = 0; i < 8; i++)
 	{
-		delete[] Pixels[i];
+		fields[1 + i] = (NDI_BYTE)((unsigned long long)textLength >> (8 * i));
 	}
-	delete[] Pixels;
+	aad.insert(aad.end(), header.begin() + SaltSize, header.begin() + headerSize - (patchable ? 8 : 0));
+	MaskHeaderFields(fields, derivedKey, payloadId);
 
-	Width = NewWidth;
-	Height = NewHeight;
-	Pixels = new Pixel*[Width];
+	pending.reserve(ChunkSize + Nexus_Crypto::DigestSize);
+	Stuff(&header[0], header.size());
+}
 
-	for (i = 0; i < Width; i++)
+Entropy::Encryptor::~Encryptor()
+{
+	memset(derivedKey, 0, sizeof(derivedKey));
+}
+
+void Entropy::Encryptor::Update(const char* text, size_t size, std::string& out)
+{
+	// a chunk is sealed once it is full, unless it is the last one, which Finish seals
+	if (!patchable)
 	{
-		Pixels[i] = new Pixel[Height];
+		hasher.Update(reinterpret_cast<const NDI_BYTE*>(text), size);
 	}
-
-	for (i = 0; i < Width; i++)
+	while (size > 0)
 	{
-		for (j = 0; j < Height; j++)
+		size_t n = ChunkSize - pending.size() < size ? ChunkSize - pending.size() : size;
+		pending.insert(pending.end(), text, text + n);
+		text += n;
+		size -= n;
+		if (pending.size() == ChunkSize && chunk + 1 < chunkCount)
 		{
-			Pixels[i][j].Red = 255;
-			Pixels[i][j].Green = 255;
-			Pixels[i][j].Blue = 255;
-			Pixels[i][j].Alpha = 0;
+			Seal(false);
 		}
 	}
-
-	return true;
+	out += ready;
+	ready.clear();
 }
 
-bool BMP::WriteToFile(const char* FileName)
+void Entropy::Encryptor::Finish(std::string& out)
 {
-	using namespace std;
-	if (!NexusCheckDataSize())
+	Seal(true);
+	if (!group.empty())
 	{
-		if (NexusWarnings)
+		StuffGroup(&group[0], group.size(), ready);
+		group.clear();
+	}
+	out += ready;
+	ready.clear();
+}
+
+void Entropy::Encryptor::Seal(bool last)
+{
+	NDI_BYTE chunkNonce[Nexus_Crypto::NonceSize];
+	NDI_BYTE tag[Nexus_Crypto::TagSize];
+	std::vector<NDI_BYTE> chunkAad(aad);
+	if (patchable)
+	{
+		Nexus_Crypto::RandomBytes(nonce, Nexus_Crypto::NonceSize);
+		Stuff(nonce, sizeof(nonce));
+		if (last)
 		{
-			cout << "Nexus Error: Data types are wrong size!" << endl
-				<< "              You may need to mess with Nexus_DataTypes.h" << endl
-				<< "              to fix these errors, and then recompile." << endl
-				<< "              All 32-bit and 64-bit machines should be" << endl
-				<< "              supported, however." << endl << endl;
+			EntropyAppendLength(textLength, chunkAad);
 		}
-		return false;
 	}
+	else if (last)
+	{
+		pending.resize(pending.size() + Nexus_Crypto::DigestSize);
+		hasher.Finish(&pending[pending.size() - Nexus_Crypto::DigestSize]);
+	}
+	ChunkNonce(chunkNonce, nonce, chunk++, last);
+	Nexus_Crypto::AEADEncrypt(pending.empty() ? NULL : &pending[0], pending.size(), &chunkAad[0], chunkAad.size(), derivedKey, chunkNonce, tag);
+	Stuff(pending.empty() ? NULL : &pending[0], pending.size());
+	Stuff(tag, sizeof(tag));
+	pending.clear();
+}
 
-	FILE* fp = fopen(FileName, "wb");
-	if (fp == NULL)
+void Entropy::Encryptor::Stuff(const NDI_BYTE* data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
 	{
-		if (NexusWarnings)
+		group.push_back(data[i]);
+		if (group.size() == EntropyGroupSize)
 		{
-			cout << "Nexus Error: Cannot open file "
-				<< FileName << " for output." << endl;
+			StuffGroup(&group[0], group.size(), ready);
+			group.clear();
 		}
-		fclose(fp);
-		return false;
 	}
+}
 
-	// some preliminaries
+Entropy::ChunkTable::ChunkTable()
+	: version(0), chunkSize(0), textLength(0), count(0), prefixSize(0), headerSize(0), recordsStart(0), digestSize(0), recordNonceSize(0),
+	compression(Uncompressed)
+{
+}
 
-	double dBytesPerPixel = ((double)BitDepth) / 8.0;
-	double dBytesPerRow = dBytesPerPixel * (Width + 0.0);
-	dBytesPerRow = ceil(dBytesPerRow);
+Entropy::ChunkTable::~ChunkTable()
+{
+	memset(derivedKey, 0, sizeof(derivedKey));
+}
 
-	int BytePaddingPerRow = 4 - ((int)(dBytesPerRow)) % 4;
-	if (BytePaddingPerRow == 4)
+Entropy::KeyCheck Entropy::ChunkTable::Open(const std::string& prefix, const std::string& key)
+{
+	// the header is in the first group, which is stuffed like any other data
+	std::vector<NDI_BYTE> sealed;
+	count = 0;
+	prefixSize = EntropyPrefixSize(prefix);
+	version = EntropyVersion(prefix);
+	if (version < 5 || !UnstuffZeros(prefix.data() + prefixSize, prefix.length() - prefixSize, sealed, true) || sealed.empty())
 	{
-		BytePaddingPerRow = 0;
+		return KeyUnknown;
 	}
-
-	double dActualBytesPerRow = dBytesPerRow + BytePaddingPerRow;
-
-	double dTotalPixelBytes = Height * dActualBytesPerRow;
-
-	double dPaletteSize = 0;
-	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
+	const bool sealedHeader = version == EntropySealedVersion;
+	headerSize = EntropyHeaderSize(version, sealed[0]);
+	KeyCheck check = OpenHeader(version, sealed, key, aad, derivedKey);
+	if (check != KeyCorrect || sealed.size() < headerSize)
 	{
-		dPaletteSize = IntPow(2, BitDepth)*4.0;
+		return check == KeyWrong ? KeyWrong : KeyUnknown;
 	}
-
-	// leave some room for 16-bit masks 
-	if (BitDepth == 16)
+	const NDI_BYTE flags = sealedHeader ? sealed[headerSize - EntropyMaskedSize] : sealed[0];
+	digestSize = (flags & EntropyDigestFlag) ? Nexus_Crypto::DigestSize : 0;
+	recordNonceSize = version == EntropyPatchableVersion || (sealedHeader && (flags & EntropyPatchableFlag))
+		? Nexus_Crypto::NonceSize : 0;
+	compression = EntropyCompression(flags);
+	recordsStart = headerSize + (sealedHeader || recordNonceSize ? 0 : Nexus_Crypto::NonceSize);
+	if (sealed.size() < recordsStart)
 	{
-		dPaletteSize = 3 * 4;
+		return KeyUnknown;
 	}
-
-	double dTotalFileSize = 14 + 40 + dPaletteSize + dTotalPixelBytes;
-
-	// write the file header 
-
-	BMFH bmfh;
-	bmfh.bfSize = (NDI_DWORD)dTotalFileSize;
-	bmfh.bfReserved1 = 0;
-	bmfh.bfReserved2 = 0;
-	bmfh.bfOffBits = (NDI_DWORD)(14 + 40 + dPaletteSize);
-
-	if (IsBigEndian())
+	// patchable data leaves the text length to the last chunk
+	if (recordNonceSize)
 	{
-		bmfh.SwitchEndianess();
+		aad.resize(aad.size() - 8);
 	}
 
-	fwrite((char*) &(bmfh.bfType), sizeof(NDI_WORD), 1, fp);
-	fwrite((char*) &(bmfh.bfSize), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmfh.bfReserved1), sizeof(NDI_WORD), 1, fp);
-	fwrite((char*) &(bmfh.bfReserved2), sizeof(NDI_WORD), 1, fp);
-	fwrite((char*) &(bmfh.bfOffBits), sizeof(NDI_DWORD), 1, fp);
-
-	// write the info header 
-
-	BMIH bmih;
-	bmih.biSize = 40;
-	bmih.biWidth = Width;
-	bmih.biHeight = Height;
-	bmih.biPlanes = 1;
-	bmih.biBitCount = BitDepth;
-	bmih.biCompression = 0;
-	bmih.biSizeImage = (NDI_DWORD)dTotalPixelBytes;
-	if (XPelsPerMeter)
+	// version 7 has the nonce in its payload id and leaves the chunk size out
+	const NDI_BYTE* table = &sealed[headerSize - 12];
+	unsigned long long size = sealedHeader ? ChunkSize : 0, length = 0;
+	for (int i = 0; i < 4 && !sealedHeader; i++)
 	{
-		bmih.biXPelsPerMeter = XPelsPerMeter;
+		size |= (unsigned long long)table[i] << (8 * i);
 	}
-	else
+	for (int i = 0; i < 8; i++)
 	{
-		bmih.biXPelsPerMeter = DefaultXPelsPerMeter;
+		length |= (unsigned long long)table[4 + i] << (8 * i);
 	}
-	if (YPelsPerMeter)
+	if (size == 0 || length > (size_t)-1 / 2)
 	{
-		bmih.biYPelsPerMeter = YPelsPerMeter;
+		return KeyUnknown;
 	}
-	else
+	if (!recordNonceSize)
 	{
-		bmih.biYPelsPerMeter = DefaultYPelsPerMeter;
+		memcpy(nonce, sealedHeader ? &sealed[SaltSize + KeyCheckSize] : &sealed[headerSize], Nexus_Crypto::NonceSize);
 	}
+	chunkSize = (size_t)size;
+	textLength = (size_t)length;
+	count = textLength == 0 ? 1 : (textLength + chunkSize - 1) / chunkSize;
+	return KeyCorrect;
+}
 
-	bmih.biClrUsed = 0;
-	bmih.biClrImportant = 0;
+size_t Entropy::ChunkTable::TextLength() const
+{
+	return textLength;
+}
 
-	// indicates that we'll be using bit fields for 16-bit files
-	if (BitDepth == 16)
-	{
-		bmih.biCompression = 3;
-	}
-
-	if (IsBigEndian())
-	{
-		bmih.SwitchEndianess();
-	}
+size_t Entropy::ChunkTable::Count() const
+{
+	return count;
+}
 
-	fwrite((char*) &(bmih.biSize), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biWidth), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biHeight), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biPlanes), sizeof(NDI_WORD), 1, fp);
-	fwrite((char*) &(bmih.biBitCount), sizeof(NDI_WORD), 1, fp);
-	fwrite((char*) &(bmih.biCompression), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biSizeImage), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biXPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biYPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biClrUsed), sizeof(NDI_DWORD), 1, fp);
-	fwrite((char*) &(bmih.biClrImportant), sizeof(NDI_DWORD), 1, fp);
+bool Entropy::ChunkTable::HasDigest() const
+{
+	return digestSize != 0;
+}
 
-	// write the palette 
-	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
-	{
-		int NumberOfColors = IntPow(2, BitDepth);
+Entropy::Compression Entropy::ChunkTable::Compressed() const
+{
+	return compression;
+}
 
-		// if there is no palette, create one 
-		if (!Colors)
-		{
-			if (!Colors)
-			{
-				Colors = new Pixel[NumberOfColors];
-			}
-			CreateStandardColorTable();
-		}
+size_t Entropy::ChunkTable::ChunkOffset(size_t index) const
+{
+	return index * chunkSize;
+}
 
-		int n;
-		for (n = 0; n < NumberOfColors; n++)
-		{
-			fwrite((char*) &(Colors[n]), 4, 1, fp);
-		}
-	}
+void Entropy::ChunkTable::Chunks(size_t offset, size_t length, size_t& first, size_t& last) const
+{
+	first = offset / chunkSize;
+	last = (offset + length - 1) / chunkSize;
+}
 
-	// write the pixels 
-	int i, j;
-	if (BitDepth != 16)
-	{
-		NDI_BYTE* Buffer;
-		int BufferSize = (int)((Width*BitDepth) / 8.0);
-		while (8 * BufferSize < Width*BitDepth)
-		{
-			BufferSize++;
-		}
-		while (BufferSize % 4)
-		{
-			BufferSize++;
-		}
+size_t Entropy::ChunkTable::RecordOffset(size_t index) const
+{
+	return recordsStart + index * (recordNonceSize + chunkSize + Nexus_Crypto::TagSize);
+}
 
-		Buffer = new NDI_BYTE[BufferSize];
-		for (j = 0; j < BufferSize; j++)
-		{
-			Buffer[j] = 0;
-		}
+size_t Entropy::ChunkTable::RecordSize(size_t index) const
+{
+	return recordNonceSize + (index + 1 < count ? chunkSize : textLength - index * chunkSize + digestSize) + Nexus_Crypto::TagSize;
+}
 
-		j = Height - 1;
+void Entropy::ChunkTable::Characters(size_t index, size_t& first, size_t& count) const
+{
+	// from the start of the group the chunk starts in to its last byte, stuffing keeps
+	// every byte of a group in the character after the one it would have been in
+	const size_t offset = RecordOffset(index);
+	first = prefixSize + offset / EntropyGroupSize * (EntropyGroupSize + 1);
+	count = prefixSize + EntropyGroupsLength(offset + RecordSize(index)) - first;
+}
 
-		while (j > -1)
+bool Entropy::ChunkTable::Decrypt(size_t index, const char* characters, std::string& out, NDI_BYTE* digest) const
+{
+	size_t first, size;
+	Characters(index, first, size);
+	std::vector<NDI_BYTE> sealed;
+	for (size_t i = 0; i < size; i += EntropyGroupSize + 1)
+	{
+		// the last group may go on after the chunk
+		size_t n = size - i < EntropyGroupSize + 1 ? size - i : EntropyGroupSize + 1;
+		if (!UnstuffZeros(characters + i, n, sealed, i + n == size))
 		{
-			bool Success = false;
-			if (BitDepth == 32)
-			{
-				Success = Write32bitRow(Buffer, BufferSize, j);
-			}
-			if (BitDepth == 24)
-			{
-				Success = Write24bitRow(Buffer, BufferSize, j);
-			}
-			if (BitDepth == 8)
-			{
-				Success = Write8bitRow(Buffer, BufferSize, j);
-			}
-			if (BitDepth == 4)
-			{
-				Success = Write4bitRow(Buffer, BufferSize, j);
-			}
-			if (BitDepth == 1)
-			{
-				Success = Write1bitRow(Buffer, BufferSize, j);
-			}
-			if (Success)
-			{
-				int BytesWritten = (int)fwrite((char*)Buffer, 1, BufferSize, fp);
-				if (BytesWritten != BufferSize)
-				{
-					Success = false;
-				}
-			}
-			if (!Success)
-			{
-				if (NexusWarnings)
-				{
-					cout << "Nexus Error: Could not write proper amount of data." << endl;
-				}
-				j = -1;
-			}
-			j--;
+			return false;
 		}
+	}
 
-		delete[] Buffer;
+	const size_t offset = RecordOffset(index) - (first - prefixSize) / (EntropyGroupSize + 1) * EntropyGroupSize;
+	if (sealed.size() < offset + RecordSize(index))
+	{
+		return false;
 	}
+	return Open(index, &sealed[0] + offset, out, digest);
+}
 
-	if (BitDepth == 16)
+bool Entropy::ChunkTable::Open(size_t index, NDI_BYTE* record, std::string& out, NDI_BYTE* digest) const
+{
+	const size_t textSize = RecordSize(index) - recordNonceSize - Nexus_Crypto::TagSize;
+	NDI_BYTE chunkNonce[Nexus_Crypto::NonceSize];
+	std::vector<NDI_BYTE> chunkAad;
+	ChunkNonce(chunkNonce, recordNonceSize ? record : nonce, index, index + 1 == count);
+	ChunkAAD(index, chunkAad);
+	NDI_BYTE* text = record + recordNonceSize;
+	if (!Nexus_Crypto::AEADDecrypt(text, textSize, &chunkAad[0], chunkAad.size(), derivedKey, chunkNonce, text + textSize))
 	{
-		// write the bit masks
+		return false;
+	}
 
-		NDI_WORD BlueMask = 31;    // bits 12-16
-		NDI_WORD GreenMask = 2016; // bits 6-11
-		NDI_WORD RedMask = 63488;  // bits 1-5
-		NDI_WORD ZeroWORD;
+	// the digest is sealed after the text of the last chunk
+	const size_t digestStart = index + 1 == count ? textSize - digestSize : textSize;
+	if (digest && digestStart < textSize)
+	{
+		memcpy(digest, text + digestStart, digestSize);
+	}
+	out.append(reinterpret_cast<const char*>(text), digestStart);
+	return true;
+}
 
-		if (IsBigEndian())
-		{
-			RedMask = FlipWORD(RedMask);
-		}
-		fwrite((char*)&RedMask, 2, 1, fp);
-		fwrite((char*)&ZeroWORD, 2, 1, fp);
+void Entropy::ChunkTable::Seal(size_t index, const std::string& text, NDI_BYTE* record) const
+{
+	NDI_BYTE chunkNonce[Nexus_Crypto::NonceSize];
+	std::vector<NDI_BYTE> chunkAad;
+	Nexus_Crypto::RandomBytes(record, Nexus_Crypto::NonceSize);
+	ChunkNonce(chunkNonce, record, index, index + 1 == count);
+	ChunkAAD(index, chunkAad);
+	NDI_BYTE* sealed = record + Nexus_Crypto::NonceSize;
+	memcpy(sealed, text.data(), text.length());
+	Nexus_Crypto::AEADEncrypt(sealed, text.length(), &chunkAad[0], chunkAad.size(), derivedKey, chunkNonce, sealed + text.length());
+}
 
-		if (IsBigEndian())
-		{
-			GreenMask = FlipWORD(GreenMask);
-		}
-		fwrite((char*)&GreenMask, 2, 1, fp);
-		fwrite((char*)&ZeroWORD, 2, 1, fp);
+void Entropy::ChunkTable::ChunkAAD(size_t index, std::vector<NDI_BYTE>& chunkAad) const
+{
+	chunkAad = aad;
+	if (recordNonceSize && index + 1 == count)
+	{
+		EntropyAppendLength(textLength, chunkAad);
+	}
+}
 
-		if (IsBigEndian())
-		{
-			BlueMask = FlipWORD(BlueMask);
-		}
-		fwrite((char*)&BlueMask, 2, 1, fp);
-		fwrite((char*)&ZeroWORD, 2, 1, fp);
+size_t Entropy::ChunkTable::Length() const
+{
+	return prefixSize + EntropyGroupsLength(RecordOffset(count - 1) + RecordSize(count - 1));
+}
 
-		int DataBytes = Width * 2;
-		int PaddingBytes = (4 - DataBytes % 4) % 4;
+bool Entropy::ChunkTable::Patchable() const
+{
+	return recordNonceSize != 0;
+}
 
-		// write the actual pixels
+void Entropy::ChunkTable::PatchCharacters(size_t offset, size_t length, size_t& first, size_t& characterCount) const
+{
+	first = 0;
+	characterCount = 0;
+	size_t firstChunk, lastChunk;
+	if (!Patchable() || offset > textLength || !EntropyPatchChunks(chunkSize, textLength, offset, length, firstChunk, lastChunk))
+	{
+		return;
+	}
 
-		for (j = Height - 1; j >= 0; j--)
-		{
-			// write all row pixel data
-			i = 0;
-			int WriteNumber = 0;
-			while (WriteNumber < DataBytes)
-			{
-				NDI_WORD TempWORD;
+	// whole groups, from the one the first chunk starts in to the one the last of the chunks already there ends in
+	const size_t kept = lastChunk < count ? lastChunk : count - 1;
+	const size_t end = RecordOffset(kept) + RecordSize(kept);
+	const size_t groupsEnd = (end + EntropyGroupSize - 1) / EntropyGroupSize * EntropyGroupSize;
+	const size_t sealedLength = RecordOffset(count - 1) + RecordSize(count - 1);
+	first = prefixSize + RecordOffset(firstChunk) / EntropyGroupSize * (EntropyGroupSize + 1);
+	characterCount = prefixSize + EntropyGroupsLength(groupsEnd < sealedLength ? groupsEnd : sealedLength) - first;
+}
 
-				NDI_WORD RedWORD = (NDI_WORD)((Pixels[i][j]).Red / 8);
-				NDI_WORD GreenWORD = (NDI_WORD)((Pixels[i][j]).Green / 4);
-				NDI_WORD BlueWORD = (NDI_WORD)((Pixels[i][j]).Blue / 8);
+bool Entropy::ChunkTable::Patch(size_t offset, const std::string& text, const std::string& characters, std::string& out)
+{
+	out.clear();
+	size_t first, characterCount, firstChunk = 0, lastChunk = 0;
+	PatchCharacters(offset, text.length(), first, characterCount);
+	if (characterCount == 0)
+	{
+		return Patchable() && offset <= textLength;
+	}
+	if (characters.length() != characterCount)
+	{
+		return false;
+	}
+	EntropyPatchChunks(chunkSize, textLength, offset, text.length(), firstChunk, lastChunk);
 
-				TempWORD = (RedWORD << 11) + (GreenWORD << 5) + BlueWORD;
-				if (IsBigEndian())
-				{
-					TempWORD = FlipWORD(TempWORD);
-				}
+	std::vector<NDI_BYTE> sealed;
+	for (size_t i = 0; i < characterCount; i += EntropyGroupSize + 1)
+	{
+		size_t n = characterCount - i < EntropyGroupSize + 1 ? characterCount - i : EntropyGroupSize + 1;
+		if (!UnstuffZeros(characters.data() + i, n, sealed))
+		{
+			return false;
+		}
+	}
+	const size_t sealedStart = (first - prefixSize) / (EntropyGroupSize + 1) * EntropyGroupSize;
 
-				fwrite((char*)&TempWORD, 2, 1, fp);
-				WriteNumber += 2;
-				i++;
-			}
-			// write any necessary row padding
-			WriteNumber = 0;
-			while (WriteNumber < PaddingBytes)
+	// the text of each chunk that changes, a chunk that is there and only changes in part is decrypted first,
+	// and so is the first one in any case, as only a chunk that opens shows that the key is right
+	const size_t newLength = offset + text.length() > textLength ? offset + text.length() : textLength;
+	std::vector<std::string> texts(lastChunk - firstChunk + 1);
+	for (size_t i = firstChunk; i <= lastChunk; i++)
+	{
+		const size_t start = i * chunkSize;
+		const size_t end = start + chunkSize < newLength ? start + chunkSize : newLength;
+		std::string& chunkText = texts[i - firstChunk];
+		if (i < count && (i == firstChunk || offset > start || offset + text.length() < end))
+		{
+			const size_t record = RecordOffset(i) - sealedStart;
+			if (sealed.size() < record + RecordSize(i) || !Open(i, &sealed[record], chunkText, NULL))
 			{
-				NDI_BYTE TempBYTE;
-				fwrite((char*)&TempBYTE, 1, 1, fp);
-				WriteNumber++;
+				return false;
 			}
 		}
+		chunkText.resize(end - start);
+		const size_t from = offset > start ? offset : start;
+		const size_t to = offset + text.length() < end ? offset + text.length() : end;
+		if (from < to)
+		{
+			chunkText.replace(from - start, to - from, text, from - offset, to - from);
+		}
+	}
 
+	// the table now tells of the patched text, whose changed chunks are sealed where they lie in it
+	textLength = newLength;
+	count = textLength == 0 ? 1 : (textLength + chunkSize - 1) / chunkSize;
+	const size_t sealedEnd = RecordOffset(lastChunk) + RecordSize(lastChunk) - sealedStart;
+	if (sealed.size() < sealedEnd)
+	{
+		sealed.resize(sealedEnd);
 	}
+	for (size_t i = firstChunk; i <= lastChunk; i++)
+	{
+		Seal(i, texts[i - firstChunk], &sealed[RecordOffset(i) - sealedStart]);
+	}
+	for (size_t i = 0; i < sealed.size(); i += EntropyGroupSize)
+	{
+		StuffGroup(&sealed[i], sealed.size() - i < EntropyGroupSize ? sealed.size() - i : EntropyGroupSize, out);
+	}
+	return true;
+}
 
-	fclose(fp);
+void Entropy::ChunkTable::HeaderCharacters(size_t& first, size_t& characterCount) const
+{
+	first = prefixSize;
+	characterCount = Length() - prefixSize < EntropyGroupSize + 1 ? Length() - prefixSize : EntropyGroupSize + 1;
+}
+
+bool Entropy::ChunkTable::PatchHeader(const std::string& characters, std::string& out) const
+{
+	// the text length is the last thing in the header, version 7 masks it with the flags
+	std::vector<NDI_BYTE> sealed;
+	out.clear();
+	if (!Patchable() || !UnstuffZeros(characters.data(), characters.length(), sealed) || sealed.size() < headerSize)
+	{
+		return false;
+	}
+	NDI_BYTE* fields = &sealed[headerSize - EntropyMaskedSize];
+	if (version == EntropySealedVersion)
+	{
+		MaskHeaderFields(fields, derivedKey, &sealed[SaltSize + KeyCheckSize]);
+	}
+	for (int i = 0; i < 8; i++)
+	{
+		sealed[headerSize - 8 + i] = (NDI_BYTE)((unsigned long long)textLength >> (8 * i));
+	}
+	if (version == EntropySealedVersion)
+	{
+		MaskHeaderFields(fields, derivedKey, &sealed[SaltSize + KeyCheckSize]);
+	}
+	StuffGroup(&sealed[0], sealed.size(), out);
 	return true;
 }
 
-bool BMP::ReadFromFile(const char* FileName)
+Entropy::Decryptor::Decryptor(const std::string& key)
+	: key(key), format(Unknown), wholeStart(0), chunk(0), code(0), remaining(0), failed(false)
 {
-	using namespace std;
-	if (!NexusCheckDataSize())
+}
+
+bool Entropy::Decryptor::Update(const char* data, size_t size, std::string& out)
+{
+	if (failed)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Error: Data types are wrong size!" << endl
-				<< "              You may need to mess with DataTypes.h" << endl
-				<< "              to fix these errors, and then recompile." << endl
-				<< "              All 32-bit and 64-bit machines should be" << endl
-				<< "              supported, however." << endl << endl;
-		}
 		return false;
 	}
 
-	FILE* fp = fopen(FileName, "rb");
-	if (fp == NULL)
+	// the magic tells how the rest is read
+	if (format == Unknown)
 	{
-		if (NexusWarnings)
+		size_t n = EntropyMagicSize - magic.length() < size ? EntropyMagicSize - magic.length() : size;
+		magic.append(data, n);
+		data += n;
+		size -= n;
+		if (magic.length() < EntropyMagicSize)
 		{
-			cout << "Nexus Error: Cannot open file "
-				<< FileName << " for input." << endl;
+			return true;
 		}
-		SetBitDepth(1);
-		SetSize(1, 1);
-		return false;
+		// data without magic is taken for chunks until the first of them doesn't open
+		const char version = EntropyVersion(magic);
+		format = version < 4 ? Whole : version == 4 ? Stream : Chunked;
+		whole = magic;
 	}
 
-	// read the file header 
+	switch (format)
+	{
+	case Shifted:
+		out += LegacyShift(std::string(data, size), key, -1);
+		return true;
+	case Whole:
+		whole.append(data, size);
+		return true;
+	case Chunked:
+		whole.append(data, size);
+		return DecryptChunks(out);
+	default:
+		break;
+	}
 
-	BMFH bmfh;
-	bool NotCorrupted = true;
-
-	NotCorrupted &= SafeFread((char*) &(bmfh.bfType), sizeof(NDI_WORD), 1, fp);
-
-	bool IsBitmap = false;
-
-	if (IsBigEndian() && bmfh.bfType == 16973)
+	// undo the stuffing, a block that isn't 254 bytes long stood for a zero after it,
+	// unless it was the last one, so that zero is only added once the next block starts
+	std::vector<NDI_BYTE> plain;
+	plain.reserve(size);
+	for (size_t i = 0; i < size; i++)
 	{
-		IsBitmap = true;
-	}
-	if (!IsBigEndian() && bmfh.bfType == 19778)
-	{
-		IsBitmap = true;
+		NDI_BYTE c = static_cast<NDI_BYTE>(data[i]);
+		if (remaining == 0)
+		{
+			if (c == 0)
+			{
+				failed = true;
+				return false;
+			}
+			if (code != 0 && code != 0xFF)
+			{
+				plain.push_back(0);
+			}
+			code = c;
+			remaining = c - 1;
+		}
+		else
+		{
+			plain.push_back(c);
+			remaining--;
+		}
 	}
+	return Consume(plain, out);
+}
 
-	if (!IsBitmap)
+bool Entropy::Decryptor::Finish(std::string& out)
+{
+	switch (format)
 	{
-		if (NexusWarnings)
+	case Unknown:
+		out += LegacyShift(magic, key, -1);
+		return true;
+	case Shifted:
+		return true;
+	case Whole:
+		return Open(out);
+	case Chunked:
+	{
+		if (!failed && chunk == 0 && DetectCipher(whole) == Legacy)
 		{
-			cout << "Nexus Error: " << FileName
-				<< " is not a Windows BMP file!" << endl;
+			return Unshift(out);
 		}
-		fclose(fp);
-		return false;
+		if (failed || table.Count() == 0 || chunk < table.Count())
+		{
+			return false;
+		}
+		// nothing may follow the last chunk, and the text has to be the one its digest was taken of
+		size_t first, count;
+		table.Characters(chunk - 1, first, count);
+		if (wholeStart + whole.length() != first + count)
+		{
+			return false;
+		}
+		NDI_BYTE actual[Nexus_Crypto::DigestSize];
+		hasher.Finish(actual);
+		if (table.HasDigest() && !Nexus_Crypto::Equal(actual, digest, Nexus_Crypto::DigestSize))
+		{
+			return false;
+		}
+		// compressed text was held back, it is only known once all of it is there
+		return Decompress(compressed, table.Compressed(), out);
 	}
-
-	NotCorrupted &= SafeFread((char*) &(bmfh.bfSize), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmfh.bfReserved1), sizeof(NDI_WORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmfh.bfReserved2), sizeof(NDI_WORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmfh.bfOffBits), sizeof(NDI_DWORD), 1, fp);
-
-	if (IsBigEndian())
-	{
-		bmfh.SwitchEndianess();
+	default:
+		break;
 	}
 
-	// read the info header
-
-	BMIH bmih;
-
-	NotCorrupted &= SafeFread((char*) &(bmih.biSize), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biWidth), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biHeight), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biPlanes), sizeof(NDI_WORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biBitCount), sizeof(NDI_WORD), 1, fp);
-
-	NotCorrupted &= SafeFread((char*) &(bmih.biCompression), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biSizeImage), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biXPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biYPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biClrUsed), sizeof(NDI_DWORD), 1, fp);
-	NotCorrupted &= SafeFread((char*) &(bmih.biClrImportant), sizeof(NDI_DWORD), 1, fp);
-
-	if (IsBigEndian())
+	// the held back bytes are the tag
+	NDI_BYTE tag[Nexus_Crypto::TagSize];
+	if (failed || remaining != 0 || !aead || held.size() != Nexus_Crypto::TagSize)
 	{
-		bmih.SwitchEndianess();
+		return false;
 	}
+	aead->Finish(tag);
+	return Nexus_Crypto::Equal(tag, &held[0], Nexus_Crypto::TagSize);
+}
 
-	// a safety catch: if any of the header information didn't read properly, abort
-	// future idea: check to see if at least most is self-consistent
+bool Entropy::Decryptor::Consume(const std::vector<NDI_BYTE>& plain, std::string& out)
+{
+	held.insert(held.end(), plain.begin(), plain.end());
 
-	if (!NotCorrupted)
+	// the header is checked as soon as it is there, the nonce after it starts the decryption
+	if (!aead)
 	{
-		if (NexusWarnings)
+		if (held.empty())
 		{
-			cout << "Nexus Error: " << FileName
-				<< " is obviously corrupted." << endl;
+			return true;
 		}
-		SetSize(1, 1);
-		SetBitDepth(1);
-		fclose(fp);
-		return false;
-	}
-
-	XPelsPerMeter = bmih.biXPelsPerMeter;
-	YPelsPerMeter = bmih.biYPelsPerMeter;
-
-	// if bmih.biCompression 1 or 2, then the file is RLE compressed
-
-	if (bmih.biCompression == 1 || bmih.biCompression == 2)
-	{
-		if (NexusWarnings)
+		const char version = magic[EntropyMagicSize - 1];
+		const size_t headerSize = EntropyHeaderSize(version, held[0]);
+		if (aad.empty() && held.size() >= headerSize && OpenHeader(version, held, key, aad, derivedKey) != KeyCorrect)
 		{
-			cout << "Nexus Error: " << FileName << " is (RLE) compressed." << endl
-				<< "              Nexus does not support compression." << endl;
+			failed = true;
+			return false;
 		}
-		SetSize(1, 1);
-		SetBitDepth(1);
-		fclose(fp);
-		return false;
-	}
-
-	// if bmih.biCompression > 3, then something strange is going on 
-	// it's probably an OS2 bitmap file.
-
-	if (bmih.biCompression > 3)
-	{
-		if (NexusWarnings)
+		if (held.size() < headerSize + Nexus_Crypto::NonceSize)
 		{
-			cout << "Nexus Error: " << FileName << " is in an unsupported format."
-				<< endl
-				<< "              (bmih.biCompression = "
-				<< bmih.biCompression << ")" << endl
-				<< "              The file is probably an old OS2 bitmap or corrupted."
-				<< endl;
+			return true;
 		}
-		SetSize(1, 1);
-		SetBitDepth(1);
-		fclose(fp);
-		return false;
+		aead.reset(new Nexus_Crypto::AEAD(derivedKey, &held[headerSize], &aad[0], aad.size()));
+		held.erase(held.begin(), held.begin() + headerSize + Nexus_Crypto::NonceSize);
+		memset(derivedKey, 0, sizeof(derivedKey));
 	}
 
-	if (bmih.biCompression == 3 && bmih.biBitCount != 16)
+	// everything but the last bytes, which may be the tag, can be decrypted
+	if (held.size() > Nexus_Crypto::TagSize)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Error: " << FileName
-				<< " uses bit fields and is not a" << endl
-				<< "              16-bit file. This is not supported." << endl;
-		}
-		SetSize(1, 1);
-		SetBitDepth(1);
-		fclose(fp);
-		return false;
+		size_t n = held.size() - Nexus_Crypto::TagSize;
+		aead->Decrypt(&held[0], n);
+		out.append(reinterpret_cast<const char*>(&held[0]), n);
+		held.erase(held.begin(), held.begin() + n);
 	}
+	return true;
+}
 
-	// set the bit depth
-
-	int TempBitDepth = (int)bmih.biBitCount;
-	if (TempBitDepth != 1 && TempBitDepth != 4
-		&& TempBitDepth != 8 && TempBitDepth != 16
-		&& TempBitDepth != 24 && TempBitDepth != 32)
+bool Entropy::Decryptor::Open(std::string& out)
+{
+	// versions 1 to 3 have the tag first, so their text is only decrypted once all of it is there
+	const char version = whole[EntropyMagicSize - 1];
+	std::vector<NDI_BYTE> sealed, aad;
+	NDI_BYTE derivedKey[Nexus_Crypto::KeySize];
+	if (!UnstuffZeros(whole.data() + EntropyMagicSize, whole.length() - EntropyMagicSize, sealed)
+		|| OpenHeader(version, sealed, key, aad, derivedKey) != KeyCorrect)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Error: " << FileName << " has unrecognized bit depth." << endl;
-		}
-		SetSize(1, 1);
-		SetBitDepth(1);
-		fclose(fp);
 		return false;
 	}
-	SetBitDepth((int)bmih.biBitCount);
-
-	// set the size
 
-	if ((int)bmih.biWidth <= 0 || (int)bmih.biHeight <= 0)
+	const size_t headerSize = EntropyHeaderSize(version, 0);
+	const size_t textStart = headerSize + Nexus_Crypto::NonceSize + Nexus_Crypto::TagSize;
+	if (sealed.size() < textStart)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Error: " << FileName
-				<< " has a non-positive width or height." << endl;
-		}
-		SetSize(1, 1);
-		SetBitDepth(1);
-		fclose(fp);
 		return false;
 	}
-	SetSize((int)bmih.biWidth, (int)bmih.biHeight);
-
-	// some preliminaries
-
-	double dBytesPerPixel = ((double)BitDepth) / 8.0;
-	double dBytesPerRow = dBytesPerPixel * (Width + 0.0);
-	dBytesPerRow = ceil(dBytesPerRow);
-
-	int BytePaddingPerRow = 4 - ((int)(dBytesPerRow)) % 4;
-	if (BytePaddingPerRow == 4)
+	const NDI_BYTE* nonce = &sealed[headerSize];
+	if (!Nexus_Crypto::AEADDecrypt(&sealed[0] + textStart, sealed.size() - textStart, &aad[0], aad.size(),
+		derivedKey, nonce, nonce + Nexus_Crypto::NonceSize))
 	{
-		BytePaddingPerRow = 0;
+		return false;
 	}
 
-	// if < 16 bits, read the palette
+	out.append(reinterpret_cast<const char*>(&sealed[0]) + textStart, sealed.size() - textStart);
+	return true;
+}
 
-	if (BitDepth < 16)
+bool Entropy::Decryptor::DecryptChunks(std::string& out)
+{
+	// the header is checked as soon as it is there, then each chunk is decrypted once all of its characters are
+	if (table.Count() == 0)
 	{
-		// determine the number of colors specified in the 
-		// color table
-
-		int NumberOfColorsToRead = ((int)bmfh.bfOffBits - 54) / 4;
-		if (NumberOfColorsToRead > IntPow(2, BitDepth))
+		if (whole.length() < HeaderLength)
 		{
-			NumberOfColorsToRead = IntPow(2, BitDepth);
+			return true;
 		}
-
-		if (NumberOfColorsToRead < GetNumberOfColors())
+		if (table.Open(whole.substr(0, HeaderLength), key) != KeyCorrect)
 		{
-			if (NexusWarnings)
+			if (DetectCipher(whole) == Legacy)
 			{
-				cout << "Nexus Warning: file " << FileName << " has an underspecified" << endl
-					<< "               color table. The table will be padded with extra" << endl
-					<< "               white (255,255,255,0) entries." << endl;
+				return Unshift(out);
 			}
+			failed = true;
+			return false;
 		}
+	}
 
-		int n;
-		for (n = 0; n < NumberOfColorsToRead; n++)
+	size_t first, count;
+	while (chunk < table.Count())
+	{
+		table.Characters(chunk, first, count);
+		if (wholeStart + whole.length() < first + count)
 		{
-			SafeFread((char*) &(Colors[n]), 4, 1, fp);
+			break;
 		}
-		for (n = NumberOfColorsToRead; n < GetNumberOfColors(); n++)
+		std::string& text = table.Compressed() == Uncompressed ? out : compressed;
+		const size_t start = text.length();
+		if (!table.Decrypt(chunk, whole.data() + (first - wholeStart), text, digest))
 		{
-			Pixel WHITE;
-			WHITE.Red = 255;
-			WHITE.Green = 255;
-			WHITE.Blue = 255;
-			WHITE.Alpha = 0;
-			SetColor(n, WHITE);
+			if (chunk == 0 && DetectCipher(whole) == Legacy)
+			{
+				return Unshift(out);
+			}
+			failed = true;
+			return false;
+		}
+		hasher.Update(reinterpret_cast<const NDI_BYTE*>(text.data()) + start, text.length() - start);
+
+		// the next chunk may start in the last group of this one
+		if (++chunk < table.Count())
+		{
+			table.Characters(chunk, first, count);
+			whole.erase(0, first - wholeStart);
+			wholeStart = first;
 		}
+	}
+	return true;
+}
+
+bool Entropy::Decryptor::Unshift(std::string& out)
+{
+	// Legacy data, or a key that doesn't open data without magic, which can't be told apart
+	format = Shifted;
+	out += LegacyShift(whole, key, -1);
+	whole.clear();
+	return true;
+}
 
+/* These functions are defined in Nexus_Injector.h */
 
+// the byte of pixel that holds element of its elements (Nexus::CarrierElements): red, green, blue and alpha,
+// or the gray of a grayscale image, which is red, and alpha
+static inline NDI_BYTE& CarrierElement(Pixel* pixel, int elements, int element)
+{
+	switch (elements < 3 && element == 1 ? 3 : element)
+	{
+	case 0: return pixel->Red;
+	case 1: return pixel->Green;
+	case 2: return pixel->Blue;
+	default: return pixel->Alpha;
 	}
+}
 
-	// skip blank data if bfOffBits so indicates
+// the bit that element of pixel hides, in its color if the image is indexed
+static inline int CarrierBit(const Nexus_PaletteOrder& palette, Pixel* pixel, int elements, int element)
+{
+	return palette.Empty() ? CarrierElement(pixel, elements, element) % 2 : palette.Bit(*pixel);
+}
 
-	int BytesToSkip = bmfh.bfOffBits - 54;;
-	if (BitDepth < 16)
+static inline void SetCarrierBit(const Nexus_PaletteOrder& palette, Pixel* pixel, int elements, int element, int bit)
+{
+	if (!palette.Empty())
 	{
-		BytesToSkip -= 4 * IntPow(2, BitDepth);
+		palette.SetBit(*pixel, bit);
+		return;
 	}
-	if (BitDepth == 16 && bmih.biCompression == 3)
+	NDI_BYTE& value = CarrierElement(pixel, elements, element);
+	value += bit - value % 2;
+	if (elements < 3)
 	{
-		BytesToSkip -= 3 * 4;
+		pixel->Green = pixel->Blue = pixel->Red;
 	}
-	if (BytesToSkip < 0)
+}
+
+Nexus_PaletteOrder::Nexus_PaletteOrder(BMP& bmp)
+{
+	if (bmp.GetBitDepth() > 8)
 	{
-		BytesToSkip = 0;
+		return;
 	}
-	if (BytesToSkip > 0 && BitDepth != 16)
+
+	// the colors by their luminance, then by their value, each of them once
+	std::vector<std::pair<int, NDI_DWORD> > colors;
+	for (int n = 0; n < bmp.GetNumberOfColors(); n++)
 	{
-		if (NexusWarnings)
+		Pixel color = bmp.GetColor(n);
+		colors.push_back(std::make_pair(299 * color.Red + 587 * color.Green + 114 * color.Blue,
+			((NDI_DWORD)color.Red << 16) | ((NDI_DWORD)color.Green << 8) | color.Blue));
+	}
+	std::sort(colors.begin(), colors.end());
+	colors.erase(std::unique(colors.begin(), colors.end()), colors.end());
+
+	// the nearer of the colors before and after a place, by their distance in red, green and blue
+	std::vector<Pixel> sorted(colors.size());
+	for (size_t i = 0; i < colors.size(); i++)
+	{
+		places[colors[i].second] = i;
+		sorted[i].Red = (NDI_BYTE)(colors[i].second >> 16);
+		sorted[i].Green = (NDI_BYTE)(colors[i].second >> 8);
+		sorted[i].Blue = (NDI_BYTE)colors[i].second;
+		sorted[i].Alpha = 0;
+	}
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		const size_t neighbours[2] = { i - 1, i + 1 };
+		size_t nearest = i;
+		int nearestDistance = -1;
+		for (int k = 0; k < 2; k++)
 		{
-			cout << "Nexus Warning: Extra meta data detected in file " << FileName << endl
-				<< "               Data will be skipped." << endl;
+			const size_t next = neighbours[k];
+			if (next >= sorted.size())
+			{
+				continue;
+			}
+			int distance = IntSquare((int)sorted[next].Red - (int)sorted[i].Red)
+				+ IntSquare((int)sorted[next].Green - (int)sorted[i].Green)
+				+ IntSquare((int)sorted[next].Blue - (int)sorted[i].Blue);
+			if (nearestDistance < 0 || distance < nearestDistance)
+			{
+				nearest = next;
+				nearestDistance = distance;
+			}
 		}
-		NDI_BYTE* TempSkipBYTE;
-		TempSkipBYTE = new NDI_BYTE[BytesToSkip];
-		SafeFread((char*)TempSkipBYTE, BytesToSkip, 1, fp);
-		delete[] TempSkipBYTE;
+		swaps.push_back(sorted[nearest]);
 	}
+}
 
-	// This code reads 1, 4, 8, 24, and 32-bpp files 
-	// with a more-efficient buffered technique.
+bool Nexus_PaletteOrder::Empty() const
+{
+	return swaps.empty();
+}
 
-	int i, j;
-	if (BitDepth != 16)
+int Nexus_PaletteOrder::Bit(const Pixel& pixel) const
+{
+	std::unordered_map<NDI_DWORD, size_t>::const_iterator place
+		= places.find(((NDI_DWORD)pixel.Red << 16) | ((NDI_DWORD)pixel.Green << 8) | pixel.Blue);
+	return place != places.end() ? (int)(place->second % 2) : 0;
+}
+
+void Nexus_PaletteOrder::SetBit(Pixel& pixel, int bit) const
+{
+	std::unordered_map<NDI_DWORD, size_t>::const_iterator place
+		= places.find(((NDI_DWORD)pixel.Red << 16) | ((NDI_DWORD)pixel.Green << 8) | pixel.Blue);
+	if (place != places.end() && (int)(place->second % 2) != bit)
 	{
-		int BufferSize = (int)((Width*BitDepth) / 8.0);
-		while (8 * BufferSize < Width*BitDepth)
-		{
-			BufferSize++;
-		}
-		while (BufferSize % 4)
-		{
-			BufferSize++;
-		}
-		NDI_BYTE* Buffer;
-		Buffer = new NDI_BYTE[BufferSize];
-		j = Height - 1;
-		while (j > -1)
+		pixel.Red = swaps[place->second].Red;
+		pixel.Green = swaps[place->second].Green;
+		pixel.Blue = swaps[place->second].Blue;
+	}
+}
+
+Nexus_TextWriter::Nexus_TextWriter(BMP& bmp, int firstRow)
+	: bmp(bmp), width(bmp.GetWidth()), height(bmp.GetHeight()), firstRow(firstRow), elements(Nexus::CarrierElements(bmp)),
+	x(0), y(0), element(0), palette(bmp)
+{
+}
+
+bool Nexus_TextWriter::Seek(size_t index)
+{
+	// a character takes 8 elements, 1 to 4 to a pixel
+	unsigned long long bit = 8ULL * index;
+	unsigned long long rowStart = (unsigned long long)elements * firstRow * width;
+	if (bit < rowStart || width <= 0 || (bit - rowStart) / elements / width >= (unsigned long long)height)
+	{
+		return false;
+	}
+	bit -= rowStart;
+	element = (int)(bit % elements);
+	x = (int)(bit / elements % width);
+	y = (int)(bit / elements / width);
+	return true;
+}
+
+bool Nexus_TextWriter::Write(const char* text, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		// the rightmost bit of the character goes first
+		int charValue = static_cast<unsigned char>(text[i]);
+		for (int n = 0; n < 8; n++, charValue /= 2)
 		{
-			int BytesRead = (int)fread((char*)Buffer, 1, BufferSize, fp);
-			if (BytesRead < BufferSize)
-			{
-				j = -1;
-				if (NexusWarnings)
-				{
-					cout << "Nexus Error: Could not read proper amount of data." << endl;
-				}
-			}
-			else
+			if (!WriteBit(charValue % 2))
 			{
-				bool Success = false;
-				if (BitDepth == 1)
-				{
-					Success = Read1bitRow(Buffer, BufferSize, j);
-				}
-				if (BitDepth == 4)
-				{
-					Success = Read4bitRow(Buffer, BufferSize, j);
-				}
-				if (BitDepth == 8)
-				{
-					Success = Read8bitRow(Buffer, BufferSize, j);
-				}
-				if (BitDepth == 24)
-				{
-					Success = Read24bitRow(Buffer, BufferSize, j);
-				}
-				if (BitDepth == 32)
-				{
-					Success = Read32bitRow(Buffer, BufferSize, j);
-				}
-				if (!Success)
-				{
-					if (NexusWarnings)
-					{
-						cout << "Nexus Error: Could not read enough pixel data!" << endl;
-					}
-					j = -1;
-				}
+				return false;
 			}
-			j--;
 		}
-		delete[] Buffer;
 	}
+	return true;
+}
 
-	if (BitDepth == 16)
+void Nexus_TextWriter::Finish()
+{
+	// the stop character is 8 zeros, the pixel they end in keeps the cleared bits of the rest of its elements
+	for (int n = 0; n < 8 && WriteBit(0); n++)
 	{
-		int DataBytes = Width * 2;
-		int PaddingBytes = (4 - DataBytes % 4) % 4;
-
-		// set the default mask
+	}
+}
 
-		NDI_WORD BlueMask = 31; // bits 12-16
-		NDI_WORD GreenMask = 992; // bits 7-11
-		NDI_WORD RedMask = 31744; // bits 2-6
+bool Nexus_TextWriter::WriteBit(int bit)
+{
+	if (y >= height)
+	{
+		return false;
+	}
 
-		// read the bit fields, if necessary, to 
-		// override the default 5-5-5 mask
+	// the least significant bits of a pixel are cleared when the first of them is written
+	Pixel* pixel = bmp(x, y);
+	if (element == 0 && palette.Empty())
+	{
+		for (int e = 0; e < elements; e++)
+		{
+			CarrierElement(pixel, elements, e) -= CarrierElement(pixel, elements, e) % 2;
+		}
+	}
+	// after a Seek into the middle of a pixel, the bits before it are kept
+	SetCarrierBit(palette, pixel, elements, element, bit);
 
-		if (bmih.biCompression != 0)
+	// move to the next pixel once each of its elements holds a bit
+	if (++element == elements)
+	{
+		element = 0;
+		if (++x == width)
 		{
-			// read the three bit masks
+			x = 0;
+			y++;
+		}
+	}
+	return true;
+}
 
-			NDI_WORD TempMaskWORD;
+Nexus_TextReader::Nexus_TextReader(BMP& bmp, int firstRow)
+	: bmp(bmp), width(bmp.GetWidth()), height(bmp.GetHeight()), firstRow(firstRow), elements(Nexus::CarrierElements(bmp)),
+	x(0), y(0), element(0), ended(false), palette(bmp)
+{
+}
 
-			SafeFread((char*)&RedMask, 2, 1, fp);
-			if (IsBigEndian())
-			{
-				RedMask = FlipWORD(RedMask);
-			}
-			SafeFread((char*)&TempMaskWORD, 2, 1, fp);
+bool Nexus_TextReader::Seek(size_t index)
+{
+	// a character takes 8 elements, 1 to 4 to a pixel
+	unsigned long long bit = 8ULL * index;
+	unsigned long long rowStart = (unsigned long long)elements * firstRow * width;
+	if (bit < rowStart || width <= 0 || (bit - rowStart) / elements / width >= (unsigned long long)height)
+	{
+		return false;
+	}
+	bit -= rowStart;
+	element = (int)(bit % elements);
+	x = (int)(bit / elements % width);
+	y = (int)(bit / elements / width);
+	ended = false;
+	return true;
+}
 
-			SafeFread((char*)&GreenMask, 2, 1, fp);
-			if (IsBigEndian())
+size_t Nexus_TextReader::Read(char* text, size_t size)
+{
+	size_t count = 0;
+	while (count < size && !ended)
+	{
+		// gather 8 bits, the rightmost one first; a character cut off by the end of the image is dropped
+		int charValue = 0;
+		for (int n = 0; n < 8; n++)
+		{
+			if (y >= height)
 			{
-				GreenMask = FlipWORD(GreenMask);
+				ended = true;
+				return count;
 			}
-			SafeFread((char*)&TempMaskWORD, 2, 1, fp);
-
-			SafeFread((char*)&BlueMask, 2, 1, fp);
-			if (IsBigEndian())
+			charValue |= CarrierBit(palette, bmp(x, y), elements, element) << n;
+			if (++element == elements)
 			{
-				BlueMask = FlipWORD(BlueMask);
+				element = 0;
+				if (++x == width)
+				{
+					x = 0;
+					y++;
+				}
 			}
-			SafeFread((char*)&TempMaskWORD, 2, 1, fp);
 		}
 
-		// read and skip any meta data
-
-		if (BytesToSkip > 0)
+		// can only be 0 if it is the stop character (the 8 zeros)
+		if (charValue == 0)
 		{
-			if (NexusWarnings)
-			{
-				cout << "Nexus Warning: Extra meta data detected in file "
-					<< FileName << endl
-					<< "               Data will be skipped." << endl;
-			}
-			NDI_BYTE* TempSkipBYTE;
-			TempSkipBYTE = new NDI_BYTE[BytesToSkip];
-			SafeFread((char*)TempSkipBYTE, BytesToSkip, 1, fp);
-			delete[] TempSkipBYTE;
+			ended = true;
+			return count;
 		}
+		text[count++] = static_cast<char>(charValue);
+	}
+	return count;
+}
 
-		// determine the red, green and blue shifts
+BMP Nexus::BMPEmbedText(std::string text, BMP bmp)
+{
+	Nexus_TextWriter writer(bmp);
+	if (writer.Write(text.data(), text.length()))
+	{
+		writer.Finish();
+	}
+	return bmp;
+}
 
-		int GreenShift = 0;
-		NDI_WORD TempShiftWORD = GreenMask;
-		while (TempShiftWORD > 31)
+std::string Nexus::BMPExtractText(BMP bmp, size_t maxLength)
+{
+	std::string extractedText;
+	Nexus_TextReader reader(bmp);
+	char buffer[4096];
+	while (extractedText.length() < maxLength)
+	{
+		size_t wanted = maxLength - extractedText.length() < sizeof(buffer) ? maxLength - extractedText.length() : sizeof(buffer);
+		size_t count = reader.Read(buffer, wanted);
+		extractedText.append(buffer, count);
+		if (count < wanted)
 		{
-			TempShiftWORD = TempShiftWORD >> 1; GreenShift++;
+			break;
 		}
-		int BlueShift = 0;
-		TempShiftWORD = BlueMask;
-		while (TempShiftWORD > 31)
+	}
+	return extractedText;
+}
+
+void Nexus::BMPEmbedStream(std::istream& data, size_t dataLength, const std::string& key, bool keyCheck, BMP& bmp,
+	Entropy::Compression compression, bool patchable)
+{
+	// a piece of the data is read, encrypted and hidden before the next one is read
+	Nexus_TextWriter writer(bmp);
+	char buffer[65536];
+	std::string hidden;
+	std::unique_ptr<Entropy::Encryptor> encryptor;
+	if (!key.empty())
+	{
+		encryptor.reset(new Entropy::Encryptor(key, dataLength, keyCheck, compression, patchable));
+	}
+
+	bool room = true;
+	while (room && (data.read(buffer, sizeof(buffer)) || data.gcount() > 0))
+	{
+		if (encryptor)
 		{
-			TempShiftWORD = TempShiftWORD >> 1; BlueShift++;
+			hidden.clear();
+			encryptor->Update(buffer, (size_t)data.gcount(), hidden);
+			room = writer.Write(hidden.data(), hidden.length());
 		}
-		int RedShift = 0;
-		TempShiftWORD = RedMask;
-		while (TempShiftWORD > 31)
+		else
 		{
-			TempShiftWORD = TempShiftWORD >> 1; RedShift++;
+			room = writer.Write(buffer, (size_t)data.gcount());
 		}
+	}
+	if (room && encryptor)
+	{
+		hidden.clear();
+		encryptor->Finish(hidden);
+		room = writer.Write(hidden.data(), hidden.length());
+	}
+	if (room)
+	{
+		writer.Finish();
+	}
+}
 
-		// read the actual pixels
+// runs task(i) for every i in [0, count), spread over one thread per core: the calling one and those of the pool
+// nexuspng shares, which hands out i in order, so a task can wait for one before it that another thread took
+static void ParallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+	nexuspng::parallel_for(count, 0, [](void* context, size_t i)
+	{
+		(*(const std::function<void(size_t)>*)context)(i);
+	}, (void*)&task);
+}
 
-		for (j = Height - 1; j >= 0; j--)
+// where scattered data goes: order is the tile at each place of the order, tiles counted across then down,
+// and start the first character of the text in each place, then the characters of the whole image; a tile
+// holds as many characters as the bits of its elements (Nexus::CarrierElements) fill, so that no character
+// is split between tiles
+struct ScatterTiles
+{
+	int width, height, across, elements;
+	std::vector<size_t> order;
+	std::vector<size_t> start;
+	std::unique_ptr<Nexus_PaletteOrder> palette;
+};
+
+// the corner and size of tile index
+static void ScatterTile(const ScatterTiles& tiles, size_t index, int& x, int& y, int& width, int& height)
+{
+	x = (int)(index % tiles.across) * Nexus::ScatterTileSide;
+	y = (int)(index / tiles.across) * Nexus::ScatterTileSide;
+	width = tiles.width - x < Nexus::ScatterTileSide ? tiles.width - x : Nexus::ScatterTileSide;
+	height = tiles.height - y < Nexus::ScatterTileSide ? tiles.height - y : Nexus::ScatterTileSide;
+}
+
+static void ScatterTilesOf(BMP& bmp, const NDI_BYTE* scatterKey, ScatterTiles& tiles)
+{
+	tiles.width = bmp.GetWidth();
+	tiles.height = bmp.GetHeight();
+	tiles.across = (tiles.width + Nexus::ScatterTileSide - 1) / Nexus::ScatterTileSide;
+	tiles.elements = Nexus::CarrierElements(bmp);
+	tiles.palette.reset(new Nexus_PaletteOrder(bmp));
+	const size_t count = (size_t)tiles.across * ((tiles.height + Nexus::ScatterTileSide - 1) / Nexus::ScatterTileSide);
+	Nexus_Crypto::Permutation order(scatterKey, 0, count);
+	tiles.order.resize(count);
+	tiles.start.assign(1, 0);
+	for (size_t i = 0; i < count; i++)
+	{
+		int x, y, width, height;
+		tiles.order[i] = (size_t)order(i);
+		ScatterTile(tiles, tiles.order[i], x, y, width, height);
+		tiles.start.push_back(tiles.start.back() + (size_t)tiles.elements * width * height / 8);
+	}
+}
+
+// calls visit(character, bit, pixel, element) for the bits of characters first to end of the text, with the pixel
+// and element that hold that bit of that character; each tile they are in goes through them on a core of its own
+template <typename Visit>
+static void VisitScattered(BMP& bmp, const ScatterTiles& tiles, const NDI_BYTE* scatterKey, size_t first, size_t end,
+	const Visit& visit)
+{
+	// the places of the order the characters are in, found by their first characters
+	const size_t firstPlace = std::upper_bound(tiles.start.begin(), tiles.start.end(), first) - tiles.start.begin() - 1;
+	const size_t endPlace = std::lower_bound(tiles.start.begin(), tiles.start.end(), end) - tiles.start.begin();
+	ParallelFor(endPlace > firstPlace ? endPlace - firstPlace : 0, [&](size_t i)
+	{
+		const size_t place = firstPlace + i;
+		int x, y, width, height;
+		ScatterTile(tiles, tiles.order[place], x, y, width, height);
+		Nexus_Crypto::Permutation bits(scatterKey, 1 + tiles.order[place], (unsigned long long)tiles.elements * width * height);
+		const size_t from = tiles.start[place] > first ? tiles.start[place] : first;
+		const size_t to = tiles.start[place + 1] < end ? tiles.start[place + 1] : end;
+		for (size_t c = from; c < to; c++)
 		{
-			i = 0;
-			int ReadNumber = 0;
-			while (ReadNumber < DataBytes)
+			for (int n = 0; n < 8; n++)
 			{
-				NDI_WORD TempWORD;
-				SafeFread((char*)&TempWORD, 2, 1, fp);
-				if (IsBigEndian())
-				{
-					TempWORD = FlipWORD(TempWORD);
-				}
-				ReadNumber += 2;
+				// the pixels of a tile are counted down its columns, the way a BMP holds them
+				unsigned long long slot = bits(8ULL * (c - tiles.start[place]) + n);
+				int pixel = (int)(slot / tiles.elements);
+				int element = (int)(slot % tiles.elements);
+				visit(c, n, bmp(x + pixel / height, y + pixel % height), element);
+			}
+		}
+	});
+}
 
-				NDI_WORD Red = RedMask & TempWORD;
-				NDI_WORD Green = GreenMask & TempWORD;
-				NDI_WORD Blue = BlueMask & TempWORD;
+// reads characters first to first + count of scattered text into text; false if the image doesn't hold them
+static bool ReadScattered(BMP& bmp, const ScatterTiles& tiles, const NDI_BYTE* scatterKey, size_t first, size_t count,
+	std::string& text)
+{
+	if (first + count > tiles.start.back())
+	{
+		return false;
+	}
+	text.assign(count, '\0');
+	VisitScattered(bmp, tiles, scatterKey, first, first + count, [&](size_t c, int n, Pixel* pixel, int element)
+	{
+		text[c - first] |= (char)(CarrierBit(*tiles.palette, pixel, tiles.elements, element) << n);
+	});
+	return true;
+}
 
-				NDI_BYTE BlueBYTE = (NDI_BYTE)8 * (Blue >> BlueShift);
-				NDI_BYTE GreenBYTE = (NDI_BYTE)8 * (Green >> GreenShift);
-				NDI_BYTE RedBYTE = (NDI_BYTE)8 * (Red >> RedShift);
+// the encrypted text hidden scattered with key, its header tells how many characters the rest of it is;
+// false if there is none, or its first chunk doesn't decrypt, as a header without magic opens with any key
+static bool ExtractScattered(BMP& bmp, const std::string& key, std::string& text)
+{
+	NDI_BYTE scatterKey[Nexus_Crypto::KeySize];
+	Entropy::ScatterKey(key, scatterKey);
+	ScatterTiles tiles;
+	ScatterTilesOf(bmp, scatterKey, tiles);
+	std::string header, characters, chunk;
+	size_t first, count;
+	Entropy::ChunkTable table;
+	bool found = ReadScattered(bmp, tiles, scatterKey, 0, Entropy::HeaderLength, header)
+		&& table.Open(header, key) == Entropy::KeyCorrect;
+	if (found)
+	{
+		table.Characters(0, first, count);
+		found = ReadScattered(bmp, tiles, scatterKey, first, count, characters) && table.Decrypt(0, characters.data(), chunk)
+			&& ReadScattered(bmp, tiles, scatterKey, 0, table.Length(), text);
+	}
+	memset(scatterKey, 0, sizeof(scatterKey));
+	return found;
+}
 
-				(Pixels[i][j]).Red = RedBYTE;
-				(Pixels[i][j]).Green = GreenBYTE;
-				(Pixels[i][j]).Blue = BlueBYTE;
+// whether the first chunk of the data table was opened from decrypts; a header without magic opens
+// with any key, so only a chunk shows the key is right
+static bool FirstChunkOpens(BMP& bmp, const Entropy::ChunkTable& table)
+{
+	size_t first, count;
+	table.Characters(0, first, count);
+	std::string characters(count, '\0'), text;
+	Nexus_TextReader reader(bmp);
+	return reader.Seek(first) && reader.Read(&characters[0], count) == count && table.Decrypt(0, characters.data(), text);
+}
 
-				i++;
+// decrypts chunks first to last of the data hidden in rows, the rows of an image from firstRow on,
+// each thread reading the characters of its own chunks; the text goes to output in order, a batch at a time.
+// When that is the whole text it is checked against its digest: each thread also hashes its chunks into
+// BLAKE3 subtrees, which are then joined in order, so the digest costs no pass of its own
+static bool DecryptChunks(BMP& rows, int firstRow, const Entropy::ChunkTable& table, size_t first, size_t last,
+	std::ostream& output)
+{
+	const size_t chunkSize = table.ChunkOffset(1);
+	const size_t chunkCount = chunkSize / Nexus_Crypto::BLAKE3::ChunkSize;
+	const bool verify = table.HasDigest() && first == 0 && last + 1 == table.Count();
+	// a chunk is a subtree of its own only if it holds a power of two of BLAKE3 chunks
+	const bool subtrees = chunkSize % Nexus_Crypto::BLAKE3::ChunkSize == 0 && (chunkCount & (chunkCount - 1)) == 0;
+	Nexus_Crypto::BLAKE3 hasher;
+	NDI_BYTE digest[Nexus_Crypto::DigestSize];
+
+	size_t batchSize = 4 * (size_t)(std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1);
+	std::vector<std::string> texts(batchSize);
+	std::vector<NDI_BYTE> cvs(batchSize * Nexus_Crypto::DigestSize);
+	for (size_t batch = first; batch <= last; batch += batchSize)
+	{
+		size_t n = last - batch + 1 < batchSize ? last - batch + 1 : batchSize;
+		std::atomic<bool> authentic(true);
+		ParallelFor(n, [&](size_t i)
+		{
+			size_t start, count;
+			table.Characters(batch + i, start, count);
+			std::string characters(count, '\0');
+			Nexus_TextReader reader(rows, firstRow);
+			texts[i].clear();
+			if (!reader.Seek(start) || reader.Read(&characters[0], count) != count
+				|| !table.Decrypt(batch + i, characters.data(), texts[i], digest))
+			{
+				authentic = false;
 			}
-			ReadNumber = 0;
-			while (ReadNumber < PaddingBytes)
+			else if (verify && subtrees && batch + i < last)
 			{
-				NDI_BYTE TempBYTE;
-				SafeFread((char*)&TempBYTE, 1, 1, fp);
-				ReadNumber++;
+				Nexus_Crypto::BLAKE3::Subtree(&cvs[i * Nexus_Crypto::DigestSize], reinterpret_cast<const NDI_BYTE*>(texts[i].data()),
+					chunkSize, (unsigned long long)(batch + i) * chunkCount);
 			}
+		});
+		if (!authentic)
+		{
+			return false;
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			if (verify && subtrees && batch + i < last)
+			{
+				hasher.Push(&cvs[i * Nexus_Crypto::DigestSize], chunkSize);
+			}
+			else if (verify)
+			{
+				hasher.Update(reinterpret_cast<const NDI_BYTE*>(texts[i].data()), texts[i].length());
+			}
+			output.write(texts[i].data(), texts[i].length());
 		}
-
 	}
 
-	fclose(fp);
+	if (verify)
+	{
+		NDI_BYTE actual[Nexus_Crypto::DigestSize];
+		hasher.Finish(actual);
+		return Nexus_Crypto::Equal(actual, digest, Nexus_Crypto::DigestSize);
+	}
 	return true;
 }
 
-bool BMP::CreateStandardColorTable(void)
+bool Nexus::BMPExtractStream(BMP& bmp, const std::string& key, std::ostream& output)
 {
-	using namespace std;
-	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
-	{
-		if (NexusWarnings)
+	// data split in chunks is decrypted by all cores, other data a piece at a time as it is read
+	if (!key.empty())
+	{
+		Nexus_TextReader header(bmp);
+		std::string prefix(Entropy::HeaderLength, '\0');
+		prefix.resize(header.Read(&prefix[0], prefix.length()));
+		Entropy::ChunkTable table;
+		Entropy::KeyCheck check = table.Open(prefix, key);
+		if (check == Entropy::KeyWrong)
 		{
-			cout << "Nexus Warning: Attempted to create color table at a bit" << endl
-				<< "               depth that does not require a color table." << endl
-				<< "               Ignoring request." << endl;
+			return false;
 		}
-		return false;
-	}
-
-	if (BitDepth == 1)
+		if (check == Entropy::KeyCorrect && FirstChunkOpens(bmp, table))
+		{
+			if (table.Compressed() == Entropy::Uncompressed)
+			{
+				return DecryptChunks(bmp, 0, table, 0, table.Count() - 1, output);
+			}
+			std::ostringstream compressed;
+			std::string text;
+			if (!DecryptChunks(bmp, 0, table, 0, table.Count() - 1, compressed)
+				|| !Entropy::Decompress(compressed.str(), table.Compressed(), text))
+			{
+				return false;
+			}
+			output.write(text.data(), text.length());
+			return true;
+		}
+
+		// scattered data leaves the top of the image as it was, so no data with magic starts there
+		std::string text, decrypted;
+		if (Entropy::DetectCipher(prefix) == Entropy::Legacy && ExtractScattered(bmp, key, text))
+		{
+			Entropy::Decryptor decryptor(key);
+			bool authentic = decryptor.Update(text.data(), text.length(), decrypted) && decryptor.Finish(decrypted);
+			output.write(decrypted.data(), decrypted.length());
+			return authentic;
+		}
+	}
+
+	Nexus_TextReader reader(bmp);
+	char buffer[65536];
+	std::string text;
+	std::unique_ptr<Entropy::Decryptor> decryptor;
+	if (!key.empty())
 	{
-		int i;
-		for (i = 0; i < 2; i++)
+		decryptor.reset(new Entropy::Decryptor(key));
+	}
+
+	size_t count;
+	while ((count = reader.Read(buffer, sizeof(buffer))) > 0)
+	{
+		if (!decryptor)
 		{
-			Colors[i].Red = i * 255;
-			Colors[i].Green = i * 255;
-			Colors[i].Blue = i * 255;
-			Colors[i].Alpha = 0;
+			output.write(buffer, count);
+			continue;
+		}
+		text.clear();
+		if (!decryptor->Update(buffer, count, text))
+		{
+			return false;
+		}
+		output.write(text.data(), text.length());
+	}
+
+	if (decryptor)
+	{
+		text.clear();
+		if (!decryptor->Finish(text))
+		{
+			return false;
+		}
+		output.write(text.data(), text.length());
+	}
+	return true;
+}
+
+int Nexus::CarrierElements(BMP& bmp)
+{
+	return CarrierElements(bmp.GetBitDepth() <= 8, bmp.GetBitDepth() >= 24 && bmp.IsGrayscale(),
+		bmp.GetBitDepth() == 32 && bmp.HasAlphaChannel());
+}
+
+int Nexus::CarrierElements(bool indexed, bool gray, bool alpha)
+{
+	if (indexed)
+	{
+		return 1;
+	}
+	if (gray)
+	{
+		return alpha ? 2 : 1;
+	}
+	return alpha ? 4 : 3;
+}
+
+int Nexus::BMPEmbedRows(size_t textLength, int width, int height, int elements)
+{
+	if (width <= 0)
+	{
+		return 0;
+	}
+
+	// every character and the 8 trailing zeros take 8 color elements, 3 or 4 per pixel,
+	// and the pixel where the zeros end is written as well
+	size_t pixels = (textLength + 1) * 8 / elements + 1;
+	size_t rows = (pixels + width - 1) / width;
+	return rows < (size_t)height ? (int)rows : height;
+}
+
+bool Nexus::BMPEmbedScattered(std::istream& data, size_t dataLength, const std::string& key, bool keyCheck, BMP& bmp,
+	Entropy::Compression compression)
+{
+	if (key.empty())
+	{
+		return false;
+	}
+
+	// the whole encrypted text is made first, then each tile takes its part of it
+	std::string text;
+	Entropy::Encryptor encryptor(key, dataLength, keyCheck, compression);
+	char buffer[65536];
+	while (data.read(buffer, sizeof(buffer)) || data.gcount() > 0)
+	{
+		encryptor.Update(buffer, (size_t)data.gcount(), text);
+	}
+	encryptor.Finish(text);
+
+	NDI_BYTE scatterKey[Nexus_Crypto::KeySize];
+	Entropy::ScatterKey(key, scatterKey);
+	ScatterTiles tiles;
+	ScatterTilesOf(bmp, scatterKey, tiles);
+	const bool fits = text.length() <= tiles.start.back();
+	if (fits)
+	{
+		VisitScattered(bmp, tiles, scatterKey, 0, text.length(), [&](size_t c, int n, Pixel* pixel, int element)
+		{
+			SetCarrierBit(*tiles.palette, pixel, tiles.elements, element, (text[c] >> n) & 1);
+		});
+	}
+	memset(scatterKey, 0, sizeof(scatterKey));
+	return fits;
+}
+
+// a name for a scratch file next to file that no other file has
+static std::string TempFileName(const std::string& file)
+{
+	static const char Digits[] = "0123456789abcdef";
+	std::string name;
+	FILE* fp;
+	do
+	{
+		NDI_BYTE random[8];
+		Nexus_Crypto::RandomBytes(random, sizeof(random));
+		name = file + ".";
+		for (NDI_BYTE b : random)
+		{
+			name += Digits[b >> 4];
+			name += Digits[b & 15];
+		}
+		name += ".tmp";
+		fp = fopen(name.c_str(), "rb");
+		if (fp != NULL)
+		{
+			fclose(fp);
 		}
+	} while (fp != NULL);
+	return name;
+}
+
+// moves the finished scratch file temp over file, in one step where the system can
+static bool MoveOverFile(const std::string& temp, const std::string& file)
+{
+	if (rename(temp.c_str(), file.c_str()) == 0)
+	{
 		return true;
 	}
+	// rename doesn't replace a file on Windows
+	remove(file.c_str());
+	return rename(temp.c_str(), file.c_str()) == 0;
+}
 
-	if (BitDepth == 4)
+// the volume and index of file on Windows, its device and inode elsewhere, false if there is no such file
+static bool FileIdentity(const char* file, unsigned long long& device, unsigned long long& index)
+{
+#ifdef _WIN32
+	HANDLE Handle = CreateFileA(file, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (Handle == INVALID_HANDLE_VALUE)
 	{
-		int i = 0;
-		int j, k, ell;
+		return false;
+	}
+	BY_HANDLE_FILE_INFORMATION Info;
+	bool Found = GetFileInformationByHandle(Handle, &Info) != 0;
+	CloseHandle(Handle);
+	device = Info.dwVolumeSerialNumber;
+	index = ((unsigned long long)Info.nFileIndexHigh << 32) | Info.nFileIndexLow;
+	return Found;
+#else
+	struct stat Status;
+	if (stat(file, &Status) != 0)
+	{
+		return false;
+	}
+	device = (unsigned long long)Status.st_dev;
+	index = (unsigned long long)Status.st_ino;
+	return true;
+#endif
+}
 
-		// simplify the code for the first 8 colors
-		for (ell = 0; ell < 2; ell++)
+// whether the paths a and b lead to the same file, however they are written
+static bool SameFile(const char* a, const char* b)
+{
+	unsigned long long DeviceA, IndexA, DeviceB, IndexB;
+	return FileIdentity(a, DeviceA, IndexA) && FileIdentity(b, DeviceB, IndexB) && DeviceA == DeviceB && IndexA == IndexB;
+}
+
+bool Nexus::BMPEmbedStreamInFile(std::istream& data, size_t dataLength, const std::string& key, bool keyCheck,
+	const char* coverFile, const char* outputFile, Entropy::Compression compression, bool patchable)
+{
+	// only read the rows that will hide the data, the first one tells the width
+	BMP rows;
+	if (!rows.ReadRowsFromFile(coverFile, 0, 1))
+	{
+		return false;
+	}
+	BMIH bmih = GetBMIH(coverFile);
+	size_t hiddenLength = key.empty() ? dataLength : Entropy::EncryptedLength(dataLength, patchable);
+	int embedRows = BMPEmbedRows(hiddenLength, rows.GetWidth(), (int)bmih.biHeight, CarrierElements(rows));
+	if (!rows.ReadRowsFromFile(coverFile, 0, embedRows))
+	{
+		return false;
+	}
+
+	// a cover that is the output too only has the rows that hide the data written
+	if (SameFile(coverFile, outputFile))
+	{
+		BMPEmbedStream(data, dataLength, key, keyCheck, rows, compression, patchable);
+		return rows.WriteRowsToFile(outputFile, 0);
+	}
+
+	// another output starts as a copy of the cover next to it, which only replaces the output once it is whole
+	std::string temp = TempFileName(outputFile);
+	{
+		std::ifstream cover(coverFile, std::ios::binary);
+		std::ofstream output(temp, std::ios::binary);
+		output << cover.rdbuf();
+		output.close();
+		if (!output)
+		{
+			remove(temp.c_str());
+			return false;
+		}
+	}
+
+	BMPEmbedStream(data, dataLength, key, keyCheck, rows, compression, patchable);
+	if (!rows.WriteRowsToFile(temp.c_str(), 0) || !MoveOverFile(temp, outputFile))
+	{
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::string Nexus::BMPExtractTextFromFile(const char* file, size_t maxLength)
+{
+	BMP rows;
+	if (!rows.ReadRowsFromFile(file, 0, 1))
+	{
+		return "";
+	}
+	BMIH bmih = GetBMIH(file);
+	int hideRows = BMPEmbedRows(maxLength, rows.GetWidth(), (int)bmih.biHeight, CarrierElements(rows));
+	if (!rows.ReadRowsFromFile(file, 0, hideRows))
+	{
+		return "";
+	}
+	return BMPExtractText(rows, maxLength);
+}
+
+bool Nexus::BMPExtractRangeFromFile(const char* file, const std::string& key, size_t offset, size_t length,
+	std::string& out)
+{
+	out.clear();
+	BMP rows;
+	if (!rows.ReadRowsFromFile(file, 0, 1))
+	{
+		return false;
+	}
+	const int width = rows.GetWidth();
+	const int elements = CarrierElements(rows);
+	BMIH bmih = GetBMIH(file);
+
+	// without a key the text is hidden as it is, so its characters are the ones wanted;
+	// with one, the header tells which chunks hold them
+	Entropy::ChunkTable table;
+	size_t firstChunk = 0, lastChunk = 0, start = offset, end = 0;
+	if (key.empty())
+	{
+		size_t capacity = (size_t)((unsigned long long)elements * width * bmih.biHeight / 8);
+		if (offset >= capacity)
+		{
+			return true;
+		}
+		if (length > capacity - offset)
+		{
+			length = capacity - offset;
+		}
+		end = offset + length;
+	}
+	else
+	{
+		if (table.Open(BMPExtractTextFromFile(file, Entropy::HeaderLength), key) != Entropy::KeyCorrect)
+		{
+			return false;
+		}
+		// offsets into compressed text are only known once all of it is decompressed
+		if (table.Compressed() != Entropy::Uncompressed)
+		{
+			lastChunk = table.Count() - 1;
+		}
+		else
+		{
+			if (offset > table.TextLength())
+			{
+				return false;
+			}
+			if (length > table.TextLength() - offset)
+			{
+				length = table.TextLength() - offset;
+			}
+			if (length == 0)
+			{
+				return true;
+			}
+			table.Chunks(offset, length, firstChunk, lastChunk);
+		}
+		size_t count;
+		table.Characters(firstChunk, start, count);
+		table.Characters(lastChunk, end, count);
+		end += count;
+	}
+	if (length == 0)
+	{
+		return true;
+	}
+
+	// only the rows that hide those characters are read
+	const int firstRow = (int)(8ULL * start / elements / width);
+	int lastRow = (int)((8ULL * end - 1) / elements / width);
+	if (lastRow >= (int)bmih.biHeight)
+	{
+		lastRow = (int)bmih.biHeight - 1;
+	}
+	if (firstRow > lastRow || !rows.ReadRowsFromFile(file, firstRow, lastRow - firstRow + 1))
+	{
+		return false;
+	}
+
+	if (key.empty())
+	{
+		Nexus_TextReader reader(rows, firstRow);
+		out.resize(length);
+		out.resize(reader.Seek(offset) ? reader.Read(&out[0], length) : 0);
+		return true;
+	}
+	std::ostringstream text;
+	if (!DecryptChunks(rows, firstRow, table, firstChunk, lastChunk, text))
+	{
+		return false;
+	}
+	if (table.Compressed() != Entropy::Uncompressed)
+	{
+		std::string whole;
+		if (!Entropy::Decompress(text.str(), table.Compressed(), whole))
+		{
+			return false;
+		}
+		if (offset > whole.length())
+		{
+			return false;
+		}
+		out = whole.substr(offset, length);
+		return true;
+	}
+	out = text.str().substr(offset - table.ChunkOffset(firstChunk), length);
+	return true;
+}
+
+// the width and height of a "bmp" or "png" file, and the elements of its pixels that hide bits
+// (Nexus::CarrierElements); false if it can't be read
+static bool ImageSize(const std::string& file, bool png, int& width, int& height, int& elements)
+{
+	elements = 3;
+	if (!png)
+	{
+		std::ifstream image(file.c_str(), std::ios::binary);
+		if (!image)
+		{
+			return false;
+		}
+		BMIH bmih = GetBMIH(file.c_str());
+		width = (int)bmih.biWidth;
+		height = (int)bmih.biHeight;
+		BMP row;
+		if (bmih.biBitCount <= 8)
+		{
+			elements = Nexus::CarrierElements(true, false, false);
+		}
+		else if ((bmih.biBitCount == 24 || bmih.biBitCount == 32) && row.ReadRowsFromFile(file.c_str(), 0, 1))
+		{
+			elements = Nexus::CarrierElements(row);
+		}
+		return width > 0 && height > 0;
+	}
+	std::vector<NDI_BYTE> buffer, pixels;
+	unsigned w, h;
+	bool alpha = false, gray;
+	nexuspng::State state;
+	if (nexuspng::load_file(buffer, file) != 0 || nexuspng_inspect(&w, &h, &state, buffer.empty() ? NULL : &buffer[0], buffer.size()) != 0
+		|| (nexuspng_is_alpha_type(&state.info_png.color) && Nexus_Converter::PNG2Pixels(pixels, w, h, alpha, gray, buffer, state) != 0)
+		|| (state.info_png.color.colortype == LCT_PALETTE && Nexus_Converter::PNG2Pixels(pixels, w, h, alpha, gray, buffer, state, true, 0, 1) != 0))
+	{
+		return false;
+	}
+	gray = state.info_png.color.colortype == LCT_GREY || state.info_png.color.colortype == LCT_GREY_ALPHA;
+	width = (int)w;
+	height = (int)h;
+	elements = Nexus::CarrierElements(Nexus_Converter::IndexedColors(state.info_png.color), gray, alpha);
+	return width > 0 && height > 0;
+}
+
+// hides text in output, a copy of cover; a PNG goes through a BMP in a scratch file next to output, and is
+// written as a plain PNG
+static bool EmbedTextInFile(const std::string& text, const std::string& key, bool keyCheck, bool png,
+	const std::string& cover, const std::string& output)
+{
+	std::istringstream data(text);
+	if (!png)
+	{
+		if (Nexus::BMPEmbedStreamInFile(data, text.length(), key, keyCheck, cover.c_str(), output.c_str()))
+		{
+			return true;
+		}
+		BMP image;
+		if (!image.ReadFromFile(cover.c_str()))
+		{
+			return false;
+		}
+		data.clear();
+		data.seekg(0, std::ios::beg);
+		Nexus::BMPEmbedStream(data, text.length(), key, keyCheck, image);
+		return image.WriteToFile(output.c_str());
+	}
+
+	nexuspng::State state;
+	std::string work = TempFileName(output);
+	BMP image;
+	if (nexuspng::save_file(Nexus_Converter::PNG2BMP(cover.c_str(), &state, true), work) != 0 || !image.ReadFromFile(work.c_str()))
+	{
+		remove(work.c_str());
+		return false;
+	}
+	Nexus::BMPEmbedStream(data, text.length(), key, keyCheck, image);
+	image.WriteToFile(work.c_str());
+	int dirtyRows = Nexus::BMPEmbedRows(Entropy::EncryptedLength(text.length()), image.GetWidth(), image.GetHeight(),
+		Nexus::CarrierElements(image));
+	std::vector<NDI_BYTE> encoded = Nexus_Converter::BMP2PNGPatch(work.c_str(), cover.c_str(), dirtyRows, state);
+	remove(work.c_str());
+	return !encoded.empty() && nexuspng::save_file(encoded, output) == 0;
+}
+
+// fills image with the width by height RGB pixels of a decoded PNG, RGBA with alpha; gray ones make it grayscale,
+// and those of a PNG with an indexed palette (Nexus_Converter::IndexedColors) an 8 bit image with its colors
+static bool PixelsToBMP(const std::vector<NDI_BYTE>& pixels, unsigned width, unsigned height, bool alpha, bool gray,
+	const NexusPNGColorMode& color, BMP& image)
+{
+	const unsigned channels = alpha ? 4 : 3;
+	if (pixels.size() < (size_t)width * height * channels || !image.SetSize((int)width, (int)height))
+	{
+		return false;
+	}
+	if (alpha)
+	{
+		image.SetBitDepth(32);
+	}
+	if (Nexus_Converter::IndexedColors(color))
+	{
+		image.SetBitDepth(8);
+		for (int n = 0; n < image.GetNumberOfColors(); n++)
+		{
+			const NDI_BYTE* entry = &color.palette[4 * ((size_t)n < color.palettesize ? n : 0)];
+			Pixel table;
+			table.Red = entry[0];
+			table.Green = entry[1];
+			table.Blue = entry[2];
+			table.Alpha = 0;
+			image.SetColor(n, table);
+		}
+	}
+	image.SetAlphaChannel(alpha);
+	image.SetGrayscale(gray);
+	for (unsigned y = 0; y < height; y++)
+	{
+		const NDI_BYTE* row = &pixels[(size_t)y * width * channels];
+		for (unsigned x = 0; x < width; x++)
+		{
+			Pixel* pixel = image((int)x, (int)y);
+			pixel->Red = row[channels * x];
+			pixel->Green = row[channels * x + 1];
+			pixel->Blue = row[channels * x + 2];
+			pixel->Alpha = alpha ? row[channels * x + 3] : 0;
+		}
+	}
+	return true;
+}
+
+// the text hidden in a "bmp" or "png" image, a PNG is decoded straight into a BMP
+static bool ExtractTextFromFile(const std::string& file, bool png, const std::string& key, std::string& text)
+{
+	BMP image;
+	if (!png)
+	{
+		if (!image.ReadFromFile(file.c_str()))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		std::vector<NDI_BYTE> buffer, pixels;
+		unsigned width, height;
+		bool alpha, gray;
+		nexuspng::State state;
+		if (nexuspng::load_file(buffer, file) != 0 || Nexus_Converter::PNG2Pixels(pixels, width, height, alpha, gray, buffer, state) != 0
+			|| !PixelsToBMP(pixels, width, height, alpha, gray, state.info_png.color, image))
+		{
+			return false;
+		}
+	}
+	std::ostringstream output;
+	if (!Nexus::BMPExtractStream(image, key, output))
+	{
+		return false;
+	}
+	text = output.str();
+	return true;
+}
+
+bool Nexus::EmbedShardsInFiles(const std::string& data, const std::string& key, bool keyCheck,
+	Entropy::Compression compression, const std::string& format, const std::vector<std::string>& covers,
+	const std::vector<std::string>& outputs)
+{
+	// the manifest needs the encrypted format, which is the one that can hold any byte
+	const size_t count = covers.size();
+	if (key.empty() || count == 0 || count != outputs.size() || count > 0xFFFFFFFF)
+	{
+		return false;
+	}
+	const bool png = format == "png";
+
+	// what each cover holds besides its manifest, leaving room for the stop character
+	std::vector<size_t> room(count);
+	size_t totalRoom = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		int width, height, elements;
+		if (!ImageSize(covers[i], png, width, height, elements))
+		{
+			return false;
+		}
+		size_t characters = (size_t)((unsigned long long)elements * width * height / 8);
+		size_t text = Entropy::TextCapacity(characters > 0 ? characters - 1 : 0);
+		room[i] = text > Entropy::ShardManifestSize ? text - Entropy::ShardManifestSize : 0;
+		totalRoom += room[i];
+	}
+
+	std::string payload;
+	Entropy::ShardManifest manifest;
+	manifest.compression = Entropy::Compress(data, compression, payload);
+	if (payload.length() > totalRoom)
+	{
+		return false;
+	}
+	Nexus_Crypto::RandomBytes(manifest.payloadId, sizeof(manifest.payloadId));
+	manifest.count = (NDI_DWORD)count;
+	manifest.payloadLength = payload.length();
+	Nexus_Crypto::BLAKE3 hasher;
+	hasher.Update(reinterpret_cast<const NDI_BYTE*>(payload.data()), payload.length());
+	hasher.Finish(manifest.digest);
+
+	// each cover gets its share of the payload, rounded down, then the first ones with room take what is left
+	std::vector<size_t> sizes(count);
+	size_t left = payload.length();
+	for (size_t i = 0; i < count; i++)
+	{
+		sizes[i] = (size_t)((long double)payload.length() * room[i] / totalRoom);
+		sizes[i] = sizes[i] < room[i] ? sizes[i] : room[i];
+		left -= sizes[i];
+	}
+	for (size_t i = 0; i < count && left > 0; i++)
+	{
+		size_t more = room[i] - sizes[i] < left ? room[i] - sizes[i] : left;
+		sizes[i] += more;
+		left -= more;
+	}
+
+	std::vector<size_t> offsets(count, 0);
+	for (size_t i = 1; i < count; i++)
+	{
+		offsets[i] = offsets[i - 1] + sizes[i - 1];
+	}
+	std::atomic<bool> embedded(true);
+	ParallelFor(count, [&](size_t i)
+	{
+		Entropy::ShardManifest shard = manifest;
+		shard.index = (NDI_DWORD)i;
+		shard.offset = offsets[i];
+		std::string text = Entropy::WriteShardManifest(shard);
+		text.append(payload, offsets[i], sizes[i]);
+		if (!EmbedTextInFile(text, key, keyCheck, png, covers[i], outputs[i]))
+		{
+			embedded = false;
+		}
+	});
+	return embedded;
+}
+
+bool Nexus::ExtractShardsFromFiles(const std::string& format, const std::vector<std::string>& images,
+	const std::string& key, std::ostream& output)
+{
+	const size_t count = images.size();
+	if (key.empty() || count == 0)
+	{
+		return false;
+	}
+	const bool png = format == "png";
+	std::vector<std::string> texts(count);
+	std::vector<Entropy::ShardManifest> manifests(count);
+	std::atomic<bool> extracted(true);
+	ParallelFor(count, [&](size_t i)
+	{
+		if (!ExtractTextFromFile(images[i], png, key, texts[i]) || !Entropy::ReadShardManifest(texts[i], manifests[i]))
+		{
+			extracted = false;
+		}
+	});
+	if (!extracted)
+	{
+		return false;
+	}
+
+	// every shard has to be of the same payload, and each of its shards has to be there once
+	const Entropy::ShardManifest& first = manifests[0];
+	std::vector<size_t> byIndex(count, count);
+	for (size_t i = 0; i < count; i++)
+	{
+		const Entropy::ShardManifest& manifest = manifests[i];
+		if (manifest.count != count || byIndex[manifest.index] != count
+			|| memcmp(manifest.payloadId, first.payloadId, sizeof(first.payloadId)) != 0
+			|| manifest.payloadLength != first.payloadLength || manifest.compression != first.compression
+			|| memcmp(manifest.digest, first.digest, sizeof(first.digest)) != 0)
+		{
+			return false;
+		}
+		byIndex[manifest.index] = i;
+	}
+
+	// the shards follow each other in the order of their indexes
+	std::string payload;
+	for (size_t index = 0; index < count; index++)
+	{
+		const size_t i = byIndex[index];
+		if (manifests[i].offset != payload.length())
+		{
+			return false;
+		}
+		payload.append(texts[i], Entropy::ShardManifestSize, std::string::npos);
+		texts[i].clear();
+	}
+	if (payload.length() != first.payloadLength)
+	{
+		return false;
+	}
+
+	NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	Nexus_Crypto::BLAKE3 hasher;
+	hasher.Update(reinterpret_cast<const NDI_BYTE*>(payload.data()), payload.length());
+	hasher.Finish(digest);
+	std::string data;
+	if (!Nexus_Crypto::Equal(digest, first.digest, sizeof(digest)) || !Entropy::Decompress(payload, first.compression, data))
+	{
+		return false;
+	}
+	output.write(data.data(), data.length());
+	return true;
+}
+
+int Nexus::reverseBits(int n)
+{
+	int result = 0;
+
+	for (int i = 0; i < 8; i++)
+	{
+		result = result * 2 + n % 2;
+		n /= 2;
+	}
+
+	return result;
+}
+
+/* These functions are defined in Nexus.h */
+
+bool NexusWarnings = true;
+
+void SetNexusWarningsOff(void)
+{
+	NexusWarnings = false;
+}
+void SetNexusWarningsOn(void)
+{
+	NexusWarnings = true;
+}
+bool GetNexusWarningstate(void)
+{
+	return NexusWarnings;
+}
+
+/* These functions are defined in Nexus_DataStructures.h */
+
+int IntPow(int base, int exponent)
+{
+	int i;
+	int output = 1;
+	for (i = 0; i < exponent; i++)
+	{
+		output *= base;
+	}
+	return output;
+}
+
+BMFH::BMFH()
+{
+	bfType = 19778;
+	bfReserved1 = 0;
+	bfReserved2 = 0;
+}
+
+void BMFH::SwitchEndianess(void)
+{
+	bfType = FlipWORD(bfType);
+	bfSize = FlipDWORD(bfSize);
+	bfReserved1 = FlipWORD(bfReserved1);
+	bfReserved2 = FlipWORD(bfReserved2);
+	bfOffBits = FlipDWORD(bfOffBits);
+	return;
+}
+
+BMIH::BMIH()
+{
+	biPlanes = 1;
+	biCompression = 0;
+	biXPelsPerMeter = DefaultXPelsPerMeter;
+	biYPelsPerMeter = DefaultYPelsPerMeter;
+	biClrUsed = 0;
+	biClrImportant = 0;
+}
+
+void BMIH::SwitchEndianess(void)
+{
+	biSize = FlipDWORD(biSize);
+	biWidth = FlipDWORD(biWidth);
+	biHeight = FlipDWORD(biHeight);
+	biPlanes = FlipWORD(biPlanes);
+	biBitCount = FlipWORD(biBitCount);
+	biCompression = FlipDWORD(biCompression);
+	biSizeImage = FlipDWORD(biSizeImage);
+	biXPelsPerMeter = FlipDWORD(biXPelsPerMeter);
+	biYPelsPerMeter = FlipDWORD(biYPelsPerMeter);
+	biClrUsed = FlipDWORD(biClrUsed);
+	biClrImportant = FlipDWORD(biClrImportant);
+	return;
+}
+
+void BMIH::display(void)
+{
+	using namespace std;
+	cout << "biSize: " << (int)biSize << endl
+		<< "biWidth: " << (int)biWidth << endl
+		<< "biHeight: " << (int)biHeight << endl
+		<< "biPlanes: " << (int)biPlanes << endl
+		<< "biBitCount: " << (int)biBitCount << endl
+		<< "biCompression: " << (int)biCompression << endl
+		<< "biSizeImage: " << (int)biSizeImage << endl
+		<< "biXPelsPerMeter: " << (int)biXPelsPerMeter << endl
+		<< "biYPelsPerMeter: " << (int)biYPelsPerMeter << endl
+		<< "biClrUsed: " << (int)biClrUsed << endl
+		<< "biClrImportant: " << (int)biClrImportant << endl << endl;
+}
+
+void BMFH::display(void)
+{
+	using namespace std;
+	cout << "bfType: " << (int)bfType << endl
+		<< "bfSize: " << (int)bfSize << endl
+		<< "bfReserved1: " << (int)bfReserved1 << endl
+		<< "bfReserved2: " << (int)bfReserved2 << endl
+		<< "bfOffBits: " << (int)bfOffBits << endl << endl;
+}
+
+/* These functions are defined in Nexus_Bitmap.h */
+
+Pixel BMP::GetPixel(int i, int j) const
+{
+	using namespace std;
+	bool Warn = false;
+	if (i >= Width)
+	{
+		i = Width - 1; Warn = true;
+	}
+	if (i < 0)
+	{
+		i = 0; Warn = true;
+	}
+	if (j >= Height)
+	{
+		j = Height - 1; Warn = true;
+	}
+	if (j < 0)
+	{
+		j = 0; Warn = true;
+	}
+	if (Warn && NexusWarnings)
+	{
+		cout << "Nexus Warning: Attempted to access non-existent pixel;" << endl
+			<< "               Truncating request to fit in the range [0,"
+			<< Width - 1 << "] x [0," << Height - 1 << "]." << endl;
+	}
+	return Pixels[i][j];
+}
+
+bool BMP::SetPixel(int i, int j, Pixel NewPixel)
+{
+	Pixels[i][j] = NewPixel;
+	return true;
+}
+
+
+bool BMP::SetColor(int ColorNumber, Pixel NewColor)
+{
+	using namespace std;
+	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Attempted to change color table for a BMP object" << endl
+				<< "               that lacks a color table. Ignoring request." << endl;
+		}
+		return false;
+	}
+	if (!Colors)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Attempted to set a color, but the color table" << endl
+				<< "               is not defined. Ignoring request." << endl;
+		}
+		return false;
+	}
+	if (ColorNumber >= GetNumberOfColors())
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Requested color number "
+				<< ColorNumber << " is outside the allowed" << endl
+				<< "               range [0," << GetNumberOfColors() - 1
+				<< "]. Ignoring request to set this color." << endl;
+		}
+		return false;
+	}
+	Colors[ColorNumber] = NewColor;
+	return true;
+}
+
+// Pixel BMP::GetColor( int ColorNumber ) const
+Pixel BMP::GetColor(int ColorNumber)
+{
+	Pixel Output;
+	Output.Red = 255;
+	Output.Green = 255;
+	Output.Blue = 255;
+	Output.Alpha = 0;
+
+	using namespace std;
+	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Attempted to access color table for a BMP object" << endl
+				<< "               that lacks a color table. Ignoring request." << endl;
+		}
+		return Output;
+	}
+	if (!Colors)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Requested a color, but the color table" << endl
+				<< "               is not defined. Ignoring request." << endl;
+		}
+		return Output;
+	}
+	if (ColorNumber >= GetNumberOfColors())
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Requested color number "
+				<< ColorNumber << " is outside the allowed" << endl
+				<< "               range [0," << GetNumberOfColors() - 1
+				<< "]. Ignoring request to get this color." << endl;
+		}
+		return Output;
+	}
+	Output = Colors[ColorNumber];
+	return Output;
+}
+
+BMP::BMP()
+{
+	Width = 1;
+	Height = 1;
+	BitDepth = 24;
+	AlphaChannel = false;
+	Grayscale = false;
+	Pixels = new Pixel*[Width];
+	Pixels[0] = new Pixel[Height];
+	Colors = NULL;
+
+	XPelsPerMeter = 0;
+	YPelsPerMeter = 0;
+
+	MetaData1 = NULL;
+	SizeOfMetaData1 = 0;
+	MetaData2 = NULL;
+	SizeOfMetaData2 = 0;
+}
+
+// BMP::BMP( const BMP& Input )
+BMP::BMP(BMP& Input)
+{
+	// first, make the image empty.
+
+	Width = 1;
+	Height = 1;
+	BitDepth = 24;
+	AlphaChannel = false;
+	Grayscale = false;
+	Pixels = new Pixel*[Width];
+	Pixels[0] = new Pixel[Height];
+	Colors = NULL;
+	XPelsPerMeter = 0;
+	YPelsPerMeter = 0;
+
+	MetaData1 = NULL;
+	SizeOfMetaData1 = 0;
+	MetaData2 = NULL;
+	SizeOfMetaData2 = 0;
+
+	// now, set the correct bit depth
+
+	SetBitDepth(Input.GetBitDepth());
+	AlphaChannel = Input.HasAlphaChannel();
+	Grayscale = Input.IsGrayscale();
+
+	// set the correct pixel size 
+
+	SetSize(Input.GetWidth(), Input.GetHeight());
+
+	// set the DPI information from Input
+
+	SetDPI(Input.GetHorizontalDPI(), Input.GetVerticalDPI());
+
+	// if there is a color table, get all the colors
+
+	if (BitDepth == 1 || BitDepth == 4 ||
+		BitDepth == 8)
+	{
+		for (int k = 0; k < GetNumberOfColors(); k++)
+		{
+			SetColor(k, Input.GetColor(k));
+		}
+	}
+
+	// get all the pixels 
+
+	for (int j = 0; j < Height; j++)
+	{
+		for (int i = 0; i < Width; i++)
+		{
+			Pixels[i][j] = *Input(i, j);
+			//   Pixels[i][j] = Input.GetPixel(i,j); // *Input(i,j);
+		}
+	}
+}
+
+BMP::~BMP()
+{
+	int i;
+	for (i = 0;i < Width;i++)
+	{
+		delete[] Pixels[i];
+	}
+	delete[] Pixels;
+	if (Colors)
+	{
+		delete[] Colors;
+	}
+
+	if (MetaData1)
+	{
+		delete[] MetaData1;
+	}
+	if (MetaData2)
+	{
+		delete[] MetaData2;
+	}
+}
+
+Pixel* BMP::operator()(int i, int j)
+{
+	using namespace std;
+	bool Warn = false;
+	if (i >= Width)
+	{
+		i = Width - 1; Warn = true;
+	}
+	if (i < 0)
+	{
+		i = 0; Warn = true;
+	}
+	if (j >= Height)
+	{
+		j = Height - 1; Warn = true;
+	}
+	if (j < 0)
+	{
+		j = 0; Warn = true;
+	}
+	if (Warn && NexusWarnings)
+	{
+		cout << "Nexus Warning: Attempted to access non-existent pixel;" << endl
+			<< "               Truncating request to fit in the range [0,"
+			<< Width - 1 << "] x [0," << Height - 1 << "]." << endl;
+	}
+	return &(Pixels[i][j]);
+}
+
+// int BMP::GetBitDepth( void ) const
+int BMP::GetBitDepth(void)
+{
+	return BitDepth;
+}
+
+bool BMP::HasAlphaChannel(void)
+{
+	return AlphaChannel;
+}
+
+void BMP::SetAlphaChannel(bool Alpha)
+{
+	AlphaChannel = Alpha;
+}
+
+bool BMP::IsGrayscale(void)
+{
+	return Grayscale;
+}
+
+void BMP::SetGrayscale(bool Gray)
+{
+	Grayscale = Gray;
+}
+
+// int BMP::GetHeight( void ) const
+int BMP::GetHeight(void)
+{
+	return Height;
+}
+
+// int BMP::GetWidth( void ) const
+int BMP::GetWidth(void)
+{
+	return Width;
+}
+
+// int BMP::GetNumberOfColors( void ) const
+int BMP::GetNumberOfColors(void)
+{
+	int output = IntPow(2, BitDepth);
+	if (BitDepth == 32)
+	{
+		output = IntPow(2, 24);
+	}
+	return output;
+}
+
+bool BMP::SetBitDepth(int NewDepth)
+{
+	using namespace std;
+	if (NewDepth != 1 && NewDepth != 4 &&
+		NewDepth != 8 && NewDepth != 16 &&
+		NewDepth != 24 && NewDepth != 32)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: User attempted to set unsupported bit depth "
+				<< NewDepth << "." << endl
+				<< "               Bit depth remains unchanged at "
+				<< BitDepth << "." << endl;
+		}
+		return false;
+	}
+
+	BitDepth = NewDepth;
+	if (Colors)
+	{
+		delete[] Colors;
+	}
+	int NumberOfColors = IntPow(2, BitDepth);
+	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
+	{
+		Colors = new Pixel[NumberOfColors];
+	}
+	else
+	{
+		Colors = NULL;
+	}
+	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
+	{
+		CreateStandardColorTable();
+	}
+
+	return true;
+}
+
+bool BMP::SetSize(int NewWidth, int NewHeight)
+{
+	using namespace std;
+	if (NewWidth <= 0 || NewHeight <= 0)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: User attempted to set a non-positive width or height." << endl
+				<< "               Size remains unchanged at "
+				<< Width << " x " << Height << "." << endl;
+		}
+		return false;
+	}
+
+	int i, j;
+
+	for (i = 0;i < Width;i++)
+	{
+		delete[] Pixels[i];
+	}
+	delete[] Pixels;
+
+	Width = NewWidth;
+	Height = NewHeight;
+	Pixels = new Pixel*[Width];
+
+	for (i = 0; i < Width; i++)
+	{
+		Pixels[i] = new Pixel[Height];
+	}
+
+	for (i = 0; i < Width; i++)
+	{
+		for (j = 0; j < Height; j++)
+		{
+			Pixels[i][j].Red = 255;
+			Pixels[i][j].Green = 255;
+			Pixels[i][j].Blue = 255;
+			Pixels[i][j].Alpha = 0;
+		}
+	}
+
+	return true;
+}
+
+void BMP::WriteHeader(FILE* fp, int FileHeight, NDI_DWORD& FileSize)
+{
+	// some preliminaries
+
+	double dBytesPerPixel = ((double)BitDepth) / 8.0;
+	double dBytesPerRow = dBytesPerPixel * (Width + 0.0);
+	dBytesPerRow = ceil(dBytesPerRow);
+
+	int BytePaddingPerRow = 4 - ((int)(dBytesPerRow)) % 4;
+	if (BytePaddingPerRow == 4)
+	{
+		BytePaddingPerRow = 0;
+	}
+
+	double dActualBytesPerRow = dBytesPerRow + BytePaddingPerRow;
+
+	double dTotalPixelBytes = FileHeight * dActualBytesPerRow;
+
+	double dPaletteSize = 0;
+	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
+	{
+		dPaletteSize = IntPow(2, BitDepth)*4.0;
+	}
+
+	// leave some room for 16-bit masks 
+	if (BitDepth == 16)
+	{
+		dPaletteSize = 3 * 4;
+	}
+
+	// a grayscale 24 or 32 bit image has the 256 grays as its color table
+	bool WriteGrays = BitDepth >= 24 && Grayscale;
+	if (WriteGrays)
+	{
+		dPaletteSize = 256 * 4;
+	}
+
+	// the alpha of a 32 bit image goes with a version 4 header, whose bit fields include an alpha mask
+	bool WriteAlpha = BitDepth == 32 && AlphaChannel;
+	int InfoHeaderSize = WriteAlpha ? 108 : 40;
+
+	double dTotalFileSize = 14 + InfoHeaderSize + dPaletteSize + dTotalPixelBytes;
+
+	// write the file header 
+
+	BMFH bmfh;
+	bmfh.bfSize = (NDI_DWORD)dTotalFileSize;
+	FileSize = bmfh.bfSize;
+	bmfh.bfReserved1 = 0;
+	bmfh.bfReserved2 = 0;
+	bmfh.bfOffBits = (NDI_DWORD)(14 + InfoHeaderSize + dPaletteSize);
+
+	if (IsBigEndian())
+	{
+		bmfh.SwitchEndianess();
+	}
+
+	fwrite((char*) &(bmfh.bfType), sizeof(NDI_WORD), 1, fp);
+	fwrite((char*) &(bmfh.bfSize), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmfh.bfReserved1), sizeof(NDI_WORD), 1, fp);
+	fwrite((char*) &(bmfh.bfReserved2), sizeof(NDI_WORD), 1, fp);
+	fwrite((char*) &(bmfh.bfOffBits), sizeof(NDI_DWORD), 1, fp);
+
+	// write the info header 
+
+	BMIH bmih;
+	bmih.biSize = InfoHeaderSize;
+	bmih.biWidth = Width;
+	bmih.biHeight = FileHeight;
+	bmih.biPlanes = 1;
+	bmih.biBitCount = BitDepth;
+	bmih.biCompression = 0;
+	bmih.biSizeImage = (NDI_DWORD)dTotalPixelBytes;
+	if (XPelsPerMeter)
+	{
+		bmih.biXPelsPerMeter = XPelsPerMeter;
+	}
+	else
+	{
+		bmih.biXPelsPerMeter = DefaultXPelsPerMeter;
+	}
+	if (YPelsPerMeter)
+	{
+		bmih.biYPelsPerMeter = YPelsPerMeter;
+	}
+	else
+	{
+		bmih.biYPelsPerMeter = DefaultYPelsPerMeter;
+	}
+
+	bmih.biClrUsed = WriteGrays ? 256 : 0;
+	bmih.biClrImportant = 0;
+
+	// indicates that we'll be using bit fields for 16-bit files
+	if (BitDepth == 16 || WriteAlpha)
+	{
+		bmih.biCompression = 3;
+	}
+
+	if (IsBigEndian())
+	{
+		bmih.SwitchEndianess();
+	}
+
+	fwrite((char*) &(bmih.biSize), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biWidth), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biHeight), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biPlanes), sizeof(NDI_WORD), 1, fp);
+	fwrite((char*) &(bmih.biBitCount), sizeof(NDI_WORD), 1, fp);
+	fwrite((char*) &(bmih.biCompression), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biSizeImage), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biXPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biYPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biClrUsed), sizeof(NDI_DWORD), 1, fp);
+	fwrite((char*) &(bmih.biClrImportant), sizeof(NDI_DWORD), 1, fp);
+
+	// the rest of the version 4 header: the masks of the blue, green, red, alpha order of the pixels,
+	// and the sRGB color space, which needs no end points or gamma
+	if (WriteAlpha)
+	{
+		NDI_DWORD V4Header[17] = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000, 0x73524742 };
+		for (int n = 0; n < 17; n++)
+		{
+			if (IsBigEndian())
+			{
+				V4Header[n] = FlipDWORD(V4Header[n]);
+			}
+			fwrite((char*) &(V4Header[n]), sizeof(NDI_DWORD), 1, fp);
+		}
+	}
+
+	if (WriteGrays)
+	{
+		for (int n = 0; n < 256; n++)
+		{
+			NDI_BYTE Gray[4] = { (NDI_BYTE)n, (NDI_BYTE)n, (NDI_BYTE)n, 0 };
+			fwrite((char*)Gray, 4, 1, fp);
+		}
+	}
+
+	// write the palette 
+	if (BitDepth == 1 || BitDepth == 4 || BitDepth == 8)
+	{
+		int NumberOfColors = IntPow(2, BitDepth);
+
+		// if there is no palette, create one 
+		if (!Colors)
+		{
+			if (!Colors)
+			{
+				Colors = new Pixel[NumberOfColors];
+			}
+			CreateStandardColorTable();
+		}
+
+		int n;
+		for (n = 0; n < NumberOfColors; n++)
+		{
+			fwrite((char*) &(Colors[n]), 4, 1, fp);
+		}
+	}
+}
+
+bool BMP::WriteToFile(const char* FileName)
+{
+	using namespace std;
+	if (!NexusCheckDataSize())
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Data types are wrong size!" << endl
+				<< "              You may need to mess with Nexus_DataTypes.h" << endl
+				<< "              to fix these errors, and then recompile." << endl
+				<< "              All 32-bit and 64-bit machines should be" << endl
+				<< "              supported, however." << endl << endl;
+		}
+		return false;
+	}
+
+	FILE* fp = fopen(FileName, "wb");
+	if (fp == NULL)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot open file "
+				<< FileName << " for output." << endl;
+		}
+		fclose(fp);
+		return false;
+	}
+
+	NDI_DWORD FileSize;
+	WriteHeader(fp, Height, FileSize);
+
+	// write the pixels 
+	int i, j;
+	if (BitDepth != 16)
+	{
+		NDI_BYTE* Buffer;
+		int BufferSize = (int)((Width*BitDepth) / 8.0);
+		while (8 * BufferSize < Width*BitDepth)
+		{
+			BufferSize++;
+		}
+		while (BufferSize % 4)
+		{
+			BufferSize++;
+		}
+
+		Buffer = new NDI_BYTE[BufferSize];
+		for (j = 0; j < BufferSize; j++)
+		{
+			Buffer[j] = 0;
+		}
+		IndexColors();
+
+		j = Height - 1;
+
+		while (j > -1)
+		{
+			bool Success = false;
+			if (BitDepth == 32)
+			{
+				Success = Write32bitRow(Buffer, BufferSize, j);
+			}
+			if (BitDepth == 24)
+			{
+				Success = Write24bitRow(Buffer, BufferSize, j);
+			}
+			if (BitDepth == 8)
+			{
+				Success = Write8bitRow(Buffer, BufferSize, j);
+			}
+			if (BitDepth == 4)
+			{
+				Success = Write4bitRow(Buffer, BufferSize, j);
+			}
+			if (BitDepth == 1)
+			{
+				Success = Write1bitRow(Buffer, BufferSize, j);
+			}
+			if (Success)
+			{
+				int BytesWritten = (int)fwrite((char*)Buffer, 1, BufferSize, fp);
+				if (BytesWritten != BufferSize)
+				{
+					Success = false;
+				}
+			}
+			if (!Success)
+			{
+				if (NexusWarnings)
+				{
+					cout << "Nexus Error: Could not write proper amount of data." << endl;
+				}
+				j = -1;
+			}
+			j--;
+		}
+
+		delete[] Buffer;
+		ColorIndex.clear();
+		NearColors.clear();
+		NearColorStart.clear();
+		NearColorEnd.clear();
+	}
+
+	if (BitDepth == 16)
+	{
+		// write the bit masks
+
+		NDI_WORD BlueMask = 31;    // bits 12-16
+		NDI_WORD GreenMask = 2016; // bits 6-11
+		NDI_WORD RedMask = 63488;  // bits 1-5
+		NDI_WORD ZeroWORD;
+
+		if (IsBigEndian())
+		{
+			RedMask = FlipWORD(RedMask);
+		}
+		fwrite((char*)&RedMask, 2, 1, fp);
+		fwrite((char*)&ZeroWORD, 2, 1, fp);
+
+		if (IsBigEndian())
+		{
+			GreenMask = FlipWORD(GreenMask);
+		}
+		fwrite((char*)&GreenMask, 2, 1, fp);
+		fwrite((char*)&ZeroWORD, 2, 1, fp);
+
+		if (IsBigEndian())
+		{
+			BlueMask = FlipWORD(BlueMask);
+		}
+		fwrite((char*)&BlueMask, 2, 1, fp);
+		fwrite((char*)&ZeroWORD, 2, 1, fp);
+
+		int DataBytes = Width * 2;
+		int PaddingBytes = (4 - DataBytes % 4) % 4;
+
+		// write the actual pixels
+
+		for (j = Height - 1; j >= 0; j--)
+		{
+			// write all row pixel data
+			i = 0;
+			int WriteNumber = 0;
+			while (WriteNumber < DataBytes)
+			{
+				NDI_WORD TempWORD;
+
+				NDI_WORD RedWORD = (NDI_WORD)((Pixels[i][j]).Red / 8);
+				NDI_WORD GreenWORD = (NDI_WORD)((Pixels[i][j]).Green / 4);
+				NDI_WORD BlueWORD = (NDI_WORD)((Pixels[i][j]).Blue / 8);
+
+				TempWORD = (RedWORD << 11) + (GreenWORD << 5) + BlueWORD;
+				if (IsBigEndian())
+				{
+					TempWORD = FlipWORD(TempWORD);
+				}
+
+				fwrite((char*)&TempWORD, 2, 1, fp);
+				WriteNumber += 2;
+				i++;
+			}
+			// write any necessary row padding
+			WriteNumber = 0;
+			while (WriteNumber < PaddingBytes)
+			{
+				NDI_BYTE TempBYTE;
+				fwrite((char*)&TempBYTE, 1, 1, fp);
+				WriteNumber++;
+			}
+		}
+
+	}
+
+	fclose(fp);
+	return true;
+}
+
+// whether the 256 colors from where fp is are the grays from black to white
+static bool ReadGrayColorTable(FILE* fp)
+{
+	NDI_BYTE Table[256 * 4];
+	if (!SafeFread((char*)Table, 4, 256, fp))
+	{
+		return false;
+	}
+	for (int n = 0; n < 256; n++)
+	{
+		if (Table[4 * n] != n || Table[4 * n + 1] != n || Table[4 * n + 2] != n)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BMP::ReadFromFile(const char* FileName)
+{
+	using namespace std;
+	if (!NexusCheckDataSize())
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Data types are wrong size!" << endl
+				<< "              You may need to mess with DataTypes.h" << endl
+				<< "              to fix these errors, and then recompile." << endl
+				<< "              All 32-bit and 64-bit machines should be" << endl
+				<< "              supported, however." << endl << endl;
+		}
+		return false;
+	}
+
+	FILE* fp = fopen(FileName, "rb");
+	if (fp == NULL)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot open file "
+				<< FileName << " for input." << endl;
+		}
+		SetBitDepth(1);
+		SetSize(1, 1);
+		return false;
+	}
+
+	// read the file header 
+
+	BMFH bmfh;
+	bool NotCorrupted = true;
+
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfType), sizeof(NDI_WORD), 1, fp);
+
+	bool IsBitmap = false;
+
+	if (IsBigEndian() && bmfh.bfType == 16973)
+	{
+		IsBitmap = true;
+	}
+	if (!IsBigEndian() && bmfh.bfType == 19778)
+	{
+		IsBitmap = true;
+	}
+
+	if (!IsBitmap)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: " << FileName
+				<< " is not a Windows BMP file!" << endl;
+		}
+		fclose(fp);
+		return false;
+	}
+
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfSize), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfReserved1), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfReserved2), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfOffBits), sizeof(NDI_DWORD), 1, fp);
+
+	if (IsBigEndian())
+	{
+		bmfh.SwitchEndianess();
+	}
+
+	// read the info header
+
+	BMIH bmih;
+
+	NotCorrupted &= SafeFread((char*) &(bmih.biSize), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biWidth), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biHeight), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biPlanes), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biBitCount), sizeof(NDI_WORD), 1, fp);
+
+	NotCorrupted &= SafeFread((char*) &(bmih.biCompression), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biSizeImage), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biXPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biYPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biClrUsed), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biClrImportant), sizeof(NDI_DWORD), 1, fp);
+
+	if (IsBigEndian())
+	{
+		bmih.SwitchEndianess();
+	}
+
+	// a safety catch: if any of the header information didn't read properly, abort
+	// future idea: check to see if at least most is self-consistent
+
+	if (!NotCorrupted)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: " << FileName
+				<< " is obviously corrupted." << endl;
+		}
+		SetSize(1, 1);
+		SetBitDepth(1);
+		fclose(fp);
+		return false;
+	}
+
+	XPelsPerMeter = bmih.biXPelsPerMeter;
+	YPelsPerMeter = bmih.biYPelsPerMeter;
+
+	// if bmih.biCompression 1 or 2, then the file is RLE compressed
+
+	if (bmih.biCompression == 1 || bmih.biCompression == 2)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: " << FileName << " is (RLE) compressed." << endl
+				<< "              Nexus does not support compression." << endl;
+		}
+		SetSize(1, 1);
+		SetBitDepth(1);
+		fclose(fp);
+		return false;
+	}
+
+	// if bmih.biCompression > 3, then something strange is going on 
+	// it's probably an OS2 bitmap file.
+
+	if (bmih.biCompression > 3)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: " << FileName << " is in an unsupported format."
+				<< endl
+				<< "              (bmih.biCompression = "
+				<< bmih.biCompression << ")" << endl
+				<< "              The file is probably an old OS2 bitmap or corrupted."
+				<< endl;
+		}
+		SetSize(1, 1);
+		SetBitDepth(1);
+		fclose(fp);
+		return false;
+	}
+
+	// 32 bit fields are read when they are in the usual blue, green, red order, the alpha mask of a
+	// version 4 or 5 header tells the fourth byte of a pixel is its alpha
+	int HeaderBytesRead = 54;
+	bool FileAlpha = false;
+	bool BitFieldsSupported = bmih.biBitCount == 16;
+	if (bmih.biCompression == 3 && bmih.biBitCount == 32)
+	{
+		NDI_DWORD Masks[4] = { 0, 0, 0, 0 };
+		int NumberOfMasks = bmih.biSize >= 56 ? 4 : 3;
+		for (int n = 0; n < NumberOfMasks; n++)
+		{
+			NotCorrupted &= SafeFread((char*) &(Masks[n]), sizeof(NDI_DWORD), 1, fp);
+			if (IsBigEndian())
+			{
+				Masks[n] = FlipDWORD(Masks[n]);
+			}
+		}
+		HeaderBytesRead += 4 * NumberOfMasks;
+		BitFieldsSupported = NotCorrupted && Masks[0] == 0x00FF0000 && Masks[1] == 0x0000FF00 && Masks[2] == 0x000000FF;
+		FileAlpha = Masks[3] == 0xFF000000;
+	}
+
+	if (bmih.biCompression == 3 && !BitFieldsSupported)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: " << FileName
+				<< " uses bit fields and is not a" << endl
+				<< "              16-bit file. This is not supported." << endl;
+		}
+		SetSize(1, 1);
+		SetBitDepth(1);
+		fclose(fp);
+		return false;
+	}
+
+	// the rest of a longer info header (the color space) is not meta data; 16-bit files read their
+	// masks from where they start
+	if (bmih.biBitCount != 16 && 14 + (int)bmih.biSize > HeaderBytesRead)
+	{
+		fseek(fp, 14 + (long)bmih.biSize, SEEK_SET);
+		HeaderBytesRead = 14 + (int)bmih.biSize;
+	}
+
+	// set the bit depth
+
+	int TempBitDepth = (int)bmih.biBitCount;
+	if (TempBitDepth != 1 && TempBitDepth != 4
+		&& TempBitDepth != 8 && TempBitDepth != 16
+		&& TempBitDepth != 24 && TempBitDepth != 32)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: " << FileName << " has unrecognized bit depth." << endl;
+		}
+		SetSize(1, 1);
+		SetBitDepth(1);
+		fclose(fp);
+		return false;
+	}
+	SetBitDepth((int)bmih.biBitCount);
+	AlphaChannel = FileAlpha;
+
+	// set the size
+
+	if ((int)bmih.biWidth <= 0 || (int)bmih.biHeight <= 0)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: " << FileName
+				<< " has a non-positive width or height." << endl;
+		}
+		SetSize(1, 1);
+		SetBitDepth(1);
+		fclose(fp);
+		return false;
+	}
+	SetSize((int)bmih.biWidth, (int)bmih.biHeight);
+
+	// some preliminaries
+
+	double dBytesPerPixel = ((double)BitDepth) / 8.0;
+	double dBytesPerRow = dBytesPerPixel * (Width + 0.0);
+	dBytesPerRow = ceil(dBytesPerRow);
+
+	int BytePaddingPerRow = 4 - ((int)(dBytesPerRow)) % 4;
+	if (BytePaddingPerRow == 4)
+	{
+		BytePaddingPerRow = 0;
+	}
+
+	// if < 16 bits, read the palette
+
+	if (BitDepth < 16)
+	{
+		// determine the number of colors specified in the 
+		// color table
+
+		int NumberOfColorsToRead = ((int)bmfh.bfOffBits - HeaderBytesRead) / 4;
+		if (NumberOfColorsToRead > IntPow(2, BitDepth))
+		{
+			NumberOfColorsToRead = IntPow(2, BitDepth);
+		}
+
+		if (NumberOfColorsToRead < GetNumberOfColors())
+		{
+			if (NexusWarnings)
+			{
+				cout << "Nexus Warning: file " << FileName << " has an underspecified" << endl
+					<< "               color table. The table will be padded with extra" << endl
+					<< "               white (255,255,255,0) entries." << endl;
+			}
+		}
+
+		int n;
+		for (n = 0; n < NumberOfColorsToRead; n++)
+		{
+			SafeFread((char*) &(Colors[n]), 4, 1, fp);
+		}
+		for (n = NumberOfColorsToRead; n < GetNumberOfColors(); n++)
+		{
+			Pixel WHITE;
+			WHITE.Red = 255;
+			WHITE.Green = 255;
+			WHITE.Blue = 255;
+			WHITE.Alpha = 0;
+			SetColor(n, WHITE);
+		}
+
+
+	}
+
+	// a 24 or 32 bit file can have a color table too, it tells the image is grayscale if it is the 256 grays
+	Grayscale = false;
+	if (BitDepth >= 24 && bmih.biClrUsed == 256 && (int)bmfh.bfOffBits - HeaderBytesRead >= 256 * 4)
+	{
+		Grayscale = ReadGrayColorTable(fp);
+		HeaderBytesRead += 256 * 4;
+	}
+
+	// skip blank data if bfOffBits so indicates
+
+	int BytesToSkip = bmfh.bfOffBits - HeaderBytesRead;
+	if (BitDepth < 16)
+	{
+		BytesToSkip -= 4 * IntPow(2, BitDepth);
+	}
+	if (BitDepth == 16 && bmih.biCompression == 3)
+	{
+		BytesToSkip -= 3 * 4;
+	}
+	if (BytesToSkip < 0)
+	{
+		BytesToSkip = 0;
+	}
+	if (BytesToSkip > 0 && BitDepth != 16)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Extra meta data detected in file " << FileName << endl
+				<< "               Data will be skipped." << endl;
+		}
+		NDI_BYTE* TempSkipBYTE;
+		TempSkipBYTE = new NDI_BYTE[BytesToSkip];
+		SafeFread((char*)TempSkipBYTE, BytesToSkip, 1, fp);
+		delete[] TempSkipBYTE;
+	}
+
+	// This code reads 1, 4, 8, 24, and 32-bpp files 
+	// with a more-efficient buffered technique.
+
+	int i, j;
+	if (BitDepth != 16)
+	{
+		int BufferSize = (int)((Width*BitDepth) / 8.0);
+		while (8 * BufferSize < Width*BitDepth)
+		{
+			BufferSize++;
+		}
+		while (BufferSize % 4)
+		{
+			BufferSize++;
+		}
+		NDI_BYTE* Buffer;
+		Buffer = new NDI_BYTE[BufferSize];
+		j = Height - 1;
+		while (j > -1)
+		{
+			int BytesRead = (int)fread((char*)Buffer, 1, BufferSize, fp);
+			if (BytesRead < BufferSize)
+			{
+				j = -1;
+				if (NexusWarnings)
+				{
+					cout << "Nexus Error: Could not read proper amount of data." << endl;
+				}
+			}
+			else
+			{
+				bool Success = false;
+				if (BitDepth == 1)
+				{
+					Success = Read1bitRow(Buffer, BufferSize, j);
+				}
+				if (BitDepth == 4)
+				{
+					Success = Read4bitRow(Buffer, BufferSize, j);
+				}
+				if (BitDepth == 8)
+				{
+					Success = Read8bitRow(Buffer, BufferSize, j);
+				}
+				if (BitDepth == 24)
+				{
+					Success = Read24bitRow(Buffer, BufferSize, j);
+				}
+				if (BitDepth == 32)
+				{
+					Success = Read32bitRow(Buffer, BufferSize, j);
+				}
+				if (!Success)
+				{
+					if (NexusWarnings)
+					{
+						cout << "Nexus Error: Could not read enough pixel data!" << endl;
+					}
+					j = -1;
+				}
+			}
+			j--;
+		}
+		delete[] Buffer;
+	}
+
+	if (BitDepth == 16)
+	{
+		int DataBytes = Width * 2;
+		int PaddingBytes = (4 - DataBytes % 4) % 4;
+
+		// set the default mask
+
+		NDI_WORD BlueMask = 31; // bits 12-16
+		NDI_WORD GreenMask = 992; // bits 7-11
+		NDI_WORD RedMask = 31744; // bits 2-6
+
+		// read the bit fields, if necessary, to 
+		// override the default 5-5-5 mask
+
+		if (bmih.biCompression != 0)
+		{
+			// read the three bit masks
+
+			NDI_WORD TempMaskWORD;
+
+			SafeFread((char*)&RedMask, 2, 1, fp);
+			if (IsBigEndian())
+			{
+				RedMask = FlipWORD(RedMask);
+			}
+			SafeFread((char*)&TempMaskWORD, 2, 1, fp);
+
+			SafeFread((char*)&GreenMask, 2, 1, fp);
+			if (IsBigEndian())
+			{
+				GreenMask = FlipWORD(GreenMask);
+			}
+			SafeFread((char*)&TempMaskWORD, 2, 1, fp);
+
+			SafeFread((char*)&BlueMask, 2, 1, fp);
+			if (IsBigEndian())
+			{
+				BlueMask = FlipWORD(BlueMask);
+			}
+			SafeFread((char*)&TempMaskWORD, 2, 1, fp);
+		}
+
+		// read and skip any meta data
+
+		if (BytesToSkip > 0)
+		{
+			if (NexusWarnings)
+			{
+				cout << "Nexus Warning: Extra meta data detected in file "
+					<< FileName << endl
+					<< "               Data will be skipped." << endl;
+			}
+			NDI_BYTE* TempSkipBYTE;
+			TempSkipBYTE = new NDI_BYTE[BytesToSkip];
+			SafeFread((char*)TempSkipBYTE, BytesToSkip, 1, fp);
+			delete[] TempSkipBYTE;
+		}
+
+		// determine the red, green and blue shifts
+
+		int GreenShift = 0;
+		NDI_WORD TempShiftWORD = GreenMask;
+		while (TempShiftWORD > 31)
+		{
+			TempShiftWORD = TempShiftWORD >> 1; GreenShift++;
+		}
+		int BlueShift = 0;
+		TempShiftWORD = BlueMask;
+		while (TempShiftWORD > 31)
+		{
+			TempShiftWORD = TempShiftWORD >> 1; BlueShift++;
+		}
+		int RedShift = 0;
+		TempShiftWORD = RedMask;
+		while (TempShiftWORD > 31)
+		{
+			TempShiftWORD = TempShiftWORD >> 1; RedShift++;
+		}
+
+		// read the actual pixels
+
+		for (j = Height - 1; j >= 0; j--)
+		{
+			i = 0;
+			int ReadNumber = 0;
+			while (ReadNumber < DataBytes)
+			{
+				NDI_WORD TempWORD;
+				SafeFread((char*)&TempWORD, 2, 1, fp);
+				if (IsBigEndian())
+				{
+					TempWORD = FlipWORD(TempWORD);
+				}
+				ReadNumber += 2;
+
+				NDI_WORD Red = RedMask & TempWORD;
+				NDI_WORD Green = GreenMask & TempWORD;
+				NDI_WORD Blue = BlueMask & TempWORD;
+
+				NDI_BYTE BlueBYTE = (NDI_BYTE)8 * (Blue >> BlueShift);
+				NDI_BYTE GreenBYTE = (NDI_BYTE)8 * (Green >> GreenShift);
+				NDI_BYTE RedBYTE = (NDI_BYTE)8 * (Red >> RedShift);
+
+				(Pixels[i][j]).Red = RedBYTE;
+				(Pixels[i][j]).Green = GreenBYTE;
+				(Pixels[i][j]).Blue = BlueBYTE;
+
+				i++;
+			}
+			ReadNumber = 0;
+			while (ReadNumber < PaddingBytes)
+			{
+				NDI_BYTE TempBYTE;
+				SafeFread((char*)&TempBYTE, 1, 1, fp);
+				ReadNumber++;
+			}
+		}
+
+	}
+
+	fclose(fp);
+	return true;
+}
+
+// the layout of an uncompressed 8, 24 or 32 bit file, where each row can be located and read or written on its own;
+// Alpha tells a 32 bit one has an alpha channel, Gray that the color table of the 256 grays says a 24 or 32 bit
+// one is grayscale, and an 8 bit one has NumberOfColors colors in its table from ColorOffset
+struct BMPRowLayout
+{
+	int Width, Height, BitDepth;
+	bool Alpha, Gray;
+	long long PixelOffset, ColorOffset;
+	int NumberOfColors;
+};
+
+// fseek with a 64 bit offset, as the rows of a big file can lie past what a 32 bit long reaches
+static bool SeekFile(FILE* fp, long long Offset, int Origin)
+{
+#ifdef _WIN32
+	return _fseeki64(fp, Offset, Origin) == 0;
+#else
+	return fseeko(fp, (off_t)Offset, Origin) == 0;
+#endif
+}
+
+// Reads the headers of a file into its row layout.
+static bool ReadRowLayout(FILE* fp, BMPRowLayout& Layout)
+{
+	BMFH bmfh;
+	BMIH bmih;
+	bool NotCorrupted = true;
+
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfType), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfSize), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfReserved1), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfReserved2), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmfh.bfOffBits), sizeof(NDI_DWORD), 1, fp);
+
+	NotCorrupted &= SafeFread((char*) &(bmih.biSize), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biWidth), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biHeight), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biPlanes), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biBitCount), sizeof(NDI_WORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biCompression), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biSizeImage), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biXPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biYPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+	NotCorrupted &= SafeFread((char*) &(bmih.biClrUsed), sizeof(NDI_DWORD), 1, fp);
+
+	if (IsBigEndian())
+	{
+		bmfh.SwitchEndianess();
+		bmih.SwitchEndianess();
+	}
+
+	// the bit fields of a 32 bit file are the masks of its blue, green, red and alpha bytes
+	NDI_DWORD Masks[4] = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0 };
+	if (NotCorrupted && bmih.biCompression == 3 && bmih.biBitCount == 32)
+	{
+		NotCorrupted &= SeekFile(fp, 54, SEEK_SET);
+		for (int n = 0; n < (bmih.biSize >= 56 ? 4 : 3); n++)
+		{
+			NotCorrupted &= SafeFread((char*) &(Masks[n]), sizeof(NDI_DWORD), 1, fp);
+			if (IsBigEndian())
+			{
+				Masks[n] = FlipDWORD(Masks[n]);
+			}
+		}
+	}
+
+	if (!NotCorrupted || bmfh.bfType != 19778
+		|| (bmih.biCompression != 0 && (bmih.biCompression != 3 || bmih.biBitCount != 32))
+		|| Masks[0] != 0x00FF0000 || Masks[1] != 0x0000FF00 || Masks[2] != 0x000000FF
+		|| (bmih.biBitCount != 8 && bmih.biBitCount != 24 && bmih.biBitCount != 32)
+		|| (int)bmih.biWidth <= 0 || (int)bmih.biHeight <= 0)
+	{
+		return false;
+	}
+	Layout.Alpha = bmih.biCompression == 3 && Masks[3] == 0xFF000000;
+
+	// the color table comes after the info header, and after the masks that follow a short one
+	Layout.ColorOffset = 14 + (long long)bmih.biSize + (bmih.biCompression == 3 && bmih.biSize < 52 ? 3 * 4 : 0);
+	Layout.NumberOfColors = 0;
+	if (bmih.biBitCount == 8 && (long long)bmfh.bfOffBits > Layout.ColorOffset)
+	{
+		Layout.NumberOfColors = (int)(((long long)bmfh.bfOffBits - Layout.ColorOffset) / 4);
+		Layout.NumberOfColors = Layout.NumberOfColors > 256 ? 256 : Layout.NumberOfColors;
+	}
+	Layout.Gray = bmih.biBitCount >= 24 && bmih.biClrUsed == 256 && (long long)bmfh.bfOffBits >= Layout.ColorOffset + 256 * 4
+		&& SeekFile(fp, Layout.ColorOffset, SEEK_SET) && ReadGrayColorTable(fp);
+
+	Layout.Width = (int)bmih.biWidth;
+	Layout.Height = (int)bmih.biHeight;
+	Layout.BitDepth = (int)bmih.biBitCount;
+	Layout.PixelOffset = (long long)bmfh.bfOffBits;
+	return true;
+}
+
+bool BMP::ReadRowsFromFile(const char* FileName, int FirstRow, int NumberOfRows)
+{
+	using namespace std;
+	FILE* fp = fopen(FileName, "rb");
+	if (fp == NULL)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot open file "
+				<< FileName << " for input." << endl;
+		}
+		return false;
+	}
+
+	BMPRowLayout Layout;
+	if (!ReadRowLayout(fp, Layout) || FirstRow < 0 || FirstRow >= Layout.Height || NumberOfRows < 1)
+	{
+		fclose(fp);
+		return false;
+	}
+	if (NumberOfRows > Layout.Height - FirstRow)
+	{
+		NumberOfRows = Layout.Height - FirstRow;
+	}
+
+	SetBitDepth(Layout.BitDepth);
+	AlphaChannel = Layout.Alpha;
+	Grayscale = Layout.Gray;
+	SetSize(Layout.Width, NumberOfRows);
+
+	// the colors missing from a short table are white, as ReadFromFile makes them
+	bool Success = true;
+	if (BitDepth == 8)
+	{
+		Success = SeekFile(fp, Layout.ColorOffset, SEEK_SET);
+		for (int n = 0; n < GetNumberOfColors(); n++)
+		{
+			Pixel WHITE;
+			WHITE.Red = 255;
+			WHITE.Green = 255;
+			WHITE.Blue = 255;
+			WHITE.Alpha = 0;
+			Success = Success && (n >= Layout.NumberOfColors || SafeFread((char*) &(Colors[n]), 4, 1, fp));
+			if (n >= Layout.NumberOfColors)
+			{
+				SetColor(n, WHITE);
+			}
+		}
+	}
+
+	int RowBytes = Width * BitDepth / 8;
+	int BufferSize = (RowBytes + 3) / 4 * 4;
+
+	// the rows are stored bottom-up, so the last of the wanted rows comes first
+	// and all of them follow each other
+	long long Offset = Layout.PixelOffset + (long long)(Layout.Height - FirstRow - NumberOfRows) * BufferSize;
+	Success = Success && SeekFile(fp, Offset, SEEK_SET);
+
+	NDI_BYTE* Buffer = new NDI_BYTE[BufferSize];
+	for (int j = Height - 1; j >= 0 && Success; j--)
+	{
+		Success = (int)fread((char*)Buffer, 1, BufferSize, fp) == BufferSize;
+		if (Success && BitDepth == 8)
+		{
+			Success = Read8bitRow(Buffer, BufferSize, j);
+		}
+		if (Success && BitDepth == 24)
+		{
+			Success = Read24bitRow(Buffer, BufferSize, j);
+		}
+		if (Success && BitDepth == 32)
+		{
+			Success = Read32bitRow(Buffer, BufferSize, j);
+		}
+	}
+	delete[] Buffer;
+
+	if (!Success && NexusWarnings)
+	{
+		cout << "Nexus Error: Could not read proper amount of data." << endl;
+	}
+	fclose(fp);
+	return Success;
+}
+
+bool BMP::WriteRowsToFile(const char* FileName, int FirstRow)
+{
+	using namespace std;
+	FILE* fp = fopen(FileName, "r+b");
+	if (fp == NULL)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot open file "
+				<< FileName << " for output." << endl;
+		}
+		return false;
+	}
+
+	BMPRowLayout Layout;
+	if (!ReadRowLayout(fp, Layout)
+		|| Layout.Width != Width || Layout.BitDepth != BitDepth || (BitDepth == 32 && Layout.Alpha != AlphaChannel)
+		|| Layout.Gray != Grayscale || FirstRow < 0 || FirstRow + Height > Layout.Height)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	int RowBytes = Width * BitDepth / 8;
+	int BufferSize = (RowBytes + 3) / 4 * 4;
+	long long Offset = Layout.PixelOffset + (long long)(Layout.Height - FirstRow - Height) * BufferSize;
+	bool Success = SeekFile(fp, Offset, SEEK_SET);
+
+	// only the pixels are written, the padding of the file stays as it is
+	NDI_BYTE* Buffer = new NDI_BYTE[BufferSize];
+	IndexColors();
+	for (int j = Height - 1; j >= 0 && Success; j--)
+	{
+		if (BitDepth == 8)
+		{
+			Write8bitRow(Buffer, BufferSize, j);
+		}
+		if (BitDepth == 24)
+		{
+			Write24bitRow(Buffer, BufferSize, j);
+		}
+		if (BitDepth == 32)
+		{
+			Write32bitRow(Buffer, BufferSize, j);
+		}
+		Success = (int)fwrite((char*)Buffer, 1, RowBytes, fp) == RowBytes
+			&& SeekFile(fp, BufferSize - RowBytes, SEEK_CUR);
+	}
+	delete[] Buffer;
+	ColorIndex.clear();
+	NearColors.clear();
+	NearColorStart.clear();
+	NearColorEnd.clear();
+
+	if (!Success && NexusWarnings)
+	{
+		cout << "Nexus Error: Could not write proper amount of data." << endl;
+	}
+	fclose(fp);
+	return Success;
+}
+
+bool BMP::WriteHeaderToFile(const char* FileName, int FileHeight)
+{
+	using namespace std;
+	if (!NexusCheckDataSize() || FileHeight < 1)
+	{
+		return false;
+	}
+	FILE* fp = fopen(FileName, "wb");
+	if (fp == NULL)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot open file "
+				<< FileName << " for output." << endl;
+		}
+		return false;
+	}
+	NDI_DWORD FileSize;
+	WriteHeader(fp, FileHeight, FileSize);
+
+	// the last byte of the pixels makes the file its whole size
+	NDI_BYTE Zero = 0;
+	bool Success = SeekFile(fp, (long long)FileSize - 1, SEEK_SET) && fwrite((char*)&Zero, 1, 1, fp) == 1;
+	if (fclose(fp) != 0)
+	{
+		Success = false;
+	}
+	if (!Success && NexusWarnings)
+	{
+		cout << "Nexus Error: Could not write proper amount of data." << endl;
+	}
+	return Success;
+}
+
+bool BMP::CreateStandardColorTable(void)
+{
+	using namespace std;
+	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Attempted to create color table at a bit" << endl
+				<< "               depth that does not require a color table." << endl
+				<< "               Ignoring request." << endl;
+		}
+		return false;
+	}
+
+	if (BitDepth == 1)
+	{
+		int i;
+		for (i = 0; i < 2; i++)
+		{
+			Colors[i].Red = i * 255;
+			Colors[i].Green = i * 255;
+			Colors[i].Blue = i * 255;
+			Colors[i].Alpha = 0;
+		}
+		return true;
+	}
+
+	if (BitDepth == 4)
+	{
+		int i = 0;
+		int j, k, ell;
+
+		// simplify the code for the first 8 colors
+		for (ell = 0; ell < 2; ell++)
+		{
+			for (k = 0; k < 2; k++)
+			{
+				for (j = 0; j < 2; j++)
+				{
+					Colors[i].Red = j * 128;
+					Colors[i].Green = k * 128;
+					Colors[i].Blue = ell * 128;
+					i++;
+				}
+			}
+		}
+
+		// simplify the code for the last 8 colors
+		for (ell = 0; ell < 2; ell++)
+		{
+			for (k = 0; k < 2; k++)
+			{
+				for (j = 0; j < 2; j++)
+				{
+					Colors[i].Red = j * 255;
+					Colors[i].Green = k * 255;
+					Colors[i].Blue = ell * 255;
+					i++;
+				}
+			}
+		}
+
+		// overwrite the duplicate color
+		i = 8;
+		Colors[i].Red = 192;
+		Colors[i].Green = 192;
+		Colors[i].Blue = 192;
+
+		for (i = 0; i < 16; i++)
+		{
+			Colors[i].Alpha = 0;
+		}
+		return true;
+	}
+
+	if (BitDepth == 8)
+	{
+		int i = 0;
+		int j, k, ell;
+
+		// do an easy loop, which works for all but colors 
+		// 0 to 9 and 246 to 255
+		for (ell = 0; ell < 4; ell++)
+		{
+			for (k = 0; k < 8; k++)
+			{
+				for (j = 0; j < 8; j++)
+				{
+					Colors[i].Red = j * 32;
+					Colors[i].Green = k * 32;
+					Colors[i].Blue = ell * 64;
+					Colors[i].Alpha = 0;
+					i++;
+				}
+			}
+		}
+
+		// now redo the first 8 colors  
+		i = 0;
+		for (ell = 0; ell < 2; ell++)
+		{
+			for (k = 0; k < 2; k++)
+			{
+				for (j = 0; j < 2; j++)
+				{
+					Colors[i].Red = j * 128;
+					Colors[i].Green = k * 128;
+					Colors[i].Blue = ell * 128;
+					i++;
+				}
+			}
+		}
+
+		// overwrite colors 7, 8, 9
+		i = 7;
+		Colors[i].Red = 192;
+		Colors[i].Green = 192;
+		Colors[i].Blue = 192;
+		i++; // 8
+		Colors[i].Red = 192;
+		Colors[i].Green = 220;
+		Colors[i].Blue = 192;
+		i++; // 9
+		Colors[i].Red = 166;
+		Colors[i].Green = 202;
+		Colors[i].Blue = 240;
+
+		// overwrite colors 246 to 255 
+		i = 246;
+		Colors[i].Red = 255;
+		Colors[i].Green = 251;
+		Colors[i].Blue = 240;
+		i++; // 247
+		Colors[i].Red = 160;
+		Colors[i].Green = 160;
+		Colors[i].Blue = 164;
+		i++; // 248
+		Colors[i].Red = 128;
+		Colors[i].Green = 128;
+		Colors[i].Blue = 128;
+		i++; // 249
+		Colors[i].Red = 255;
+		Colors[i].Green = 0;
+		Colors[i].Blue = 0;
+		i++; // 250
+		Colors[i].Red = 0;
+		Colors[i].Green = 255;
+		Colors[i].Blue = 0;
+		i++; // 251
+		Colors[i].Red = 255;
+		Colors[i].Green = 255;
+		Colors[i].Blue = 0;
+		i++; // 252
+		Colors[i].Red = 0;
+		Colors[i].Green = 0;
+		Colors[i].Blue = 255;
+		i++; // 253
+		Colors[i].Red = 255;
+		Colors[i].Green = 0;
+		Colors[i].Blue = 255;
+		i++; // 254
+		Colors[i].Red = 0;
+		Colors[i].Green = 255;
+		Colors[i].Blue = 255;
+		i++; // 255
+		Colors[i].Red = 255;
+		Colors[i].Green = 255;
+		Colors[i].Blue = 255;
+
+		return true;
+	}
+	return true;
+}
+
+bool SafeFread(char* buffer, int size, int number, FILE* fp)
+{
+	using namespace std;
+	int ItemsRead;
+	if (feof(fp))
+	{
+		return false;
+	}
+	ItemsRead = (int)fread(buffer, size, number, fp);
+	if (ItemsRead < number)
+	{
+		return false;
+	}
+	return true;
+}
+
+void BMP::SetDPI(int HorizontalDPI, int VerticalDPI)
+{
+	XPelsPerMeter = (int)(HorizontalDPI * 39.37007874015748);
+	YPelsPerMeter = (int)(VerticalDPI * 39.37007874015748);
+}
+
+// int BMP::GetVerticalDPI( void ) const
+int BMP::GetVerticalDPI(void)
+{
+	if (!YPelsPerMeter)
+	{
+		YPelsPerMeter = DefaultYPelsPerMeter;
+	}
+	return (int)(YPelsPerMeter / (double) 39.37007874015748);
+}
+
+// int BMP::GetHorizontalDPI( void ) const
+int BMP::GetHorizontalDPI(void)
+{
+	if (!XPelsPerMeter)
+	{
+		XPelsPerMeter = DefaultXPelsPerMeter;
+	}
+	return (int)(XPelsPerMeter / (double) 39.37007874015748);
+}
+
+/* These functions are defined in Nexus_VariousBMPutilities.h */
+
+BMFH GetBMFH(const char* szFileNameIn)
+{
+	using namespace std;
+	BMFH bmfh;
+
+	FILE* fp;
+	fp = fopen(szFileNameIn, "rb");
+
+	if (!fp)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot initialize from file "
+				<< szFileNameIn << "." << endl
+				<< "              File cannot be opened or does not exist."
+				<< endl;
+		}
+		bmfh.bfType = 0;
+		return bmfh;
+	}
+
+	SafeFread((char*) &(bmfh.bfType), sizeof(NDI_WORD), 1, fp);
+	SafeFread((char*) &(bmfh.bfSize), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmfh.bfReserved1), sizeof(NDI_WORD), 1, fp);
+	SafeFread((char*) &(bmfh.bfReserved2), sizeof(NDI_WORD), 1, fp);
+	SafeFread((char*) &(bmfh.bfOffBits), sizeof(NDI_DWORD), 1, fp);
+
+	fclose(fp);
+
+	if (IsBigEndian())
+	{
+		bmfh.SwitchEndianess();
+	}
+
+	return bmfh;
+}
+
+BMIH GetBMIH(const char* szFileNameIn)
+{
+	using namespace std;
+	BMFH bmfh;
+	BMIH bmih;
+
+	FILE* fp;
+	fp = fopen(szFileNameIn, "rb");
+
+	if (!fp)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot initialize from file "
+				<< szFileNameIn << "." << endl
+				<< "              File cannot be opened or does not exist."
+				<< endl;
+		}
+		return bmih;
+	}
+
+	// read the bmfh, i.e., first 14 bytes (just to get it out of the way);
+
+	NDI_BYTE TempBYTE;
+	int i;
+	for (i = 14; i > 0; i--)
+	{
+		SafeFread((char*)&TempBYTE, sizeof(NDI_BYTE), 1, fp);
+	}
+
+	// read the bmih 
+
+	SafeFread((char*) &(bmih.biSize), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmih.biWidth), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmih.biHeight), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmih.biPlanes), sizeof(NDI_WORD), 1, fp);
+
+	SafeFread((char*) &(bmih.biBitCount), sizeof(NDI_WORD), 1, fp);
+	SafeFread((char*) &(bmih.biCompression), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmih.biSizeImage), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmih.biXPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+
+	SafeFread((char*) &(bmih.biYPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmih.biClrUsed), sizeof(NDI_DWORD), 1, fp);
+	SafeFread((char*) &(bmih.biClrImportant), sizeof(NDI_DWORD), 1, fp);
+
+	fclose(fp);
+
+	if (IsBigEndian())
+	{
+		bmih.SwitchEndianess();
+	}
+
+	return bmih;
+}
+
+void DisplayBitmapInfo(const char* szFileNameIn)
+{
+	using namespace std;
+	FILE* fp;
+	fp = fopen(szFileNameIn, "rb");
+
+	if (!fp)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: Cannot initialize from file "
+				<< szFileNameIn << "." << endl
+				<< "              File cannot be opened or does not exist."
+				<< endl;
+		}
+		return;
+	}
+	fclose(fp);
+
+	// don't duplicate work! Just use the functions from above!
+
+	BMFH bmfh = GetBMFH(szFileNameIn);
+	BMIH bmih = GetBMIH(szFileNameIn);
+
+	cout << "File information for file " << szFileNameIn
+		<< ":" << endl << endl;
+
+	cout << "BITMAPFILEHEADER:" << endl
+		<< "bfType: " << bmfh.bfType << endl
+		<< "bfSize: " << bmfh.bfSize << endl
+		<< "bfReserved1: " << bmfh.bfReserved1 << endl
+		<< "bfReserved2: " << bmfh.bfReserved2 << endl
+		<< "bfOffBits: " << bmfh.bfOffBits << endl << endl;
+
+	cout << "BITMAPINFOHEADER:" << endl
+		<< "biSize: " << bmih.biSize << endl
+		<< "biWidth: " << bmih.biWidth << endl
+		<< "biHeight: " << bmih.biHeight << endl
+		<< "biPlanes: " << bmih.biPlanes << endl
+		<< "biBitCount: " << bmih.biBitCount << endl
+		<< "biCompression: " << bmih.biCompression << endl
+		<< "biSizeImage: " << bmih.biSizeImage << endl
+		<< "biXPelsPerMeter: " << bmih.biXPelsPerMeter << endl
+		<< "biYPelsPerMeter: " << bmih.biYPelsPerMeter << endl
+		<< "biClrUsed: " << bmih.biClrUsed << endl
+		<< "biClrImportant: " << bmih.biClrImportant << endl << endl;
+	return;
+}
+
+int GetBitmapColorDepth(const char* szFileNameIn)
+{
+	BMIH bmih = GetBMIH(szFileNameIn);
+	return (int)bmih.biBitCount;
+}
+
+void PixelToPixelCopy(BMP& From, int FromX, int FromY,
+	BMP& To, int ToX, int ToY)
+{
+	*To(ToX, ToY) = *From(FromX, FromY);
+	return;
+}
+
+void PixelToPixelCopyTransparent(BMP& From, int FromX, int FromY,
+	BMP& To, int ToX, int ToY,
+	Pixel& Transparent)
+{
+	if (From(FromX, FromY)->Red != Transparent.Red ||
+		From(FromX, FromY)->Green != Transparent.Green ||
+		From(FromX, FromY)->Blue != Transparent.Blue)
+	{
+		*To(ToX, ToY) = *From(FromX, FromY);
+	}
+	return;
+}
+
+// the copies of ranges of pixels go a column at a time, whose pixels are next to each other; one of at least
+// BlitParallelPixels pixels goes a group of BlitGroupColumns columns at a time on each core
+static const int BlitGroupColumns = 64;
+static const size_t BlitParallelPixels = 1 << 20;
+
+// clips a copy of the columns FromL to FromR and rows FromT to FromB (or FromB to FromT) of From to To at ToX, ToY
+// to the pixels that are in both images; returns false if none are
+static bool ClipBlit(BMP& From, int& FromL, int& FromR, int& FromB, int& FromT, BMP& To, int& ToX, int& ToY)
+{
+	// make sure the conventions are followed
+	if (FromB < FromT)
+	{
+		int Temp = FromT; FromT = FromB; FromB = Temp;
+	}
+
+	// make sure that the copied regions exist in both bitmaps
+	if (FromL < 0) { FromL = 0; }
+	if (FromT < 0) { FromT = 0; }
+	if (ToX < 0)
+	{
+		FromL -= ToX; ToX = 0;
+	}
+	if (ToY < 0)
+	{
+		FromT -= ToY; ToY = 0;
+	}
+	if (FromR >= From.GetWidth())
+	{
+		FromR = From.GetWidth() - 1;
+	}
+	if (FromB >= From.GetHeight())
+	{
+		FromB = From.GetHeight() - 1;
+	}
+	if (ToX + (FromR - FromL) >= To.GetWidth())
+	{
+		FromR = To.GetWidth() - 1 + FromL - ToX;
+	}
+	if (ToY + (FromB - FromT) >= To.GetHeight())
+	{
+		FromB = To.GetHeight() - 1 + FromT - ToY;
+	}
+	return FromL <= FromR && FromT <= FromB;
+}
+
+#ifdef NEXUS_BMP_X86
+// BlitColumnTransparent 4 pixels at a time, the ones whose blue, green and red are the key keep the pixel of to;
+// returns how many pixels it copied
+NEXUS_BMP_TARGET_SSE2 static int BlitColumnTransparentSSE2(const Pixel* from, Pixel* to, int rows, const Pixel& transparent)
+{
+	__m128i Key = _mm_set1_epi32((int)((NDI_DWORD)transparent.Blue | ((NDI_DWORD)transparent.Green << 8)
+		| ((NDI_DWORD)transparent.Red << 16)));
+	__m128i Color = _mm_set1_epi32(0x00FFFFFF);
+	int j = 0;
+	for (; j + 4 <= rows; j += 4)
+	{
+		__m128i Source = _mm_loadu_si128((const __m128i*)(from + j));
+		__m128i Target = _mm_loadu_si128((const __m128i*)(to + j));
+		__m128i Keep = _mm_cmpeq_epi32(_mm_and_si128(Source, Color), Key);
+		_mm_storeu_si128((__m128i*)(to + j), _mm_or_si128(_mm_and_si128(Keep, Target), _mm_andnot_si128(Keep, Source)));
+	}
+	return j;
+}
+#endif
+
+// copies the rows pixels of a column at from to to, but the ones of the color of transparent
+static void BlitColumnTransparent(const Pixel* from, Pixel* to, int rows, const Pixel& transparent)
+{
+	int j = 0;
+#ifdef NEXUS_BMP_X86
+	j = BlitColumnTransparentSSE2(from, to, rows, transparent);
+#endif
+	for (; j < rows; j++)
+	{
+		if (from[j].Red != transparent.Red ||
+			from[j].Green != transparent.Green ||
+			from[j].Blue != transparent.Blue)
+		{
+			to[j] = from[j];
+		}
+	}
+}
+
+// RangedPixelToPixelCopy, or RangedPixelToPixelCopyTransparent with transparent; a range copied within one
+// image over itself is copied from a copy of it
+static void Blit(BMP& From, int FromL, int FromR, int FromB, int FromT, BMP& To, int ToX, int ToY,
+	const Pixel* transparent)
+{
+	if (!ClipBlit(From, FromL, FromR, FromB, FromT, To, ToX, ToY))
+	{
+		return;
+	}
+	int Columns = FromR - FromL + 1;
+	int Rows = FromB - FromT + 1;
+
+	std::vector<Pixel> Range;
+	if (&From == &To && FromL < ToX + Columns && ToX <= FromR && FromT < ToY + Rows && ToY <= FromB)
+	{
+		Range.resize((size_t)Columns * Rows);
+		for (int i = 0; i < Columns; i++)
+		{
+			memcpy(&Range[(size_t)i * Rows], From(FromL + i, FromT), Rows * sizeof(Pixel));
+		}
+	}
+
+	int GroupColumns = (size_t)Columns * Rows >= BlitParallelPixels ? BlitGroupColumns : Columns;
+	ParallelFor((Columns + GroupColumns - 1) / GroupColumns, [&](size_t group)
+	{
+		int First = (int)group * GroupColumns;
+		int Last = First + GroupColumns < Columns ? First + GroupColumns : Columns;
+		for (int i = First; i < Last; i++)
+		{
+			const Pixel* Source = Range.empty() ? From(FromL + i, FromT) : &Range[(size_t)i * Rows];
+			Pixel* Target = To(ToX + i, ToY);
+			if (transparent)
+			{
+				BlitColumnTransparent(Source, Target, Rows, *transparent);
+			}
+			else
+			{
+				memcpy(Target, Source, Rows * sizeof(Pixel));
+			}
+		}
+	});
+}
+
+void RangedPixelToPixelCopy(BMP& From, int FromL, int FromR, int FromB, int FromT,
+	BMP& To, int ToX, int ToY)
+{
+	Blit(From, FromL, FromR, FromB, FromT, To, ToX, ToY, NULL);
+	return;
+}
+
+void RangedPixelToPixelCopyTransparent(
+	BMP& From, int FromL, int FromR, int FromB, int FromT,
+	BMP& To, int ToX, int ToY,
+	Pixel& Transparent)
+{
+	Blit(From, FromL, FromR, FromB, FromT, To, ToX, ToY, &Transparent);
+	return;
+}
+
+bool CreateGrayscaleColorTable(BMP& InputImage)
+{
+	using namespace std;
+	int BitDepth = InputImage.GetBitDepth();
+	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Attempted to create color table at a bit" << endl
+				<< "               depth that does not require a color table." << endl
+				<< "               Ignoring request." << endl;
+		}
+		return false;
+	}
+	int i;
+	int NumberOfColors = InputImage.GetNumberOfColors();
+
+	NDI_BYTE StepSize;
+	if (BitDepth != 1)
+	{
+		StepSize = 255 / (NumberOfColors - 1);
+	}
+	else
+	{
+		StepSize = 255;
+	}
+
+	for (i = 0; i < NumberOfColors; i++)
+	{
+		NDI_BYTE TempBYTE = i*StepSize;
+		Pixel TempColor;
+		TempColor.Red = TempBYTE;
+		TempColor.Green = TempBYTE;
+		TempColor.Blue = TempBYTE;
+		TempColor.Alpha = 0;
+		InputImage.SetColor(i, TempColor);
+	}
+	return true;
+}
+
+// the box of 8 by 8 by 8 colors a color is in, of the 32 by 32 by 32 boxes of an inverse color map
+static inline int ColorBox(const Pixel& color)
+{
+	return ((color.Red >> 3) << 10) | ((color.Green >> 3) << 5) | (color.Blue >> 3);
+}
+
+// fills inverse, by ColorBox, with the index of the first of the count colors nearest to the middle of each box,
+// a plane of red at a time on each core
+static void InverseColorMap(const Pixel* colors, int count, std::vector<NDI_BYTE>& inverse)
+{
+	inverse.resize(32 * 32 * 32);
+	ParallelFor(32, [&](size_t r)
+	{
+		int Red = (int)r * 8 + 4;
+		for (int g = 0; g < 32; g++)
+		{
+			int Green = g * 8 + 4;
+			for (int b = 0; b < 32; b++)
+			{
+				int Blue = b * 8 + 4;
+				int BestI = 0;
+				int BestMatch = 999999;
+				for (int i = 0; i < count; i++)
+				{
+					int TempMatch = IntSquare((int)colors[i].Red - Red)
+						+ IntSquare((int)colors[i].Green - Green)
+						+ IntSquare((int)colors[i].Blue - Blue);
+					if (TempMatch < BestMatch)
+					{
+						BestI = i; BestMatch = TempMatch;
+					}
+				}
+				inverse[((int)r << 10) | (g << 5) | b] = (NDI_BYTE)BestI;
+			}
+		}
+	});
+}
+
+// adds the least and the most squared distance, along one channel, from Value to the 8 values from Low on
+static inline void ChannelReach(int Value, int Low, int& Near, int& Far)
+{
+	int Below = Value - Low, Above = Value - (Low + 7);
+	Near += Below < 0 ? Below * Below : Above > 0 ? Above * Above : 0;
+	Far += Below * Below > Above * Above ? Below * Below : Above * Above;
+}
+
+// appends to lists the colors of the table, of count colors, that can be the nearest to some color of box (of
+// ColorBox), in the order of the table: those whose nearest point of the box is no further than the furthest
+// point of the box is from another color
+static void AppendNearColors(const Pixel* colors, int count, int box, std::vector<NDI_BYTE>& lists)
+{
+	const int Red = (box >> 10) * 8, Green = ((box >> 5) & 31) * 8, Blue = (box & 31) * 8;
+	int Limit = 3 * 255 * 255;
+	for (int i = 0; i < count; i++)
+	{
+		int Near = 0, Far = 0;
+		ChannelReach(colors[i].Red, Red, Near, Far);
+		ChannelReach(colors[i].Green, Green, Near, Far);
+		ChannelReach(colors[i].Blue, Blue, Near, Far);
+		Limit = Far < Limit ? Far : Limit;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		int Near = 0, Far = 0;
+		ChannelReach(colors[i].Red, Red, Near, Far);
+		ChannelReach(colors[i].Green, Green, Near, Far);
+		ChannelReach(colors[i].Blue, Blue, Near, Far);
+		if (Near <= Limit)
+		{
+			lists.push_back((NDI_BYTE)i);
+		}
+	}
+}
+
+// the pixels of a histogram box and the sums of their red, green and blue
+struct ColorCount
+{
+	unsigned long long Pixels, Red, Green, Blue;
+};
+
+// a box of the histogram, from Low to High on each of red, green and blue, that median cut splits
+struct ColorCut
+{
+	int Low[3], High[3];
+	unsigned long long Pixels;
+};
+
+static inline int ColorCutBox(int r, int g, int b)
+{
+	return (r << 10) | (g << 5) | b;
+}
+
+// shrinks cut to the boxes of the histogram that have pixels, and counts them
+static void ShrinkColorCut(ColorCut& cut, const std::vector<ColorCount>& histogram)
+{
+	int Low[3] = { 32, 32, 32 };
+	int High[3] = { -1, -1, -1 };
+	cut.Pixels = 0;
+	for (int r = cut.Low[0]; r <= cut.High[0]; r++)
+	{
+		for (int g = cut.Low[1]; g <= cut.High[1]; g++)
+		{
+			for (int b = cut.Low[2]; b <= cut.High[2]; b++)
+			{
+				unsigned long long Pixels = histogram[ColorCutBox(r, g, b)].Pixels;
+				if (Pixels)
+				{
+					int Box[3] = { r, g, b };
+					for (int k = 0; k < 3; k++)
+					{
+						Low[k] = Box[k] < Low[k] ? Box[k] : Low[k];
+						High[k] = Box[k] > High[k] ? Box[k] : High[k];
+					}
+					cut.Pixels += Pixels;
+				}
+			}
+		}
+	}
+	if (cut.Pixels)
+	{
+		memcpy(cut.Low, Low, sizeof(Low));
+		memcpy(cut.High, High, sizeof(High));
+	}
+}
+
+bool CreateOptimalColorTable(BMP& InputImage)
+{
+	using namespace std;
+	int BitDepth = InputImage.GetBitDepth();
+	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Attempted to create color table at a bit" << endl
+				<< "               depth that does not require a color table." << endl
+				<< "               Ignoring request." << endl;
+		}
+		return false;
+	}
+	int Width = InputImage.GetWidth();
+	int Height = InputImage.GetHeight();
+	int NumberOfColors = InputImage.GetNumberOfColors();
+
+	// a histogram of the columns of each core, added up after (the pixels of a column are next to each other)
+	size_t Parts = std::thread::hardware_concurrency();
+	Parts = Parts < 1 ? 1 : (Parts > (size_t)Width ? (size_t)Width : Parts);
+	vector<vector<ColorCount> > Histograms(Parts, vector<ColorCount>(32 * 32 * 32, ColorCount()));
+	ParallelFor(Parts, [&](size_t part)
+	{
+		vector<ColorCount>& Histogram = Histograms[part];
+		for (int i = (int)(Width * part / Parts); i < (int)(Width * (part + 1) / Parts); i++)
+		{
+			for (int j = 0; j < Height; j++)
+			{
+				Pixel* Color = InputImage(i, j);
+				ColorCount& Count = Histogram[ColorBox(*Color)];
+				Count.Pixels++;
+				Count.Red += Color->Red;
+				Count.Green += Color->Green;
+				Count.Blue += Color->Blue;
+			}
+		}
+	});
+	vector<ColorCount>& Histogram = Histograms[0];
+	for (size_t part = 1; part < Parts; part++)
+	{
+		for (size_t n = 0; n < Histogram.size(); n++)
+		{
+			Histogram[n].Pixels += Histograms[part][n].Pixels;
+			Histogram[n].Red += Histograms[part][n].Red;
+			Histogram[n].Green += Histograms[part][n].Green;
+			Histogram[n].Blue += Histograms[part][n].Blue;
+		}
+	}
+
+	// splits the cut with the most pixels times its longest side, along that side where half its pixels are
+	vector<ColorCut> Cuts(1);
+	for (int k = 0; k < 3; k++)
+	{
+		Cuts[0].Low[k] = 0;
+		Cuts[0].High[k] = 31;
+	}
+	ShrinkColorCut(Cuts[0], Histogram);
+	while (Cuts[0].Pixels && (int)Cuts.size() < NumberOfColors)
+	{
+		int Best = -1, Side = 0;
+		unsigned long long BestSize = 0;
+		for (int n = 0; n < (int)Cuts.size(); n++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned long long Size = Cuts[n].Pixels * (unsigned long long)(Cuts[n].High[k] - Cuts[n].Low[k]);
+				if (Size > BestSize)
+				{
+					Best = n; Side = k; BestSize = Size;
+				}
+			}
+		}
+		if (Best < 0)
+		{
+			break;
+		}
+
+		ColorCut& Cut = Cuts[Best];
+		vector<unsigned long long> Slices(32, 0);
+		for (int r = Cut.Low[0]; r <= Cut.High[0]; r++)
+		{
+			for (int g = Cut.Low[1]; g <= Cut.High[1]; g++)
+			{
+				for (int b = Cut.Low[2]; b <= Cut.High[2]; b++)
+				{
+					int Box[3] = { r, g, b };
+					Slices[Box[Side]] += Histogram[ColorCutBox(r, g, b)].Pixels;
+				}
+			}
+		}
+		// the last slice of the lower half, which leaves at least one slice for the upper one
+		int Split = Cut.Low[Side];
+		unsigned long long Below = Slices[Split];
+		while (Split + 1 < Cut.High[Side] && 2 * (Below + Slices[Split + 1]) <= Cut.Pixels)
+		{
+			Split++;
+			Below += Slices[Split];
+		}
+
+		ColorCut Upper = Cut;
+		Upper.Low[Side] = Split + 1;
+		Cut.High[Side] = Split;
+		ShrinkColorCut(Cut, Histogram);
+		ShrinkColorCut(Upper, Histogram);
+		Cuts.push_back(Upper);
+	}
+
+	// each cut gives the average of its pixels, the colors left over are black
+	for (int n = 0; n < NumberOfColors; n++)
+	{
+		Pixel TempColor;
+		TempColor.Red = 0;
+		TempColor.Green = 0;
+		TempColor.Blue = 0;
+		TempColor.Alpha = 0;
+		if (n < (int)Cuts.size() && Cuts[n].Pixels)
+		{
+			ColorCount Sum = ColorCount();
+			for (int r = Cuts[n].Low[0]; r <= Cuts[n].High[0]; r++)
+			{
+				for (int g = Cuts[n].Low[1]; g <= Cuts[n].High[1]; g++)
+				{
+					for (int b = Cuts[n].Low[2]; b <= Cuts[n].High[2]; b++)
+					{
+						const ColorCount& Count = Histogram[ColorCutBox(r, g, b)];
+						Sum.Pixels += Count.Pixels;
+						Sum.Red += Count.Red;
+						Sum.Green += Count.Green;
+						Sum.Blue += Count.Blue;
+					}
+				}
+			}
+			TempColor.Red = (NDI_BYTE)((Sum.Red + Sum.Pixels / 2) / Sum.Pixels);
+			TempColor.Green = (NDI_BYTE)((Sum.Green + Sum.Pixels / 2) / Sum.Pixels);
+			TempColor.Blue = (NDI_BYTE)((Sum.Blue + Sum.Pixels / 2) / Sum.Pixels);
+		}
+		InputImage.SetColor(n, TempColor);
+	}
+	return true;
+}
+
+bool QuantizeToColorTable(BMP& InputImage, bool Dither)
+{
+	using namespace std;
+	int BitDepth = InputImage.GetBitDepth();
+	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Warning: Attempted to quantize an image at a bit" << endl
+				<< "               depth that has no color table." << endl
+				<< "               Ignoring request." << endl;
+		}
+		return false;
+	}
+	int Width = InputImage.GetWidth();
+	int Height = InputImage.GetHeight();
+	int NumberOfColors = InputImage.GetNumberOfColors();
+	vector<Pixel> Table(NumberOfColors);
+	for (int n = 0; n < NumberOfColors; n++)
+	{
+		Table[n] = InputImage.GetColor(n);
+	}
+	vector<NDI_BYTE> Inverse;
+	InverseColorMap(&Table[0], NumberOfColors, Inverse);
+
+	if (!Dither)
+	{
+		// a column at a time, its pixels are next to each other
+		ParallelFor(Width, [&](size_t i)
+		{
+			for (int j = 0; j < Height; j++)
+			{
+				Pixel* Color = InputImage((int)i, j);
+				const Pixel& Nearest = Table[Inverse[ColorBox(*Color)]];
+				Color->Red = Nearest.Red;
+				Color->Green = Nearest.Green;
+				Color->Blue = Nearest.Blue;
+			}
+		});
+		return true;
+	}
+
+	// a row at a time on each core, as a wavefront: a segment of a row only starts once the row before is two
+	// columns past it, so all the differences spread to it are in and the rows come out as if gone through in turn.
+	// The differences spread to each row, a pixel to each side of it more, are in a ring of rows that has room for
+	// the rows in progress; a row only clears the one after it once the row that had it before is done
+	const int SegmentColumns = 64;
+	const size_t Rows = (thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1) + 2;
+	vector<vector<int> > Differences(Rows, vector<int>(3 * (Width + 2), 0));
+	unique_ptr<atomic<int>[]> Done(new atomic<int>[Height]());
+	ParallelFor(Height, [&](size_t row)
+	{
+		const int j = (int)row;
+		vector<int>& This = Differences[row % Rows];
+		vector<int>& Next = Differences[(row + 1) % Rows];
+		if (row + 1 >= Rows)
+		{
+			while (Done[row + 1 - Rows].load(memory_order_acquire) < Width)
+			{
+				this_thread::yield();
+			}
+		}
+		fill(Next.begin(), Next.end(), 0);
+
+		for (int First = 0; First < Width; First += SegmentColumns)
+		{
+			const int Last = First + SegmentColumns < Width ? First + SegmentColumns : Width;
+			const int Needed = Last + 2 < Width ? Last + 2 : Width;
+			while (j > 0 && Done[j - 1].load(memory_order_acquire) < Needed)
+			{
+				this_thread::yield();
+			}
+			for (int i = First; i < Last; i++)
+			{
+				Pixel* Color = InputImage(i, j);
+				int Wanted[3] = { Color->Red, Color->Green, Color->Blue };
+				for (int k = 0; k < 3; k++)
+				{
+					Wanted[k] += This[3 * (i + 1) + k] / 16;
+					Wanted[k] = Wanted[k] < 0 ? 0 : (Wanted[k] > 255 ? 255 : Wanted[k]);
+				}
+				Pixel Target = *Color;
+				Target.Red = (NDI_BYTE)Wanted[0];
+				Target.Green = (NDI_BYTE)Wanted[1];
+				Target.Blue = (NDI_BYTE)Wanted[2];
+				const Pixel& Nearest = Table[Inverse[ColorBox(Target)]];
+				Color->Red = Nearest.Red;
+				Color->Green = Nearest.Green;
+				Color->Blue = Nearest.Blue;
+				int Got[3] = { Nearest.Red, Nearest.Green, Nearest.Blue };
+				for (int k = 0; k < 3; k++)
+				{
+					int Error = Wanted[k] - Got[k];
+					This[3 * (i + 2) + k] += 7 * Error;
+					Next[3 * i + k] += 3 * Error;
+					Next[3 * (i + 1) + k] += 5 * Error;
+					Next[3 * (i + 2) + k] += Error;
+				}
+			}
+			Done[j].store(Last, memory_order_release);
+		}
+	});
+	return true;
+}
+
+bool BMP::Read32bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int i;
+	if (Width * 4 > BufferSize)
+	{
+		return false;
+	}
+	for (i = 0; i < Width; i++)
+	{
+		memcpy((char*) &(Pixels[i][Row]), (char*)Buffer + 4 * i, 4);
+	}
+	return true;
+}
+
+bool BMP::Read24bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int i;
+	if (Width * 3 > BufferSize)
+	{
+		return false;
+	}
+	for (i = 0; i < Width; i++)
+	{
+		memcpy((char*) &(Pixels[i][Row]), Buffer + 3 * i, 3);
+	}
+	return true;
+}
+
+bool BMP::Read8bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int i;
+	if (Width > BufferSize)
+	{
+		return false;
+	}
+	for (i = 0; i < Width; i++)
+	{
+		int Index = Buffer[i];
+		*(this->operator()(i, Row)) = GetColor(Index);
+	}
+	return true;
+}
+
+bool BMP::Read4bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int Shifts[2] = { 4  ,0 };
+	int Masks[2] = { 240,15 };
+
+	int i = 0;
+	int j;
+	int k = 0;
+	if (Width > 2 * BufferSize)
+	{
+		return false;
+	}
+	while (i < Width)
+	{
+		j = 0;
+		while (j < 2 && i < Width)
+		{
+			int Index = (int)((Buffer[k] & Masks[j]) >> Shifts[j]);
+			*(this->operator()(i, Row)) = GetColor(Index);
+			i++; j++;
+		}
+		k++;
+	}
+	return true;
+}
+
+bool BMP::Read1bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int Shifts[8] = { 7  ,6 ,5 ,4 ,3,2,1,0 };
+	int Masks[8] = { 128,64,32,16,8,4,2,1 };
+
+	int i = 0;
+	int j;
+	int k = 0;
+
+	if (Width > 8 * BufferSize)
+	{
+		return false;
+	}
+	while (i < Width)
+	{
+		j = 0;
+		while (j < 8 && i < Width)
+		{
+			int Index = (int)((Buffer[k] & Masks[j]) >> Shifts[j]);
+			*(this->operator()(i, Row)) = GetColor(Index);
+			i++; j++;
+		}
+		k++;
+	}
+	return true;
+}
+
+bool BMP::Write32bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int i;
+	if (Width * 4 > BufferSize)
+	{
+		return false;
+	}
+	for (i = 0; i < Width; i++)
+	{
+		memcpy((char*)Buffer + 4 * i, (char*) &(Pixels[i][Row]), 4);
+	}
+	return true;
+}
+
+bool BMP::Write24bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int i;
+	if (Width * 3 > BufferSize)
+	{
+		return false;
+	}
+	for (i = 0; i < Width; i++)
+	{
+		memcpy((char*)Buffer + 3 * i, (char*) &(Pixels[i][Row]), 3);
+	}
+	return true;
+}
+
+bool BMP::Write8bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int i;
+	if (Width > BufferSize)
+	{
+		return false;
+	}
+	for (i = 0; i < Width; i++)
+	{
+		Buffer[i] = FindClosestColor(Pixels[i][Row]);
+	}
+	return true;
+}
+
+bool BMP::Write4bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int PositionWeights[2] = { 16,1 };
+
+	int i = 0;
+	int j;
+	int k = 0;
+	if (Width > 2 * BufferSize)
+	{
+		return false;
+	}
+	while (i < Width)
+	{
+		j = 0;
+		int Index = 0;
+		while (j < 2 && i < Width)
+		{
+			Index += (PositionWeights[j] * (int)FindClosestColor(Pixels[i][Row]));
+			i++; j++;
+		}
+		Buffer[k] = (NDI_BYTE)Index;
+		k++;
+	}
+	return true;
+}
+
+bool BMP::Write1bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+{
+	int PositionWeights[8] = { 128,64,32,16,8,4,2,1 };
+
+	int i = 0;
+	int j;
+	int k = 0;
+	if (Width > 8 * BufferSize)
+	{
+		return false;
+	}
+	while (i < Width)
+	{
+		j = 0;
+		int Index = 0;
+		while (j < 8 && i < Width)
+		{
+			Index += (PositionWeights[j] * (int)FindClosestColor(Pixels[i][Row]));
+			i++; j++;
+		}
+		Buffer[k] = (NDI_BYTE)Index;
+		k++;
+	}
+	return true;
+}
+
+void BMP::IndexColors(void)
+{
+	// the first of the same colors is the one that is used
+	ColorIndex.clear();
+	NearColors.clear();
+	NearColorStart.clear();
+	NearColorEnd.clear();
+	if (!Colors || BitDepth > 8)
+	{
+		return;
+	}
+	for (int n = GetNumberOfColors() - 1; n >= 0; n--)
+	{
+		ColorIndex[((NDI_DWORD)Colors[n].Red << 16) | ((NDI_DWORD)Colors[n].Green << 8) | Colors[n].Blue] = (NDI_BYTE)n;
+	}
+	NearColorStart.assign(32 * 32 * 32, -1);
+	NearColorEnd.assign(32 * 32 * 32, 0);
+}
+
+NDI_BYTE BMP::FindClosestColor(Pixel& input)
+{
+	using namespace std;
+
+	std::unordered_map<NDI_DWORD, NDI_BYTE>::const_iterator Index
+		= ColorIndex.find(((NDI_DWORD)input.Red << 16) | ((NDI_DWORD)input.Green << 8) | input.Blue);
+	if (Index != ColorIndex.end())
+	{
+		return Index->second;
+	}
+
+	int i = 0;
+	int NumberOfColors = GetNumberOfColors();
+	NDI_BYTE BestI = 0;
+	int BestMatch = 999999;
+
+	// only the colors that can be nearest to the box of the color are compared, in the order of the table,
+	// so the same one is found as by comparing all of them; they are listed the first time the box comes up
+	if (!NearColorStart.empty())
+	{
+		int Box = ColorBox(input);
+		if (NearColorStart[Box] < 0)
+		{
+			NearColorStart[Box] = (int)NearColors.size();
+			AppendNearColors(Colors, NumberOfColors, Box, NearColors);
+			NearColorEnd[Box] = (int)NearColors.size();
+		}
+		for (int k = NearColorStart[Box]; k < NearColorEnd[Box]; k++)
+		{
+			const Pixel& Attempt = Colors[NearColors[k]];
+			int TempMatch = IntSquare((int)Attempt.Red - (int)input.Red)
+				+ IntSquare((int)Attempt.Green - (int)input.Green)
+				+ IntSquare((int)Attempt.Blue - (int)input.Blue);
+			if (TempMatch < BestMatch)
+			{
+				BestI = NearColors[k]; BestMatch = TempMatch;
+			}
+		}
+		return BestI;
+	}
+
+	while (i < NumberOfColors)
+	{
+		Pixel Attempt = GetColor(i);
+		int TempMatch = IntSquare((int)Attempt.Red - (int)input.Red)
+			+ IntSquare((int)Attempt.Green - (int)input.Green)
+			+ IntSquare((int)Attempt.Blue - (int)input.Blue);
+		if (TempMatch < BestMatch)
+		{
+			BestI = (NDI_BYTE)i; BestMatch = TempMatch;
+		}
+		if (BestMatch < 1)
+		{
+			i = NumberOfColors;
+		}
+		i++;
+	}
+	return BestI;
+}
+
+#ifdef NEXUS_BMP_X86
+// splits 16 pixels into 16 samples of each channel
+NEXUS_BMP_TARGET_SSE2 static void SplitPixelsSSE2(const Pixel* pixels, NDI_BYTE* blue, NDI_BYTE* green, NDI_BYTE* red,
+	NDI_BYTE* alpha)
+{
+	__m128i Four[4];
+	for (int k = 0; k < 4; k++)
+	{
+		Four[k] = _mm_loadu_si128((const __m128i*)(pixels + 4 * k));
+	}
+	NDI_BYTE* Planes[4] = { blue, green, red, alpha };
+	__m128i Low = _mm_set1_epi32(0xFF);
+	for (int c = 0; c < 4; c++)
+	{
+		__m128i Samples[4];
+		for (int k = 0; k < 4; k++)
+		{
+			Samples[k] = _mm_and_si128(_mm_srli_epi32(Four[k], 8 * c), Low);
+		}
+		_mm_storeu_si128((__m128i*)Planes[c], _mm_packus_epi16(_mm_packs_epi32(Samples[0], Samples[1]),
+			_mm_packs_epi32(Samples[2], Samples[3])));
+	}
+}
+
+// joins 16 samples of each channel into 16 pixels
+NEXUS_BMP_TARGET_SSE2 static void JoinPixelsSSE2(const NDI_BYTE* blue, const NDI_BYTE* green, const NDI_BYTE* red,
+	const NDI_BYTE* alpha, Pixel* pixels)
+{
+	__m128i B = _mm_loadu_si128((const __m128i*)blue);
+	__m128i G = _mm_loadu_si128((const __m128i*)green);
+	__m128i R = _mm_loadu_si128((const __m128i*)red);
+	__m128i A = _mm_loadu_si128((const __m128i*)alpha);
+	__m128i BGLow = _mm_unpacklo_epi8(B, G), BGHigh = _mm_unpackhi_epi8(B, G);
+	__m128i RALow = _mm_unpacklo_epi8(R, A), RAHigh = _mm_unpackhi_epi8(R, A);
+	_mm_storeu_si128((__m128i*)pixels, _mm_unpacklo_epi16(BGLow, RALow));
+	_mm_storeu_si128((__m128i*)(pixels + 4), _mm_unpackhi_epi16(BGLow, RALow));
+	_mm_storeu_si128((__m128i*)(pixels + 8), _mm_unpacklo_epi16(BGHigh, RAHigh));
+	_mm_storeu_si128((__m128i*)(pixels + 12), _mm_unpackhi_epi16(BGHigh, RAHigh));
+}
+
+// GetBitPlane of 16 samples: the bit goes to the top of each byte, where movemask takes it from
+NEXUS_BMP_TARGET_SSE2 static int GetBitsSSE2(const NDI_BYTE* samples, int bit)
+{
+	return _mm_movemask_epi8(_mm_slli_epi16(_mm_loadu_si128((const __m128i*)samples), 7 - bit));
+}
+
+// SetBitPlane of 16 samples from the 16 bits in bits
+NEXUS_BMP_TARGET_SSE2 static void SetBitsSSE2(NDI_BYTE* samples, int bit, int bits)
+{
+	__m128i Select = _mm_set_epi8((char)128, 64, 32, 16, 8, 4, 2, 1, (char)128, 64, 32, 16, 8, 4, 2, 1);
+	__m128i Spread = _mm_unpacklo_epi64(_mm_set1_epi8((char)(bits & 0xFF)), _mm_set1_epi8((char)(bits >> 8)));
+	__m128i Set = _mm_cmpeq_epi8(_mm_and_si128(Spread, Select), Select);
+	__m128i Bit = _mm_set1_epi8((char)(1 << bit));
+	__m128i Samples = _mm_loadu_si128((const __m128i*)samples);
+	_mm_storeu_si128((__m128i*)samples, _mm_or_si128(_mm_andnot_si128(Bit, Samples), _mm_and_si128(Set, Bit)));
+}
+#endif
+
+BMPPlanes::BMPPlanes()
+{
+	Width = 0;
+	Height = 0;
+	Stride = 0;
+	Offset = 0;
+}
+
+BMPPlanes::BMPPlanes(BMP& Input)
+{
+	Load(Input);
+}
+
+int BMPPlanes::GetWidth(void) const
+{
+	return Width;
+}
+
+int BMPPlanes::GetHeight(void) const
+{
+	return Height;
+}
+
+NDI_BYTE* BMPPlanes::Plane(int channel)
+{
+	return &Buffer[Offset + channel * Stride];
+}
+
+const NDI_BYTE* BMPPlanes::Plane(int channel) const
+{
+	return &Buffer[Offset + channel * Stride];
+}
+
+void BMPPlanes::Load(BMP& Input)
+{
+	Width = Input.GetWidth();
+	Height = Input.GetHeight();
+	Stride = ((size_t)Width * Height + 63) / 64 * 64;
+	Buffer.assign(4 * Stride + 64, 0);
+	Offset = (64 - (size_t)((uintptr_t)&Buffer[0] & 63)) & 63;
+
+	NDI_BYTE* Planes[4] = { Plane(Blue), Plane(Green), Plane(Red), Plane(Alpha) };
+	for (int i = 0; i < Width; i++)
+	{
+		const Pixel* Column = Input(i, 0);
+		size_t First = (size_t)i * Height;
+		int j = 0;
+#ifdef NEXUS_BMP_X86
+		for (; j + 16 <= Height; j += 16)
+		{
+			SplitPixelsSSE2(Column + j, Planes[Blue] + First + j, Planes[Green] + First + j, Planes[Red] + First + j,
+				Planes[Alpha] + First + j);
+		}
+#endif
+		for (; j < Height; j++)
+		{
+			Planes[Blue][First + j] = Column[j].Blue;
+			Planes[Green][First + j] = Column[j].Green;
+			Planes[Red][First + j] = Column[j].Red;
+			Planes[Alpha][First + j] = Column[j].Alpha;
+		}
+	}
+}
+
+bool BMPPlanes::Store(BMP& Output) const
+{
+	if (Output.GetWidth() != Width || Output.GetHeight() != Height)
+	{
+		return false;
+	}
+	const NDI_BYTE* Planes[4] = { Plane(Blue), Plane(Green), Plane(Red), Plane(Alpha) };
+	for (int i = 0; i < Width; i++)
+	{
+		Pixel* Column = Output(i, 0);
+		size_t First = (size_t)i * Height;
+		int j = 0;
+#ifdef NEXUS_BMP_X86
+		for (; j + 16 <= Height; j += 16)
+		{
+			JoinPixelsSSE2(Planes[Blue] + First + j, Planes[Green] + First + j, Planes[Red] + First + j,
+				Planes[Alpha] + First + j, Column + j);
+		}
+#endif
+		for (; j < Height; j++)
+		{
+			Column[j].Blue = Planes[Blue][First + j];
+			Column[j].Green = Planes[Green][First + j];
+			Column[j].Red = Planes[Red][First + j];
+			Column[j].Alpha = Planes[Alpha][First + j];
+		}
+	}
+	return true;
+}
+
+void BMPPlanes::GetBitPlane(int channel, int bit, std::vector<NDI_BYTE>& Bits) const
+{
+	size_t Count = (size_t)Width * Height;
+	Bits.assign((Count + 7) / 8, 0);
+	const NDI_BYTE* Samples = Plane(channel);
+	size_t n = 0;
+#ifdef NEXUS_BMP_X86
+	for (; n + 16 <= Count; n += 16)
+	{
+		int Sixteen = GetBitsSSE2(Samples + n, bit);
+		Bits[n / 8] = (NDI_BYTE)Sixteen;
+		Bits[n / 8 + 1] = (NDI_BYTE)(Sixteen >> 8);
+	}
+#endif
+	for (; n < Count; n++)
+	{
+		Bits[n / 8] |= (NDI_BYTE)(((Samples[n] >> bit) & 1) << (n % 8));
+	}
+}
+
+bool BMPPlanes::SetBitPlane(int channel, int bit, const std::vector<NDI_BYTE>& Bits)
+{
+	size_t Count = (size_t)Width * Height;
+	if (Bits.size() < (Count + 7) / 8)
+	{
+		return false;
+	}
+	NDI_BYTE* Samples = Plane(channel);
+	size_t n = 0;
+#ifdef NEXUS_BMP_X86
+	for (; n + 16 <= Count; n += 16)
+	{
+		SetBitsSSE2(Samples + n, bit, Bits[n / 8] | (Bits[n / 8 + 1] << 8));
+	}
+#endif
+	for (; n < Count; n++)
+	{
+		Samples[n] = (NDI_BYTE)((Samples[n] & ~(1 << bit)) | (((Bits[n / 8] >> (n % 8)) & 1) << bit));
+	}
+	return true;
+}
+
+void BMPPlanes::Histogram(int channel, size_t Counts[256]) const
+{
+	// four tables, so that samples of the same value in a row don't wait on each other
+	std::vector<size_t> Tables(4 * 256, 0);
+	size_t Count = (size_t)Width * Height;
+	const NDI_BYTE* Samples = Plane(channel);
+	size_t n = 0;
+	for (; n + 4 <= Count; n += 4)
+	{
+		Tables[Samples[n]]++;
+		Tables[256 + Samples[n + 1]]++;
+		Tables[512 + Samples[n + 2]]++;
+		Tables[768 + Samples[n + 3]]++;
+	}
+	for (; n < Count; n++)
+	{
+		Tables[Samples[n]]++;
+	}
+	for (int v = 0; v < 256; v++)
+	{
+		Counts[v] = Tables[v] + Tables[256 + v] + Tables[512 + v] + Tables[768 + v];
+	}
+}
+
+bool NexusCheckDataSize(void)
+{
+	using namespace std;
+	bool ReturnValue = true;
+	if (sizeof(NDI_BYTE) != 1)
+	{
+		if (NexusWarnings)
+		{
+			cout << "Nexus Error: NDI_BYTE has the wrong size ("
+				<< sizeof(NDI_BYTE) << " bytes)," << endl
+				<< "              Compared to the expected 1 byte value" << endl;
+		}
+		ReturnValue = false;
+	}
+	if (sizeof(NDI_WORD) != 2)
+	{
+		if (NexusWarnings)
 		{
-			for (k = 0; k < 2; k++)
-			{
-				for (j = 0; j < 2; j++)
-				{
-					Colors[i].Red = j * 128;
-					Colors[i].Green = k * 128;
-					Colors[i].Blue = ell * 128;
-					i++;
-				}
-			}
+			cout << "Nexus Error: NDI_WORD has the wrong size ("
+				<< sizeof(NDI_WORD) << " bytes)," << endl
+				<< "              Compared to the expected 2 byte value" << endl;
 		}
-
-		// simplify the code for the last 8 colors
-		for (ell = 0; ell < 2; ell++)
+		ReturnValue = false;
+	}
+	if (sizeof(NDI_DWORD) != 4)
+	{
+		if (NexusWarnings)
 		{
-			for (k = 0; k < 2; k++)
-			{
-				for (j = 0; j < 2; j++)
-				{
-					Colors[i].Red = j * 255;
-					Colors[i].Green = k * 255;
-					Colors[i].Blue = ell * 255;
-					i++;
-				}
-			}
+			cout << "Nexus Error: NDI_DWORD has the wrong size ("
+				<< sizeof(NDI_DWORD) << " bytes)," << endl
+				<< "              Compared to the expected 4 byte value" << endl;
 		}
+		ReturnValue = false;
+	}
+	return ReturnValue;
+}
 
-		// overwrite the duplicate color
-		i = 8;
-		Colors[i].Red = 192;
-		Colors[i].Green = 192;
-		Colors[i].Blue = 192;
+// Rescale blends with weights of 7 bits, 0 to 128: a pixel of a column of the image is blended from the two
+// pixels above each other nearest to it into 4 words (blue, green, red and alpha, up to 255 * 128), and the new
+// pixel from the words of the two columns next to each other nearest to it.
 
-		for (i = 0; i < 16; i++)
-		{
-			Colors[i].Alpha = 0;
-		}
-		return true;
+#ifdef NEXUS_BMP_X86
+// RescaleColumn for a column of more than one pixel: the pixel at a row and the one below it are 8 bytes
+NEXUS_BMP_TARGET_SSE2 static void RescaleColumnSSE2(const NDI_BYTE* column, const int* rows, const int* weights,
+	NDI_WORD* out, int count)
+{
+	__m128i Zero = _mm_setzero_si128();
+	for (int j = 0; j < count; j++)
+	{
+		__m128i Weights = _mm_set_epi16((short)weights[j], (short)weights[j], (short)weights[j], (short)weights[j],
+			(short)(128 - weights[j]), (short)(128 - weights[j]), (short)(128 - weights[j]), (short)(128 - weights[j]));
+		__m128i Pair = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(column + 4 * rows[j])), Zero);
+		__m128i Products = _mm_mullo_epi16(Pair, Weights);
+		_mm_storel_epi64((__m128i*)(out + 4 * j), _mm_add_epi16(Products, _mm_srli_si128(Products, 8)));
 	}
+}
 
-	if (BitDepth == 8)
+// RescaleRow for count words, a multiple of 8: each left and right word side by side, times their weights
+NEXUS_BMP_TARGET_SSE2 static void RescaleRowSSE2(const NDI_WORD* left, const NDI_WORD* right, int weight,
+	NDI_BYTE* out, int count)
+{
+	__m128i Weights = _mm_set1_epi32(((weight & 0xFFFF) << 16) | (128 - weight));
+	__m128i Half = _mm_set1_epi32(8192);
+	for (int k = 0; k < count; k += 8)
 	{
-		int i = 0;
-		int j, k, ell;
+		__m128i Left = _mm_loadu_si128((const __m128i*)(left + k));
+		__m128i Right = _mm_loadu_si128((const __m128i*)(right + k));
+		__m128i Low = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(Left, Right), Weights), Half), 14);
+		__m128i High = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(Left, Right), Weights), Half), 14);
+		__m128i Words = _mm_packs_epi32(Low, High);
+		_mm_storel_epi64((__m128i*)(out + k), _mm_packus_epi16(Words, Words));
+	}
+}
+#endif
 
-		// do an easy loop, which works for all but colors 
-		// 0 to 9 and 246 to 255
-		for (ell = 0; ell < 4; ell++)
+// where each of count new rows or columns falls between two of old ones: the first of them, which is never
+// the last unless there is only one, and the weight of the second, from 0 to 128
+static void RescaleWeights(int count, int old, std::vector<int>& first, std::vector<int>& weights)
+{
+	first.resize(count);
+	weights.resize(count);
+	for (int n = 0; n < count; n++)
+	{
+		long long Place = count > 1 ? (long long)n * (old - 1) * 128 / (count - 1) : 0;
+		first[n] = (int)(Place >> 7);
+		weights[n] = (int)(Place & 127);
+		if (first[n] == old - 1 && old > 1)
 		{
-			for (k = 0; k < 8; k++)
-			{
-				for (j = 0; j < 8; j++)
-				{
-					Colors[i].Red = j * 32;
-					Colors[i].Green = k * 32;
-					Colors[i].Blue = ell * 64;
-					Colors[i].Alpha = 0;
-					i++;
-				}
-			}
+			first[n]--;
+			weights[n] = 128;
 		}
+	}
+}
 
-		// now redo the first 8 colors  
-		i = 0;
-		for (ell = 0; ell < 2; ell++)
+// blends count pixels of a column from the pixels at column + 4 * rows[j] and the one after it into the 4 words
+// at out + 4 * j
+static void RescaleColumn(const NDI_BYTE* column, int height, const int* rows, const int* weights, NDI_WORD* out, int count)
+{
+	int j = 0;
+#ifdef NEXUS_BMP_X86
+	if (height > 1)
+	{
+		j = count;
+		RescaleColumnSSE2(column, rows, weights, out, count);
+	}
+#endif
+	for (; j < count; j++)
+	{
+		const NDI_BYTE* Above = column + 4 * rows[j];
+		const NDI_BYTE* Below = height > 1 ? Above + 4 : Above;
+		for (int k = 0; k < 4; k++)
 		{
-			for (k = 0; k < 2; k++)
-			{
-				for (j = 0; j < 2; j++)
-				{
-					Colors[i].Red = j * 128;
-					Colors[i].Green = k * 128;
-					Colors[i].Blue = ell * 128;
-					i++;
-				}
-			}
+			out[4 * j + k] = (NDI_WORD)(Above[k] * (128 - weights[j]) + Below[k] * weights[j]);
 		}
+	}
+}
 
-		// overwrite colors 7, 8, 9
-		i = 7;
-		Colors[i].Red = 192;
-		Colors[i].Green = 192;
-		Colors[i].Blue = 192;
-		i++; // 8
-		Colors[i].Red = 192;
-		Colors[i].Green = 220;
-		Colors[i].Blue = 192;
-		i++; // 9
-		Colors[i].Red = 166;
-		Colors[i].Green = 202;
-		Colors[i].Blue = 240;
-
-		// overwrite colors 246 to 255 
-		i = 246;
-		Colors[i].Red = 255;
-		Colors[i].Green = 251;
-		Colors[i].Blue = 240;
-		i++; // 247
-		Colors[i].Red = 160;
-		Colors[i].Green = 160;
-		Colors[i].Blue = 164;
-		i++; // 248
-		Colors[i].Red = 128;
-		Colors[i].Green = 128;
-		Colors[i].Blue = 128;
-		i++; // 249
-		Colors[i].Red = 255;
-		Colors[i].Green = 0;
-		Colors[i].Blue = 0;
-		i++; // 250
-		Colors[i].Red = 0;
-		Colors[i].Green = 255;
-		Colors[i].Blue = 0;
-		i++; // 251
-		Colors[i].Red = 255;
-		Colors[i].Green = 255;
-		Colors[i].Blue = 0;
-		i++; // 252
-		Colors[i].Red = 0;
-		Colors[i].Green = 0;
-		Colors[i].Blue = 255;
-		i++; // 253
-		Colors[i].Red = 255;
-		Colors[i].Green = 0;
-		Colors[i].Blue = 255;
-		i++; // 254
-		Colors[i].Red = 0;
-		Colors[i].Green = 255;
-		Colors[i].Blue = 255;
-		i++; // 255
-		Colors[i].Red = 255;
-		Colors[i].Green = 255;
-		Colors[i].Blue = 255;
-
-		return true;
+// blends the count words of two blended columns, left and right, into the bytes of a new column
+static void RescaleRow(const NDI_WORD* left, const NDI_WORD* right, int weight, NDI_BYTE* out, int count)
+{
+	int k = 0;
+#ifdef NEXUS_BMP_X86
+	k = count / 8 * 8;
+	RescaleRowSSE2(left, right, weight, out, k);
+#endif
+	for (; k < count; k++)
+	{
+		out[k] = (NDI_BYTE)((left[k] * (128 - weight) + right[k] * weight + 8192) >> 14);
 	}
-	return true;
 }
 
-bool SafeFread(char* buffer, int size, int number, FILE* fp)
+// Rescale with filter 'B', from the columns of the image
+static void RescaleBilinear(BMP& InputImage, int NewWidth, int NewHeight)
 {
 	using namespace std;
-	int ItemsRead;
-	if (feof(fp))
+	int OldWidth = InputImage.GetWidth();
+	int OldHeight = InputImage.GetHeight();
+
+	// the old rows and columns of each new one, worked out once
+	vector<int> Rows, RowWeights, Columns, ColumnWeights;
+	RescaleWeights(NewHeight, OldHeight, Rows, RowWeights);
+	RescaleWeights(NewWidth, OldWidth, Columns, ColumnWeights);
+
+	// the new rows of each old column, whose pixels are next to each other, a column at a time on each core
+	vector<NDI_WORD> Blended((size_t)OldWidth * NewHeight * 4);
+	ParallelFor(OldWidth, [&](size_t i)
 	{
-		return false;
-	}
-	ItemsRead = (int)fread(buffer, size, number, fp);
-	if (ItemsRead < number)
+		RescaleColumn((const NDI_BYTE*)InputImage((int)i, 0), OldHeight, &Rows[0], &RowWeights[0],
+			&Blended[i * NewHeight * 4], NewHeight);
+	});
+
+	InputImage.SetSize(NewWidth, NewHeight);
+	InputImage.SetBitDepth(24);
+
+	// each new column from the two blended ones next to it
+	ParallelFor(NewWidth, [&](size_t i)
 	{
-		return false;
-	}
-	return true;
+		const NDI_WORD* Left = &Blended[(size_t)Columns[i] * NewHeight * 4];
+		const NDI_WORD* Right = OldWidth > 1 ? Left + (size_t)NewHeight * 4 : Left;
+		RescaleRow(Left, Right, ColumnWeights[i], (NDI_BYTE*)InputImage((int)i, 0), NewHeight * 4);
+	});
 }
 
-void BMP::SetDPI(int HorizontalDPI, int VerticalDPI)
+// The other filters of Rescale weigh all the old pixels within their reach of the middle of a new one, the
+// middles of the old and new pixels spread evenly over the image; when the image shrinks, their reach grows
+// with it, so every old pixel counts. The old columns are filtered down into numbers with 7 fractional bits,
+// and the new pixels across from those.
+
+// a filter for one axis: the first old row or column of each new one, how many it is made of, and their weights
+// of 14 bits, which add up to 16384, Taps of them for each new one
+struct RescaleFilter
 {
-	XPelsPerMeter = (int)(HorizontalDPI * 39.37007874015748);
-	YPelsPerMeter = (int)(VerticalDPI * 39.37007874015748);
-}
+	int Taps;
+	std::vector<int> First, Count, Weights;
+};
 
-// int BMP::GetVerticalDPI( void ) const
-int BMP::GetVerticalDPI(void)
+static double RescaleSinc(double x)
 {
-	if (!YPelsPerMeter)
+	if (x == 0.0)
 	{
-		YPelsPerMeter = DefaultYPelsPerMeter;
+		return 1.0;
 	}
-	return (int)(YPelsPerMeter / (double) 39.37007874015748);
+	x *= 3.14159265358979323846;
+	return sin(x) / x;
 }
 
-// int BMP::GetHorizontalDPI( void ) const
-int BMP::GetHorizontalDPI(void)
+// the filter Rescale takes the letter of at x pixels from the middle: 'A' averages the area of the new pixel,
+// 'C' is the cubic of Keys (a = -0.5), 'L' is Lanczos with 3 lobes
+static double RescaleFilterValue(int filter, double x)
 {
-	if (!XPelsPerMeter)
+	if (filter == 'A')
 	{
-		XPelsPerMeter = DefaultXPelsPerMeter;
+		// a pixel right on the edge only counts on one side
+		return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
 	}
-	return (int)(XPelsPerMeter / (double) 39.37007874015748);
+	x = fabs(x);
+	if (filter == 'C')
+	{
+		if (x < 1.0)
+		{
+			return (1.5 * x - 2.5) * x * x + 1.0;
+		}
+		return x < 2.0 ? ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0 : 0.0;
+	}
+	return x < 3.0 ? RescaleSinc(x) * RescaleSinc(x / 3.0) : 0.0;
 }
 
-/* These functions are defined in Nexus_VariousBMPutilities.h */
+// how far the filter reaches from the middle, in pixels
+static double RescaleFilterReach(int filter)
+{
+	return filter == 'A' ? 0.5 : (filter == 'C' ? 2.0 : 3.0);
+}
 
-BMFH GetBMFH(const char* szFileNameIn)
+// the filter table for count new rows or columns from old ones
+static void RescaleFilterWeights(int filter, int count, int old, RescaleFilter& table)
 {
 	using namespace std;
-	BMFH bmfh;
-
-	FILE* fp;
-	fp = fopen(szFileNameIn, "rb");
+	double Scale = (double)old / count;
+	double Stretch = Scale > 1.0 ? Scale : 1.0;
+	double Reach = RescaleFilterReach(filter) * Stretch;
+	table.Taps = 2 * (int)ceil(Reach) + 1;
+	table.First.resize(count);
+	table.Count.resize(count);
+	table.Weights.assign((size_t)count * table.Taps, 0);
+
+	vector<double> Values(table.Taps);
+	for (int n = 0; n < count; n++)
+	{
+		double Middle = (n + 0.5) * Scale;
+		int First = (int)floor(Middle - Reach + 0.5);
+		int Last = (int)floor(Middle + Reach + 0.5);
+		First = First < 0 ? 0 : First;
+		Last = Last > old ? old : (Last - First > table.Taps ? First + table.Taps : Last);
+
+		double Sum = 0.0;
+		for (int k = First; k < Last; k++)
+		{
+			Values[k - First] = RescaleFilterValue(filter, (k + 0.5 - Middle) / Stretch);
+			Sum += Values[k - First];
+		}
+		if (Sum == 0.0)
+		{
+			// only the nearest pixel, if none is in reach
+			First = (int)Middle < old ? (int)Middle : old - 1;
+			Last = First + 1;
+			Values[0] = Sum = 1.0;
+		}
 
-	if (!fp)
-	{
-		if (NexusWarnings)
+		// the largest weight takes what rounding leaves over, so that they add up to 16384
+		int* Weights = &table.Weights[(size_t)n * table.Taps];
+		int Total = 0, Largest = 0;
+		for (int k = 0; k < Last - First; k++)
 		{
-			cout << "Nexus Error: Cannot initialize from file "
-				<< szFileNameIn << "." << endl
-				<< "              File cannot be opened or does not exist."
-				<< endl;
+			Weights[k] = (int)floor(Values[k] / Sum * 16384.0 + 0.5);
+			Total += Weights[k];
+			Largest = Weights[k] > Weights[Largest] ? k : Largest;
 		}
-		bmfh.bfType = 0;
-		return bmfh;
+		Weights[Largest] += 16384 - Total;
+		table.First[n] = First;
+		table.Count[n] = Last - First;
 	}
+}
 
-	SafeFread((char*) &(bmfh.bfType), sizeof(NDI_WORD), 1, fp);
-	SafeFread((char*) &(bmfh.bfSize), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmfh.bfReserved1), sizeof(NDI_WORD), 1, fp);
-	SafeFread((char*) &(bmfh.bfReserved2), sizeof(NDI_WORD), 1, fp);
-	SafeFread((char*) &(bmfh.bfOffBits), sizeof(NDI_DWORD), 1, fp);
+#ifdef NEXUS_BMP_X86
+static const bool UseAVX2 = Nexus_Crypto::HasAVX2();
 
-	fclose(fp);
+// RescaleFilterColumn, two old pixels at a time, one in each half
+NEXUS_BMP_TARGET_AVX2 static void RescaleFilterColumnAVX2(const NDI_BYTE* column, const RescaleFilter& rows, int* out,
+	int count)
+{
+	for (int j = 0; j < count; j++)
+	{
+		const NDI_BYTE* Pixels = column + 4 * rows.First[j];
+		const int* Weights = &rows.Weights[(size_t)j * rows.Taps];
+		int Taps = rows.Count[j];
+		__m256i Sum = _mm256_setzero_si256();
+		int t = 0;
+		for (; t + 2 <= Taps; t += 2)
+		{
+			__m256i Two = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(Pixels + 4 * t)));
+			__m256i Weight = _mm256_setr_epi32(Weights[t], Weights[t], Weights[t], Weights[t],
+				Weights[t + 1], Weights[t + 1], Weights[t + 1], Weights[t + 1]);
+			Sum = _mm256_add_epi32(Sum, _mm256_mullo_epi32(Two, Weight));
+		}
+		__m128i Total = _mm_add_epi32(_mm256_castsi256_si128(Sum), _mm256_extracti128_si256(Sum, 1));
+		if (t < Taps)
+		{
+			int Last;
+			memcpy(&Last, Pixels + 4 * t, 4);
+			Total = _mm_add_epi32(Total, _mm_mullo_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(Last)),
+				_mm_set1_epi32(Weights[t])));
+		}
+		Total = _mm_srai_epi32(_mm_add_epi32(Total, _mm_set1_epi32(64)), 7);
+		_mm_storeu_si128((__m128i*)(out + 4 * j), Total);
+	}
+}
 
-	if (IsBigEndian())
+// RescaleFilterRow for from to to, 8 numbers at a time and what is left over after
+NEXUS_BMP_TARGET_AVX2 static void RescaleFilterRowAVX2(const int* columns, size_t stride, const int* weights, int taps,
+	NDI_BYTE* out, int from, int to)
+{
+	__m256i Half = _mm256_set1_epi32(1 << 20);
+	__m256i Zero = _mm256_setzero_si256();
+	__m256i Most = _mm256_set1_epi32(255);
+	int k = from;
+	for (; k + 8 <= to; k += 8)
+	{
+		__m256i Sum = Half;
+		for (int t = 0; t < taps; t++)
+		{
+			__m256i Numbers = _mm256_loadu_si256((const __m256i*)(columns + t * stride + k));
+			Sum = _mm256_add_epi32(Sum, _mm256_mullo_epi32(Numbers, _mm256_set1_epi32(weights[t])));
+		}
+		Sum = _mm256_min_epi32(_mm256_max_epi32(_mm256_srai_epi32(Sum, 21), Zero), Most);
+		__m128i Words = _mm_packs_epi32(_mm256_castsi256_si128(Sum), _mm256_extracti128_si256(Sum, 1));
+		_mm_storel_epi64((__m128i*)(out + k), _mm_packus_epi16(Words, Words));
+	}
+	for (; k < to; k++)
 	{
-		bmfh.SwitchEndianess();
+		int Sum = 1 << 20;
+		for (int t = 0; t < taps; t++)
+		{
+			Sum += weights[t] * columns[t * stride + k];
+		}
+		Sum >>= 21;
+		out[k] = (NDI_BYTE)(Sum < 0 ? 0 : (Sum > 255 ? 255 : Sum));
 	}
-
-	return bmfh;
 }
+#endif
 
-BMIH GetBMIH(const char* szFileNameIn)
+// filters a column of old pixels down into the 4 numbers of each of its count new rows at out
+static void RescaleFilterColumn(const NDI_BYTE* column, const RescaleFilter& rows, int* out, int count)
 {
-	using namespace std;
-	BMFH bmfh;
-	BMIH bmih;
-
-	FILE* fp;
-	fp = fopen(szFileNameIn, "rb");
-
-	if (!fp)
+#ifdef NEXUS_BMP_X86
+	if (UseAVX2)
 	{
-		if (NexusWarnings)
+		RescaleFilterColumnAVX2(column, rows, out, count);
+		return;
+	}
+#endif
+	for (int j = 0; j < count; j++)
+	{
+		const NDI_BYTE* Pixels = column + 4 * rows.First[j];
+		const int* Weights = &rows.Weights[(size_t)j * rows.Taps];
+		int Sum[4] = { 64, 64, 64, 64 };
+		for (int t = 0; t < rows.Count[j]; t++)
 		{
-			cout << "Nexus Error: Cannot initialize from file "
-				<< szFileNameIn << "." << endl
-				<< "              File cannot be opened or does not exist."
-				<< endl;
+			for (int k = 0; k < 4; k++)
+			{
+				Sum[k] += Weights[t] * Pixels[4 * t + k];
+			}
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			out[4 * j + k] = Sum[k] >> 7;
 		}
-		return bmih;
 	}
+}
 
-	// read the bmfh, i.e., first 14 bytes (just to get it out of the way);
-
-	NDI_BYTE TempBYTE;
-	int i;
-	for (i = 14; i > 0; i--)
+// filters the numbers from to to of taps filtered columns, stride numbers apart from columns on, across into
+// the bytes of a new column
+static void RescaleFilterRow(const int* columns, size_t stride, const int* weights, int taps, NDI_BYTE* out,
+	int from, int to)
+{
+#ifdef NEXUS_BMP_X86
+	if (UseAVX2)
 	{
-		SafeFread((char*)&TempBYTE, sizeof(NDI_BYTE), 1, fp);
+		RescaleFilterRowAVX2(columns, stride, weights, taps, out, from, to);
+		return;
 	}
+#endif
+	for (int k = from; k < to; k++)
+	{
+		int Sum = 1 << 20;
+		for (int t = 0; t < taps; t++)
+		{
+			Sum += weights[t] * columns[t * stride + k];
+		}
+		Sum >>= 21;
+		out[k] = (NDI_BYTE)(Sum < 0 ? 0 : (Sum > 255 ? 255 : Sum));
+	}
+}
 
-	// read the bmih 
-
-	SafeFread((char*) &(bmih.biSize), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmih.biWidth), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmih.biHeight), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmih.biPlanes), sizeof(NDI_WORD), 1, fp);
-
-	SafeFread((char*) &(bmih.biBitCount), sizeof(NDI_WORD), 1, fp);
-	SafeFread((char*) &(bmih.biCompression), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmih.biSizeImage), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmih.biXPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
-
-	SafeFread((char*) &(bmih.biYPelsPerMeter), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmih.biClrUsed), sizeof(NDI_DWORD), 1, fp);
-	SafeFread((char*) &(bmih.biClrImportant), sizeof(NDI_DWORD), 1, fp);
+// Rescale with filter 'A', 'C' or 'L'
+static void RescaleFiltered(BMP& InputImage, int filter, int NewWidth, int NewHeight)
+{
+	using namespace std;
+	int OldWidth = InputImage.GetWidth();
+	int OldHeight = InputImage.GetHeight();
 
-	fclose(fp);
+	RescaleFilter Rows, Columns;
+	RescaleFilterWeights(filter, NewHeight, OldHeight, Rows);
+	RescaleFilterWeights(filter, NewWidth, OldWidth, Columns);
 
-	if (IsBigEndian())
+	// the new rows of each old column, a column at a time on each core
+	size_t Stride = (size_t)NewHeight * 4;
+	vector<int> Filtered((size_t)OldWidth * Stride);
+	ParallelFor(OldWidth, [&](size_t i)
 	{
-		bmih.SwitchEndianess();
-	}
+		RescaleFilterColumn((const NDI_BYTE*)InputImage((int)i, 0), Rows, &Filtered[i * Stride], NewHeight);
+	});
 
-	return bmih;
+	InputImage.SetSize(NewWidth, NewHeight);
+	InputImage.SetBitDepth(24);
+
+	// tiles of TileColumns new columns by TileNumbers numbers of their rows, a tile at a time on each core;
+	// the columns next to each other in a tile are filtered from mostly the same ones, which stay in cache
+	const int TileColumns = 16;
+	const int TileNumbers = 1024;
+	size_t Across = (NewWidth + TileColumns - 1) / TileColumns;
+	size_t Down = (Stride + TileNumbers - 1) / TileNumbers;
+	ParallelFor(Across * Down, [&](size_t tile)
+	{
+		int Left = (int)(tile / Down) * TileColumns;
+		int Right = Left + TileColumns < NewWidth ? Left + TileColumns : NewWidth;
+		int From = (int)(tile % Down) * TileNumbers;
+		int To = From + TileNumbers < (int)Stride ? From + TileNumbers : (int)Stride;
+		for (int i = Left; i < Right; i++)
+		{
+			RescaleFilterRow(&Filtered[Columns.First[i] * Stride], Stride, &Columns.Weights[(size_t)i * Columns.Taps],
+				Columns.Count[i], (NDI_BYTE*)InputImage(i, 0), From, To);
+		}
+	});
 }
 
-void DisplayBitmapInfo(const char* szFileNameIn)
+bool Rescale(BMP& InputImage, char mode, int NewDimension, char filter)
 {
 	using namespace std;
-	FILE* fp;
-	fp = fopen(szFileNameIn, "rb");
+	int CapMode = toupper(mode);
+	int CapFilter = toupper(filter);
 
-	if (!fp)
+	if (CapMode != 'P' &&
+		CapMode != 'W' &&
+		CapMode != 'H' &&
+		CapMode != 'F')
 	{
 		if (NexusWarnings)
 		{
-			cout << "Nexus Error: Cannot initialize from file "
-				<< szFileNameIn << "." << endl
-				<< "              File cannot be opened or does not exist."
-				<< endl;
+			char ErrorMessage[1024];
+			sprintf(ErrorMessage, "Nexus Error: Unknown rescale mode %c requested\n", mode);
+			cout << ErrorMessage;
 		}
-		return;
+		return false;
+	}
+	if (CapFilter != 'B' &&
+		CapFilter != 'A' &&
+		CapFilter != 'C' &&
+		CapFilter != 'L')
+	{
+		if (NexusWarnings)
+		{
+			char ErrorMessage[1024];
+			sprintf(ErrorMessage, "Nexus Error: Unknown rescale filter %c requested\n", filter);
+			cout << ErrorMessage;
+		}
+		return false;
 	}
-	fclose(fp);
-
-	// don't duplicate work! Just use the functions from above!
-
-	BMFH bmfh = GetBMFH(szFileNameIn);
-	BMIH bmih = GetBMIH(szFileNameIn);
-
-	cout << "File information for file " << szFileNameIn
-		<< ":" << endl << endl;
-
-	cout << "BITMAPFILEHEADER:" << endl
-		<< "bfType: " << bmfh.bfType << endl
-		<< "bfSize: " << bmfh.bfSize << endl
-		<< "bfReserved1: " << bmfh.bfReserved1 << endl
-		<< "bfReserved2: " << bmfh.bfReserved2 << endl
-		<< "bfOffBits: " << bmfh.bfOffBits << endl << endl;
-
-	cout << "BITMAPINFOHEADER:" << endl
-		<< "biSize: " << bmih.biSize << endl
-		<< "biWidth: " << bmih.biWidth << endl
-		<< "biHeight: " << bmih.biHeight << endl
-		<< "biPlanes: " << bmih.biPlanes << endl
-		<< "biBitCount: " << bmih.biBitCount << endl
-		<< "biCompression: " << bmih.biCompression << endl
-		<< "biSizeImage: " << bmih.biSizeImage << endl
-		<< "biXPelsPerMeter: " << bmih.biXPelsPerMeter << endl
-		<< "biYPelsPerMeter: " << bmih.biYPelsPerMeter << endl
-		<< "biClrUsed: " << bmih.biClrUsed << endl
-		<< "biClrImportant: " << bmih.biClrImportant << endl << endl;
-	return;
-}
 
-int GetBitmapColorDepth(const char* szFileNameIn)
-{
-	BMIH bmih = GetBMIH(szFileNameIn);
-	return (int)bmih.biBitCount;
-}
+	int NewWidth = 0;
+	int NewHeight = 0;
 
-void PixelToPixelCopy(BMP& From, int FromX, int FromY,
-	BMP& To, int ToX, int ToY)
-{
-	*To(ToX, ToY) = *From(FromX, FromY);
-	return;
-}
+	int OldWidth = InputImage.GetWidth();
+	int OldHeight = InputImage.GetHeight();
 
-void PixelToPixelCopyTransparent(BMP& From, int FromX, int FromY,
-	BMP& To, int ToX, int ToY,
-	Pixel& Transparent)
-{
-	if (From(FromX, FromY)->Red != Transparent.Red ||
-		From(FromX, FromY)->Green != Transparent.Green ||
-		From(FromX, FromY)->Blue != Transparent.Blue)
+	if (CapMode == 'P')
 	{
-		*To(ToX, ToY) = *From(FromX, FromY);
+		NewWidth = (int)floor(OldWidth * NewDimension / 100.0);
+		NewHeight = (int)floor(OldHeight * NewDimension / 100.0);
 	}
-	return;
-}
-
-void RangedPixelToPixelCopy(BMP& From, int FromL, int FromR, int FromB, int FromT,
-	BMP& To, int ToX, int ToY)
-{
-	// make sure the conventions are followed
-	if (FromB < FromT)
+	if (CapMode == 'F')
 	{
-		int Temp = FromT; FromT = FromB; FromB = Temp;
+		if (OldWidth > OldHeight)
+		{
+			CapMode = 'W';
+		}
+		else
+		{
+			CapMode = 'H';
+		}
 	}
 
-	// make sure that the copied regions exist in both bitmaps
-	if (FromR >= From.GetWidth())
+	if (CapMode == 'W')
 	{
-		FromR = From.GetWidth() - 1;
+		double percent = (double)NewDimension / (double)OldWidth;
+		NewWidth = NewDimension;
+		NewHeight = (int)floor(OldHeight * percent);
 	}
-	if (FromL < 0) { FromL = 0; }
-
-	if (FromB >= From.GetHeight())
+	if (CapMode == 'H')
 	{
-		FromB = From.GetHeight() - 1;
+		double percent = (double)NewDimension / (double)OldHeight;
+		NewHeight = NewDimension;
+		NewWidth = (int)floor(OldWidth * percent);
 	}
-	if (FromT < 0) { FromT = 0; }
 
-	if (ToX + (FromR - FromL) >= To.GetWidth())
+	if (NewWidth < 1)
 	{
-		FromR = To.GetWidth() - 1 + FromL - ToX;
+		NewWidth = 1;
 	}
-	if (ToY + (FromB - FromT) >= To.GetHeight())
+	if (NewHeight < 1)
 	{
-		FromB = To.GetHeight() - 1 + FromT - ToY;
+		NewHeight = 1;
 	}
 
-	int i, j;
-	for (j = FromT; j <= FromB; j++)
+	if (CapFilter == 'B')
 	{
-		for (i = FromL; i <= FromR; i++)
-		{
-			PixelToPixelCopy(From, i, j,
-				To, ToX + (i - FromL), ToY + (j - FromT));
-		}
+		RescaleBilinear(InputImage, NewWidth, NewHeight);
 	}
+	else
+	{
+		RescaleFiltered(InputImage, CapFilter, NewWidth, NewHeight);
+	}
+	return true;
+}
 
-	return;
+BMPPipeline::BMPPipeline(BMP& Source) : Source(Source)
+{
+	Gray = Source.IsGrayscale();
 }
 
-void RangedPixelToPixelCopyTransparent(
-	BMP& From, int FromL, int FromR, int FromB, int FromT,
-	BMP& To, int ToX, int ToY,
-	Pixel& Transparent)
+int BMPPipeline::GetWidth(void) const
 {
-	// make sure the conventions are followed
-	if (FromB < FromT)
-	{
-		int Temp = FromT; FromT = FromB; FromB = Temp;
-	}
+	return Operations.empty() ? Source.GetWidth() : Operations.back().Width;
+}
 
-	// make sure that the copied regions exist in both bitmaps
-	if (FromR >= From.GetWidth())
-	{
-		FromR = From.GetWidth() - 1;
-	}
-	if (FromL < 0) { FromL = 0; }
+int BMPPipeline::GetHeight(void) const
+{
+	return Operations.empty() ? Source.GetHeight() : Operations.back().Height;
+}
 
-	if (FromB >= From.GetHeight())
+BMPPipeline& BMPPipeline::Crop(int FromL, int FromR, int FromB, int FromT)
+{
+	if (FromB < FromT)
 	{
-		FromB = From.GetHeight() - 1;
+		int Temp = FromT; FromT = FromB; FromB = Temp;
 	}
-	if (FromT < 0) { FromT = 0; }
+	FromL = FromL < 0 ? 0 : FromL;
+	FromT = FromT < 0 ? 0 : FromT;
+	FromR = FromR >= GetWidth() ? GetWidth() - 1 : FromR;
+	FromB = FromB >= GetHeight() ? GetHeight() - 1 : FromB;
+
+	Operation Crop;
+	Crop.Type = 'C';
+	Crop.Left = FromL;
+	Crop.Top = FromT;
+	Crop.Width = FromR >= FromL ? FromR - FromL + 1 : 0;
+	Crop.Height = FromB >= FromT ? FromB - FromT + 1 : 0;
+	Operations.push_back(Crop);
+	return *this;
+}
 
-	if (ToX + (FromR - FromL) >= To.GetWidth())
-	{
-		FromR = To.GetWidth() - 1 + FromL - ToX;
-	}
-	if (ToY + (FromB - FromT) >= To.GetHeight())
+BMPPipeline& BMPPipeline::Resize(int NewWidth, int NewHeight)
+{
+	Operation Resize;
+	Resize.Type = 'R';
+	Resize.Left = 0;
+	Resize.Top = 0;
+	Resize.Width = NewWidth < 1 ? 1 : NewWidth;
+	Resize.Height = NewHeight < 1 ? 1 : NewHeight;
+	if (GetWidth() > 0 && GetHeight() > 0)
 	{
-		FromB = To.GetHeight() - 1 + FromT - ToY;
+		RescaleWeights(Resize.Height, GetHeight(), Resize.Rows, Resize.RowWeights);
+		RescaleWeights(Resize.Width, GetWidth(), Resize.Columns, Resize.ColumnWeights);
 	}
-
-	int i, j;
-	for (j = FromT; j <= FromB; j++)
+	else
 	{
-		for (i = FromL; i <= FromR; i++)
-		{
-			PixelToPixelCopyTransparent(From, i, j,
-				To, ToX + (i - FromL), ToY + (j - FromT),
-				Transparent);
-		}
+		// nothing to scale, the result stays empty
+		Resize.Width = 0;
+		Resize.Height = 0;
 	}
+	Operations.push_back(Resize);
+	return *this;
+}
 
-	return;
+BMPPipeline& BMPPipeline::Grayscale(void)
+{
+	Operation Gray;
+	Gray.Type = 'G';
+	Gray.Left = 0;
+	Gray.Top = 0;
+	Gray.Width = GetWidth();
+	Gray.Height = GetHeight();
+	Operations.push_back(Gray);
+	this->Gray = true;
+	return *this;
 }
 
-bool CreateGrayscaleColorTable(BMP& InputImage)
+void BMPPipeline::Produce(size_t Count, int Left, int Top, int Width, int Height, std::vector<Pixel>& Out) const
 {
-	using namespace std;
-	int BitDepth = InputImage.GetBitDepth();
-	if (BitDepth != 1 && BitDepth != 4 && BitDepth != 8)
+	Out.resize((size_t)Width * Height);
+	if (Count == 0)
 	{
-		if (NexusWarnings)
+		for (int x = 0; x < Width; x++)
 		{
-			cout << "Nexus Warning: Attempted to create color table at a bit" << endl
-				<< "               depth that does not require a color table." << endl
-				<< "               Ignoring request." << endl;
+			const Pixel* Column = Source(Left + x, Top);
+			for (int y = 0; y < Height; y++)
+			{
+				Out[(size_t)y * Width + x] = Column[y];
+			}
 		}
-		return false;
+		return;
 	}
-	int i;
-	int NumberOfColors = InputImage.GetNumberOfColors();
 
-	NDI_BYTE StepSize;
-	if (BitDepth != 1)
+	const Operation& Step = Operations[Count - 1];
+	if (Step.Type == 'C')
 	{
-		StepSize = 255 / (NumberOfColors - 1);
+		Produce(Count - 1, Left + Step.Left, Top + Step.Top, Width, Height, Out);
+		return;
 	}
-	else
+	if (Step.Type == 'G')
 	{
-		StepSize = 255;
+		Produce(Count - 1, Left, Top, Width, Height, Out);
+		for (size_t n = 0; n < Out.size(); n++)
+		{
+			NDI_BYTE Luminance = (NDI_BYTE)((299 * Out[n].Red + 587 * Out[n].Green + 114 * Out[n].Blue + 500) / 1000);
+			Out[n].Red = Luminance;
+			Out[n].Green = Luminance;
+			Out[n].Blue = Luminance;
+		}
+		return;
 	}
 
-	for (i = 0; i < NumberOfColors; i++)
-	{
-		NDI_BYTE TempBYTE = i*StepSize;
-		Pixel TempColor;
-		TempColor.Red = TempBYTE;
-		TempColor.Green = TempBYTE;
-		TempColor.Blue = TempBYTE;
-		TempColor.Alpha = 0;
-		InputImage.SetColor(i, TempColor);
+	// the old rows and columns the pixels are blended from, each new row of them, then the new pixels across
+	// from those, with the weights and rounding of RescaleBilinear
+	int OldWidth = Count > 1 ? Operations[Count - 2].Width : Source.GetWidth();
+	int OldHeight = Count > 1 ? Operations[Count - 2].Height : Source.GetHeight();
+	int FirstRow = Step.Rows[Top];
+	int LastRow = OldHeight > 1 ? Step.Rows[Top + Height - 1] + 1 : FirstRow;
+	int FirstColumn = Step.Columns[Left];
+	int LastColumn = OldWidth > 1 ? Step.Columns[Left + Width - 1] + 1 : FirstColumn;
+	int Columns = LastColumn - FirstColumn + 1;
+	std::vector<Pixel> In;
+	Produce(Count - 1, FirstColumn, FirstRow, Columns, LastRow - FirstRow + 1, In);
+
+	std::vector<NDI_WORD> Blended((size_t)Columns * 4);
+	for (int y = 0; y < Height; y++)
+	{
+		const NDI_BYTE* Above = (const NDI_BYTE*)&In[(size_t)(Step.Rows[Top + y] - FirstRow) * Columns];
+		const NDI_BYTE* Below = OldHeight > 1 ? Above + 4 * Columns : Above;
+		int Weight = Step.RowWeights[Top + y];
+		for (int k = 0; k < 4 * Columns; k++)
+		{
+			Blended[k] = (NDI_WORD)(Above[k] * (128 - Weight) + Below[k] * Weight);
+		}
+		NDI_BYTE* Row = (NDI_BYTE*)&Out[(size_t)y * Width];
+		for (int x = 0; x < Width; x++)
+		{
+			const NDI_WORD* Pixels = &Blended[4 * (Step.Columns[Left + x] - FirstColumn)];
+			const NDI_WORD* Right = OldWidth > 1 ? Pixels + 4 : Pixels;
+			int Across = Step.ColumnWeights[Left + x];
+			for (int k = 0; k < 4; k++)
+			{
+				Row[4 * x + k] = (NDI_BYTE)((Pixels[k] * (128 - Across) + Right[k] * Across + 8192) >> 14);
+			}
+		}
 	}
-	return true;
 }
 
-bool BMP::Read32bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+int BMPPipeline::BandRows(void) const
+{
+	int Rows = BandPixels / GetWidth();
+	return Rows < 1 ? 1 : Rows;
+}
+
+bool BMPPipeline::Run(BMP& Output, int BitDepth)
 {
-	int i;
-	if (Width * 4 > BufferSize)
+	int Width = GetWidth();
+	int Height = GetHeight();
+	if (Width < 1 || Height < 1 || (BitDepth != 24 && BitDepth != 32))
 	{
 		return false;
 	}
-	for (i = 0; i < Width; i++)
+	bool Alpha = BitDepth == 32 && Source.HasAlphaChannel();
+	Output.SetSize(Width, Height);
+	Output.SetBitDepth(BitDepth);
+	Output.SetAlphaChannel(Alpha);
+	Output.SetGrayscale(Gray);
+
+	int Rows = BandRows();
+	ParallelFor((Height + Rows - 1) / Rows, [&](size_t band)
 	{
-		memcpy((char*) &(Pixels[i][Row]), (char*)Buffer + 4 * i, 4);
-	}
+		int First = (int)band * Rows;
+		int Last = First + Rows < Height ? First + Rows : Height;
+		std::vector<Pixel> Band;
+		Produce(Operations.size(), 0, First, Width, Last - First, Band);
+		for (int x = 0; x < Width; x++)
+		{
+			Pixel* Column = Output(x, First);
+			for (int y = 0; y < Last - First; y++)
+			{
+				Column[y] = Band[(size_t)y * Width + x];
+			}
+		}
+	});
 	return true;
 }
 
-bool BMP::Read24bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+bool BMPPipeline::WriteToFile(const char* FileName, int BitDepth)
 {
-	int i;
-	if (Width * 3 > BufferSize)
+	int Width = GetWidth();
+	int Height = GetHeight();
+	if (Width < 1 || Height < 1 || (BitDepth != 24 && BitDepth != 32))
 	{
 		return false;
 	}
-	for (i = 0; i < Width; i++)
+	bool Alpha = BitDepth == 32 && Source.HasAlphaChannel();
+	BMP Header;
+	Header.SetSize(Width, 1);
+	Header.SetBitDepth(BitDepth);
+	Header.SetAlphaChannel(Alpha);
+	Header.SetGrayscale(Gray);
+	if (!Header.WriteHeaderToFile(FileName, Height))
 	{
-		memcpy((char*) &(Pixels[i][Row]), Buffer + 3 * i, 3);
+		return false;
 	}
-	return true;
+
+	// a band at a time into the file, in whatever order they are done
+	std::mutex Writing;
+	std::atomic<bool> Success(true);
+	int Rows = BandRows();
+	ParallelFor((Height + Rows - 1) / Rows, [&](size_t band)
+	{
+		int First = (int)band * Rows;
+		int Last = First + Rows < Height ? First + Rows : Height;
+		std::vector<Pixel> Band;
+		Produce(Operations.size(), 0, First, Width, Last - First, Band);
+		BMP Part;
+		Part.SetSize(Width, Last - First);
+		Part.SetBitDepth(BitDepth);
+		Part.SetAlphaChannel(Alpha);
+		Part.SetGrayscale(Gray);
+		for (int x = 0; x < Width; x++)
+		{
+			Pixel* Column = Part(x, 0);
+			for (int y = 0; y < Last - First; y++)
+			{
+				Column[y] = Band[(size_t)y * Width + x];
+			}
+		}
+		std::lock_guard<std::mutex> Lock(Writing);
+		if (!Part.WriteRowsToFile(FileName, First))
+		{
+			Success = false;
+		}
+	});
+	return Success;
 }
 
-bool BMP::Read8bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+// reads the rows of a "bmp" or "png" image that hide characters start to end into rows, which then start
+// at firstRow; a PNG is decoded straight into a BMP, only the segments that hold these rows if it has any
+static bool ReadTextRowsFromFile(const std::string& file, bool png, size_t start, size_t end, BMP& rows, int& firstRow)
 {
-	int i;
-	if (Width > BufferSize)
+	int width, height, elements;
+	if (end <= start || !ImageSize(file, png, width, height, elements))
 	{
 		return false;
 	}
-	for (i = 0; i < Width; i++)
+	firstRow = (int)(8ULL * start / elements / width);
+	int lastRow = (int)((8ULL * end - 1) / elements / width);
+	if (lastRow >= height)
 	{
-		int Index = Buffer[i];
-		*(this->operator()(i, Row)) = GetColor(Index);
+		lastRow = height - 1;
 	}
-	return true;
-}
-
-bool BMP::Read4bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
-{
-	int Shifts[2] = { 4  ,0 };
-	int Masks[2] = { 240,15 };
-
-	int i = 0;
-	int j;
-	int k = 0;
-	if (Width > 2 * BufferSize)
+	if (firstRow > lastRow)
 	{
 		return false;
 	}
-	while (i < Width)
+	if (!png)
 	{
-		j = 0;
-		while (j < 2 && i < Width)
-		{
-			int Index = (int)((Buffer[k] & Masks[j]) >> Shifts[j]);
-			*(this->operator()(i, Row)) = GetColor(Index);
-			i++; j++;
-		}
-		k++;
+		return rows.ReadRowsFromFile(file.c_str(), firstRow, lastRow - firstRow + 1);
 	}
-	return true;
+
+	std::vector<NDI_BYTE> buffer, pixels;
+	unsigned w, h;
+	bool alpha, gray;
+	nexuspng::State state;
+	return nexuspng::load_file(buffer, file) == 0
+		&& Nexus_Converter::PNG2Pixels(pixels, w, h, alpha, gray, buffer, state, true, (unsigned)firstRow, (unsigned)(lastRow - firstRow + 1)) == 0
+		&& PixelsToBMP(pixels, w, (unsigned)(lastRow - firstRow + 1), alpha, gray, state.info_png.color, rows);
 }
 
-bool BMP::Read1bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+// decrypts the length characters of text from offset on that are hidden in a "bmp" or "png" image whose
+// header opened table, reading only the rows of the chunks that hold them
+static bool ExtractTextRangeFromFile(const std::string& file, bool png, const Entropy::ChunkTable& table,
+	unsigned long long offset, unsigned long long length, std::string& out)
 {
-	int Shifts[8] = { 7  ,6 ,5 ,4 ,3,2,1,0 };
-	int Masks[8] = { 128,64,32,16,8,4,2,1 };
-
-	int i = 0;
-	int j;
-	int k = 0;
-
-	if (Width > 8 * BufferSize)
+	out.clear();
+	if (offset > table.TextLength() || length > table.TextLength() - offset)
 	{
 		return false;
 	}
-	while (i < Width)
+	if (length == 0)
 	{
-		j = 0;
-		while (j < 8 && i < Width)
-		{
-			int Index = (int)((Buffer[k] & Masks[j]) >> Shifts[j]);
-			*(this->operator()(i, Row)) = GetColor(Index);
-			i++; j++;
-		}
-		k++;
+		return true;
 	}
-	return true;
-}
+	size_t firstChunk, lastChunk, start, end, count;
+	table.Chunks((size_t)offset, (size_t)length, firstChunk, lastChunk);
+	table.Characters(firstChunk, start, count);
+	table.Characters(lastChunk, end, count);
+	end += count;
 
-bool BMP::Write32bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
-{
-	int i;
-	if (Width * 4 > BufferSize)
+	BMP rows;
+	int firstRow;
+	std::ostringstream text;
+	if (!ReadTextRowsFromFile(file, png, start, end, rows, firstRow)
+		|| !DecryptChunks(rows, firstRow, table, firstChunk, lastChunk, text))
 	{
 		return false;
 	}
-	for (i = 0; i < Width; i++)
-	{
-		memcpy((char*)Buffer + 4 * i, (char*) &(Pixels[i][Row]), 4);
-	}
+	out = text.str().substr((size_t)offset - table.ChunkOffset(firstChunk), (size_t)length);
 	return true;
 }
 
-bool BMP::Write24bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+// opens the header of the volume hidden in a "bmp" or "png" image and reads its directory
+static bool ReadVolumeDirectoryFromFile(const std::string& file, bool png, const std::string& key,
+	Entropy::ChunkTable& table, std::vector<Entropy::VolumeEntry>& entries)
 {
-	int i;
-	if (Width * 3 > BufferSize)
+	BMP rows;
+	int firstRow;
+	if (key.empty() || !ReadTextRowsFromFile(file, png, 0, Entropy::HeaderLength, rows, firstRow))
 	{
 		return false;
 	}
-	for (i = 0; i < Width; i++)
+	std::string header(Entropy::HeaderLength, '\0');
+	Nexus_TextReader reader(rows, firstRow);
+	header.resize(reader.Read(&header[0], header.length()));
+	// a volume is never compressed as a whole, each of its entries is on its own
+	if (table.Open(header, key) != Entropy::KeyCorrect || table.Compressed() != Entropy::Uncompressed)
 	{
-		memcpy((char*)Buffer + 3 * i, (char*) &(Pixels[i][Row]), 3);
+		return false;
 	}
-	return true;
+
+	std::string directory;
+	size_t directoryLength;
+	return ExtractTextRangeFromFile(file, png, table, 0, Entropy::VolumeHeaderSize, directory)
+		&& (directoryLength = Entropy::VolumeDirectoryLength(directory)) != 0
+		&& ExtractTextRangeFromFile(file, png, table, 0, directoryLength, directory)
+		&& Entropy::ReadVolumeDirectory(directory, entries);
 }
 
-bool BMP::Write8bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+bool Nexus::EmbedVolumeInFile(const std::vector<std::string>& names, const std::vector<std::string>& contents,
+	const std::string& key, bool keyCheck, Entropy::Compression compression, const std::string& format,
+	const std::string& cover, const std::string& output)
 {
-	int i;
-	if (Width > BufferSize)
+	// the directory holds binary numbers, so only the encrypted format can hide it
+	if (key.empty() || names.size() != contents.size() || names.size() > 0xFFFFFFFF)
 	{
 		return false;
 	}
-	for (i = 0; i < Width; i++)
+	const bool png = format == "png";
+	int width, height, elements;
+	std::string volume = Entropy::MakeVolume(names, contents, compression);
+	if (!ImageSize(cover, png, width, height, elements)
+		|| Entropy::EncryptedLength(volume.length()) >= (size_t)((unsigned long long)elements * width * height / 8))
 	{
-		Buffer[i] = FindClosestColor(Pixels[i][Row]);
+		return false;
 	}
-	return true;
+	return EmbedTextInFile(volume, key, keyCheck, png, cover, output);
 }
 
-bool BMP::Write4bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+bool Nexus::ReadVolumeFromFile(const std::string& format, const std::string& file, const std::string& key,
+	std::vector<Entropy::VolumeEntry>& entries)
 {
-	int PositionWeights[2] = { 16,1 };
+	Entropy::ChunkTable table;
+	return ReadVolumeDirectoryFromFile(file, format == "png", key, table, entries);
+}
 
-	int i = 0;
-	int j;
-	int k = 0;
-	if (Width > 2 * BufferSize)
+bool Nexus::ExtractEntryFromFile(const std::string& format, const std::string& file, const std::string& key,
+	const std::string& name, std::string& out)
+{
+	const bool png = format == "png";
+	Entropy::ChunkTable table;
+	std::vector<Entropy::VolumeEntry> entries;
+	if (!ReadVolumeDirectoryFromFile(file, png, key, table, entries))
 	{
 		return false;
 	}
-	while (i < Width)
+	for (size_t i = 0; i < entries.size(); i++)
 	{
-		j = 0;
-		int Index = 0;
-		while (j < 2 && i < Width)
+		if (entries[i].name == name)
 		{
-			Index += (PositionWeights[j] * (int)FindClosestColor(Pixels[i][Row]));
-			i++; j++;
+			std::string text;
+			return ExtractTextRangeFromFile(file, png, table, entries[i].offset, entries[i].length, text)
+				&& Entropy::OpenVolumeEntry(entries[i], text, out);
 		}
-		Buffer[k] = (NDI_BYTE)Index;
-		k++;
 	}
-	return true;
+	return false;
 }
 
-bool BMP::Write1bitRow(NDI_BYTE* Buffer, int BufferSize, int Row)
+// the count characters of the text hidden in a BMP file from first on, reading only their rows
+static bool ReadCharactersFromFile(const std::string& file, size_t first, size_t count, std::string& characters)
 {
-	int PositionWeights[8] = { 128,64,32,16,8,4,2,1 };
-
-	int i = 0;
-	int j;
-	int k = 0;
-	if (Width > 8 * BufferSize)
+	BMP rows;
+	int firstRow;
+	if (!ReadTextRowsFromFile(file, false, first, first + count, rows, firstRow))
 	{
 		return false;
 	}
-	while (i < Width)
-	{
-		j = 0;
-		int Index = 0;
-		while (j < 8 && i < Width)
-		{
-			Index += (PositionWeights[j] * (int)FindClosestColor(Pixels[i][Row]));
-			i++; j++;
-		}
-		Buffer[k] = (NDI_BYTE)Index;
-		k++;
-	}
-	return true;
+	Nexus_TextReader reader(rows, firstRow);
+	characters.assign(count, '\0');
+	return reader.Seek(first) && reader.Read(&characters[0], count) == count;
 }
 
-NDI_BYTE BMP::FindClosestColor(Pixel& input)
+// hides characters in a BMP file from first on, in place, reading and writing only their rows; unless they end
+// the text, the characters after them up to the end of their last pixel are written back as they were, and
+// when they do the stop character follows; lastRow receives the last row written if it is further down
+static bool WriteCharactersToFile(const std::string& file, size_t first, const std::string& characters, bool last,
+	int& lastRow)
 {
-	using namespace std;
-
-	int i = 0;
-	int NumberOfColors = GetNumberOfColors();
-	NDI_BYTE BestI = 0;
-	int BestMatch = 999999;
-
-	while (i < NumberOfColors)
+	// 3 characters fill 8 whole pixels of 3 elements, a character 2 pixels of 4, 4 of 2 or 8 of 1
+	int width, height, elements;
+	if (!ImageSize(file, false, width, height, elements))
 	{
-		Pixel Attempt = GetColor(i);
-		int TempMatch = IntSquare((int)Attempt.Red - (int)input.Red)
-			+ IntSquare((int)Attempt.Green - (int)input.Green)
-			+ IntSquare((int)Attempt.Blue - (int)input.Blue);
-		if (TempMatch < BestMatch)
-		{
-			BestI = (NDI_BYTE)i; BestMatch = TempMatch;
-		}
-		if (BestMatch < 1)
-		{
-			i = NumberOfColors;
-		}
-		i++;
+		return false;
 	}
-	return BestI;
-}
-
-bool NexusCheckDataSize(void)
-{
-	using namespace std;
-	bool ReturnValue = true;
-	if (sizeof(NDI_BYTE) != 1)
+	const size_t group = elements == 3 ? 3 : 1;
+	const size_t end = first + characters.length();
+	const size_t pixelEnd = (end + group - 1) / group * group;
+	BMP rows;
+	int firstRow;
+	if (!ReadTextRowsFromFile(file, false, first, (pixelEnd > end ? pixelEnd : end + 1), rows, firstRow))
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Error: NDI_BYTE has the wrong size ("
-				<< sizeof(NDI_BYTE) << " bytes)," << endl
-				<< "              Compared to the expected 1 byte value" << endl;
-		}
-		ReturnValue = false;
+		return false;
 	}
-	if (sizeof(NDI_WORD) != 2)
+	std::string tail;
+	if (!last)
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Error: NDI_WORD has the wrong size ("
-				<< sizeof(NDI_WORD) << " bytes)," << endl
-				<< "              Compared to the expected 2 byte value" << endl;
-		}
-		ReturnValue = false;
+		// the text may end in the last pixel, then the stop character is written again after it
+		Nexus_TextReader reader(rows, firstRow);
+		tail.assign(pixelEnd - end, '\0');
+		tail.resize(tail.empty() || !reader.Seek(end) ? 0 : reader.Read(&tail[0], tail.length()));
+		last = tail.length() < pixelEnd - end;
 	}
-	if (sizeof(NDI_DWORD) != 4)
+	Nexus_TextWriter writer(rows, firstRow);
+	if (!writer.Seek(first) || !writer.Write(characters.data(), characters.length()) || !writer.Write(tail.data(), tail.length()))
 	{
-		if (NexusWarnings)
-		{
-			cout << "Nexus Error: NDI_DWORD has the wrong size ("
-				<< sizeof(NDI_DWORD) << " bytes)," << endl
-				<< "              Compared to the expected 4 byte value" << endl;
-		}
-		ReturnValue = false;
+		return false;
 	}
-	return ReturnValue;
+	if (last)
+	{
+		writer.Finish();
+	}
+	int rowsEnd = firstRow + rows.GetHeight() - 1;
+	lastRow = rowsEnd > lastRow ? rowsEnd : lastRow;
+	return rows.WriteRowsToFile(file.c_str(), firstRow);
 }
 
-bool Rescale(BMP& InputImage, char mode, int NewDimension)
+// PatchFile on a BMP file, appending if append is set
+static bool PatchBMPFile(const std::string& file, const std::string& key, size_t offset, bool append,
+	const std::string& data, int& lastRow)
 {
-	using namespace std;
-	int CapMode = toupper(mode);
-
-	BMP OldImage(InputImage);
-
-	if (CapMode != 'P' &&
-		CapMode != 'W' &&
-		CapMode != 'H' &&
-		CapMode != 'F')
+	std::string header, characters, patched;
+	Entropy::ChunkTable table;
+	if (key.empty() || !ReadCharactersFromFile(file, 0, Entropy::HeaderLength, header)
+		|| table.Open(header, key) != Entropy::KeyCorrect || !table.Patchable())
 	{
-		if (NexusWarnings)
-		{
-			char ErrorMessage[1024];
-			sprintf(ErrorMessage, "Nexus Error: Unknown rescale mode %c requested\n", mode);
-			cout << ErrorMessage;
-		}
 		return false;
 	}
+	const size_t textLength = table.TextLength();
+	offset = append ? textLength : offset;
+	size_t first, count;
+	table.PatchCharacters(offset, data.length(), first, count);
+	if (count == 0)
+	{
+		return offset <= textLength;
+	}
 
-	int NewWidth = 0;
-	int NewHeight = 0;
-
-	int OldWidth = OldImage.GetWidth();
-	int OldHeight = OldImage.GetHeight();
-
-	if (CapMode == 'P')
+	// the chunks that change, then the header if the text got longer; the file is written in place, so
+	// should writing stop between the two, a longer text reads as its old length and its old last chunk,
+	// sealed again as an inner one, no longer opens (a PNG only replaces its file once it is whole)
+	int width, height, elements;
+	if (!ReadCharactersFromFile(file, first, count, characters) || !table.Patch(offset, data, characters, patched)
+		|| !ImageSize(file, false, width, height, elements)
+		|| table.Length() >= (size_t)((unsigned long long)elements * width * height / 8)
+		|| !WriteCharactersToFile(file, first, patched, first + patched.length() == table.Length(), lastRow))
 	{
-		NewWidth = (int)floor(OldWidth * NewDimension / 100.0);
-		NewHeight = (int)floor(OldHeight * NewDimension / 100.0);
+		return false;
 	}
-	if (CapMode == 'F')
+	if (table.TextLength() == textLength)
 	{
-		if (OldWidth > OldHeight)
+		return true;
+	}
+	table.HeaderCharacters(first, count);
+	return ReadCharactersFromFile(file, first, count, characters) && table.PatchHeader(characters, patched)
+		&& WriteCharactersToFile(file, first, patched, first + patched.length() == table.Length(), lastRow);
+}
+
+// whether the PNG file stores its image data in segments (BMP2PNGPatch with Restart), whose index comes before it
+static bool HasRestartPoints(const std::string& file)
+{
+	std::ifstream png(file.c_str(), std::ios::binary);
+	png.seekg(8, std::ios::beg);
+	char chunk[8];
+	while (png.read(chunk, sizeof(chunk)))
+	{
+		if (memcmp(chunk + 4, "nxIX", 4) == 0)
 		{
-			CapMode = 'W';
+			return true;
 		}
-		else
+		if (memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "IEND", 4) == 0)
 		{
-			CapMode = 'H';
+			return false;
 		}
+		png.seekg((std::streamoff)nexuspng_chunk_length((const unsigned char*)chunk) + 4, std::ios::cur);
 	}
+	return false;
+}
 
-	if (CapMode == 'W')
-	{
-		double percent = (double)NewDimension / (double)OldWidth;
-		NewWidth = NewDimension;
-		NewHeight = (int)floor(OldHeight * percent);
-	}
-	if (CapMode == 'H')
+// PatchFile, a PNG is patched as a BMP in a scratch file next to it and compressed again down to the last row
+// that changed, into another one that then replaces it; one stored in segments stays so, and only those with
+// the changed rows are compressed again
+static bool PatchImageFile(const std::string& format, const std::string& file, const std::string& key, size_t offset,
+	bool append, const std::string& data)
+{
+	int lastRow = -1;
+	if (format != "png")
 	{
-		double percent = (double)NewDimension / (double)OldHeight;
-		NewHeight = NewDimension;
-		NewWidth = (int)floor(OldWidth * percent);
+		return PatchBMPFile(file, key, offset, append, data, lastRow);
 	}
 
-	if (NewWidth < 1)
-	{
-		NewWidth = 1;
-	}
-	if (NewHeight < 1)
+	nexuspng::State state;
+	std::string work = TempFileName(file);
+	bool patched = nexuspng::save_file(Nexus_Converter::PNG2BMP(file.c_str(), &state, true), work) == 0
+		&& PatchBMPFile(work, key, offset, append, data, lastRow);
+	std::vector<NDI_BYTE> encoded;
+	if (patched && lastRow >= 0)
 	{
-		NewHeight = 1;
+		encoded = Nexus_Converter::BMP2PNGPatch(work.c_str(), file.c_str(), (unsigned)lastRow + 1, state,
+			HasRestartPoints(file));
+		remove(work.c_str());
+		patched = !encoded.empty() && nexuspng::save_file(encoded, work) == 0 && MoveOverFile(work, file);
 	}
+	remove(work.c_str());
+	return patched;
+}
 
-	InputImage.SetSize(NewWidth, NewHeight);
-	InputImage.SetBitDepth(24);
+bool Nexus::PatchFile(const std::string& format, const std::string& file, const std::string& key, size_t offset,
+	const std::string& data)
+{
+	return PatchImageFile(format, file, key, offset, false, data);
+}
 
-	int I, J;
-	double ThetaI, ThetaJ;
-
-	for (int j = 0; j < NewHeight - 1; j++)
-	{
-		ThetaJ = (double)(j*(OldHeight - 1.0))
-			/ (double)(NewHeight - 1.0);
-		J = (int)floor(ThetaJ);
-		ThetaJ -= J;
-
-		for (int i = 0; i < NewWidth - 1; i++)
-		{
-			ThetaI = (double)(i*(OldWidth - 1.0))
-				/ (double)(NewWidth - 1.0);
-			I = (int)floor(ThetaI);
-			ThetaI -= I;
-
-			InputImage(i, j)->Red = (NDI_BYTE)
-				((1.0 - ThetaI - ThetaJ + ThetaI*ThetaJ)*(OldImage(I, J)->Red)
-					+ (ThetaI - ThetaI*ThetaJ)*(OldImage(I + 1, J)->Red)
-					+ (ThetaJ - ThetaI*ThetaJ)*(OldImage(I, J + 1)->Red)
-					+ (ThetaI*ThetaJ)*(OldImage(I + 1, J + 1)->Red));
-			InputImage(i, j)->Green = (NDI_BYTE)
-				((1.0 - ThetaI - ThetaJ + ThetaI*ThetaJ)*OldImage(I, J)->Green
-					+ (ThetaI - ThetaI*ThetaJ)*OldImage(I + 1, J)->Green
-					+ (ThetaJ - ThetaI*ThetaJ)*OldImage(I, J + 1)->Green
-					+ (ThetaI*ThetaJ)*OldImage(I + 1, J + 1)->Green);
-			InputImage(i, j)->Blue = (NDI_BYTE)
-				((1.0 - ThetaI - ThetaJ + ThetaI*ThetaJ)*OldImage(I, J)->Blue
-					+ (ThetaI - ThetaI*ThetaJ)*OldImage(I + 1, J)->Blue
-					+ (ThetaJ - ThetaI*ThetaJ)*OldImage(I, J + 1)->Blue
-					+ (ThetaI*ThetaJ)*OldImage(I + 1, J + 1)->Blue);
-		}
-		InputImage(NewWidth - 1, j)->Red = (NDI_BYTE)
-			((1.0 - ThetaJ)*(OldImage(OldWidth - 1, J)->Red)
-				+ ThetaJ*(OldImage(OldWidth - 1, J + 1)->Red));
-		InputImage(NewWidth - 1, j)->Green = (NDI_BYTE)
-			((1.0 - ThetaJ)*(OldImage(OldWidth - 1, J)->Green)
-				+ ThetaJ*(OldImage(OldWidth - 1, J + 1)->Green));
-		InputImage(NewWidth - 1, j)->Blue = (NDI_BYTE)
-			((1.0 - ThetaJ)*(OldImage(OldWidth - 1, J)->Blue)
-				+ ThetaJ*(OldImage(OldWidth - 1, J + 1)->Blue));
-	}
-
-	for (int i = 0; i < NewWidth - 1; i++)
-	{
-		ThetaI = (double)(i*(OldWidth - 1.0))
-			/ (double)(NewWidth - 1.0);
-		I = (int)floor(ThetaI);
-		ThetaI -= I;
-		InputImage(i, NewHeight - 1)->Red = (NDI_BYTE)
-			((1.0 - ThetaI)*(OldImage(I, OldHeight - 1)->Red)
-				+ ThetaI*(OldImage(I, OldHeight - 1)->Red));
-		InputImage(i, NewHeight - 1)->Green = (NDI_BYTE)
-			((1.0 - ThetaI)*(OldImage(I, OldHeight - 1)->Green)
-				+ ThetaI*(OldImage(I, OldHeight - 1)->Green));
-		InputImage(i, NewHeight - 1)->Blue = (NDI_BYTE)
-			((1.0 - ThetaI)*(OldImage(I, OldHeight - 1)->Blue)
-				+ ThetaI*(OldImage(I, OldHeight - 1)->Blue));
-	}
-
-	*InputImage(NewWidth - 1, NewHeight - 1) = *OldImage(OldWidth - 1, OldHeight - 1);
-	return true;
+bool Nexus::AppendToFile(const std::string& format, const std::string& file, const std::string& key,
+	const std::string& data)
+{
+	return PatchImageFile(format, file, key, 0, true, data);
 }
 
@@ -1,22 +1,64 @@
-#ifndef _Nexus_Converter_h_
+#ifndef _Nexus_Converter_h_
 #define _Nexus_Converter_h_
 
 class Nexus_Converter
 {
 public:
-	// BMP to PNG
-	static std::vector<NDI_BYTE> BMP2PNG(const char* BMPfile);
+	// BMP to PNG, MaxCompression trades a lot of encoding time for a smaller file
+	// Cover is the state PNG2BMP filled in for the original image, its scanline filters are reused
+	static std::vector<NDI_BYTE> BMP2PNG(const char* BMPfile, bool MaxCompression = false, const nexuspng::State* Cover = NULL);
 	
-	// PNG to BMP
-	static std::vector<NDI_BYTE> PNG2BMP(const char* PNGFile);
+	// BMP to PNG, for a BMP that was converted from CoverPNG and only changed in the top DirtyRows.
+	// Restart stores the image data in segments that are compressed on their own (see restart_rows), a plain PNG
+	// otherwise; if CoverPNG was made with Restart too, only the segments with those rows are compressed again.
+	static std::vector<NDI_BYTE> BMP2PNGPatch(const char* BMPfile, const char* CoverPNG, unsigned DirtyRows, const nexuspng::State& Cover,
+		bool Restart = false);
+	
+	// PNG to BMP, Cover (optional) receives the color type and scanline filters of the PNG;
+	// Carrier makes the BMP the one text is hidden in (see PNG2Pixels); empty if the PNG can't be decoded
+	static std::vector<NDI_BYTE> PNG2BMP(const char* PNGFile, nexuspng::State* Cover = NULL, bool Carrier = false);
+
+	// PNG to BMP of only the top rows, the ones that hide the first TextLength characters, with Carrier;
+	// empty if the PNG can't be decoded
+	static std::vector<NDI_BYTE> PNG2BMPRows(const char* PNGFile, size_t TextLength);
+
+	// decodes Rows rows from FirstRow of a PNG (all of them if Rows is 0) to 8 bit RGB, or RGBA if the image
+	// has alpha and isn't fully opaque (Alpha tells which), into Image; w and h are the size of the whole PNG.
+	// Gray tells the PNG is grayscale, its pixels are then gray in the RGB(A) too.
+	// 16 bit samples keep their high byte, or with Carrier their low one, where text is hidden, BMP2PNGPatch
+	// puts the high ones back. An image with alpha is decoded as a whole, whether it is fully opaque needs all rows
+	static unsigned PNG2Pixels(std::vector<NDI_BYTE>& Image, unsigned& w, unsigned& h, bool& Alpha, bool& Gray,
+		const std::vector<NDI_BYTE>& PNG, nexuspng::State& State, bool Carrier = true, unsigned FirstRow = 0,
+		unsigned Rows = 0);
+
+	// whether a PNG of Color hides text in the colors of its palette (see Nexus_PaletteOrder), which it can
+	// if they all differ in red, green and blue, so that the color of a pixel tells its index. Its BMP is then
+	// 8 bit with the palette as the color table, and is stored again with the palette of the cover
+	static bool IndexedColors(const NexusPNGColorMode& Color);
 
 
 private:
-	// BMP to PNG
-	static unsigned decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, unsigned& h, const std::vector<NDI_BYTE>& bmp);
+	// BMP to PNG, alpha tells the BMP has an alpha channel
+	static unsigned decodeBMP(std::vector<NDI_BYTE>& image, unsigned& w, unsigned& h, bool& alpha, const std::vector<NDI_BYTE>& bmp);
+
+	// makes image, the RGBA pixels of a BMP that PNG2BMP made with Carrier from the 16 bit PNG cover, 16 bit again
+	// with the high bytes of the cover's samples, and sets state to encode it
+	static unsigned restoreHighBytes(std::vector<NDI_BYTE>& image, unsigned w, unsigned h, bool alpha,
+		const std::vector<NDI_BYTE>& cover, nexuspng::State& state);
+
+	// makes image, the RGBA pixels of a BMP made from the cover with IndexedColors, the indexes of their colors in
+	// the palette of Cover, and sets state to encode it in the color type and scanline filters of Cover; fails if a
+	// color isn't in the palette
+	static unsigned restoreIndices(std::vector<NDI_BYTE>& image, unsigned w, unsigned h, const nexuspng::State& Cover,
+		nexuspng::State& state);
+
+	// Sets up state to encode with the scanline filters of Cover, if image gets the same color type
+	static void reuseCoverFilters(nexuspng::State& state, const std::vector<NDI_BYTE>& image, unsigned w, unsigned h, const nexuspng::State& Cover);
 
-	// PNG to BMP
-	static void encodeBMP(std::vector<NDI_BYTE>& bmp, const NDI_BYTE* image, int w, int h);
+	// PNG to BMP, RGB pixels or RGBA with alpha; gray ones give it the grayscale color table (BMP::IsGrayscale),
+	// and with a palette (see IndexedColors) it is 8 bit
+	static void encodeBMP(std::vector<NDI_BYTE>& bmp, const NDI_BYTE* image, int w, int h, bool alpha = false, bool gray = false,
+		const NexusPNGColorMode* palette = NULL);
 
 };
 #endif
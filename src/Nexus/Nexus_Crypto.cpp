@@ -0,0 +1,1641 @@
+#include "Nexus.h"
+#include <thread>
+#include <cstdlib>
+
+// RandomBytes asks the operating system: BCryptGenRandom on Windows, getrandom on Linux and /dev/urandom elsewhere
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <bcrypt.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "bcrypt.lib")
+#endif
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 25))
+#define NEXUS_CRYPTO_GETRANDOM
+#include <sys/random.h>
+#endif
+#endif
+
+// the ChaCha20 kernels for several blocks at once use SSE2, and AVX2 when the processor has it;
+// the BLAKE3 kernels for several chunks at once SSE4.1 or AVX2, when the processor has them.
+// NEXUS_CRYPTO_PORTABLE leaves them out, and the 128-bit products of Poly1305, so that the tests can check
+// the code other processors and compilers run
+#if (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)) && !defined(NEXUS_CRYPTO_PORTABLE)
+#define NEXUS_CRYPTO_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NEXUS_TARGET_SSE2 __attribute__((target("sse2")))
+#define NEXUS_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define NEXUS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define NEXUS_TARGET_SSE2
+#define NEXUS_TARGET_SSE41
+#define NEXUS_TARGET_AVX2
+#endif
+
+typedef unsigned long long NDI_QWORD;
+
+static inline NDI_DWORD ReadLE32(const NDI_BYTE* p)
+{
+	return (NDI_DWORD)p[0] | ((NDI_DWORD)p[1] << 8) | ((NDI_DWORD)p[2] << 16) | ((NDI_DWORD)p[3] << 24);
+}
+
+static inline void WriteLE32(NDI_BYTE* p, NDI_DWORD v)
+{
+	p[0] = (NDI_BYTE)v;
+	p[1] = (NDI_BYTE)(v >> 8);
+	p[2] = (NDI_BYTE)(v >> 16);
+	p[3] = (NDI_BYTE)(v >> 24);
+}
+
+static inline NDI_QWORD ReadLE64(const NDI_BYTE* p)
+{
+	return (NDI_QWORD)ReadLE32(p) | ((NDI_QWORD)ReadLE32(p + 4) << 32);
+}
+
+static inline void WriteLE64(NDI_BYTE* p, NDI_QWORD v)
+{
+	WriteLE32(p, (NDI_DWORD)v);
+	WriteLE32(p + 4, (NDI_DWORD)(v >> 32));
+}
+
+/* ChaCha20 */
+
+#define NEXUS_ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define NEXUS_QUARTERROUND(a, b, c, d) \
+	a += b; d ^= a; d = NEXUS_ROTL32(d, 16); \
+	c += d; b ^= c; b = NEXUS_ROTL32(b, 12); \
+	a += b; d ^= a; d = NEXUS_ROTL32(d, 8); \
+	c += d; b ^= c; b = NEXUS_ROTL32(b, 7);
+
+static void ChaChaSetup(NDI_DWORD* state, const NDI_BYTE* key, const NDI_BYTE* nonce, NDI_DWORD counter)
+{
+	// "expand 32-byte k"
+	state[0] = 0x61707865;
+	state[1] = 0x3320646e;
+	state[2] = 0x79622d32;
+	state[3] = 0x6b206574;
+	for (int i = 0; i < 8; i++)
+	{
+		state[4 + i] = ReadLE32(key + 4 * i);
+	}
+	state[12] = counter;
+	state[13] = ReadLE32(nonce);
+	state[14] = ReadLE32(nonce + 4);
+	state[15] = ReadLE32(nonce + 8);
+}
+
+// one block of key stream for state, whose counter is then advanced
+static void ChaChaBlock(NDI_BYTE* out, NDI_DWORD* state)
+{
+	NDI_DWORD x[16];
+	for (int i = 0; i < 16; i++)
+	{
+		x[i] = state[i];
+	}
+	for (int i = 0; i < 10; i++)
+	{
+		NEXUS_QUARTERROUND(x[0], x[4], x[8], x[12]);
+		NEXUS_QUARTERROUND(x[1], x[5], x[9], x[13]);
+		NEXUS_QUARTERROUND(x[2], x[6], x[10], x[14]);
+		NEXUS_QUARTERROUND(x[3], x[7], x[11], x[15]);
+		NEXUS_QUARTERROUND(x[0], x[5], x[10], x[15]);
+		NEXUS_QUARTERROUND(x[1], x[6], x[11], x[12]);
+		NEXUS_QUARTERROUND(x[2], x[7], x[8], x[13]);
+		NEXUS_QUARTERROUND(x[3], x[4], x[9], x[14]);
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		WriteLE32(out + 4 * i, x[i] + state[i]);
+	}
+	state[12]++;
+}
+
+#ifdef NEXUS_CRYPTO_X86
+#define NEXUS_ROTL128(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define NEXUS_QUARTERROUND128(a, b, c, d) \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = NEXUS_ROTL128(d, 16); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = NEXUS_ROTL128(b, 12); \
+	a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = NEXUS_ROTL128(d, 8); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = NEXUS_ROTL128(b, 7);
+
+// xors the blocks of 256 bytes in data, 4 ChaCha blocks at a time, one in each lane
+NEXUS_TARGET_SSE2 static void ChaChaBlocksSSE2(NDI_BYTE* data, size_t blocks, NDI_DWORD* state)
+{
+	for (size_t n = 0; n < blocks; n++)
+	{
+		__m128i s[16], x[16];
+		for (int i = 0; i < 16; i++)
+		{
+			s[i] = _mm_set1_epi32((int)state[i]);
+		}
+		s[12] = _mm_add_epi32(s[12], _mm_set_epi32(3, 2, 1, 0));
+		for (int i = 0; i < 16; i++)
+		{
+			x[i] = s[i];
+		}
+		for (int i = 0; i < 10; i++)
+		{
+			NEXUS_QUARTERROUND128(x[0], x[4], x[8], x[12]);
+			NEXUS_QUARTERROUND128(x[1], x[5], x[9], x[13]);
+			NEXUS_QUARTERROUND128(x[2], x[6], x[10], x[14]);
+			NEXUS_QUARTERROUND128(x[3], x[7], x[11], x[15]);
+			NEXUS_QUARTERROUND128(x[0], x[5], x[10], x[15]);
+			NEXUS_QUARTERROUND128(x[1], x[6], x[11], x[12]);
+			NEXUS_QUARTERROUND128(x[2], x[7], x[8], x[13]);
+			NEXUS_QUARTERROUND128(x[3], x[4], x[9], x[14]);
+		}
+
+		// transpose each group of 4 words, so that each vector holds 16 bytes of one block
+		NDI_BYTE* out = data + n * 256;
+		for (int g = 0; g < 4; g++)
+		{
+			__m128i a = _mm_add_epi32(x[4 * g], s[4 * g]);
+			__m128i b = _mm_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+			__m128i c = _mm_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+			__m128i d = _mm_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+			__m128i t0 = _mm_unpacklo_epi32(a, b);
+			__m128i t1 = _mm_unpacklo_epi32(c, d);
+			__m128i t2 = _mm_unpackhi_epi32(a, b);
+			__m128i t3 = _mm_unpackhi_epi32(c, d);
+			__m128i k[4];
+			k[0] = _mm_unpacklo_epi64(t0, t1);
+			k[1] = _mm_unpackhi_epi64(t0, t1);
+			k[2] = _mm_unpacklo_epi64(t2, t3);
+			k[3] = _mm_unpackhi_epi64(t2, t3);
+			for (int j = 0; j < 4; j++)
+			{
+				__m128i* p = (__m128i*)(out + 64 * j + 16 * g);
+				_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k[j]));
+			}
+		}
+		state[12] += 4;
+	}
+}
+
+#define NEXUS_ROTL256(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define NEXUS_QUARTERROUND256(a, b, c, d) \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = NEXUS_ROTL256(d, 16); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = NEXUS_ROTL256(b, 12); \
+	a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = NEXUS_ROTL256(d, 8); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = NEXUS_ROTL256(b, 7);
+
+// xors the blocks of 512 bytes in data, 8 ChaCha blocks at a time, one in each lane
+NEXUS_TARGET_AVX2 static void ChaChaBlocksAVX2(NDI_BYTE* data, size_t blocks, NDI_DWORD* state)
+{
+	for (size_t n = 0; n < blocks; n++)
+	{
+		__m256i s[16], x[16];
+		for (int i = 0; i < 16; i++)
+		{
+			s[i] = _mm256_set1_epi32((int)state[i]);
+		}
+		s[12] = _mm256_add_epi32(s[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+		for (int i = 0; i < 16; i++)
+		{
+			x[i] = s[i];
+		}
+		for (int i = 0; i < 10; i++)
+		{
+			NEXUS_QUARTERROUND256(x[0], x[4], x[8], x[12]);
+			NEXUS_QUARTERROUND256(x[1], x[5], x[9], x[13]);
+			NEXUS_QUARTERROUND256(x[2], x[6], x[10], x[14]);
+			NEXUS_QUARTERROUND256(x[3], x[7], x[11], x[15]);
+			NEXUS_QUARTERROUND256(x[0], x[5], x[10], x[15]);
+			NEXUS_QUARTERROUND256(x[1], x[6], x[11], x[12]);
+			NEXUS_QUARTERROUND256(x[2], x[7], x[8], x[13]);
+			NEXUS_QUARTERROUND256(x[3], x[4], x[9], x[14]);
+		}
+
+		// the unpack instructions work within 128-bit halves: the low halves end up with
+		// blocks 0 to 3, the high halves with blocks 4 to 7
+		NDI_BYTE* out = data + n * 512;
+		for (int g = 0; g < 4; g++)
+		{
+			__m256i a = _mm256_add_epi32(x[4 * g], s[4 * g]);
+			__m256i b = _mm256_add_epi32(x[4 * g + 1], s[4 * g + 1]);
+			__m256i c = _mm256_add_epi32(x[4 * g + 2], s[4 * g + 2]);
+			__m256i d = _mm256_add_epi32(x[4 * g + 3], s[4 * g + 3]);
+			__m256i t0 = _mm256_unpacklo_epi32(a, b);
+			__m256i t1 = _mm256_unpacklo_epi32(c, d);
+			__m256i t2 = _mm256_unpackhi_epi32(a, b);
+			__m256i t3 = _mm256_unpackhi_epi32(c, d);
+			__m256i k[4];
+			k[0] = _mm256_unpacklo_epi64(t0, t1);
+			k[1] = _mm256_unpackhi_epi64(t0, t1);
+			k[2] = _mm256_unpacklo_epi64(t2, t3);
+			k[3] = _mm256_unpackhi_epi64(t2, t3);
+			for (int j = 0; j < 4; j++)
+			{
+				__m128i* lo = (__m128i*)(out + 64 * j + 16 * g);
+				__m128i* hi = (__m128i*)(out + 64 * (j + 4) + 16 * g);
+				_mm_storeu_si128(lo, _mm_xor_si128(_mm_loadu_si128(lo), _mm256_castsi256_si128(k[j])));
+				_mm_storeu_si128(hi, _mm_xor_si128(_mm_loadu_si128(hi), _mm256_extracti128_si256(k[j], 1)));
+			}
+		}
+		state[12] += 8;
+	}
+}
+
+#endif
+
+bool Nexus_Crypto::HasAVX2()
+{
+#if defined(NEXUS_CRYPTO_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	// the OS must save the AVX registers too
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(NEXUS_CRYPTO_X86) && (defined(__GNUC__) || defined(__clang__))
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+bool Nexus_Crypto::HasSSE41()
+{
+#if defined(NEXUS_CRYPTO_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 19)) != 0;
+#elif defined(NEXUS_CRYPTO_X86) && (defined(__GNUC__) || defined(__clang__))
+	return __builtin_cpu_supports("sse4.1") != 0;
+#else
+	return false;
+#endif
+}
+
+#ifdef NEXUS_CRYPTO_X86
+static const bool UseAVX2 = Nexus_Crypto::HasAVX2();
+static const bool UseSSE41 = Nexus_Crypto::HasSSE41();
+#endif
+
+void Nexus_Crypto::ChaCha20(NDI_BYTE* data, size_t size, const NDI_BYTE* key, const NDI_BYTE* nonce, NDI_DWORD counter)
+{
+	NDI_DWORD state[16];
+	ChaChaSetup(state, key, nonce, counter);
+
+	size_t offset = 0;
+#ifdef NEXUS_CRYPTO_X86
+	if (UseAVX2)
+	{
+		ChaChaBlocksAVX2(data, size / 512, state);
+		offset = size / 512 * 512;
+	}
+	ChaChaBlocksSSE2(data + offset, (size - offset) / 256, state);
+	offset += (size - offset) / 256 * 256;
+#endif
+
+	NDI_BYTE block[64];
+	while (offset < size)
+	{
+		ChaChaBlock(block, state);
+		size_t n = size - offset < 64 ? size - offset : 64;
+		for (size_t i = 0; i < n; i++)
+		{
+			data[offset + i] ^= block[i];
+		}
+		offset += n;
+	}
+}
+
+/* Poly1305, with 44, 44 and 42 bit limbs */
+
+// 128-bit products for the limb multiplications
+struct NexusUInt128
+{
+	NDI_QWORD lo, hi;
+};
+
+static inline NexusUInt128 Mul64(NDI_QWORD a, NDI_QWORD b)
+{
+	NexusUInt128 r;
+#if defined(__SIZEOF_INT128__) && !defined(NEXUS_CRYPTO_PORTABLE)
+	unsigned __int128 p = (unsigned __int128)a * b;
+	r.lo = (NDI_QWORD)p;
+	r.hi = (NDI_QWORD)(p >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64) && !defined(NEXUS_CRYPTO_PORTABLE)
+	r.lo = _umul128(a, b, &r.hi);
+#else
+	NDI_QWORD a0 = a & 0xffffffff, a1 = a >> 32, b0 = b & 0xffffffff, b1 = b >> 32;
+	NDI_QWORD p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+	NDI_QWORD middle = (p00 >> 32) + (p01 & 0xffffffff) + (p10 & 0xffffffff);
+	r.lo = (p00 & 0xffffffff) | (middle << 32);
+	r.hi = p11 + (p01 >> 32) + (p10 >> 32) + (middle >> 32);
+#endif
+	return r;
+}
+
+static inline void Add128(NexusUInt128& a, NexusUInt128 b)
+{
+	a.lo += b.lo;
+	a.hi += b.hi + (a.lo < b.lo ? 1 : 0);
+}
+
+static inline NDI_QWORD Shr128(NexusUInt128 a, int n)
+{
+	return (a.lo >> n) | (a.hi << (64 - n));
+}
+
+typedef Nexus_Crypto::Poly1305State Poly1305State;
+
+static void Poly1305Init(Poly1305State& st, const NDI_BYTE* key)
+{
+	// r is clamped as the specification requires
+	NDI_QWORD t0 = ReadLE64(key), t1 = ReadLE64(key + 8);
+	st.r[0] = t0 & 0xffc0fffffff;
+	st.r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+	st.r[2] = (t1 >> 24) & 0x00ffffffc0f;
+	st.s[0] = st.r[1] * (5 << 2);
+	st.s[1] = st.r[2] * (5 << 2);
+	st.h[0] = st.h[1] = st.h[2] = 0;
+	st.pad[0] = ReadLE64(key + 16);
+	st.pad[1] = ReadLE64(key + 24);
+	st.leftover = 0;
+}
+
+// hibit is 1 << 40 for full blocks, and 0 for the padded last block
+static void Poly1305Blocks(Poly1305State& st, const NDI_BYTE* m, size_t size, NDI_QWORD hibit)
+{
+	const NDI_QWORD mask44 = 0xfffffffffff, mask42 = 0x3ffffffffff;
+	NDI_QWORD r0 = st.r[0], r1 = st.r[1], r2 = st.r[2], s1 = st.s[0], s2 = st.s[1];
+	NDI_QWORD h0 = st.h[0], h1 = st.h[1], h2 = st.h[2];
+
+	while (size >= 16)
+	{
+		NDI_QWORD t0 = ReadLE64(m), t1 = ReadLE64(m + 8);
+		h0 += t0 & mask44;
+		h1 += ((t0 >> 44) | (t1 << 20)) & mask44;
+		h2 += (((t1 >> 24)) & mask42) | hibit;
+
+		// h *= r, modulo 2^130 - 5
+		NexusUInt128 d0 = Mul64(h0, r0), d1 = Mul64(h0, r1), d2 = Mul64(h0, r2);
+		Add128(d0, Mul64(h1, s2));
+		Add128(d0, Mul64(h2, s1));
+		Add128(d1, Mul64(h1, r0));
+		Add128(d1, Mul64(h2, s2));
+		Add128(d2, Mul64(h1, r1));
+		Add128(d2, Mul64(h2, r0));
+
+		NDI_QWORD c = Shr128(d0, 44);
+		h0 = d0.lo & mask44;
+		NexusUInt128 carry = { c, 0 };
+		Add128(d1, carry);
+		c = Shr128(d1, 44);
+		h1 = d1.lo & mask44;
+		carry.lo = c;
+		Add128(d2, carry);
+		c = Shr128(d2, 42);
+		h2 = d2.lo & mask42;
+		h0 += c * 5;
+		c = h0 >> 44;
+		h0 &= mask44;
+		h1 += c;
+
+		m += 16;
+		size -= 16;
+	}
+
+	st.h[0] = h0;
+	st.h[1] = h1;
+	st.h[2] = h2;
+}
+
+static void Poly1305Update(Poly1305State& st, const NDI_BYTE* m, size_t size)
+{
+	if (st.leftover)
+	{
+		size_t n = 16 - st.leftover < size ? 16 - st.leftover : size;
+		memcpy(st.buffer + st.leftover, m, n);
+		st.leftover += n;
+		m += n;
+		size -= n;
+		if (st.leftover < 16)
+		{
+			return;
+		}
+		Poly1305Blocks(st, st.buffer, 16, (NDI_QWORD)1 << 40);
+		st.leftover = 0;
+	}
+	if (size >= 16)
+	{
+		size_t n = size & ~(size_t)15;
+		Poly1305Blocks(st, m, n, (NDI_QWORD)1 << 40);
+		m += n;
+		size -= n;
+	}
+	if (size)
+	{
+		memcpy(st.buffer, m, size);
+		st.leftover = size;
+	}
+}
+
+static void Poly1305Finish(Poly1305State& st, NDI_BYTE* tag)
+{
+	const NDI_QWORD mask44 = 0xfffffffffff, mask42 = 0x3ffffffffff;
+	if (st.leftover)
+	{
+		// the last partial block ends with a 1 byte instead of the 1 << 128 bit
+		st.buffer[st.leftover] = 1;
+		for (size_t i = st.leftover + 1; i < 16; i++)
+		{
+			st.buffer[i] = 0;
+		}
+		Poly1305Blocks(st, st.buffer, 16, 0);
+	}
+
+	// fully carry h
+	NDI_QWORD h0 = st.h[0], h1 = st.h[1], h2 = st.h[2], c;
+	c = h1 >> 44; h1 &= mask44;
+	h2 += c; c = h2 >> 42; h2 &= mask42;
+	h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+	h1 += c; c = h1 >> 44; h1 &= mask44;
+	h2 += c; c = h2 >> 42; h2 &= mask42;
+	h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+	h1 += c;
+
+	// g = h + 5 - 2^130, which is h mod 2^130 - 5 if it doesn't go below zero
+	NDI_QWORD g0 = h0 + 5; c = g0 >> 44; g0 &= mask44;
+	NDI_QWORD g1 = h1 + c; c = g1 >> 44; g1 &= mask44;
+	NDI_QWORD g2 = h2 + c - ((NDI_QWORD)1 << 42);
+
+	c = (g2 >> 63) - 1;
+	g0 &= c; g1 &= c; g2 &= c;
+	c = ~c;
+	h0 = (h0 & c) | g0;
+	h1 = (h1 & c) | g1;
+	h2 = (h2 & c) | g2;
+
+	// tag = h + pad, modulo 2^128
+	NDI_QWORD t0 = st.pad[0], t1 = st.pad[1];
+	h0 += t0 & mask44; c = h0 >> 44; h0 &= mask44;
+	h1 += (((t0 >> 44) | (t1 << 20)) & mask44) + c; c = h1 >> 44; h1 &= mask44;
+	h2 += (((t1 >> 24)) & mask42) + c; h2 &= mask42;
+
+	WriteLE64(tag, h0 | (h1 << 44));
+	WriteLE64(tag + 8, (h1 >> 20) | (h2 << 24));
+}
+
+void Nexus_Crypto::Poly1305(NDI_BYTE* tag, const NDI_BYTE* data, size_t size, const NDI_BYTE* key)
+{
+	Poly1305State st;
+	Poly1305Init(st, key);
+	Poly1305Update(st, data, size);
+	Poly1305Finish(st, tag);
+}
+
+/* ChaCha20-Poly1305 */
+
+static const NDI_BYTE zeros[16] = { 0 };
+
+// the tag over aad and the ciphertext, each padded to 16 bytes, and their lengths
+static void AEADTag(NDI_BYTE* tag, const NDI_BYTE* data, size_t size, const NDI_BYTE* aad, size_t aadSize,
+	const NDI_BYTE* key, const NDI_BYTE* nonce)
+{
+
+	// the one-time key is the first half of key stream block 0
+	NDI_BYTE polyKey[64] = { 0 };
+	Nexus_Crypto::ChaCha20(polyKey, sizeof(polyKey), key, nonce, 0);
+
+	Poly1305State st;
+	Poly1305Init(st, polyKey);
+	Poly1305Update(st, aad, aadSize);
+	Poly1305Update(st, zeros, (16 - aadSize % 16) % 16);
+	Poly1305Update(st, data, size);
+	Poly1305Update(st, zeros, (16 - size % 16) % 16);
+	NDI_BYTE lengths[16];
+	WriteLE64(lengths, (NDI_QWORD)aadSize);
+	WriteLE64(lengths + 8, (NDI_QWORD)size);
+	Poly1305Update(st, lengths, 16);
+	Poly1305Finish(st, tag);
+}
+
+void Nexus_Crypto::AEADEncrypt(NDI_BYTE* data, size_t size, const NDI_BYTE* aad, size_t aadSize,
+	const NDI_BYTE* key, const NDI_BYTE* nonce, NDI_BYTE* tag)
+{
+	ChaCha20(data, size, key, nonce, 1);
+	AEADTag(tag, data, size, aad, aadSize, key, nonce);
+}
+
+bool Nexus_Crypto::AEADDecrypt(NDI_BYTE* data, size_t size, const NDI_BYTE* aad, size_t aadSize,
+	const NDI_BYTE* key, const NDI_BYTE* nonce, const NDI_BYTE* tag)
+{
+	NDI_BYTE expected[TagSize];
+	AEADTag(expected, data, size, aad, aadSize, key, nonce);
+	if (!Equal(expected, tag, TagSize))
+	{
+		return false;
+	}
+	ChaCha20(data, size, key, nonce, 1);
+	return true;
+}
+
+Nexus_Crypto::AEAD::AEAD(const NDI_BYTE* key, const NDI_BYTE* nonce, const NDI_BYTE* aad, size_t aadSize)
+	: counter(1), keyStreamUsed(sizeof(keyStream)), dataSize(0), aadSize(aadSize)
+{
+	memcpy(this->key, key, KeySize);
+	memcpy(this->nonce, nonce, NonceSize);
+
+	NDI_BYTE polyKey[64] = { 0 };
+	ChaCha20(polyKey, sizeof(polyKey), key, nonce, 0);
+	Poly1305Init(poly, polyKey);
+	Poly1305Update(poly, aad, aadSize);
+	Poly1305Update(poly, zeros, (16 - aadSize % 16) % 16);
+}
+
+Nexus_Crypto::AEAD::~AEAD()
+{
+	volatile NDI_BYTE* wipe = key;
+	for (size_t i = 0; i < KeySize; i++)
+	{
+		wipe[i] = 0;
+	}
+}
+
+void Nexus_Crypto::AEAD::XorKeyStream(NDI_BYTE* data, size_t size)
+{
+	// the rest of the last key stream block, whole blocks, then the start of a new one
+	for (; size > 0 && keyStreamUsed < sizeof(keyStream); size--)
+	{
+		*data++ ^= keyStream[keyStreamUsed++];
+	}
+	size_t whole = size / 64 * 64;
+	ChaCha20(data, whole, key, nonce, counter);
+	counter += (NDI_DWORD)(whole / 64);
+	data += whole;
+	size -= whole;
+	if (size > 0)
+	{
+		memset(keyStream, 0, sizeof(keyStream));
+		ChaCha20(keyStream, sizeof(keyStream), key, nonce, counter++);
+		for (keyStreamUsed = 0; keyStreamUsed < size; keyStreamUsed++)
+		{
+			data[keyStreamUsed] ^= keyStream[keyStreamUsed];
+		}
+	}
+}
+
+void Nexus_Crypto::AEAD::Encrypt(NDI_BYTE* data, size_t size)
+{
+	XorKeyStream(data, size);
+	Poly1305Update(poly, data, size);
+	dataSize += size;
+}
+
+void Nexus_Crypto::AEAD::Decrypt(NDI_BYTE* data, size_t size)
+{
+	Poly1305Update(poly, data, size);
+	XorKeyStream(data, size);
+	dataSize += size;
+}
+
+void Nexus_Crypto::AEAD::Finish(NDI_BYTE* tag)
+{
+	Poly1305Update(poly, zeros, (size_t)((16 - dataSize % 16) % 16));
+	NDI_BYTE lengths[16];
+	WriteLE64(lengths, (NDI_QWORD)aadSize);
+	WriteLE64(lengths + 8, dataSize);
+	Poly1305Update(poly, lengths, 16);
+	Poly1305Finish(poly, tag);
+}
+
+/* SHA-256 */
+
+static const NDI_DWORD SHA256K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define NEXUS_ROTR32(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+static void SHA256Block(NDI_DWORD* h, const NDI_BYTE* block)
+{
+	NDI_DWORD w[64];
+	for (int i = 0; i < 16; i++)
+	{
+		w[i] = ((NDI_DWORD)block[4 * i] << 24) | ((NDI_DWORD)block[4 * i + 1] << 16)
+			| ((NDI_DWORD)block[4 * i + 2] << 8) | (NDI_DWORD)block[4 * i + 3];
+	}
+	for (int i = 16; i < 64; i++)
+	{
+		NDI_DWORD s0 = NEXUS_ROTR32(w[i - 15], 7) ^ NEXUS_ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		NDI_DWORD s1 = NEXUS_ROTR32(w[i - 2], 17) ^ NEXUS_ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	NDI_DWORD a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+	for (int i = 0; i < 64; i++)
+	{
+		NDI_DWORD s1 = NEXUS_ROTR32(e, 6) ^ NEXUS_ROTR32(e, 11) ^ NEXUS_ROTR32(e, 25);
+		NDI_DWORD ch = (e & f) ^ (~e & g);
+		NDI_DWORD t1 = k + s1 + ch + SHA256K[i] + w[i];
+		NDI_DWORD s0 = NEXUS_ROTR32(a, 2) ^ NEXUS_ROTR32(a, 13) ^ NEXUS_ROTR32(a, 22);
+		NDI_DWORD maj = (a & b) ^ (a & c) ^ (b & c);
+		NDI_DWORD t2 = s0 + maj;
+		k = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+struct SHA256State
+{
+	NDI_DWORD h[8];
+	NDI_BYTE buffer[64];
+	NDI_QWORD size;
+};
+
+static void SHA256Init(SHA256State& st)
+{
+	static const NDI_DWORD initial[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(st.h, initial, sizeof(initial));
+	st.size = 0;
+}
+
+static void SHA256Update(SHA256State& st, const NDI_BYTE* data, size_t size)
+{
+	size_t used = (size_t)(st.size % 64);
+	st.size += size;
+	if (used)
+	{
+		size_t n = 64 - used < size ? 64 - used : size;
+		memcpy(st.buffer + used, data, n);
+		data += n;
+		size -= n;
+		if (used + n < 64)
+		{
+			return;
+		}
+		SHA256Block(st.h, st.buffer);
+	}
+	for (; size >= 64; data += 64, size -= 64)
+	{
+		SHA256Block(st.h, data);
+	}
+	memcpy(st.buffer, data, size);
+}
+
+// writes the big-endian words of h
+static void SHA256Output(NDI_BYTE* digest, const NDI_DWORD* h)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		digest[4 * i] = (NDI_BYTE)(h[i] >> 24);
+		digest[4 * i + 1] = (NDI_BYTE)(h[i] >> 16);
+		digest[4 * i + 2] = (NDI_BYTE)(h[i] >> 8);
+		digest[4 * i + 3] = (NDI_BYTE)h[i];
+	}
+}
+
+static void SHA256Final(SHA256State& st, NDI_BYTE* digest)
+{
+	// the rest, a 1 bit, zeros and the length in bits, in one or two blocks
+	NDI_BYTE last[128] = { 0 };
+	size_t rest = (size_t)(st.size % 64);
+	memcpy(last, st.buffer, rest);
+	last[rest] = 0x80;
+	size_t lastSize = rest < 56 ? 64 : 128;
+	NDI_QWORD bits = st.size * 8;
+	for (int i = 0; i < 8; i++)
+	{
+		last[lastSize - 1 - i] = (NDI_BYTE)(bits >> (8 * i));
+	}
+	SHA256Block(st.h, last);
+	if (lastSize == 128)
+	{
+		SHA256Block(st.h, last + 64);
+	}
+	SHA256Output(digest, st.h);
+}
+
+void Nexus_Crypto::SHA256(NDI_BYTE* digest, const NDI_BYTE* data, size_t size)
+{
+	SHA256State st;
+	SHA256Init(st);
+	SHA256Update(st, data, size);
+	SHA256Final(st, digest);
+}
+
+/* HMAC-SHA256 and PBKDF2 */
+
+// the hash states after the key xored with the inner and the outer pad
+static void HMACInit(SHA256State& inner, SHA256State& outer, const NDI_BYTE* key, size_t keySize)
+{
+	NDI_BYTE block[64] = { 0 };
+	if (keySize > 64)
+	{
+		Nexus_Crypto::SHA256(block, key, keySize);
+	}
+	else
+	{
+		memcpy(block, key, keySize);
+	}
+
+	NDI_BYTE pad[64];
+	for (int i = 0; i < 64; i++)
+	{
+		pad[i] = block[i] ^ 0x36;
+	}
+	SHA256Init(inner);
+	SHA256Update(inner, pad, 64);
+	for (int i = 0; i < 64; i++)
+	{
+		pad[i] = block[i] ^ 0x5c;
+	}
+	SHA256Init(outer);
+	SHA256Update(outer, pad, 64);
+}
+
+static void HMACFinal(SHA256State& inner, SHA256State& outer, NDI_BYTE* mac)
+{
+	NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	SHA256Final(inner, digest);
+	SHA256Update(outer, digest, sizeof(digest));
+	SHA256Final(outer, mac);
+}
+
+void Nexus_Crypto::HMACSHA256(NDI_BYTE* mac, const NDI_BYTE* key, size_t keySize, const NDI_BYTE* data, size_t size)
+{
+	SHA256State inner, outer;
+	HMACInit(inner, outer, key, keySize);
+	SHA256Update(inner, data, size);
+	HMACFinal(inner, outer, mac);
+}
+
+void Nexus_Crypto::PBKDF2(NDI_BYTE* out, size_t outSize, const NDI_BYTE* password, size_t passwordSize,
+	const NDI_BYTE* salt, size_t saltSize, NDI_DWORD iterations)
+{
+	SHA256State inner, outer;
+	HMACInit(inner, outer, password, passwordSize);
+
+	// every iteration after the first hashes one 32 byte digest after a pad, so its padded
+	// block is built once and only the digest is rewritten
+	NDI_BYTE block[64] = { 0 };
+	block[32] = 0x80;
+	block[62] = (64 + 32) * 8 >> 8;
+	block[63] = (NDI_BYTE)((64 + 32) * 8);
+
+	for (NDI_DWORD blockIndex = 1; outSize > 0; blockIndex++)
+	{
+		// U1 = HMAC(password, salt || blockIndex)
+		NDI_BYTE u[DigestSize], t[DigestSize];
+		NDI_BYTE index[4] = { (NDI_BYTE)(blockIndex >> 24), (NDI_BYTE)(blockIndex >> 16), (NDI_BYTE)(blockIndex >> 8), (NDI_BYTE)blockIndex };
+		SHA256State innerU = inner, outerU = outer;
+		SHA256Update(innerU, salt, saltSize);
+		SHA256Update(innerU, index, 4);
+		HMACFinal(innerU, outerU, u);
+		memcpy(t, u, DigestSize);
+
+		// Ui = HMAC(password, Ui-1), xored into T
+		for (NDI_DWORD i = 1; i < iterations; i++)
+		{
+			NDI_DWORD h[8];
+			memcpy(block, u, DigestSize);
+			memcpy(h, inner.h, sizeof(h));
+			SHA256Block(h, block);
+			SHA256Output(block, h);
+			memcpy(h, outer.h, sizeof(h));
+			SHA256Block(h, block);
+			SHA256Output(u, h);
+			for (size_t j = 0; j < DigestSize; j++)
+			{
+				t[j] ^= u[j];
+			}
+		}
+
+		size_t n = outSize < DigestSize ? outSize : DigestSize;
+		memcpy(out, t, n);
+		out += n;
+		outSize -= n;
+	}
+}
+
+/* BLAKE3 */
+
+static const NDI_DWORD Blake3IV[8] =
+{
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// the order the message words are used in by each of the 7 rounds
+static const NDI_BYTE Blake3Schedule[7][16] =
+{
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+	{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+	{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+	{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+	{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+	{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 }
+};
+
+static const NDI_DWORD Blake3ChunkStart = 1;
+static const NDI_DWORD Blake3ChunkEnd = 2;
+static const NDI_DWORD Blake3Parent = 4;
+static const NDI_DWORD Blake3Root = 8;
+static const size_t Blake3BlockSize = 64;
+static const size_t Blake3ChunkSize = Nexus_Crypto::BLAKE3::ChunkSize;
+// the most inputs a kernel hashes at once
+static const size_t Blake3MaxDegree = 8;
+// subtrees from this size on are split between two threads
+static const size_t Blake3ThreadSize = 256 * 1024;
+
+#define NEXUS_ROTR32(v, n) (((v) >> (n)) | ((v) << (32 - (n))))
+
+#define NEXUS_BLAKE3_G(a, b, c, d, x, y) \
+	a += b + x; d = NEXUS_ROTR32(d ^ a, 16); c += d; b = NEXUS_ROTR32(b ^ c, 12); \
+	a += b + y; d = NEXUS_ROTR32(d ^ a, 8); c += d; b = NEXUS_ROTR32(b ^ c, 7);
+
+// the compression function, out receives its 16 words, the first 8 of them are the next chaining value
+static void Blake3Compress(NDI_DWORD* out, const NDI_DWORD* cv, const NDI_BYTE* block, NDI_QWORD counter,
+	NDI_DWORD blockSize, NDI_DWORD flags)
+{
+	NDI_DWORD m[16], v[16];
+	for (int i = 0; i < 16; i++)
+	{
+		m[i] = ReadLE32(block + 4 * i);
+	}
+	for (int i = 0; i < 8; i++)
+	{
+		v[i] = cv[i];
+	}
+	v[8] = Blake3IV[0];
+	v[9] = Blake3IV[1];
+	v[10] = Blake3IV[2];
+	v[11] = Blake3IV[3];
+	v[12] = (NDI_DWORD)counter;
+	v[13] = (NDI_DWORD)(counter >> 32);
+	v[14] = blockSize;
+	v[15] = flags;
+
+	for (int r = 0; r < 7; r++)
+	{
+		const NDI_BYTE* s = Blake3Schedule[r];
+		NEXUS_BLAKE3_G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+		NEXUS_BLAKE3_G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+		NEXUS_BLAKE3_G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+		NEXUS_BLAKE3_G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+		NEXUS_BLAKE3_G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+		NEXUS_BLAKE3_G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+		NEXUS_BLAKE3_G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+		NEXUS_BLAKE3_G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+// hashes count inputs of blocks blocks each into their chaining values, the first block of each with
+// flagsStart and the last with flagsEnd; the counter goes up by one for each input if increment is set
+static void Blake3HashManyPortable(const NDI_BYTE* const* inputs, size_t count, size_t blocks, NDI_QWORD counter,
+	bool increment, NDI_DWORD flags, NDI_DWORD flagsStart, NDI_DWORD flagsEnd, NDI_BYTE* out)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		NDI_DWORD cv[8], next[16];
+		memcpy(cv, Blake3IV, sizeof(Blake3IV));
+		NDI_DWORD blockFlags = flags | flagsStart;
+		for (size_t b = 0; b < blocks; b++)
+		{
+			if (b + 1 == blocks)
+			{
+				blockFlags |= flagsEnd;
+			}
+			Blake3Compress(next, cv, inputs[i] + b * Blake3BlockSize, counter, Blake3BlockSize, blockFlags);
+			memcpy(cv, next, sizeof(cv));
+			blockFlags = flags;
+		}
+		for (int w = 0; w < 8; w++)
+		{
+			WriteLE32(out + 32 * i + 4 * w, cv[w]);
+		}
+		if (increment)
+		{
+			counter++;
+		}
+	}
+}
+
+#ifdef NEXUS_CRYPTO_X86
+#define NEXUS_BLAKE3_G128(a, b, c, d, x, y) \
+	a = _mm_add_epi32(_mm_add_epi32(a, b), x); d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot16); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = _mm_or_si128(_mm_srli_epi32(b, 12), _mm_slli_epi32(b, 20)); \
+	a = _mm_add_epi32(_mm_add_epi32(a, b), y); d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot8); \
+	c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = _mm_or_si128(_mm_srli_epi32(b, 7), _mm_slli_epi32(b, 25));
+
+// turns 4 vectors of 4 words into 4 vectors of the words at the same place in each
+NEXUS_TARGET_SSE41 static inline void Transpose4(__m128i* v)
+{
+	__m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+	__m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+	__m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+	__m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+	v[0] = _mm_unpacklo_epi64(t0, t1);
+	v[1] = _mm_unpackhi_epi64(t0, t1);
+	v[2] = _mm_unpacklo_epi64(t2, t3);
+	v[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Blake3HashManyPortable for 4 inputs, one in each lane
+NEXUS_TARGET_SSE41 static void Blake3Hash4SSE41(const NDI_BYTE* const* inputs, size_t blocks, NDI_QWORD counter,
+	bool increment, NDI_DWORD flags, NDI_DWORD flagsStart, NDI_DWORD flagsEnd, NDI_BYTE* out)
+{
+	const __m128i rot16 = _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	const __m128i rot8 = _mm_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1);
+	NDI_QWORD c[4];
+	for (int i = 0; i < 4; i++)
+	{
+		c[i] = counter + (increment ? i : 0);
+	}
+	const __m128i counterLow = _mm_set_epi32((int)c[3], (int)c[2], (int)c[1], (int)c[0]);
+	const __m128i counterHigh = _mm_set_epi32((int)(c[3] >> 32), (int)(c[2] >> 32), (int)(c[1] >> 32), (int)(c[0] >> 32));
+
+	__m128i h[8];
+	for (int i = 0; i < 8; i++)
+	{
+		h[i] = _mm_set1_epi32((int)Blake3IV[i]);
+	}
+	NDI_DWORD blockFlags = flags | flagsStart;
+	for (size_t b = 0; b < blocks; b++)
+	{
+		if (b + 1 == blocks)
+		{
+			blockFlags |= flagsEnd;
+		}
+		__m128i m[16];
+		for (int g = 0; g < 4; g++)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				m[4 * g + i] = _mm_loadu_si128((const __m128i*)(inputs[i] + b * Blake3BlockSize + 16 * g));
+			}
+			Transpose4(m + 4 * g);
+		}
+
+		__m128i v[16];
+		for (int i = 0; i < 8; i++)
+		{
+			v[i] = h[i];
+		}
+		v[8] = _mm_set1_epi32((int)Blake3IV[0]);
+		v[9] = _mm_set1_epi32((int)Blake3IV[1]);
+		v[10] = _mm_set1_epi32((int)Blake3IV[2]);
+		v[11] = _mm_set1_epi32((int)Blake3IV[3]);
+		v[12] = counterLow;
+		v[13] = counterHigh;
+		v[14] = _mm_set1_epi32((int)Blake3BlockSize);
+		v[15] = _mm_set1_epi32((int)blockFlags);
+		for (int r = 0; r < 7; r++)
+		{
+			const NDI_BYTE* s = Blake3Schedule[r];
+			NEXUS_BLAKE3_G128(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+			NEXUS_BLAKE3_G128(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+			NEXUS_BLAKE3_G128(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+			NEXUS_BLAKE3_G128(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+			NEXUS_BLAKE3_G128(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+			NEXUS_BLAKE3_G128(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+			NEXUS_BLAKE3_G128(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+			NEXUS_BLAKE3_G128(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+		}
+		for (int i = 0; i < 8; i++)
+		{
+			h[i] = _mm_xor_si128(v[i], v[i + 8]);
+		}
+		blockFlags = flags;
+	}
+
+	// back to the words of each input, the first 4 words of every chaining value and then the last 4
+	Transpose4(h);
+	Transpose4(h + 4);
+	for (int i = 0; i < 4; i++)
+	{
+		_mm_storeu_si128((__m128i*)(out + 32 * i), h[i]);
+		_mm_storeu_si128((__m128i*)(out + 32 * i + 16), h[i + 4]);
+	}
+}
+
+#define NEXUS_BLAKE3_G256(a, b, c, d, x, y) \
+	a = _mm256_add_epi32(_mm256_add_epi32(a, b), x); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = _mm256_or_si256(_mm256_srli_epi32(b, 12), _mm256_slli_epi32(b, 20)); \
+	a = _mm256_add_epi32(_mm256_add_epi32(a, b), y); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8); \
+	c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = _mm256_or_si256(_mm256_srli_epi32(b, 7), _mm256_slli_epi32(b, 25));
+
+// turns 8 vectors of 8 words into 8 vectors of the words at the same place in each
+NEXUS_TARGET_AVX2 static inline void Transpose8(__m256i* v)
+{
+	// the unpack instructions work within 128-bit halves, which are put together last
+	__m256i t[8], u[8];
+	for (int i = 0; i < 8; i += 4)
+	{
+		t[i] = _mm256_unpacklo_epi32(v[i], v[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(v[i], v[i + 1]);
+		t[i + 2] = _mm256_unpacklo_epi32(v[i + 2], v[i + 3]);
+		t[i + 3] = _mm256_unpackhi_epi32(v[i + 2], v[i + 3]);
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (int i = 0; i < 4; i++)
+	{
+		v[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		v[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
+
+// Blake3HashManyPortable for 8 inputs, one in each lane
+NEXUS_TARGET_AVX2 static void Blake3Hash8AVX2(const NDI_BYTE* const* inputs, size_t blocks, NDI_QWORD counter,
+	bool increment, NDI_DWORD flags, NDI_DWORD flagsStart, NDI_DWORD flagsEnd, NDI_BYTE* out)
+{
+	const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+		13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	const __m256i rot8 = _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+		12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1);
+	NDI_DWORD low[8], high[8];
+	for (int i = 0; i < 8; i++)
+	{
+		NDI_QWORD c = counter + (increment ? i : 0);
+		low[i] = (NDI_DWORD)c;
+		high[i] = (NDI_DWORD)(c >> 32);
+	}
+	const __m256i counterLow = _mm256_loadu_si256((const __m256i*)low);
+	const __m256i counterHigh = _mm256_loadu_si256((const __m256i*)high);
+
+	__m256i h[8];
+	for (int i = 0; i < 8; i++)
+	{
+		h[i] = _mm256_set1_epi32((int)Blake3IV[i]);
+	}
+	NDI_DWORD blockFlags = flags | flagsStart;
+	for (size_t b = 0; b < blocks; b++)
+	{
+		if (b + 1 == blocks)
+		{
+			blockFlags |= flagsEnd;
+		}
+		__m256i m[16];
+		for (int g = 0; g < 2; g++)
+		{
+			for (int i = 0; i < 8; i++)
+			{
+				m[8 * g + i] = _mm256_loadu_si256((const __m256i*)(inputs[i] + b * Blake3BlockSize + 32 * g));
+			}
+			Transpose8(m + 8 * g);
+		}
+
+		__m256i v[16];
+		for (int i = 0; i < 8; i++)
+		{
+			v[i] = h[i];
+		}
+		v[8] = _mm256_set1_epi32((int)Blake3IV[0]);
+		v[9] = _mm256_set1_epi32((int)Blake3IV[1]);
+		v[10] = _mm256_set1_epi32((int)Blake3IV[2]);
+		v[11] = _mm256_set1_epi32((int)Blake3IV[3]);
+		v[12] = counterLow;
+		v[13] = counterHigh;
+		v[14] = _mm256_set1_epi32((int)Blake3BlockSize);
+		v[15] = _mm256_set1_epi32((int)blockFlags);
+		for (int r = 0; r < 7; r++)
+		{
+			const NDI_BYTE* s = Blake3Schedule[r];
+			NEXUS_BLAKE3_G256(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+			NEXUS_BLAKE3_G256(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+			NEXUS_BLAKE3_G256(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+			NEXUS_BLAKE3_G256(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+			NEXUS_BLAKE3_G256(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+			NEXUS_BLAKE3_G256(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+			NEXUS_BLAKE3_G256(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+			NEXUS_BLAKE3_G256(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+		}
+		for (int i = 0; i < 8; i++)
+		{
+			h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+		}
+		blockFlags = flags;
+	}
+
+	Transpose8(h);
+	for (int i = 0; i < 8; i++)
+	{
+		_mm256_storeu_si256((__m256i*)(out + 32 * i), h[i]);
+	}
+}
+#endif
+
+// hashes the inputs with the widest kernel the processor has, the rest of them one at a time
+static void Blake3HashMany(const NDI_BYTE* const* inputs, size_t count, size_t blocks, NDI_QWORD counter,
+	bool increment, NDI_DWORD flags, NDI_DWORD flagsStart, NDI_DWORD flagsEnd, NDI_BYTE* out)
+{
+#ifdef NEXUS_CRYPTO_X86
+	for (; UseAVX2 && count >= 8; inputs += 8, count -= 8, out += 8 * 32)
+	{
+		Blake3Hash8AVX2(inputs, blocks, counter, increment, flags, flagsStart, flagsEnd, out);
+		counter += increment ? 8 : 0;
+	}
+	for (; UseSSE41 && count >= 4; inputs += 4, count -= 4, out += 4 * 32)
+	{
+		Blake3Hash4SSE41(inputs, blocks, counter, increment, flags, flagsStart, flagsEnd, out);
+		counter += increment ? 4 : 0;
+	}
+#endif
+	Blake3HashManyPortable(inputs, count, blocks, counter, increment, flags, flagsStart, flagsEnd, out);
+}
+
+// the amount of inputs the widest kernel hashes at once
+static size_t Blake3Degree()
+{
+#ifdef NEXUS_CRYPTO_X86
+	if (UseAVX2)
+	{
+		return 8;
+	}
+	if (UseSSE41)
+	{
+		return 4;
+	}
+#endif
+	return 1;
+}
+
+// what the last block of a chunk or a parent node is compressed into, as a chaining value or the root
+struct Blake3Output
+{
+	NDI_DWORD cv[8];
+	NDI_BYTE block[64];
+	NDI_DWORD blockSize;
+	NDI_QWORD counter;
+	NDI_DWORD flags;
+};
+
+static void Blake3ChainingValue(const Blake3Output& output, NDI_BYTE* cv)
+{
+	NDI_DWORD out[16];
+	Blake3Compress(out, output.cv, output.block, output.counter, output.blockSize, output.flags);
+	for (int i = 0; i < 8; i++)
+	{
+		WriteLE32(cv + 4 * i, out[i]);
+	}
+}
+
+static Blake3Output Blake3ParentOutput(const NDI_BYTE* block)
+{
+	Blake3Output output;
+	memcpy(output.cv, Blake3IV, sizeof(Blake3IV));
+	memcpy(output.block, block, Blake3BlockSize);
+	output.blockSize = Blake3BlockSize;
+	output.counter = 0;
+	output.flags = Blake3Parent;
+	return output;
+}
+
+static void Blake3ChunkInit(Nexus_Crypto::BLAKE3ChunkState& chunk, NDI_QWORD counter)
+{
+	memcpy(chunk.cv, Blake3IV, sizeof(Blake3IV));
+	chunk.counter = counter;
+	chunk.blockSize = 0;
+	chunk.blocksDone = 0;
+}
+
+static size_t Blake3ChunkLength(const Nexus_Crypto::BLAKE3ChunkState& chunk)
+{
+	return chunk.blocksDone * Blake3BlockSize + chunk.blockSize;
+}
+
+static void Blake3ChunkUpdate(Nexus_Crypto::BLAKE3ChunkState& chunk, const NDI_BYTE* data, size_t size)
+{
+	// a block is only compressed once more data comes, since the last one is compressed with ChunkEnd
+	while (size > 0)
+	{
+		if (chunk.blockSize == Blake3BlockSize)
+		{
+			NDI_DWORD out[16];
+			Blake3Compress(out, chunk.cv, chunk.block, chunk.counter, Blake3BlockSize,
+				chunk.blocksDone == 0 ? Blake3ChunkStart : 0);
+			memcpy(chunk.cv, out, sizeof(chunk.cv));
+			chunk.blocksDone++;
+			chunk.blockSize = 0;
+		}
+		size_t n = Blake3BlockSize - chunk.blockSize < size ? Blake3BlockSize - chunk.blockSize : size;
+		memcpy(chunk.block + chunk.blockSize, data, n);
+		chunk.blockSize += n;
+		data += n;
+		size -= n;
+	}
+}
+
+static Blake3Output Blake3ChunkOutput(const Nexus_Crypto::BLAKE3ChunkState& chunk)
+{
+	Blake3Output output;
+	memcpy(output.cv, chunk.cv, sizeof(chunk.cv));
+	memcpy(output.block, chunk.block, chunk.blockSize);
+	memset(output.block + chunk.blockSize, 0, Blake3BlockSize - chunk.blockSize);
+	output.blockSize = (NDI_DWORD)chunk.blockSize;
+	output.counter = chunk.counter;
+	output.flags = (chunk.blocksDone == 0 ? Blake3ChunkStart : 0) | Blake3ChunkEnd;
+	return output;
+}
+
+// the chaining values of the whole chunks in data and of the partial one after them, if any
+static size_t Blake3CompressChunks(const NDI_BYTE* data, size_t size, NDI_QWORD counter, NDI_BYTE* out)
+{
+	const NDI_BYTE* chunks[Blake3MaxDegree];
+	size_t count = 0;
+	for (; size - count * Blake3ChunkSize >= Blake3ChunkSize; count++)
+	{
+		chunks[count] = data + count * Blake3ChunkSize;
+	}
+	Blake3HashMany(chunks, count, Blake3ChunkSize / Blake3BlockSize, counter, true, 0, Blake3ChunkStart, Blake3ChunkEnd, out);
+
+	if (size > count * Blake3ChunkSize)
+	{
+		Nexus_Crypto::BLAKE3ChunkState chunk;
+		Blake3ChunkInit(chunk, counter + count);
+		Blake3ChunkUpdate(chunk, data + count * Blake3ChunkSize, size - count * Blake3ChunkSize);
+		Blake3ChainingValue(Blake3ChunkOutput(chunk), out + count * 32);
+		return count + 1;
+	}
+	return count;
+}
+
+// the parents of each pair of chaining values, an odd one out is passed on as it is
+static size_t Blake3CompressParents(const NDI_BYTE* cvs, size_t count, NDI_BYTE* out)
+{
+	const NDI_BYTE* parents[Blake3MaxDegree];
+	size_t pairs = 0;
+	for (; count - 2 * pairs >= 2; pairs++)
+	{
+		parents[pairs] = cvs + 2 * pairs * 32;
+	}
+	Blake3HashMany(parents, pairs, 1, 0, false, Blake3Parent, 0, 0, out);
+
+	if (count > 2 * pairs)
+	{
+		memcpy(out + pairs * 32, cvs + 2 * pairs * 32, 32);
+		return pairs + 1;
+	}
+	return pairs;
+}
+
+// hashes the subtree of size bytes, which must be more than one chunk, down to at least 2 and at most
+// Blake3MaxDegree chaining values, the left half on another thread as long as threads allow it
+static size_t Blake3CompressSubtree(const NDI_BYTE* data, size_t size, NDI_QWORD counter, NDI_BYTE* out, unsigned threads)
+{
+	const size_t degree = Blake3Degree();
+	if (size <= degree * Blake3ChunkSize)
+	{
+		return Blake3CompressChunks(data, size, counter, out);
+	}
+
+	// the left subtree is the largest power of two of chunks that leaves some data on the right
+	size_t leftSize = Blake3ChunkSize;
+	while (2 * leftSize < size)
+	{
+		leftSize *= 2;
+	}
+	// a left subtree of more than degree chunks always comes down to degree chaining values, or 2 of them
+	// without a kernel, so the right ones are put after as many
+	NDI_BYTE cvs[2 * Blake3MaxDegree * 32];
+	NDI_BYTE* rightCvs = cvs + (leftSize > Blake3ChunkSize && degree == 1 ? 2 : degree) * 32;
+	size_t leftCount = 0, rightCount = 0;
+	if (threads > 1 && size >= Blake3ThreadSize)
+	{
+		std::thread left([&]() { leftCount = Blake3CompressSubtree(data, leftSize, counter, cvs, threads / 2); });
+		rightCount = Blake3CompressSubtree(data + leftSize, size - leftSize, counter + leftSize / Blake3ChunkSize, rightCvs,
+			threads - threads / 2);
+		left.join();
+	}
+	else
+	{
+		leftCount = Blake3CompressSubtree(data, leftSize, counter, cvs, 1);
+		rightCount = Blake3CompressSubtree(data + leftSize, size - leftSize, counter + leftSize / Blake3ChunkSize, rightCvs, 1);
+	}
+
+	// a single chaining value on the left only comes with one chunk on each side, which are kept as they are
+	if (leftCount == 1)
+	{
+		memcpy(out, cvs, 2 * 32);
+		return 2;
+	}
+	return Blake3CompressParents(cvs, leftCount + rightCount, out);
+}
+
+// the two chaining values at the top of the subtree of size bytes, which must be more than one chunk
+static void Blake3SubtreePair(const NDI_BYTE* data, size_t size, NDI_QWORD counter, NDI_BYTE* pair, unsigned threads)
+{
+	NDI_BYTE cvs[Blake3MaxDegree * 32], parents[Blake3MaxDegree * 32 / 2];
+	size_t count = Blake3CompressSubtree(data, size, counter, cvs, threads);
+	while (count > 2)
+	{
+		count = Blake3CompressParents(cvs, count, parents);
+		memcpy(cvs, parents, count * 32);
+	}
+	memcpy(pair, cvs, 2 * 32);
+}
+
+Nexus_Crypto::BLAKE3::BLAKE3()
+	: stackSize(0)
+{
+	Blake3ChunkInit(chunk, 0);
+}
+
+void Nexus_Crypto::BLAKE3::Update(const NDI_BYTE* data, size_t size)
+{
+	// the chunk already started is filled first
+	if (Blake3ChunkLength(chunk) > 0)
+	{
+		size_t n = Blake3ChunkSize - Blake3ChunkLength(chunk) < size ? Blake3ChunkSize - Blake3ChunkLength(chunk) : size;
+		Blake3ChunkUpdate(chunk, data, n);
+		data += n;
+		size -= n;
+		if (size == 0)
+		{
+			return;
+		}
+		NDI_BYTE cv[32];
+		Blake3ChainingValue(Blake3ChunkOutput(chunk), cv);
+		PushChainingValue(cv, chunk.counter);
+		Blake3ChunkInit(chunk, chunk.counter + 1);
+	}
+
+	// then the largest subtrees that fit what is hashed so far, keeping the last chunk,
+	// which may be the root, for later
+	unsigned threads = std::thread::hardware_concurrency();
+	while (size > Blake3ChunkSize)
+	{
+		size_t subtree = Blake3ChunkSize;
+		while (2 * subtree <= size && (chunk.counter & (2 * subtree / Blake3ChunkSize - 1)) == 0)
+		{
+			subtree *= 2;
+		}
+		if (subtree == Blake3ChunkSize)
+		{
+			BLAKE3ChunkState single;
+			NDI_BYTE cv[32];
+			Blake3ChunkInit(single, chunk.counter);
+			Blake3ChunkUpdate(single, data, subtree);
+			Blake3ChainingValue(Blake3ChunkOutput(single), cv);
+			PushChainingValue(cv, chunk.counter);
+		}
+		else
+		{
+			NDI_BYTE pair[64];
+			Blake3SubtreePair(data, subtree, chunk.counter, pair, threads);
+			PushChainingValue(pair, chunk.counter);
+			PushChainingValue(pair + 32, chunk.counter + subtree / Blake3ChunkSize / 2);
+		}
+		chunk.counter += subtree / Blake3ChunkSize;
+		data += subtree;
+		size -= subtree;
+	}
+
+	if (size > 0)
+	{
+		Blake3ChunkUpdate(chunk, data, size);
+		MergeStack(chunk.counter);
+	}
+}
+
+void Nexus_Crypto::BLAKE3::Push(const NDI_BYTE* cv, size_t size)
+{
+	// a chunk that was filled by Update is done now that more data comes
+	if (Blake3ChunkLength(chunk) == Blake3ChunkSize)
+	{
+		NDI_BYTE chunkCv[32];
+		Blake3ChainingValue(Blake3ChunkOutput(chunk), chunkCv);
+		PushChainingValue(chunkCv, chunk.counter);
+		Blake3ChunkInit(chunk, chunk.counter + 1);
+	}
+	PushChainingValue(cv, chunk.counter);
+	chunk.counter += size / Blake3ChunkSize;
+}
+
+void Nexus_Crypto::BLAKE3::Finish(NDI_BYTE* digest)
+{
+	// the root is the chunk being hashed, or the parent of the last two subtrees if it is empty,
+	// followed up the stack with ROOT only on the last compression
+	Blake3Output output;
+	size_t remaining = stackSize;
+	if (stackSize == 0 || Blake3ChunkLength(chunk) > 0)
+	{
+		output = Blake3ChunkOutput(chunk);
+	}
+	else
+	{
+		remaining = stackSize - 2;
+		output = Blake3ParentOutput(stack + remaining * 32);
+	}
+	while (remaining > 0)
+	{
+		remaining--;
+		NDI_BYTE block[64];
+		memcpy(block, stack + remaining * 32, 32);
+		Blake3ChainingValue(output, block + 32);
+		output = Blake3ParentOutput(block);
+	}
+
+	NDI_DWORD out[16];
+	Blake3Compress(out, output.cv, output.block, 0, output.blockSize, output.flags | Blake3Root);
+	for (int i = 0; i < 8; i++)
+	{
+		WriteLE32(digest + 4 * i, out[i]);
+	}
+}
+
+void Nexus_Crypto::BLAKE3::Subtree(NDI_BYTE* cv, const NDI_BYTE* data, size_t size, unsigned long long counter)
+{
+	if (size <= Blake3ChunkSize)
+	{
+		BLAKE3ChunkState single;
+		Blake3ChunkInit(single, counter);
+		Blake3ChunkUpdate(single, data, size);
+		Blake3ChainingValue(Blake3ChunkOutput(single), cv);
+		return;
+	}
+	NDI_BYTE pair[64];
+	Blake3SubtreePair(data, size, counter, pair, 1);
+	Blake3ChainingValue(Blake3ParentOutput(pair), cv);
+}
+
+void Nexus_Crypto::BLAKE3::PushChainingValue(const NDI_BYTE* cv, unsigned long long counter)
+{
+	MergeStack(counter);
+	memcpy(stack + stackSize * 32, cv, 32);
+	stackSize++;
+}
+
+void Nexus_Crypto::BLAKE3::MergeStack(unsigned long long chunks)
+{
+	// the stack holds one chaining value for each 1 bit in the amount of chunks hashed,
+	// the ones beyond that are merged into their parents
+	size_t bits = 0;
+	for (unsigned long long n = chunks; n != 0; n &= n - 1)
+	{
+		bits++;
+	}
+	while (stackSize > bits)
+	{
+		NDI_BYTE* pair = stack + (stackSize - 2) * 32;
+		Blake3ChainingValue(Blake3ParentOutput(pair), pair);
+		stackSize--;
+	}
+}
+
+/* Utilities */
+
+// fills out with size bytes from the generator of the operating system, false if it can't give them
+static bool SystemRandomBytes(NDI_BYTE* out, size_t size)
+{
+#ifdef _WIN32
+	while (size > 0)
+	{
+		ULONG n = size < 0x40000000 ? (ULONG)size : 0x40000000;
+		if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, out, n, BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+		{
+			return false;
+		}
+		out += n;
+		size -= n;
+	}
+	return true;
+#else
+#ifdef NEXUS_CRYPTO_GETRANDOM
+	// a kernel without getrandom leaves the rest to /dev/urandom
+	while (size > 0)
+	{
+		ssize_t n = getrandom(out, size, 0);
+		if (n == 0 || (n < 0 && errno != EINTR))
+		{
+			break;
+		}
+		if (n > 0)
+		{
+			out += n;
+			size -= (size_t)n;
+		}
+	}
+	if (size == 0)
+	{
+		return true;
+	}
+#endif
+	int file = open("/dev/urandom", O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+	while (size > 0)
+	{
+		ssize_t n = read(file, out, size);
+		if (n == 0 || (n < 0 && errno != EINTR))
+		{
+			close(file);
+			return false;
+		}
+		if (n > 0)
+		{
+			out += n;
+			size -= (size_t)n;
+		}
+	}
+	close(file);
+	return true;
+#endif
+}
+
+void Nexus_Crypto::RandomBytes(NDI_BYTE* out, size_t size)
+{
+	// keys, salts and nonces from anything weaker could be guessed, so there is no going on without it
+	if (!SystemRandomBytes(out, size))
+	{
+		std::cerr << "Nexus Error: The secure random generator of the system is unavailable." << std::endl;
+		abort();
+	}
+}
+
+bool Nexus_Crypto::Equal(const NDI_BYTE* a, const NDI_BYTE* b, size_t size)
+{
+	NDI_BYTE difference = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		difference |= a[i] ^ b[i];
+	}
+	return difference == 0;
+}
+
+// the finalizer of MurmurHash3, every bit of x reaches every bit of the result
+static inline NDI_QWORD Mix64(NDI_QWORD x)
+{
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+Nexus_Crypto::Permutation::Permutation(const NDI_BYTE* key, NDI_QWORD tweak, NDI_QWORD size)
+	: size(size), halfBits(1)
+{
+	while (halfBits < 32 && (1ULL << (2 * halfBits)) < size)
+	{
+		halfBits++;
+	}
+	mask = (1ULL << halfBits) - 1;
+	for (int r = 0; r < Rounds; r++)
+	{
+		roundKeys[r] = ReadLE64(key + 8 * r) ^ Mix64(tweak * Rounds + r + 1);
+	}
+}
+
+NDI_QWORD Nexus_Crypto::Permutation::operator()(NDI_QWORD index) const
+{
+	// the domain holds less than 4 times size, so a few walks at most on average
+	do
+	{
+		NDI_QWORD left = index >> halfBits, right = index & mask;
+		for (int r = 0; r < Rounds; r++)
+		{
+			NDI_QWORD next = left ^ (Mix64(right ^ roundKeys[r]) & mask);
+			left = right;
+			right = next;
+		}
+		index = (left << halfBits) | right;
+	} while (index >= size);
+	return index;
+}
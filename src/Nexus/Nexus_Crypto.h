@@ -0,0 +1,131 @@
+#ifndef _Nexus_Crypto_h_
+#define _Nexus_Crypto_h_
+// cryptographic primitives used by Entropy, all of them work in place on byte spans
+class Nexus_Crypto
+{
+public:
+	static const size_t KeySize = 32;
+	static const size_t NonceSize = 12;
+	static const size_t TagSize = 16;
+	static const size_t DigestSize = 32;
+
+	// ChaCha20 (RFC 8439): xors size bytes of data with the key stream, starting at block counter
+	static void ChaCha20(NDI_BYTE* data, size_t size, const NDI_BYTE* key, const NDI_BYTE* nonce, NDI_DWORD counter);
+
+	// Poly1305 (RFC 8439): the 16 byte tag of data under the one-time key
+	static void Poly1305(NDI_BYTE* tag, const NDI_BYTE* data, size_t size, const NDI_BYTE* key);
+
+	// ChaCha20-Poly1305 AEAD (RFC 8439): encrypts data in place and authenticates it together with aad
+	static void AEADEncrypt(NDI_BYTE* data, size_t size, const NDI_BYTE* aad, size_t aadSize,
+		const NDI_BYTE* key, const NDI_BYTE* nonce, NDI_BYTE* tag);
+	// decrypts data in place; returns false, leaving data encrypted, if the tag doesn't match
+	static bool AEADDecrypt(NDI_BYTE* data, size_t size, const NDI_BYTE* aad, size_t aadSize,
+		const NDI_BYTE* key, const NDI_BYTE* nonce, const NDI_BYTE* tag);
+
+	struct Poly1305State
+	{
+		unsigned long long r[3], s[2], h[3], pad[2];
+		NDI_BYTE buffer[16];
+		size_t leftover;
+	};
+
+	// ChaCha20-Poly1305 for data that comes in pieces of any size: Encrypt or Decrypt them in order, then Finish
+	class AEAD
+	{
+	public:
+		AEAD(const NDI_BYTE* key, const NDI_BYTE* nonce, const NDI_BYTE* aad, size_t aadSize);
+		~AEAD();
+		void Encrypt(NDI_BYTE* data, size_t size);
+		void Decrypt(NDI_BYTE* data, size_t size);
+		// the tag over the associated data and everything encrypted or decrypted so far
+		void Finish(NDI_BYTE* tag);
+
+	private:
+		void XorKeyStream(NDI_BYTE* data, size_t size);
+
+		NDI_BYTE key[KeySize];
+		NDI_BYTE nonce[NonceSize];
+		NDI_DWORD counter;
+		NDI_BYTE keyStream[64];
+		size_t keyStreamUsed;
+		unsigned long long dataSize;
+		size_t aadSize;
+		Poly1305State poly;
+	};
+
+	// SHA-256 of data
+	static void SHA256(NDI_BYTE* digest, const NDI_BYTE* data, size_t size);
+
+	struct BLAKE3ChunkState
+	{
+		NDI_DWORD cv[8];
+		unsigned long long counter;
+		NDI_BYTE block[64];
+		size_t blockSize, blocksDone;
+	};
+
+	// BLAKE3 of data that comes in pieces: the chunks of a long piece are hashed several at a time by
+	// the SIMD kernels, and its subtrees on several threads once it is large enough
+	class BLAKE3
+	{
+	public:
+		static const size_t ChunkSize = 1024;
+
+		BLAKE3();
+		void Update(const NDI_BYTE* data, size_t size);
+		// hashes the next size bytes from the chaining value Subtree gave for them instead of the bytes,
+		// so that parts of the data can be hashed by other threads; they can't be the end of the data
+		void Push(const NDI_BYTE* cv, size_t size);
+		// the DigestSize bytes digest of everything so far
+		void Finish(NDI_BYTE* digest);
+		// the chaining value of size bytes that start at chunk index counter, where size is a power of two
+		// of chunks and counter a multiple of their count
+		static void Subtree(NDI_BYTE* cv, const NDI_BYTE* data, size_t size, unsigned long long counter);
+
+	private:
+		void PushChainingValue(const NDI_BYTE* cv, unsigned long long counter);
+		void MergeStack(unsigned long long chunks);
+
+		BLAKE3ChunkState chunk;
+		NDI_BYTE stack[54 * DigestSize];
+		size_t stackSize;
+	};
+
+	// HMAC-SHA256 (RFC 2104) of data under key
+	static void HMACSHA256(NDI_BYTE* mac, const NDI_BYTE* key, size_t keySize, const NDI_BYTE* data, size_t size);
+
+	// PBKDF2-HMAC-SHA256 (RFC 8018): stretches a password into outSize bytes of key
+	static void PBKDF2(NDI_BYTE* out, size_t outSize, const NDI_BYTE* password, size_t passwordSize,
+		const NDI_BYTE* salt, size_t saltSize, NDI_DWORD iterations);
+
+	// fills out with bytes from the system's secure random generator (BCryptGenRandom on Windows, getrandom
+	// or /dev/urandom elsewhere), ending the program with an error if there is none
+	static void RandomBytes(NDI_BYTE* out, size_t size);
+
+	// compares two byte spans in a time that doesn't depend on where they differ
+	static bool Equal(const NDI_BYTE* a, const NDI_BYTE* b, size_t size);
+
+	// whether the processor, and the system for the AVX registers, support AVX2 or SSE4.1, false off x86;
+	// the kernels here and those of Rescale use them
+	static bool HasAVX2();
+	static bool HasSSE41();
+
+	// a keyed bijection of the numbers below size: a balanced Feistel network over the smallest even power of
+	// two that holds them, applied again until the result is below size; its rounds are a 64-bit mix rather
+	// than a cipher, the order it gives scatters data that is already encrypted, it doesn't have to hide it
+	class Permutation
+	{
+	public:
+		// tweak picks one of the permutations of the key, size has to be at least 1
+		Permutation(const NDI_BYTE* key, unsigned long long tweak, unsigned long long size);
+		unsigned long long operator()(unsigned long long index) const;
+
+	private:
+		static const int Rounds = 4;
+
+		unsigned long long size, mask;
+		int halfBits;
+		unsigned long long roundKeys[Rounds];
+	};
+};
+#endif
\ No newline at end of file
@@ -3,7 +3,278 @@
 class Entropy
 {
 public:
-	static std::string Nexus_Encrypt(std::string text, std::string key);
-	static std::string Nexus_Decrypt(std::string text, std::string key);
+	// the ciphers data can be encrypted with, Legacy is only kept to read images from older versions
+	enum Cipher
+	{
+		Legacy,
+		ChaCha20Poly1305
+	};
+
+	// PBKDF2 iterations for newly encrypted data, which doesn't record them; older data records its own
+	static const NDI_DWORD KeyDerivationIterations = 600000;
+	static const size_t SaltSize = 16;
+	static const size_t KeyCheckSize = 8;
+
+	// the amount of leading characters of encrypted data that CheckKey needs
+	static const size_t KeyCheckLength = 34;
+	// the size of the output Decoy makes
+	static const size_t DecoySize = 4096;
+	// the amount of leading characters of encrypted data that hold its header
+	static const size_t HeaderLength = 62;
+	// text is encrypted in chunks of this size, each of them authenticated and decrypted on its own
+	static const size_t ChunkSize = 65536;
+
+	enum KeyCheck
+	{
+		KeyUnknown,
+		KeyCorrect,
+		KeyWrong
+	};
+
+	// how text is compressed before it is encrypted: Deflate is the zlib stream PNG uses, Fast an LZ77
+	// of whole bytes in the manner of LZ4, which gives up some of the size for several times the speed
+	enum Compression
+	{
+		Uncompressed,
+		Deflate,
+		Fast
+	};
+
+	// nothing in the data can be read without the key, not even that it is there; with keyCheck, it carries
+	// a key check value, so that CheckKey can tell a wrong key from its first KeyCheckLength characters;
+	// without it, nothing short of a chunk tells; the text is compressed first with compression if that
+	// makes it smaller
+	static std::string Nexus_Encrypt(std::string text, std::string key, Cipher cipher = ChaCha20Poly1305,
+		bool keyCheck = false, Compression compression = Uncompressed);
+	// detects the cipher and compression by itself, returns false if the key is wrong or the data has been changed;
+	// data that has no magic and doesn't open with key can't be told from Legacy data, and is decrypted as that
+	static bool Nexus_Decrypt(std::string text, std::string key, std::string& result);
+	// the cipher of data from before the magic was left out, Legacy for newer data, which has none
+	static Cipher DetectCipher(const std::string& text);
+
+	// checks key against the key check value in the first characters of encrypted data, KeyUnknown if the data
+	// has none; newer data doesn't tell whether it has one, with hasCheck a key it doesn't match is wrong
+	static KeyCheck CheckKey(const std::string& prefix, const std::string& key, bool hasCheck = false);
+	// random output that stands in for data that couldn't be decrypted, it tells nothing about the data
+	static std::string Decoy();
+	// the amount of characters Nexus_Encrypt makes from textLength characters, or an Encryptor made patchable
+	static size_t EncryptedLength(size_t textLength, bool patchable = false);
+	// the most characters of text whose EncryptedLength fits in length characters, 0 if not even none do
+	static size_t TextCapacity(size_t length, bool patchable = false);
+
+	// compresses text into out with compression, unless a sample of it looks too random to get smaller
+	// or it didn't; returns the compression out ended up with, Uncompressed leaving out a copy of text
+	static Compression Compress(const std::string& text, Compression compression, std::string& out);
+	// appends the text Compress made data from to out, returns false if data is damaged
+	static bool Decompress(const std::string& data, Compression compression, std::string& out);
+	// the compression recorded in the first HeaderLength characters of encrypted data, which only key reads
+	static Compression DetectCompression(const std::string& prefix, const std::string& key);
+
+	// a payload hidden in several images is split in shards, each encrypted after this manifest, so that
+	// the images can be read in any order and a missing shard, or one of another payload, is noticed;
+	// offset is where the shard starts in the payload, which has the digest and compression given
+	struct ShardManifest
+	{
+		NDI_BYTE payloadId[16];
+		NDI_DWORD index, count;
+		unsigned long long offset, payloadLength;
+		Compression compression;
+		NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	};
+	static const size_t ShardManifestSize = 77;
+	// the ShardManifestSize characters of manifest
+	static std::string WriteShardManifest(const ShardManifest& manifest);
+	// reads the manifest at the start of text, false if there is none
+	static bool ReadShardManifest(const std::string& text, ShardManifest& manifest);
+
+	// several files hidden as one text: a directory of named entries, then the text of each entry in turn,
+	// compressed on its own so that it can be extracted alone; offset is where the text of an entry starts
+	// in the volume and length how long it is, size and digest are those of the entry once decompressed
+	struct VolumeEntry
+	{
+		std::string name;
+		unsigned long long offset, length, size;
+		Compression compression;
+		NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	};
+	// the amount of leading characters of a volume that tell how long its directory is
+	static const size_t VolumeHeaderSize = 12;
+	// a volume of the named contents, each of them compressed with compression if that makes it smaller
+	static std::string MakeVolume(const std::vector<std::string>& names, const std::vector<std::string>& contents,
+		Compression compression = Uncompressed);
+	// the length of the directory of the volume that starts with header, 0 if it isn't one
+	static size_t VolumeDirectoryLength(const std::string& header);
+	// the entries in the directory of a volume, false if it is damaged
+	static bool ReadVolumeDirectory(const std::string& directory, std::vector<VolumeEntry>& entries);
+	// the contents of entry from the length characters of its text, false if they don't match its digest
+	static bool OpenVolumeEntry(const VolumeEntry& entry, const std::string& text, std::string& out);
+
+	// encrypts textLength characters of text that come in pieces, giving the same format as Nexus_Encrypt
+	// while holding no more than a chunk of it at a time; the BLAKE3 digest of the text is worked out on
+	// the way and sealed after it, so that a decrypted text can be checked as a whole
+	class Encryptor
+	{
+	public:
+		// compression is the one the text already has, recorded in the header for decrypting to undo;
+		// patchable data can be changed a chunk at a time by ChunkTable::Patch: each chunk gets a nonce of
+		// its own and only the last one authenticates the text length, so the text has no digest and
+		// can't be compressed
+		Encryptor(const std::string& key, size_t textLength, bool keyCheck = false, Compression compression = Uncompressed,
+			bool patchable = false);
+		~Encryptor();
+		// encrypts the next piece of text, out receives the encrypted data that is ready
+		void Update(const char* text, size_t size, std::string& out);
+		// out receives the rest of the encrypted data, once all textLength characters went through Update
+		void Finish(std::string& out);
+
+	private:
+		void Seal(bool last);
+		void Stuff(const NDI_BYTE* data, size_t size);
+
+		std::vector<NDI_BYTE> aad;
+		NDI_BYTE derivedKey[Nexus_Crypto::KeySize];
+		NDI_BYTE nonce[Nexus_Crypto::NonceSize];
+		bool patchable;
+		size_t textLength, chunk, chunkCount;
+		std::vector<NDI_BYTE> pending;
+		std::vector<NDI_BYTE> group;
+		std::string ready;
+		Nexus_Crypto::BLAKE3 hasher;
+	};
+
+	// where the chunks of encrypted data lie, so that any of them can be read and decrypted
+	// without the ones before it, by any thread
+	class ChunkTable
+	{
+	public:
+		ChunkTable();
+		~ChunkTable();
+		// reads the header from the first HeaderLength characters of the data; KeyWrong if its key check
+		// tells the key is wrong, KeyUnknown if the data isn't split in chunks or its header is damaged.
+		// Data without magic opens with any key, only a chunk that decrypts shows it is there
+		KeyCheck Open(const std::string& prefix, const std::string& key);
+		size_t TextLength() const;
+		size_t Count() const;
+		// whether the last chunk carries the digest of the text, data from before digests doesn't
+		bool HasDigest() const;
+		// the compression of the text, whose length and chunks are those of the compressed text
+		Compression Compressed() const;
+		// where chunk index starts in the text
+		size_t ChunkOffset(size_t index) const;
+		// the chunks that hold the length characters of text from offset on, length can't be 0
+		void Chunks(size_t offset, size_t length, size_t& first, size_t& last) const;
+		// the characters of the data, counted from its start, that chunk index is read from
+		void Characters(size_t index, size_t& first, size_t& count) const;
+		// decrypts chunk index from the characters Characters gives for it, appending its text to out, and for
+		// the last chunk the digest to digest unless it is NULL; returns false if it isn't authentic
+		bool Decrypt(size_t index, const char* characters, std::string& out, NDI_BYTE* digest = NULL) const;
+		// the amount of characters of the data
+		size_t Length() const;
+
+		// whether the data was made patchable by its Encryptor
+		bool Patchable() const;
+		// the characters, counted from the start of the data, that writing length characters of text from offset
+		// on changes, offset being no further than TextLength; count is 0 if none do. They start and end with
+		// whole groups of the stuffing, and go on to the end of the data if the text gets longer
+		void PatchCharacters(size_t offset, size_t length, size_t& first, size_t& count) const;
+		// writes text from offset on, given the characters PatchCharacters gave; out receives the characters that
+		// replace them, more of them if the text gets longer. Only the chunks kept in part are decrypted, and
+		// each chunk that changes is sealed again with a new nonce; the table then tells of the patched data,
+		// but its header, which tells the text length, is in the characters HeaderCharacters gives.
+		// Returns false if the data isn't patchable or a chunk kept in part isn't authentic
+		bool Patch(size_t offset, const std::string& text, const std::string& characters, std::string& out);
+		// the characters of the group the header is stuffed in
+		void HeaderCharacters(size_t& first, size_t& count) const;
+		// given the characters HeaderCharacters gave, out receives them with the text length of the table
+		bool PatchHeader(const std::string& characters, std::string& out) const;
+
+	private:
+		size_t RecordOffset(size_t index) const;
+		size_t RecordSize(size_t index) const;
+		// decrypts the sealed record of chunk index in place, see Decrypt
+		bool Open(size_t index, NDI_BYTE* record, std::string& out, NDI_BYTE* digest) const;
+		// seals text as the record of chunk index, which has to have room for RecordSize
+		void Seal(size_t index, const std::string& text, NDI_BYTE* record) const;
+		// the associated data of chunk index
+		void ChunkAAD(size_t index, std::vector<NDI_BYTE>& chunkAad) const;
+
+		std::vector<NDI_BYTE> aad;
+		NDI_BYTE derivedKey[Nexus_Crypto::KeySize];
+		NDI_BYTE nonce[Nexus_Crypto::NonceSize];
+		char version;
+		size_t chunkSize, textLength, count, prefixSize, headerSize, recordsStart, digestSize, recordNonceSize;
+		Compression compression;
+	};
+
+	// decrypts data made by Nexus_Encrypt or an Encryptor as it comes in pieces, a chunk at a time; data
+	// from older versions, which can't be decrypted before all of it is there, is decrypted by Finish, and
+	// data without magic whose first chunk doesn't open is shifted back as Legacy data
+	class Decryptor
+	{
+	public:
+		Decryptor(const std::string& key);
+		// out receives the text decrypted so far, which is verified a chunk at a time (only by Finish for data
+		// from before chunks, and compressed text only comes out of Finish); returns false as soon as the key
+		// turns out wrong or the data damaged
+		bool Update(const char* data, size_t size, std::string& out);
+		// out receives the rest of the text, returns true if all of it was authentic and matches its digest
+		bool Finish(std::string& out);
+
+	private:
+		enum Format
+		{
+			Unknown,
+			Shifted,
+			Whole,
+			Stream,
+			Chunked
+		};
+
+		bool Consume(const std::vector<NDI_BYTE>& plain, std::string& out);
+		bool Open(std::string& out);
+		bool DecryptChunks(std::string& out);
+		bool Unshift(std::string& out);
+
+		std::string key;
+		std::string magic;
+		Format format;
+		std::string whole;
+		size_t wholeStart;
+		ChunkTable table;
+		size_t chunk;
+		Nexus_Crypto::BLAKE3 hasher;
+		NDI_BYTE digest[Nexus_Crypto::DigestSize];
+		std::string compressed;
+		NDI_BYTE code;
+		size_t remaining;
+		bool failed;
+		std::vector<NDI_BYTE> held;
+		std::vector<NDI_BYTE> aad;
+		NDI_BYTE derivedKey[Nexus_Crypto::KeySize];
+		std::unique_ptr<Nexus_Crypto::AEAD> aead;
+	};
+
+	// the key the order of scattered data is drawn from: derived from the password like the key of the data,
+	// so that trying a password on the order costs as much as on the data, but with a fixed salt, as the order
+	// is needed before anything can be read
+	static void ScatterKey(const std::string& key, NDI_BYTE* scatterKey);
+
+	// derived keys are cached, so that encrypting or decrypting many images with one password only
+	// pays for the key derivation once; this forgets them
+	static void ClearKeyCache();
+
+private:
+	static std::string LegacyShift(std::string text, const std::string& key, int direction);
+	// derives the key for the unstuffed data after the magic, checking it if the data has a key check;
+	// aad receives the associated data, and the masked fields of a whole header of version 7 are unmasked
+	static KeyCheck OpenHeader(char version, std::vector<NDI_BYTE>& sealed, const std::string& key,
+		std::vector<NDI_BYTE>& aad, NDI_BYTE* derivedKey);
+	// OpenHeader for version 7, whose key check is only KeyCorrect or KeyUnknown, as data may carry none
+	static KeyCheck OpenSealedHeader(std::vector<NDI_BYTE>& sealed, const std::string& key,
+		std::vector<NDI_BYTE>& aad, NDI_BYTE* derivedKey);
+	// the key for data with the given salt and iterations
+	static void DeriveKey(const std::string& key, const NDI_BYTE* salt, NDI_DWORD iterations, NDI_BYTE* derivedKey);
+	// the salt and key for new data, the salt is picked once for each password and iterations
+	static void EncryptionKey(const std::string& key, NDI_DWORD iterations, NDI_BYTE* salt, NDI_BYTE* derivedKey);
 };
 #endif
\ No newline at end of file
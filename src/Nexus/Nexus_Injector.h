@@ -1,10 +1,148 @@
 #ifndef _Nexus_Injector_h_
 #define _Nexus_Injector_h_
+// the colors of the table of an indexed image (8 bits or fewer) sorted by luminance: a pixel hides the lowest
+// bit of the place of its color in that order, and the other bit with the nearer of the colors next to it
+class Nexus_PaletteOrder
+{
+public:
+	// empty for an image that isn't indexed
+	Nexus_PaletteOrder(BMP& bmp);
+	bool Empty() const;
+	int Bit(const Pixel& pixel) const;
+	void SetBit(Pixel& pixel, int bit) const;
+
+private:
+	// the place of each color, by its red, green and blue, and the color that each place is swapped with
+	std::unordered_map<NDI_DWORD, size_t> places;
+	std::vector<Pixel> swaps;
+};
+
+// hides characters in the least significant bits of the red, green and blue elements of the pixels (and alpha,
+// or only gray in a grayscale image, see Nexus::CarrierElements), or in the colors of an indexed image
+// (Nexus_PaletteOrder), a character in 8 of them from its rightmost bit on, going through the rows from the top
+class Nexus_TextWriter
+{
+public:
+	// bmp holds the rows of the image from firstRow on
+	Nexus_TextWriter(BMP& bmp, int firstRow = 0);
+	// hides the next size characters, returns false once the image is full
+	bool Write(const char* text, size_t size);
+	// moves to character index of the text; returns false if it isn't in the rows
+	bool Seek(size_t index);
+	// hides the stop character, 8 zeros, that ends the text
+	void Finish();
+
+private:
+	bool WriteBit(int bit);
+
+	BMP& bmp;
+	int width, height, firstRow, elements;
+	int x, y, element;
+	Nexus_PaletteOrder palette;
+};
+
+// reads the characters a Nexus_TextWriter hid, from bmp holding the rows of the image from firstRow on
+class Nexus_TextReader
+{
+public:
+	Nexus_TextReader(BMP& bmp, int firstRow = 0);
+	// reads up to size characters into text, fewer once the stop character or the end of the image comes
+	size_t Read(char* text, size_t size);
+	// moves to character index of the text; returns false if it isn't in the rows
+	bool Seek(size_t index);
+
+private:
+	BMP& bmp;
+	int width, height, firstRow, elements;
+	int x, y, element;
+	bool ended;
+	Nexus_PaletteOrder palette;
+};
+
 class Nexus
 {
 public:
 	static BMP BMPEmbedText(std::string text, BMP bmp);
-	static std::string BMPExtractText(BMP bmp);
+	// extracts the hidden text, or at most its first maxLength characters
+	static std::string BMPExtractText(BMP bmp, size_t maxLength = (size_t)-1);
+	// the first maxLength characters hidden in an uncompressed 24 or 32 bit BMP, reading only the rows that hide them;
+	// returns an empty string for other BMPs
+	static std::string BMPExtractTextFromFile(const char* file, size_t maxLength);
+	// the elements of each pixel of bmp that hide bits: red, green and blue, and alpha too in a 32 bit image
+	// with an alpha channel, which PNG2BMP only gives an image that isn't fully opaque; a grayscale image
+	// (BMP::IsGrayscale) hides them in its gray instead, so that it stays gray, and alpha; an indexed image
+	// hides one bit in the color of a pixel (Nexus_PaletteOrder)
+	static int CarrierElements(BMP& bmp);
+	// the same for an image that is indexed, gray or has an alpha channel
+	static int CarrierElements(bool indexed, bool gray, bool alpha);
+	// the amount of rows, from the top, that BMPEmbedText changes to hide textLength characters
+	// in pixels of elements (CarrierElements) elements
+	static int BMPEmbedRows(size_t textLength, int width, int height, int elements = 3);
+	// hides the dataLength bytes of data, encrypted with key unless it is empty, reading and encrypting
+	// a piece at a time, so neither the data nor its encrypted form is ever held as a whole; with a key,
+	// compression is the one data already has (from Entropy::Compress), so extracting can undo it;
+	// patchable data can be changed later by PatchFile and AppendToFile, and isn't compressed
+	static void BMPEmbedStream(std::istream& data, size_t dataLength, const std::string& key, bool keyCheck, BMP& bmp,
+		Entropy::Compression compression = Entropy::Uncompressed, bool patchable = false);
+	// BMPEmbedStream into outputFile, a copy of coverFile (or coverFile itself), for dataLength bytes of data,
+	// writing only the rows that change; returns false if the cover is not an uncompressed 24 or 32 bit BMP
+	static bool BMPEmbedStreamInFile(std::istream& data, size_t dataLength, const std::string& key, bool keyCheck,
+		const char* coverFile, const char* outputFile, Entropy::Compression compression = Entropy::Uncompressed,
+		bool patchable = false);
+	// the side of the tiles BMPEmbedScattered cuts an image in, the 16KB of pixels of a tile stay in cache
+	static const int ScatterTileSide = 64;
+	// hides data like BMPEmbedStream, encrypted with key, but scattered over the whole image in an order drawn
+	// from key: tiles of ScatterTileSide by ScatterTileSide pixels in a keyed order, the bits of each tile in
+	// a keyed order of their own, a tile at a time on each core; BMPExtractStream finds it when the text at the
+	// top isn't encrypted data. Returns false if key is empty or the data doesn't fit
+	static bool BMPEmbedScattered(std::istream& data, size_t dataLength, const std::string& key, bool keyCheck, BMP& bmp,
+		Entropy::Compression compression = Entropy::Uncompressed);
+	// writes the hidden data to output as it is read, decrypting it with key unless it is empty, on all cores
+	// a batch of chunks at a time; returns false if the key is wrong or the data damaged, output then has
+	// the chunks before the damage, or unverified data from before chunks; compressed data is decompressed
+	// once all of it is decrypted
+	static bool BMPExtractStream(BMP& bmp, const std::string& key, std::ostream& output);
+	// the length bytes of hidden data from offset on (fewer if it ends before) in an uncompressed 24 or 32 bit BMP,
+	// reading only the header rows and the rows of the chunks that hold them; returns false if the key is wrong,
+	// the data damaged or, with a key, not split in chunks; without a key, the end of the data isn't known
+	// unless it is in the range; compressed data is decrypted and decompressed as a whole to find the range
+	static bool BMPExtractRangeFromFile(const char* file, const std::string& key, size_t offset, size_t length,
+		std::string& out);
+	// splits data, compressed first unless compression is Uncompressed, over the "bmp" or "png" covers, each
+	// shard as large as its cover holds in proportion to the others, and hides every shard with key after its
+	// manifest in outputs, a cover at a time on each core; returns false if data doesn't fit or an image fails
+	static bool EmbedShardsInFiles(const std::string& data, const std::string& key, bool keyCheck,
+		Entropy::Compression compression, const std::string& format, const std::vector<std::string>& covers,
+		const std::vector<std::string>& outputs);
+	// reassembles the payload EmbedShardsInFiles hid in images, which can come in any order, reading an image at
+	// a time on each core; returns false if the key is wrong, or a shard damaged, missing or from another payload
+	static bool ExtractShardsFromFiles(const std::string& format, const std::vector<std::string>& images,
+		const std::string& key, std::ostream& output);
+	// hides the named contents with key in output, a copy of the "bmp" or "png" cover, as a volume: a directory
+	// of the entries, then each entry compressed on its own unless compression is Uncompressed; returns false
+	// if the volume doesn't fit or the image fails
+	static bool EmbedVolumeInFile(const std::vector<std::string>& names, const std::vector<std::string>& contents,
+		const std::string& key, bool keyCheck, Entropy::Compression compression, const std::string& format,
+		const std::string& cover, const std::string& output);
+	// the directory of the volume hidden in a "bmp" or "png" image, reading only the rows that hold it;
+	// returns false if the key is wrong or the image holds no volume
+	static bool ReadVolumeFromFile(const std::string& format, const std::string& file, const std::string& key,
+		std::vector<Entropy::VolumeEntry>& entries);
+	// the contents of the entry called name in the volume hidden in a "bmp" or "png" image, reading only the rows
+	// of its directory and of that entry; returns false if there is none or it doesn't match its digest
+	static bool ExtractEntryFromFile(const std::string& format, const std::string& file, const std::string& key,
+		const std::string& name, std::string& out);
+	// writes data over the text hidden patchable in a "bmp" or "png" image from offset on, in place, the text
+	// getting longer if data goes on after its end; only the chunks that change are encrypted again, and a BMP
+	// only has the rows of those chunks and of the header read and written (a PNG is compressed again, one stored
+	// in segments only down to the last row that changed); returns false if the key is wrong, the text isn't patchable, offset is after
+	// its end or the text no longer fits. A BMP is written in place, chunks before header, so a patch that
+	// stops halfway can leave the text unreadable; a PNG only replaces the file once the new one is written
+	static bool PatchFile(const std::string& format, const std::string& file, const std::string& key, size_t offset,
+		const std::string& data);
+	// PatchFile at the end of the hidden text
+	static bool AppendToFile(const std::string& format, const std::string& file, const std::string& key,
+		const std::string& data);
 	static int reverseBits(int n);
 };
 #endif
\ No newline at end of file
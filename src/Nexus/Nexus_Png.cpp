@@ -1,9 +1,18 @@
 #include "Nexus_PNG.h"
 
 #include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef NEXUS_PNG_COMPILE_THREADS
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif /*NEXUS_PNG_COMPILE_THREADS*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -50,6 +59,131 @@ void* nexuspng_realloc(void* ptr, size_t new_size);
 void nexuspng_free(void* ptr);
 #endif /*NEXUS_PNG_COMPILE_ALLOCATORS*/
 
+#ifdef NEXUS_PNG_COMPILE_THREADS
+/*A call of nexuspng_parallel_for that the threads of the pool can join while it has calls left.*/
+struct ParallelJob
+{
+  size_t count;
+  unsigned numthreads; /*most threads that may work on it at once, the calling one included*/
+  void (*task)(void*, size_t);
+  void* context;
+  std::atomic<size_t> next;
+  unsigned active; /*threads working on it, guarded by the mutex of the pool*/
+};
+
+/*
+One thread per core but one, started the first time work is split and shared by the whole process, so that a
+call doesn't start threads of its own. They are never stopped: the pool is left to the end of the process, as
+joining its threads while statics are destroyed could wait on a thread the process already ended.
+*/
+class ParallelPool
+{
+  public:
+    static ParallelPool& get()
+    {
+      static ParallelPool* pool = new ParallelPool();
+      return *pool;
+    }
+
+    /*the calling thread works on the job too, and returns once no thread works on it any more*/
+    void run(ParallelJob& job)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobs.push_back(&job);
+      }
+      wake.notify_all();
+      work(job);
+      std::unique_lock<std::mutex> lock(mutex);
+      while(job.active != 0) done.wait(lock);
+    }
+
+  private:
+    ParallelPool()
+    {
+      unsigned cores = std::thread::hardware_concurrency(), t;
+      for(t = 1; t < cores; ++t) std::thread([this]() { serve(); }).detach();
+    }
+
+    void serve()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      for(;;)
+      {
+        ParallelJob* job = 0;
+        size_t j;
+        for(j = 0; j != jobs.size() && !job; ++j)
+        {
+          if(jobs[j]->active < jobs[j]->numthreads) job = jobs[j];
+        }
+        if(!job)
+        {
+          wake.wait(lock);
+          continue;
+        }
+        ++job->active;
+        lock.unlock();
+        work(*job);
+        lock.lock();
+      }
+    }
+
+    /*the calls are handed out in order, so a call can wait for one before it to be done by another thread*/
+    void work(ParallelJob& job)
+    {
+      size_t i, j;
+      while((i = job.next++) < job.count) job.task(job.context, i);
+      std::unique_lock<std::mutex> lock(mutex);
+      for(j = 0; j != jobs.size(); ++j)
+      {
+        if(jobs[j] == &job)
+        {
+          jobs.erase(jobs.begin() + j);
+          break;
+        }
+      }
+      if(--job.active == 0) done.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    std::vector<ParallelJob*> jobs;
+};
+#endif /*NEXUS_PNG_COMPILE_THREADS*/
+
+/*
+Calls task(context, i) for every i in [0, count) on the calling thread and up to numthreads - 1 threads of a
+pool shared by the whole process (0 means one per core, and never more than that); i is handed out in order.
+Returns when all calls are done. Each call must only touch its own part of the context; it may split its own
+work with nexuspng_parallel_for.
+*/
+static void nexuspng_parallel_for(size_t count, unsigned numthreads, void (*task)(void*, size_t), void* context)
+{
+#ifdef NEXUS_PNG_COMPILE_THREADS
+  unsigned cores = std::thread::hardware_concurrency();
+  if(numthreads == 0 || numthreads > cores) numthreads = cores;
+  if(numthreads > count) numthreads = (unsigned)count;
+  if(numthreads > 1)
+  {
+    ParallelJob job;
+    job.count = count;
+    job.numthreads = numthreads;
+    job.task = task;
+    job.context = context;
+    job.next = 0;
+    job.active = 1;
+    ParallelPool::get().run(job);
+    return;
+  }
+#else /*NEXUS_PNG_COMPILE_THREADS*/
+  (void)numthreads;
+#endif /*NEXUS_PNG_COMPILE_THREADS*/
+  {
+    size_t i;
+    for(i = 0; i != count; ++i) task(context, i);
+  }
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* ////////////////////////////////////////////////////////////////////////// */
 /* // Tools for C, and common code for PNG and Zlib.                       // */
@@ -1202,7 +1336,7 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
   p = (*bp) / 8; /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
-  if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
+  if(p + 4 > inlength) return 52; /*error, bit pointer will jump past memory*/
   LEN = in[p] + 256u * in[p + 1]; p += 2;
   NLEN = in[p] + 256u * in[p + 1]; p += 2;
 
@@ -1250,6 +1384,34 @@ static unsigned nexuspng_inflatev(ucvector* out,
   return error;
 }
 
+/*
+Inflates one segment of segmented image data (see SegmentInfo): blocks up to the end of in, which
+is at a byte boundary after an empty stored block. A segment has no final block.
+*/
+static unsigned inflateSegment(ucvector* out, const unsigned char* in, size_t insize)
+{
+  size_t bp = 0;
+  size_t pos = 0; /*byte position in the out buffer*/
+  unsigned error = 0;
+
+  while(bp != insize * 8)
+  {
+    unsigned BTYPE;
+    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
+    if(readBitFromStream(&bp, in)) return 52; /*error: the final block is after the segments*/
+    BTYPE = 1u * readBitFromStream(&bp, in);
+    BTYPE += 2u * readBitFromStream(&bp, in);
+
+    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
+    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+
+    if(error) return error;
+  }
+
+  return error;
+}
+
 unsigned nexuspng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const NexusPNGDecompressSettings* settings)
@@ -1620,7 +1782,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned final)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
@@ -1632,7 +1794,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
@@ -1690,31 +1852,22 @@ static void writeLZ77data(size_t* bp, ucvector* out, const uivector* lz77_encode
   }
 }
 
-/*Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees*/
-static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
-                               const unsigned char* data, size_t datapos, size_t dataend,
-                               const NexusPNGCompressSettings* settings, unsigned final)
+/*
+Write the header of a block of type "dynamic": BFINAL, BTYPE and the code lengths of the two
+given trees. The code lengths are run-length encoded and huffman compressed with a third tree.
+*/
+static unsigned writeDynamicHeader(ucvector* out, size_t* bp,
+                                   const HuffmanTree* tree_ll, const HuffmanTree* tree_d, unsigned final)
 {
   unsigned error = 0;
 
   /*
-  A block is compressed as follows: The PNG data is lz77 encoded, resulting in
-  literal bytes and length/distance pairs. This is then huffman compressed with
-  two huffman trees. One huffman tree is used for the lit and len values ("ll"),
-  another huffman tree is used for the dist values ("d"). These two trees are
-  stored using their code lengths, and to compress even more these code lengths
-  are also run-length encoded and huffman compressed. This gives a huffman tree
-  of code lengths "cl". The code lenghts used to describe this third tree are
-  the code length code lengths ("clcl").
+  The code lengths of tree_ll and tree_d are stored using run-length codes and are then
+  huffman compressed. This gives a huffman tree of code lengths "cl". The code lenghts used
+  to describe this third tree are the code length code lengths ("clcl").
   */
 
-  /*The lz77 encoded data, represented with integers since there will also be length and distance codes in it*/
-  uivector lz77_encoded;
-  HuffmanTree tree_ll; /*tree for lit,len values*/
-  HuffmanTree tree_d; /*tree for distance codes*/
   HuffmanTree tree_cl; /*tree for encoding the code lengths representing tree_ll and tree_d*/
-  uivector frequencies_ll; /*frequency of lit,len codes*/
-  uivector frequencies_d; /*frequency of dist codes*/
   uivector frequencies_cl; /*frequency of code length codes*/
   uivector bitlen_lld; /*lit,len,dist code lenghts (int bits), literally (without repeat codes).*/
   uivector bitlen_lld_e; /*bitlen_lld encoded with repeat codes (this is a rudemtary run length compression)*/
@@ -1722,7 +1875,6 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   (these are written as is in the file, it would be crazy to compress these using yet another huffman
   tree that needs to be represented by yet another set of code lengths)*/
   uivector bitlen_cl;
-  size_t datasize = dataend - datapos;
 
   /*
   Due to the huffman compression of huffman tree representations ("two levels"), there are some anologies:
@@ -1735,12 +1887,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   size_t numcodes_ll, numcodes_d, i;
   unsigned HLIT, HDIST, HCLEN;
 
-  uivector_init(&lz77_encoded);
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
   HuffmanTree_init(&tree_cl);
-  uivector_init(&frequencies_ll);
-  uivector_init(&frequencies_d);
   uivector_init(&frequencies_cl);
   uivector_init(&bitlen_lld);
   uivector_init(&bitlen_lld_e);
@@ -1750,47 +1897,11 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   allow breaking out of it to the cleanup phase on error conditions.*/
   while(!error)
   {
-    if(settings->use_lz77)
-    {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
-      if(error) break;
-    }
-    else
-    {
-      if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
-      for(i = datapos; i < dataend; ++i) lz77_encoded.data[i - datapos] = data[i]; /*no LZ77, but still will be Huffman compressed*/
-    }
-
-    if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(83 /*alloc fail*/);
-    if(!uivector_resizev(&frequencies_d, 30, 0)) ERROR_BREAK(83 /*alloc fail*/);
-
-    /*Count the frequencies of lit, len and dist codes*/
-    for(i = 0; i != lz77_encoded.size; ++i)
-    {
-      unsigned symbol = lz77_encoded.data[i];
-      ++frequencies_ll.data[symbol];
-      if(symbol > 256)
-      {
-        unsigned dist = lz77_encoded.data[i + 2];
-        ++frequencies_d.data[dist];
-        i += 3;
-      }
-    }
-    frequencies_ll.data[256] = 1; /*there will be exactly 1 end code, at the end of the block*/
-
-    /*Make both huffman trees, one for the lit and len codes, one for the dist codes*/
-    error = HuffmanTree_makeFromFrequencies(&tree_ll, frequencies_ll.data, 257, frequencies_ll.size, 15);
-    if(error) break;
-    /*2, not 1, is chosen for mincodes: some buggy PNG decoders require at least 2 symbols in the dist tree*/
-    error = HuffmanTree_makeFromFrequencies(&tree_d, frequencies_d.data, 2, frequencies_d.size, 15);
-    if(error) break;
-
-    numcodes_ll = tree_ll.numcodes; if(numcodes_ll > 286) numcodes_ll = 286;
-    numcodes_d = tree_d.numcodes; if(numcodes_d > 30) numcodes_d = 30;
+    numcodes_ll = tree_ll->numcodes; if(numcodes_ll > 286) numcodes_ll = 286;
+    numcodes_d = tree_d->numcodes; if(numcodes_d > 30) numcodes_d = 30;
     /*store the code lengths of both generated trees in bitlen_lld*/
-    for(i = 0; i != numcodes_ll; ++i) uivector_push_back(&bitlen_lld, HuffmanTree_getLength(&tree_ll, (unsigned)i));
-    for(i = 0; i != numcodes_d; ++i) uivector_push_back(&bitlen_lld, HuffmanTree_getLength(&tree_d, (unsigned)i));
+    for(i = 0; i != numcodes_ll; ++i) uivector_push_back(&bitlen_lld, HuffmanTree_getLength(tree_ll, (unsigned)i));
+    for(i = 0; i != numcodes_d; ++i) uivector_push_back(&bitlen_lld, HuffmanTree_getLength(tree_d, (unsigned)i));
 
     /*run-length compress bitlen_ldd into bitlen_lld_e by using repeat codes 16 (copy length 3-6 times),
     17 (3-10 zeroes), 18 (11-138 zeroes)*/
@@ -1868,7 +1979,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     if(error) break;
 
     /*
-    Write everything into the output
+    Write the header into the output
 
     After the BFINAL and BTYPE, the dynamic block consists out of the following:
     - 5 bits HLIT, 5 bits HDIST, 4 bits HCLEN
@@ -1877,8 +1988,8 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
       alphabet, + possible repetition codes 16, 17, 18)
     - HDIST + 1 code lengths of distance alphabet (encoded using the code length
       alphabet, + possible repetition codes 16, 17, 18)
-    - compressed data
-    - 256 (end code)
+    - compressed data (written by the caller)
+    - 256 (end code) (written by the caller)
     */
 
     /*Write block type*/
@@ -1910,6 +2021,92 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
       else if(bitlen_lld_e.data[i] == 18) addBitsToStream(bp, out, bitlen_lld_e.data[++i], 7);
     }
 
+    break; /*end of error-while*/
+  }
+
+  /*cleanup*/
+  HuffmanTree_cleanup(&tree_cl);
+  uivector_cleanup(&frequencies_cl);
+  uivector_cleanup(&bitlen_lld_e);
+  uivector_cleanup(&bitlen_lld);
+  uivector_cleanup(&bitlen_cl);
+
+  return error;
+}
+
+/*Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees*/
+static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
+                               const unsigned char* data, size_t datapos, size_t dataend,
+                               const NexusPNGCompressSettings* settings, unsigned final)
+{
+  unsigned error = 0;
+
+  /*
+  A block is compressed as follows: The PNG data is lz77 encoded, resulting in
+  literal bytes and length/distance pairs. This is then huffman compressed with
+  two huffman trees. One huffman tree is used for the lit and len values ("ll"),
+  another huffman tree is used for the dist values ("d"). These two trees are
+  stored using their code lengths, see writeDynamicHeader.
+  */
+
+  /*The lz77 encoded data, represented with integers since there will also be length and distance codes in it*/
+  uivector lz77_encoded;
+  HuffmanTree tree_ll; /*tree for lit,len values*/
+  HuffmanTree tree_d; /*tree for distance codes*/
+  uivector frequencies_ll; /*frequency of lit,len codes*/
+  uivector frequencies_d; /*frequency of dist codes*/
+  size_t datasize = dataend - datapos;
+  size_t i;
+
+  uivector_init(&lz77_encoded);
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+  uivector_init(&frequencies_ll);
+  uivector_init(&frequencies_d);
+
+  /*This while loop never loops due to a break at the end, it is here to
+  allow breaking out of it to the cleanup phase on error conditions.*/
+  while(!error)
+  {
+    if(settings->use_lz77)
+    {
+      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
+                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      if(error) break;
+    }
+    else
+    {
+      if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
+      for(i = datapos; i < dataend; ++i) lz77_encoded.data[i - datapos] = data[i]; /*no LZ77, but still will be Huffman compressed*/
+    }
+
+    if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(83 /*alloc fail*/);
+    if(!uivector_resizev(&frequencies_d, 30, 0)) ERROR_BREAK(83 /*alloc fail*/);
+
+    /*Count the frequencies of lit, len and dist codes*/
+    for(i = 0; i != lz77_encoded.size; ++i)
+    {
+      unsigned symbol = lz77_encoded.data[i];
+      ++frequencies_ll.data[symbol];
+      if(symbol > 256)
+      {
+        unsigned dist = lz77_encoded.data[i + 2];
+        ++frequencies_d.data[dist];
+        i += 3;
+      }
+    }
+    frequencies_ll.data[256] = 1; /*there will be exactly 1 end code, at the end of the block*/
+
+    /*Make both huffman trees, one for the lit and len codes, one for the dist codes*/
+    error = HuffmanTree_makeFromFrequencies(&tree_ll, frequencies_ll.data, 257, frequencies_ll.size, 15);
+    if(error) break;
+    /*2, not 1, is chosen for mincodes: some buggy PNG decoders require at least 2 symbols in the dist tree*/
+    error = HuffmanTree_makeFromFrequencies(&tree_d, frequencies_d.data, 2, frequencies_d.size, 15);
+    if(error) break;
+
+    error = writeDynamicHeader(out, bp, &tree_ll, &tree_d, final);
+    if(error) break;
+
     /*write the compressed data symbols*/
     writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
     /*error: the length of the end code 256 must be larger than 0*/
@@ -1925,13 +2122,8 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   uivector_cleanup(&lz77_encoded);
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
-  HuffmanTree_cleanup(&tree_cl);
   uivector_cleanup(&frequencies_ll);
   uivector_cleanup(&frequencies_d);
-  uivector_cleanup(&frequencies_cl);
-  uivector_cleanup(&bitlen_lld_e);
-  uivector_cleanup(&bitlen_lld);
-  uivector_cleanup(&bitlen_cl);
 
   return error;
 }
@@ -1984,56 +2176,967 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
-static unsigned nexuspng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const NexusPNGCompressSettings* settings)
-{
-  unsigned error = 0;
-  size_t i, blocksize, numdeflateblocks;
-  size_t bp = 0; /*the bit pointer*/
-  Hash hash;
+/* ////////////////////////////////////////////////////////////////////////// */
+/* / Deflator - optimal parsing (maximum compression)                       / */
+/* ////////////////////////////////////////////////////////////////////////// */
 
-  if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
-  else if(settings->btype == 1) blocksize = insize;
-  else /*if(settings->btype == 2)*/
-  {
-    /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
-    blocksize = insize / 8 + 8;
-    if(blocksize < 65536) blocksize = 65536;
-    if(blocksize > 262144) blocksize = 262144;
-  }
+/*
+Used instead of encodeLZ77 when settings->optimal is set. The match finder first records,
+for every position, the shortest distance for each match length that is available there.
+The LZ77 parse of a block is then chosen as the shortest path through the block, where
+the cost of each symbol is its bit length in a statistical model. The model is rebuilt
+from the previous parse for settings->numiterations rounds, and the smallest parse wins.
+Before that, each master block is split into deflate blocks wherever a separate pair of
+huffman trees pays for itself, and each block is finally written with whichever of the
+stored, fixed or dynamic block types is smallest.
+
+Master blocks only read their preceding window as dictionary and never depend on how it
+was encoded, so they are encoded on separate threads and their bit streams concatenated.
+*/
 
-  numdeflateblocks = (insize + blocksize - 1) / blocksize;
-  if(numdeflateblocks == 0) numdeflateblocks = 1;
+#define OPT_MASTER_BLOCK_SIZE 1000000 /*input bytes per independently encoded master block*/
+#define OPT_WINDOW_SIZE 32768
+#define OPT_WINDOW_MASK 32767
+#define OPT_MAX_CHAIN_HITS 8192 /*positions visited per match search*/
+#define OPT_MAX_STEPS 8 /*(length, distance) steps remembered per position*/
+#define OPT_SPLIT_SAMPLES 9 /*block split points sampled per round of the split point search*/
+#define OPT_LARGE_FLOAT 1e30f
 
-  error = hash_init(&hash, settings->windowsize);
-  if(error) return error;
+/*the matches found at each position of a master block*/
+typedef struct OptMatches
+{
+  /*steps of position start + i are at [first[i], first[i + 1]). Each step is the longest match
+  length reachable with the given distance, and any shorter length (down to the previous step)
+  is also reachable with it. Both increase from step to step.*/
+  unsigned* first;
+  unsigned short* length;
+  unsigned short* dist;
+  size_t size, allocsize;
+  unsigned short* same; /*amount of equal bytes starting at each position (capped at 65535)*/
+} OptMatches;
 
-  for(i = 0; i != numdeflateblocks && !error; ++i)
-  {
-    unsigned final = (i == numdeflateblocks - 1);
-    size_t start = i * blocksize;
-    size_t end = start + blocksize;
-    if(end > insize) end = insize;
+/*an LZ77 parse: litlen is a literal byte if dist is 0, a match length otherwise*/
+typedef struct OptParse
+{
+  unsigned short* litlen;
+  unsigned short* dist;
+  size_t* pos; /*position in the input where each symbol starts*/
+  size_t size;
+} OptParse;
 
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
-  }
+/*cost in bits of each literal, length and distance, including extra bits*/
+typedef struct OptCostModel
+{
+  float literal[256];
+  float length[MAX_SUPPORTED_DEFLATE_LENGTH + 1];
+  float dist[30];
+} OptCostModel;
 
-  hash_cleanup(&hash);
+typedef struct OptStats
+{
+  size_t ll[286];
+  size_t d[30];
+} OptStats;
 
-  return error;
+static unsigned optGetLengthSymbol(unsigned length)
+{
+  return (unsigned)searchCodeIndex(LENGTHBASE, 29, length) + FIRST_LENGTH_CODE_INDEX;
 }
 
-unsigned nexuspng_deflate(unsigned char** out, size_t* outsize,
-                         const unsigned char* in, size_t insize,
-                         const NexusPNGCompressSettings* settings)
+static unsigned optGetDistSymbol(unsigned dist)
 {
-  unsigned error;
-  ucvector v;
-  ucvector_init_buffer(&v, *out, *outsize);
-  error = nexuspng_deflatev(&v, in, insize, settings);
-  *out = v.data;
+  /*the codes come in pairs per power of two, the second half of each pair has the next bit set*/
+  unsigned d = dist - 1, l = 0;
+  if(dist < 5) return d;
+  while((d >> (l + 1)) != 0) ++l;
+  return l * 2 + ((d >> (l - 1)) & 1);
+}
+
+static void optMatches_init(OptMatches* m)
+{
+  m->first = 0;
+  m->length = 0;
+  m->dist = 0;
+  m->size = m->allocsize = 0;
+  m->same = 0;
+}
+
+static void optMatches_cleanup(OptMatches* m)
+{
+  nexuspng_free(m->first);
+  nexuspng_free(m->length);
+  nexuspng_free(m->dist);
+  nexuspng_free(m->same);
+}
+
+static unsigned optMatches_push(OptMatches* m, unsigned length, unsigned dist)
+{
+  if(m->size >= m->allocsize)
+  {
+    size_t newsize = m->allocsize * 2 + 1024;
+    unsigned short* length_data = (unsigned short*)nexuspng_realloc(m->length, newsize * sizeof(unsigned short));
+    unsigned short* dist_data;
+    if(!length_data) return 83; /*alloc fail*/
+    m->length = length_data;
+    dist_data = (unsigned short*)nexuspng_realloc(m->dist, newsize * sizeof(unsigned short));
+    if(!dist_data) return 83; /*alloc fail*/
+    m->dist = dist_data;
+    m->allocsize = newsize;
+  }
+  m->length[m->size] = (unsigned short)length;
+  m->dist[m->size] = (unsigned short)dist;
+  ++m->size;
+  return 0;
+}
+
+/*records a match of position i, that is longer than all matches with a shorter distance*/
+static unsigned optAddStep(OptMatches* m, size_t i, unsigned length, unsigned dist)
+{
+  if(m->size - m->first[i] == OPT_MAX_STEPS)
+  {
+    /*out of room: the last step is replaced, its shorter lengths are then reached with the longer distance*/
+    m->length[m->size - 1] = (unsigned short)length;
+    m->dist[m->size - 1] = (unsigned short)dist;
+    return 0;
+  }
+  return optMatches_push(m, length, dist);
+}
+
+static unsigned optHash(const unsigned char* data)
+{
+  unsigned value = (unsigned)data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16);
+  return ((value * 2654435761u) >> 16) & 65535u;
+}
+
+/*
+Finds the matches of every position in [start, end). Matches look back into the window before
+start, but never extend past end.
+*/
+static unsigned optFindMatches(OptMatches* m, const unsigned char* in, size_t start, size_t end)
+{
+  unsigned error = 0;
+  size_t lookback = start > OPT_WINDOW_SIZE ? start - OPT_WINDOW_SIZE : 0;
+  size_t pos, runlength = 0;
+  /*head and prev chain all positions by the hash of their first three bytes. Positions inside a run
+  of one byte value all share a hash, so those are also chained by run length in head2 and prev2.*/
+  int* head = (int*)nexuspng_malloc(sizeof(int) * 65536);
+  int* head2 = (int*)nexuspng_malloc(sizeof(int) * 65536);
+  int* prev = (int*)nexuspng_malloc(sizeof(int) * OPT_WINDOW_SIZE);
+  int* prev2 = (int*)nexuspng_malloc(sizeof(int) * OPT_WINDOW_SIZE);
+  unsigned short* same = (unsigned short*)nexuspng_malloc(sizeof(unsigned short) * OPT_WINDOW_SIZE);
+
+  m->first = (unsigned*)nexuspng_malloc(sizeof(unsigned) * (end - start + 1));
+  m->same = (unsigned short*)nexuspng_malloc(sizeof(unsigned short) * (end - start + 1));
+  if(!head || !head2 || !prev || !prev2 || !same || !m->first || !m->same) error = 83; /*alloc fail*/
+
+  if(!error)
+  {
+    for(pos = 0; pos != 65536; ++pos) head[pos] = head2[pos] = -1;
+  }
+
+  for(pos = lookback; pos < end && !error; ++pos)
+  {
+    size_t wpos = pos & OPT_WINDOW_MASK;
+    size_t i = pos - start;
+    unsigned maxlength = end - pos < MAX_SUPPORTED_DEFLATE_LENGTH ? (unsigned)(end - pos) : MAX_SUPPORTED_DEFLATE_LENGTH;
+    unsigned bestlength = 2, hits = 0, hashval = 0, hashval2 = 0, run;
+    int p;
+
+    /*the run of equal bytes only needs to be counted again when the previous one ended*/
+    if(runlength > 1 && in[pos] == in[pos - 1]) --runlength;
+    else
+    {
+      runlength = 1;
+      while(pos + runlength < end && runlength < 65535 && in[pos + runlength] == in[pos]) ++runlength;
+    }
+    run = (unsigned)runlength;
+    same[wpos] = (unsigned short)run;
+
+    if(pos + 2 < end)
+    {
+      hashval = optHash(&in[pos]);
+      prev[wpos] = head[hashval];
+      head[hashval] = (int)pos;
+      if(run >= 3)
+      {
+        hashval2 = ((unsigned)in[pos] * 259u + (run < 259 ? run : 259)) & 65535u;
+        prev2[wpos] = head2[hashval2];
+        head2[hashval2] = (int)pos;
+      }
+    }
+
+    if(pos < start) continue;
+    m->first[i] = (unsigned)m->size;
+    m->same[i] = (unsigned short)run;
+    if(maxlength < 3 || pos + 2 >= end) continue;
+
+    if(run >= 3)
+    {
+      if(pos > lookback && in[pos - 1] == in[pos])
+      {
+        /*inside a run distance 1 matches the rest of the run, which no other distance beats*/
+        bestlength = run < maxlength ? run : maxlength;
+        error = optAddStep(m, i, bestlength, 1);
+      }
+      else
+      {
+        /*at the start of a run, earlier runs give shorter matches at shorter distances*/
+        for(p = prev[wpos]; p >= 0 && hits < OPT_MAX_CHAIN_HITS && !error; p = prev[p & OPT_WINDOW_MASK])
+        {
+          unsigned dist = (unsigned)(pos - (size_t)p), length;
+          if(dist >= OPT_WINDOW_SIZE || (size_t)p < lookback) break;
+          ++hits;
+          if(in[p] != in[pos]) continue;
+          length = same[p & OPT_WINDOW_MASK];
+          if(length >= run)
+          {
+            /*an earlier run at least as long: longer matches are found through the run length chain below*/
+            length = run < maxlength ? run : maxlength;
+            if(length > bestlength)
+            {
+              bestlength = length;
+              error = optAddStep(m, i, length, dist);
+            }
+            break;
+          }
+          if(length > maxlength) length = maxlength;
+          if(length > bestlength)
+          {
+            bestlength = length;
+            error = optAddStep(m, i, length, dist);
+            if(length >= maxlength) break;
+          }
+          if(prev[p & OPT_WINDOW_MASK] >= p) break;
+        }
+      }
+      if(bestlength >= maxlength) continue;
+
+      /*longer matches need an earlier run of exactly the same length, followed by the same bytes*/
+      hits = 0;
+      for(p = prev2[wpos]; p >= 0 && hits < OPT_MAX_CHAIN_HITS && !error; p = prev2[p & OPT_WINDOW_MASK])
+      {
+        unsigned dist = (unsigned)(pos - (size_t)p), length;
+        if(dist >= OPT_WINDOW_SIZE || (size_t)p < lookback) break;
+        ++hits;
+        if(in[p] == in[pos] && same[p & OPT_WINDOW_MASK] == run)
+        {
+          length = run < maxlength ? run : maxlength;
+          while(length < maxlength && in[p + length] == in[pos + length]) ++length;
+          if(length > bestlength)
+          {
+            bestlength = length;
+            error = optAddStep(m, i, length, dist);
+            if(length >= maxlength) break;
+          }
+        }
+        if(prev2[p & OPT_WINDOW_MASK] >= p) break;
+      }
+      continue;
+    }
+
+    for(p = prev[wpos]; p >= 0 && hits < OPT_MAX_CHAIN_HITS && !error; p = prev[p & OPT_WINDOW_MASK])
+    {
+      unsigned dist = (unsigned)(pos - (size_t)p), length = 0;
+      if(dist >= OPT_WINDOW_SIZE || (size_t)p < lookback) break;
+      ++hits;
+      /*a longer match must at least agree on the byte that ends the current best one*/
+      if(in[p + bestlength] == in[pos + bestlength])
+      {
+        while(length < maxlength && in[p + length] == in[pos + length]) ++length;
+        if(length > bestlength)
+        {
+          bestlength = length;
+          error = optAddStep(m, i, length, dist);
+          if(length >= maxlength) break;
+        }
+      }
+      if(prev[p & OPT_WINDOW_MASK] >= p) break;
+    }
+  }
+  if(!error) m->first[end - start] = (unsigned)m->size;
+
+  nexuspng_free(head);
+  nexuspng_free(head2);
+  nexuspng_free(prev);
+  nexuspng_free(prev2);
+  nexuspng_free(same);
+  return error;
+}
+
+static void optCostModel_fixed(OptCostModel* model)
+{
+  unsigned i;
+  for(i = 0; i != 256; ++i) model->literal[i] = i < 144 ? 8.0f : 9.0f;
+  for(i = 3; i <= MAX_SUPPORTED_DEFLATE_LENGTH; ++i)
+  {
+    unsigned symbol = optGetLengthSymbol(i);
+    model->length[i] = (symbol < 280 ? 7.0f : 8.0f) + LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX];
+  }
+  for(i = 0; i != 30; ++i) model->dist[i] = 5.0f + DISTANCEEXTRA[i];
+}
+
+static float optLog2(double value)
+{
+  return (float)(log(value) * 1.4426950408889634); /*1 / ln(2)*/
+}
+
+static void optCostModel_fromStats(OptCostModel* model, const OptStats* stats)
+{
+  float cost_ll[286], cost_d[30];
+  size_t sum_ll = 0, sum_d = 0, i;
+  float log2sum_ll, log2sum_d;
+  for(i = 0; i != 286; ++i) sum_ll += stats->ll[i];
+  for(i = 0; i != 30; ++i) sum_d += stats->d[i];
+  log2sum_ll = optLog2(sum_ll ? (double)sum_ll : 1.0);
+  log2sum_d = optLog2(sum_d ? (double)sum_d : 1.0);
+  /*symbols that did not occur are given the cost of one occurrence*/
+  for(i = 0; i != 286; ++i) cost_ll[i] = stats->ll[i] ? log2sum_ll - optLog2((double)stats->ll[i]) : log2sum_ll;
+  for(i = 0; i != 30; ++i) cost_d[i] = stats->d[i] ? log2sum_d - optLog2((double)stats->d[i]) : log2sum_d;
+
+  for(i = 0; i != 256; ++i) model->literal[i] = cost_ll[i];
+  for(i = 3; i <= MAX_SUPPORTED_DEFLATE_LENGTH; ++i)
+  {
+    unsigned symbol = optGetLengthSymbol((unsigned)i);
+    model->length[i] = cost_ll[symbol] + LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX];
+  }
+  for(i = 0; i != 30; ++i) model->dist[i] = cost_d[i] + DISTANCEEXTRA[i];
+}
+
+static void optStats_get(OptStats* stats, const OptParse* parse, size_t begin, size_t end)
+{
+  size_t i;
+  memset(stats, 0, sizeof(OptStats));
+  for(i = begin; i != end; ++i)
+  {
+    if(parse->dist[i] == 0) ++stats->ll[parse->litlen[i]];
+    else
+    {
+      ++stats->ll[optGetLengthSymbol(parse->litlen[i])];
+      ++stats->d[optGetDistSymbol(parse->dist[i])];
+    }
+  }
+  stats->ll[256] = 1; /*the end code*/
+}
+
+/*total bit size of a block with the given statistics, stored in the given (dynamic or fixed) trees*/
+static size_t optDataBits(const OptStats* stats, const HuffmanTree* tree_ll, const HuffmanTree* tree_d)
+{
+  size_t i, result = 0;
+  for(i = 0; i != 286; ++i)
+  {
+    if(!stats->ll[i]) continue;
+    result += stats->ll[i] * HuffmanTree_getLength(tree_ll, (unsigned)i);
+    if(i >= FIRST_LENGTH_CODE_INDEX) result += stats->ll[i] * LENGTHEXTRA[i - FIRST_LENGTH_CODE_INDEX];
+  }
+  for(i = 0; i != 30; ++i)
+  {
+    if(!stats->d[i]) continue;
+    result += stats->d[i] * (HuffmanTree_getLength(tree_d, (unsigned)i) + DISTANCEEXTRA[i]);
+  }
+  return result;
+}
+
+static unsigned optMakeTrees(HuffmanTree* tree_ll, HuffmanTree* tree_d, const OptStats* stats)
+{
+  unsigned frequencies_ll[286], frequencies_d[30], i;
+  unsigned error;
+  /*huffman code lengths only depend on the relative frequencies, clamp them to fit in an unsigned*/
+  for(i = 0; i != 286; ++i) frequencies_ll[i] = stats->ll[i] > 0x7fffffff ? 0x7fffffff : (unsigned)stats->ll[i];
+  for(i = 0; i != 30; ++i) frequencies_d[i] = stats->d[i] > 0x7fffffff ? 0x7fffffff : (unsigned)stats->d[i];
+  error = HuffmanTree_makeFromFrequencies(tree_ll, frequencies_ll, 257, 286, 15);
+  /*2, not 1, is chosen for mincodes: some buggy PNG decoders require at least 2 symbols in the dist tree*/
+  if(!error) error = HuffmanTree_makeFromFrequencies(tree_d, frequencies_d, 2, 30, 15);
+  return error;
+}
+
+/*size in bits of a dynamic block with the given statistics, including the header*/
+static size_t optDynamicBlockBits(const OptStats* stats)
+{
+  HuffmanTree tree_ll, tree_d;
+  ucvector header;
+  size_t bp = 0, result = (size_t)(-1);
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+  ucvector_init(&header);
+  if(!optMakeTrees(&tree_ll, &tree_d, stats) && !writeDynamicHeader(&header, &bp, &tree_ll, &tree_d, 0))
+  {
+    result = bp + optDataBits(stats, &tree_ll, &tree_d);
+  }
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+  ucvector_cleanup(&header);
+  return result;
+}
+
+static size_t optFixedBlockBits(const OptStats* stats)
+{
+  HuffmanTree tree_ll, tree_d;
+  size_t result;
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+  generateFixedLitLenTree(&tree_ll);
+  generateFixedDistanceTree(&tree_d);
+  result = 3 + optDataBits(stats, &tree_ll, &tree_d);
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+  return result;
+}
+
+static size_t optStoredBlockBits(size_t size)
+{
+  size_t numblocks = size == 0 ? 1 : (size + 65534) / 65535;
+  /*3 header bits and up to 7 padding bits, LEN and NLEN for each stored block*/
+  return numblocks * (8 + 32) + size * 8;
+}
+
+/*
+Finds the cheapest parse of [begin, end) under the cost model: costs[i] is the cheapest way to
+encode the first i bytes, and the symbol that ends there is remembered to walk back from the end.
+*/
+static unsigned optBestParse(OptParse* parse, const OptMatches* m, const unsigned char* in, size_t start,
+                             size_t begin, size_t end, const OptCostModel* model,
+                             float* costs, unsigned short* lengths, unsigned short* dists)
+{
+  size_t n = end - begin, i, count = 0;
+
+  costs[0] = 0;
+  for(i = 1; i <= n; ++i) costs[i] = OPT_LARGE_FLOAT;
+
+  for(i = 0; i < n; ++i)
+  {
+    size_t mi = begin + i - start;
+    float base = costs[i], cost;
+    unsigned step, previous = 2;
+
+    /*long runs: every position takes the longest match at distance 1, so skip straight over them. The
+    previous position is inside the run too, so its distance 1 match already reached the skipped costs.*/
+    if(m->same[mi] > MAX_SUPPORTED_DEFLATE_LENGTH * 2 && i + MAX_SUPPORTED_DEFLATE_LENGTH * 2 < n
+       && i >= 2 && in[begin + i - 2] == in[begin + i] && in[begin + i - 1] == in[begin + i])
+    {
+      float symbolcost = model->length[MAX_SUPPORTED_DEFLATE_LENGTH] + model->dist[0];
+      unsigned k;
+      for(k = 0; k != MAX_SUPPORTED_DEFLATE_LENGTH; ++k, ++i)
+      {
+        costs[i + MAX_SUPPORTED_DEFLATE_LENGTH] = costs[i] + symbolcost;
+        lengths[i + MAX_SUPPORTED_DEFLATE_LENGTH] = MAX_SUPPORTED_DEFLATE_LENGTH;
+        dists[i + MAX_SUPPORTED_DEFLATE_LENGTH] = 1;
+      }
+      --i;
+      continue;
+    }
+
+    cost = base + model->literal[in[begin + i]];
+    if(cost < costs[i + 1])
+    {
+      costs[i + 1] = cost;
+      lengths[i + 1] = 1;
+      dists[i + 1] = 0;
+    }
+
+    for(step = m->first[mi]; step != m->first[mi + 1]; ++step)
+    {
+      unsigned length, maxlength = m->length[step], dist = m->dist[step];
+      float distcost = base + model->dist[optGetDistSymbol(dist)];
+      if(maxlength > n - i) maxlength = (unsigned)(n - i);
+      for(length = previous + 1; length <= maxlength; ++length)
+      {
+        cost = distcost + model->length[length];
+        if(cost < costs[i + length])
+        {
+          costs[i + length] = cost;
+          lengths[i + length] = (unsigned short)length;
+          dists[i + length] = (unsigned short)dist;
+        }
+      }
+      previous = m->length[step];
+    }
+  }
+
+  /*walk back from the end, then reverse to get the symbols in order*/
+  for(i = n; i > 0; i -= lengths[i]) ++count;
+  parse->size = count;
+  for(i = n; i > 0; i -= lengths[i])
+  {
+    --count;
+    parse->pos[count] = begin + i - lengths[i];
+    if(lengths[i] == 1)
+    {
+      parse->litlen[count] = in[begin + i - 1];
+      parse->dist[count] = 0;
+    }
+    else
+    {
+      parse->litlen[count] = lengths[i];
+      parse->dist[count] = dists[i];
+    }
+  }
+  return 0;
+}
+
+static void optParse_init(OptParse* parse)
+{
+  parse->litlen = 0;
+  parse->dist = 0;
+  parse->pos = 0;
+  parse->size = 0;
+}
+
+static unsigned optParse_alloc(OptParse* parse, size_t size)
+{
+  parse->litlen = (unsigned short*)nexuspng_malloc(sizeof(unsigned short) * (size + 1));
+  parse->dist = (unsigned short*)nexuspng_malloc(sizeof(unsigned short) * (size + 1));
+  parse->pos = (size_t*)nexuspng_malloc(sizeof(size_t) * (size + 1));
+  parse->size = 0;
+  return (parse->litlen && parse->dist && parse->pos) ? 0 : 83; /*alloc fail*/
+}
+
+static void optParse_cleanup(OptParse* parse)
+{
+  nexuspng_free(parse->litlen);
+  nexuspng_free(parse->dist);
+  nexuspng_free(parse->pos);
+}
+
+static void optParse_copy(OptParse* dest, const OptParse* source)
+{
+  memcpy(dest->litlen, source->litlen, sizeof(unsigned short) * source->size);
+  memcpy(dest->dist, source->dist, sizeof(unsigned short) * source->size);
+  memcpy(dest->pos, source->pos, sizeof(size_t) * source->size);
+  dest->size = source->size;
+}
+
+static size_t optRangeCost(const OptParse* parse, size_t begin, size_t end)
+{
+  OptStats stats;
+  optStats_get(&stats, parse, begin, end);
+  return optDynamicBlockBits(&stats);
+}
+
+/*
+Finds the symbol index in (begin, end) where splitting the range in two gives the smallest
+estimated size, by sampling a few split points and narrowing down around the best one.
+*/
+static size_t optFindSplit(const OptParse* parse, size_t begin, size_t end, size_t* splitcost)
+{
+  size_t lo = begin + 1, hi = end, best = lo, lastbest = (size_t)(-1);
+  size_t i;
+
+  if(end - begin < 1024)
+  {
+    /*small enough to try every split point*/
+    for(i = begin + 1; i < end; ++i)
+    {
+      size_t cost = optRangeCost(parse, begin, i) + optRangeCost(parse, i, end);
+      if(cost < lastbest) { lastbest = cost; best = i; }
+    }
+    *splitcost = lastbest;
+    return best;
+  }
+
+  for(;;)
+  {
+    size_t p[OPT_SPLIT_SAMPLES], vp[OPT_SPLIT_SAMPLES], besti = 0;
+    if(hi - lo <= OPT_SPLIT_SAMPLES) break;
+    for(i = 0; i != OPT_SPLIT_SAMPLES; ++i)
+    {
+      p[i] = lo + (i + 1) * ((hi - lo) / (OPT_SPLIT_SAMPLES + 1));
+      vp[i] = optRangeCost(parse, begin, p[i]) + optRangeCost(parse, p[i], end);
+      if(vp[i] < vp[besti]) besti = i;
+    }
+    if(vp[besti] > lastbest) break;
+    lo = besti == 0 ? lo : p[besti - 1];
+    hi = besti == OPT_SPLIT_SAMPLES - 1 ? hi : p[besti + 1];
+    best = p[besti];
+    lastbest = vp[besti];
+  }
+  *splitcost = lastbest;
+  return best;
+}
+
+/*
+Splits the parse of a master block into deflate blocks. splits receives the symbol indices
+where a new block starts, in increasing order, and numsplits their amount.
+*/
+static void optSplitBlocks(size_t* splits, size_t* numsplits, size_t maxsplits, const OptParse* parse)
+{
+  /*done[k] marks the k-th block (between splits) as not worth splitting further*/
+  unsigned char done[256];
+  size_t k;
+  *numsplits = 0;
+  memset(done, 0, sizeof(done));
+  if(maxsplits > 255) maxsplits = 255;
+
+  while(*numsplits < maxsplits)
+  {
+    size_t begin = 0, end = parse->size, largest = 0, blockindex = 0, split, splitcost, origcost;
+    /*try the largest block that may still benefit*/
+    for(k = 0; k <= *numsplits; ++k)
+    {
+      size_t b = k == 0 ? 0 : splits[k - 1];
+      size_t e = k == *numsplits ? parse->size : splits[k];
+      if(!done[k] && e - b > largest) { largest = e - b; begin = b; end = e; blockindex = k; }
+    }
+    if(largest < 10) break;
+
+    split = optFindSplit(parse, begin, end, &splitcost);
+    origcost = optRangeCost(parse, begin, end);
+    if(split <= begin || split >= end || splitcost >= origcost)
+    {
+      done[blockindex] = 1;
+      continue;
+    }
+    for(k = *numsplits; k > blockindex; --k)
+    {
+      splits[k] = splits[k - 1];
+      done[k + 1] = done[k];
+    }
+    splits[blockindex] = split;
+    done[blockindex + 1] = 0;
+    ++(*numsplits);
+  }
+}
+
+/*xorshift, used to shake up statistics that stopped improving*/
+static unsigned optRandom(unsigned* state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static void optStats_randomize(OptStats* stats, unsigned* state)
+{
+  size_t i;
+  for(i = 0; i != 286; ++i) if((optRandom(state) >> 4) % 3 == 0) stats->ll[i] = stats->ll[optRandom(state) % 286];
+  for(i = 0; i != 30; ++i) if((optRandom(state) >> 4) % 3 == 0) stats->d[i] = stats->d[optRandom(state) % 30];
+  stats->ll[256] = 1;
+}
+
+static unsigned optWriteStoredBlock(ucvector* out, size_t* bp, const unsigned char* data, size_t size, unsigned final)
+{
+  size_t pos = 0;
+  do
+  {
+    size_t len = size - pos < 65535 ? size - pos : 65535, i;
+    unsigned last = final && pos + len == size;
+    addBitToStream(bp, out, last);
+    addBitToStream(bp, out, 0);
+    addBitToStream(bp, out, 0);
+    *bp = (*bp + 7) & ~(size_t)7; /*stored blocks continue at the next byte boundary*/
+    if(!ucvector_push_back(out, (unsigned char)(len & 255))) return 83; /*alloc fail*/
+    ucvector_push_back(out, (unsigned char)(len >> 8));
+    ucvector_push_back(out, (unsigned char)((65535 - len) & 255));
+    ucvector_push_back(out, (unsigned char)((65535 - len) >> 8));
+    for(i = 0; i != len; ++i) ucvector_push_back(out, data[pos + i]);
+    *bp += (4 + len) * 8;
+    pos += len;
+  } while(pos < size);
+  return 0;
+}
+
+/*writes the parse of the bytes [datapos, dataend) as one block of the smallest type*/
+static unsigned optWriteBlock(ucvector* out, size_t* bp, const OptParse* parse, const unsigned char* in,
+                              size_t datapos, size_t dataend, unsigned final)
+{
+  unsigned error = 0;
+  OptStats stats;
+  size_t dynamicbits, fixedbits, storedbits, i;
+  HuffmanTree tree_ll, tree_d;
+  uivector lz77_encoded;
+
+  optStats_get(&stats, parse, 0, parse->size);
+  dynamicbits = optDynamicBlockBits(&stats);
+  fixedbits = optFixedBlockBits(&stats);
+  storedbits = optStoredBlockBits(dataend - datapos);
+
+  if(storedbits < dynamicbits && storedbits < fixedbits)
+  {
+    return optWriteStoredBlock(out, bp, &in[datapos], dataend - datapos, final);
+  }
+
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+  uivector_init(&lz77_encoded);
+
+  for(i = 0; i != parse->size; ++i)
+  {
+    if(parse->dist[i] == 0) uivector_push_back(&lz77_encoded, parse->litlen[i]);
+    else addLengthDistance(&lz77_encoded, parse->litlen[i], parse->dist[i]);
+  }
+
+  if(fixedbits <= dynamicbits)
+  {
+    generateFixedLitLenTree(&tree_ll);
+    generateFixedDistanceTree(&tree_d);
+    addBitToStream(bp, out, final);
+    addBitToStream(bp, out, 1); /*first bit of BTYPE "fixed"*/
+    addBitToStream(bp, out, 0); /*second bit of BTYPE "fixed"*/
+  }
+  else
+  {
+    error = optMakeTrees(&tree_ll, &tree_d, &stats);
+    if(!error) error = writeDynamicHeader(out, bp, &tree_ll, &tree_d, final);
+  }
+
+  if(!error)
+  {
+    writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
+    addHuffmanSymbol(bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
+  }
+
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+  uivector_cleanup(&lz77_encoded);
+  return error;
+}
+
+/*
+Iterates the cost model over the bytes [begin, end) and leaves the smallest parse found in best.
+*/
+static unsigned optIterateBlock(OptParse* best, OptParse* current, const OptMatches* m,
+                                const unsigned char* in, size_t start, size_t begin, size_t end,
+                                const NexusPNGCompressSettings* settings,
+                                float* costs, unsigned short* lengths, unsigned short* dists)
+{
+  OptCostModel model;
+  OptStats stats, laststats, beststats;
+  size_t bestcost, lastcost = 0;
+  unsigned i, randomized = 0, random_state = 1;
+  unsigned error;
+
+  optCostModel_fixed(&model);
+  error = optBestParse(best, m, in, start, begin, end, &model, costs, lengths, dists);
+  if(error) return error;
+  optStats_get(&stats, best, 0, best->size);
+  bestcost = optDynamicBlockBits(&stats);
+  beststats = stats;
+
+  for(i = 0; i < settings->numiterations && !error; ++i)
+  {
+    size_t cost;
+    optCostModel_fromStats(&model, &stats);
+    error = optBestParse(current, m, in, start, begin, end, &model, costs, lengths, dists);
+    if(error) break;
+
+    laststats = stats;
+    optStats_get(&stats, current, 0, current->size);
+    cost = optDynamicBlockBits(&stats);
+    if(cost < bestcost)
+    {
+      bestcost = cost;
+      beststats = stats;
+      optParse_copy(best, current);
+    }
+
+    if(randomized)
+    {
+      /*converges slower but better: keep half of the previous statistics*/
+      size_t k;
+      for(k = 0; k != 286; ++k) stats.ll[k] += laststats.ll[k] / 2;
+      for(k = 0; k != 30; ++k) stats.d[k] += laststats.d[k] / 2;
+      stats.ll[256] = 1;
+    }
+    if(i > 5 && cost == lastcost)
+    {
+      /*stuck: restart from the best statistics, shaken up*/
+      stats = beststats;
+      optStats_randomize(&stats, &random_state);
+      randomized = 1;
+    }
+    lastcost = cost;
+  }
+  return error;
+}
+
+/*one master block: its input range, and the bits it encodes to*/
+typedef struct OptMasterBlock
+{
+  const unsigned char* in;
+  size_t start, end;
+  unsigned final;
+  unsigned last; /*no master block follows this one*/
+  const NexusPNGCompressSettings* settings;
+  ucvector out;
+  size_t bp;
+  unsigned error;
+} OptMasterBlock;
+
+static void optEncodeMasterBlock(void* context, size_t index)
+{
+  OptMasterBlock* block = &((OptMasterBlock*)context)[index];
+  const unsigned char* in = block->in;
+  size_t start = block->start, end = block->end, n = end - start;
+  size_t splits[256], numsplits = 0, k;
+  size_t maxsplits = block->settings->blocksplittingmax ? block->settings->blocksplittingmax - 1 : 255;
+  unsigned error = 0;
+  OptMatches m;
+  OptParse whole, best, current;
+  OptCostModel model;
+  float* costs = (float*)nexuspng_malloc(sizeof(float) * (n + 1));
+  unsigned short* lengths = (unsigned short*)nexuspng_malloc(sizeof(unsigned short) * (n + 1));
+  unsigned short* dists = (unsigned short*)nexuspng_malloc(sizeof(unsigned short) * (n + 1));
+
+  optMatches_init(&m);
+  optParse_init(&whole);
+  optParse_init(&best);
+  optParse_init(&current);
+  error = optParse_alloc(&whole, n);
+  if(!error) error = optParse_alloc(&best, n);
+  if(!error) error = optParse_alloc(&current, n);
+  if(!costs || !lengths || !dists) error = 83; /*alloc fail*/
+
+  if(!error) error = optFindMatches(&m, in, start, end);
+
+  /*split the master block, using a parse with the fixed cost model to estimate the sizes*/
+  if(!error)
+  {
+    optCostModel_fixed(&model);
+    error = optBestParse(&whole, &m, in, start, start, end, &model, costs, lengths, dists);
+  }
+  if(!error) optSplitBlocks(splits, &numsplits, maxsplits, &whole);
+
+  for(k = 0; k <= numsplits && !error; ++k)
+  {
+    size_t begin = k == 0 ? start : whole.pos[splits[k - 1]];
+    size_t blockend = k == numsplits ? end : whole.pos[splits[k]];
+    unsigned final = block->final && k == numsplits;
+    error = optIterateBlock(&best, &current, &m, in, start, begin, blockend, block->settings, costs, lengths, dists);
+    if(!error) error = optWriteBlock(&block->out, &block->bp, &best, in, begin, blockend, final);
+  }
+  /*stored blocks are aligned to the bytes of this block's own stream, so when another master block follows,
+  end on a byte boundary with an empty stored block: then every master block starts at a whole byte*/
+  if(!error && !block->last && (block->bp & 7)) error = optWriteStoredBlock(&block->out, &block->bp, in, 0, 0);
+
+  optMatches_cleanup(&m);
+  optParse_cleanup(&whole);
+  optParse_cleanup(&best);
+  optParse_cleanup(&current);
+  nexuspng_free(costs);
+  nexuspng_free(lengths);
+  nexuspng_free(dists);
+  block->error = error;
+}
+
+/*appends a deflate stream of streambp bits that starts at bit 0, at a byte boundary of out so its stored blocks
+stay aligned*/
+static unsigned deflateAppend(ucvector* out, size_t* bp, const ucvector* stream, size_t streambp)
+{
+  if(*bp & 7)
+  {
+    unsigned error = optWriteStoredBlock(out, bp, stream->data, 0, 0);
+    if(error) return error;
+  }
+  if(!ucvector_resize(out, out->size + stream->size)) return 83; /*alloc fail*/
+  memcpy(&out->data[out->size - stream->size], stream->data, stream->size);
+  *bp += streambp; /*the unused bits of the last byte are zero, so the bits written after this can fill them in*/
+  return 0;
+}
+
+static unsigned deflateOptimal(ucvector* out, size_t* bp, const unsigned char* in, size_t insize,
+                               const NexusPNGCompressSettings* settings, unsigned final)
+{
+  unsigned error = 0;
+  size_t numblocks = (insize + OPT_MASTER_BLOCK_SIZE - 1) / OPT_MASTER_BLOCK_SIZE, i;
+  OptMasterBlock* blocks = (OptMasterBlock*)nexuspng_malloc(sizeof(OptMasterBlock) * numblocks);
+  if(!blocks) return 83; /*alloc fail*/
+
+  for(i = 0; i != numblocks; ++i)
+  {
+    blocks[i].in = in;
+    blocks[i].start = i * OPT_MASTER_BLOCK_SIZE;
+    blocks[i].end = i + 1 == numblocks ? insize : (i + 1) * OPT_MASTER_BLOCK_SIZE;
+    blocks[i].final = final && i + 1 == numblocks;
+    blocks[i].last = i + 1 == numblocks;
+    blocks[i].settings = settings;
+    ucvector_init(&blocks[i].out);
+    blocks[i].bp = 0;
+    blocks[i].error = 0;
+  }
+
+  nexuspng_parallel_for(numblocks, settings->numthreads, optEncodeMasterBlock, blocks);
+
+  /*concatenate the bit streams of the master blocks, all but the last end on a byte boundary*/
+  for(i = 0; i != numblocks; ++i)
+  {
+    if(!error) error = blocks[i].error;
+    if(!error) error = deflateAppend(out, bp, &blocks[i].out, blocks[i].bp);
+    ucvector_cleanup(&blocks[i].out);
+  }
+
+  nexuspng_free(blocks);
+  return error;
+}
+
+/*bp is the bit pointer, if final is 0 the last block isn't marked as final so more blocks can follow*/
+static unsigned nexuspng_deflatev(ucvector* out, size_t* bp, const unsigned char* in, size_t insize,
+                                 const NexusPNGCompressSettings* settings, unsigned final)
+{
+  unsigned error = 0;
+  size_t i, blocksize, numdeflateblocks;
+  Hash hash;
+
+  if(settings->btype > 2) return 61;
+  else if(settings->btype == 0) return deflateNoCompression(out, in, insize, final);
+  else if(settings->btype == 2 && settings->optimal && insize > 0)
+  {
+    /*the optimal parse starts from a fixed cost model, and on some noise still ends up larger than the encoding
+    with the LZ77 settings: make both and keep the smaller*/
+    NexusPNGCompressSettings lazysettings = *settings;
+    ucvector optimal, lazy;
+    size_t optimalbp = 0, lazybp = 0;
+    lazysettings.optimal = 0;
+    ucvector_init(&optimal);
+    ucvector_init(&lazy);
+    error = deflateOptimal(&optimal, &optimalbp, in, insize, settings, final);
+    if(!error) error = nexuspng_deflatev(&lazy, &lazybp, in, insize, &lazysettings, final);
+    if(!error && lazybp < optimalbp) error = deflateAppend(out, bp, &lazy, lazybp);
+    else if(!error) error = deflateAppend(out, bp, &optimal, optimalbp);
+    ucvector_cleanup(&optimal);
+    ucvector_cleanup(&lazy);
+    return error;
+  }
+  else if(settings->btype == 1) blocksize = insize;
+  else /*if(settings->btype == 2)*/
+  {
+    /*on PNGs, deflate blocks of 65-262k seem to give most dense encoding*/
+    blocksize = insize / 8 + 8;
+    if(blocksize < 65536) blocksize = 65536;
+    if(blocksize > 262144) blocksize = 262144;
+  }
+
+  numdeflateblocks = (insize + blocksize - 1) / blocksize;
+  if(numdeflateblocks == 0) numdeflateblocks = 1;
+
+  error = hash_init(&hash, settings->windowsize);
+  if(error) return error;
+
+  for(i = 0; i != numdeflateblocks && !error; ++i)
+  {
+    unsigned blockfinal = final && (i == numdeflateblocks - 1);
+    size_t start = i * blocksize;
+    size_t end = start + blocksize;
+    if(end > insize) end = insize;
+
+    if(settings->btype == 1) error = deflateFixed(out, bp, &hash, in, start, end, settings, blockfinal);
+    else if(settings->btype == 2) error = deflateDynamic(out, bp, &hash, in, start, end, settings, blockfinal);
+  }
+
+  hash_cleanup(&hash);
+
+  return error;
+}
+
+unsigned nexuspng_deflate(unsigned char** out, size_t* outsize,
+                         const unsigned char* in, size_t insize,
+                         const NexusPNGCompressSettings* settings)
+{
+  unsigned error;
+  ucvector v;
+  size_t bp = 0; /*the bit pointer*/
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = nexuspng_deflatev(&v, &bp, in, insize, settings, 1);
+  *out = v.data;
   *outsize = v.size;
   return error;
 }
@@ -2087,6 +3190,22 @@ static unsigned adler32(const unsigned char* data, unsigned len)
   return update_adler32(1L, data, len);
 }
 
+/*Return the adler32 of two pieces of data one after the other, from the adler32 of each piece and
+the length of the second one, without needing the data itself*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  unsigned rem = (unsigned)(len2 % 65521);
+  unsigned s1 = adler1 & 0xffff;
+  unsigned s2 = (rem * s1) % 65521;
+  s1 += (adler2 & 0xffff) + 65521 - 1;
+  s2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + 65521 - rem;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s2 >= 65521 * 2) s2 -= 65521 * 2;
+  if(s2 >= 65521) s2 -= 65521;
+  return (s2 << 16) | s1;
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2210,6 +3329,28 @@ static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsign
   }
 }
 
+/*
+Deflates one segment of a zlib stream that is built from independently compressed segments. The
+segment doesn't refer back to data before it, and ends with an empty stored block (a sync flush), so
+it ends at a byte boundary: segments can be concatenated in any combination. The zlib header, and
+the final block and adler32 after the last segment, must be added by the caller. out must be empty.
+*/
+static unsigned zlib_compress_segment(ucvector* out, const unsigned char* in, size_t insize,
+                                      const NexusPNGCompressSettings* settings)
+{
+  size_t bp = 0; /*the bit pointer*/
+  unsigned error = nexuspng_deflatev(out, &bp, in, insize, settings, 0);
+  if(error) return error;
+
+  /*BFINAL 0 and BTYPE 00, padding bits up to the byte boundary, then LEN 0 and NLEN 65535*/
+  addBitToStream(&bp, out, 0);
+  addBitToStream(&bp, out, 0);
+  addBitToStream(&bp, out, 0);
+  if(!ucvector_push_back(out, 0) || !ucvector_push_back(out, 0)
+     || !ucvector_push_back(out, 255) || !ucvector_push_back(out, 255)) return 83; /*alloc fail*/
+  return 0;
+}
+
 #endif /*NEXUS_PNG_COMPILE_ENCODER*/
 
 #else /*no NEXUS_PNG_COMPILE_ZLIB*/
@@ -2249,13 +3390,17 @@ void nexuspng_compress_settings_init(NexusPNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->optimal = 0;
+  settings->numiterations = 15;
+  settings->blocksplittingmax = 15;
+  settings->numthreads = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const NexusPNGCompressSettings nexuspng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const NexusPNGCompressSettings nexuspng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 15, 15, 0, 0, 0, 0};
 
 
 #endif /*NEXUS_PNG_COMPILE_ENCODER*/
@@ -2510,6 +3655,64 @@ unsigned nexuspng_chunk_create(unsigned char** out, size_t* outlength, unsigned
   return 0;
 }
 
+/*
+Segmented image data. When the encoder's restart_rows is set, the zlib stream of the image data is
+split over several IDAT chunks: one with the zlib header, one per segment of restart_rows scanlines,
+and one with the final block and adler32. Every segment is compressed on its own (no references to
+earlier segments) and ends at a byte boundary, so it can be compressed, replaced or decompressed
+without the others. The private chunk "nxIX", right before the IDAT chunks, describes the segments:
+a version byte, a flags byte, then per segment four 32-bit values: the first scanline, the size of
+its IDAT chunk data, and the size and adler32 of its filtered scanlines. The name marks it as not
+safe to copy, since it is only valid together with these IDAT chunks. Other decoders simply read the
+IDAT chunks as one zlib stream, NexusPNG decodes the segments in parallel.
+*/
+#define SEGMENT_INDEX_VERSION 1
+/*flag: the first scanline of every segment has filter type None or Sub, so the segments can also be
+unfiltered without the scanlines of the segment above*/
+#define SEGMENT_INDEX_INDEPENDENT 1
+
+typedef struct SegmentInfo
+{
+  unsigned row; /*the first scanline of the segment*/
+  unsigned compressedsize; /*data size of the IDAT chunk of the segment*/
+  unsigned size; /*size of the filtered scanlines, including the filter type bytes*/
+  unsigned adler; /*adler32 of the filtered scanlines*/
+} SegmentInfo;
+
+/*
+Reads the data of an nxIX chunk, and checks it against the image size. scanlinesize is the size of
+one filtered scanline. Returns 0 if it isn't a usable index, otherwise *segments must be freed.
+*/
+static unsigned readSegmentIndex(SegmentInfo** segments, size_t* numsegments, unsigned* flags,
+                                 const unsigned char* data, size_t size, unsigned h, size_t scanlinesize)
+{
+  size_t i;
+  if(size <= 2 || data[0] != SEGMENT_INDEX_VERSION || (size - 2) % 16 != 0) return 0;
+  *numsegments = (size - 2) / 16;
+  *flags = data[1];
+  *segments = (SegmentInfo*)nexuspng_malloc(sizeof(SegmentInfo) * (*numsegments));
+  if(!*segments) return 0;
+  for(i = 0; i != *numsegments; ++i)
+  {
+    SegmentInfo* segment = &(*segments)[i];
+    size_t rows;
+    segment->row = nexuspng_read32bitInt(&data[2 + i * 16]);
+    segment->compressedsize = nexuspng_read32bitInt(&data[2 + i * 16 + 4]);
+    segment->size = nexuspng_read32bitInt(&data[2 + i * 16 + 8]);
+    segment->adler = nexuspng_read32bitInt(&data[2 + i * 16 + 12]);
+    if(segment->row >= h || (i == 0 && segment->row != 0) || (i > 0 && segment->row <= (*segments)[i - 1].row)) break;
+    rows = (i + 1 == *numsegments ? h : nexuspng_read32bitInt(&data[2 + (i + 1) * 16])) - (size_t)segment->row;
+    if(rows > h || segment->size != rows * scanlinesize) break;
+  }
+  if(i != *numsegments)
+  {
+    nexuspng_free(*segments);
+    *segments = 0;
+    return 0;
+  }
+  return 1;
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Color types and such                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -4184,6 +5387,178 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
   return 0;
 }
 
+/*stores the filter type of each scanline of a non-interlaced image in state->filters*/
+static unsigned rememberFilters(NexusPNGState* state, const unsigned char* scanlines, size_t linebytes, unsigned h)
+{
+  unsigned y;
+  unsigned char* filters = (unsigned char*)nexuspng_realloc(state->filters, h ? h : 1);
+  if(!filters) return 83; /*alloc fail*/
+  state->filters = filters;
+  state->numfilters = h;
+  for(y = 0; y != h; ++y) state->filters[y] = scanlines[(1 + linebytes) * y];
+  return 0;
+}
+
+/*copies numrows rows, from firstrow on, of a raw image to the start of out. out may be the same buffer*/
+static void copyRawRows(unsigned char* out, const unsigned char* in, size_t linebits, unsigned firstrow, unsigned numrows)
+{
+  if(linebits % 8 == 0) memmove(out, &in[firstrow * (linebits / 8)], numrows * (linebits / 8));
+  else
+  {
+    /*rows don't start at a byte, out is never ahead of in so in can still be read when they overlap*/
+    size_t ibp = firstrow * linebits, obp = 0, i;
+    for(i = 0; i != numrows * linebits; ++i) setBitOfReversedStream(&obp, out, readBitFromReversedStream(&ibp, in));
+    while(obp % 8 != 0) setBitOfReversedStream(&obp, out, 0); /*the unused bits of the last byte*/
+  }
+}
+
+#ifdef NEXUS_PNG_COMPILE_ZLIB
+/*a segment of the image data that is being decoded, see SegmentInfo*/
+typedef struct SegmentDecode
+{
+  const unsigned char* in; /*the compressed segment*/
+  const SegmentInfo* info;
+  unsigned char* scanlines; /*receives the filtered scanlines*/
+  unsigned char* pixels; /*receives the unfiltered scanlines, if not 0*/
+  unsigned w, rows, bpp;
+  unsigned ignore_adler32;
+  unsigned error;
+} SegmentDecode;
+
+static void decodeSegment(void* context, size_t index)
+{
+  SegmentDecode* segment = &((SegmentDecode*)context)[index];
+  ucvector v;
+  ucvector_init(&v);
+  segment->error = inflateSegment(&v, segment->in, segment->info->compressedsize);
+  if(!segment->error && v.size != segment->info->size) segment->error = 91; /*invalid decompressed idat size*/
+  if(!segment->error && !segment->ignore_adler32 && adler32(v.data, (unsigned)v.size) != segment->info->adler)
+  {
+    segment->error = 58; /*adler checksum not correct, data must be corrupted*/
+  }
+  if(!segment->error) memcpy(segment->scanlines, v.data, v.size);
+  ucvector_cleanup(&v);
+
+  if(!segment->error && segment->pixels)
+  {
+    /*the index promised otherwise, leave unfiltering to the caller*/
+    if(segment->scanlines[0] > 1) segment->pixels = 0;
+    else segment->error = unfilter(segment->pixels, segment->scanlines, segment->w, segment->rows, segment->bpp);
+  }
+}
+
+/*
+Decodes the rows firstrow to endrow of a non-interlaced image with segmented image data into out, which
+has the raw size of these rows. idat is the data of all IDAT chunks, index that of the nxIX chunk.
+Only the segments that hold the rows are inflated, in parallel, and also unfiltered in parallel if the
+index allows that. Returns 0 if the index doesn't match the image data, then the image must be decoded
+as one zlib stream. Otherwise returns 1 and sets state->error.
+*/
+static unsigned decodeSegmentedRows(unsigned char* out, NexusPNGState* state,
+                                    const unsigned char* idat, size_t idatsize,
+                                    const unsigned char* index, size_t indexsize,
+                                    unsigned w, unsigned h, unsigned firstrow, unsigned endrow)
+{
+  SegmentInfo* segments = 0;
+  SegmentDecode* decodes = 0;
+  size_t numsegments, first, last, i, pos = 2;
+  unsigned flags, adler = 1, r0, r1, independent;
+  unsigned bpp = nexuspng_get_bpp(&state->info_png.color);
+  size_t linebytes = ((size_t)w * bpp + 7) / 8;
+  unsigned padded = bpp < 8 && w * bpp != linebytes * 8;
+  unsigned char* scanlines;
+  unsigned char* pixels;
+
+  if(!readSegmentIndex(&segments, &numsegments, &flags, index, indexsize, h, linebytes + 1)) return 0;
+
+  /*the image data must be exactly the zlib header, the segments and the trailer*/
+  for(i = 0; i != numsegments && pos <= idatsize; ++i)
+  {
+    pos += segments[i].compressedsize;
+    adler = adler32_combine(adler, segments[i].adler, segments[i].size);
+  }
+  if(pos + 6 != idatsize || (idat[0] * 256u + idat[1]) % 31 != 0 || (idat[0] & 15) != 8 || (idat[0] >> 4) > 7
+     || (idat[1] & 32) || idat[pos] != 3 || idat[pos + 1] != 0
+     || (!state->decoder.zlibsettings.ignore_adler32 && nexuspng_read32bitInt(&idat[pos + 2]) != adler))
+  {
+    nexuspng_free(segments);
+    return 0;
+  }
+
+  /*rows can only be unfiltered starting halfway the image if the segments are independent*/
+  independent = (flags & SEGMENT_INDEX_INDEPENDENT) != 0;
+  for(first = 0; independent && first + 1 != numsegments && segments[first + 1].row <= firstrow; ++first) {}
+  for(last = first; last + 1 != numsegments && segments[last + 1].row < endrow; ++last) {}
+  r0 = segments[first].row;
+  r1 = last + 1 == numsegments ? h : segments[last + 1].row;
+
+  scanlines = (unsigned char*)nexuspng_malloc((r1 - r0) * (linebytes + 1));
+  /*unfilter straight into out if that has the same rows and layout*/
+  pixels = r0 == firstrow && r1 == endrow && !padded ? out : (unsigned char*)nexuspng_malloc((r1 - r0) * linebytes);
+  decodes = (SegmentDecode*)nexuspng_malloc(sizeof(SegmentDecode) * (last - first + 1));
+  if(!scanlines || !pixels || !decodes) state->error = 83; /*alloc fail*/
+
+  if(!state->error)
+  {
+    const unsigned char* in = &idat[2];
+    for(i = 0; i != first; ++i) in += segments[i].compressedsize;
+    for(i = first; i <= last; ++i)
+    {
+      SegmentDecode* decode = &decodes[i - first];
+      unsigned row = segments[i].row - r0;
+      decode->in = in;
+      decode->info = &segments[i];
+      decode->scanlines = &scanlines[row * (linebytes + 1)];
+      decode->pixels = independent ? &pixels[row * linebytes] : 0;
+      decode->w = w;
+      decode->rows = (i + 1 == numsegments ? h : segments[i + 1].row) - segments[i].row;
+      decode->bpp = bpp;
+      decode->ignore_adler32 = state->decoder.zlibsettings.ignore_adler32;
+      in += segments[i].compressedsize;
+    }
+    nexuspng_parallel_for(last - first + 1, state->decoder.numthreads, decodeSegment, decodes);
+    for(i = first; i <= last && !state->error; ++i)
+    {
+      state->error = decodes[i - first].error;
+      if(!decodes[i - first].pixels) independent = 0;
+    }
+  }
+  /*serial unfiltering, possible from the top of the image only*/
+  if(!state->error && !independent)
+  {
+    if(r0 == 0) state->error = unfilter(pixels, scanlines, w, r1 - r0, bpp);
+    else
+    {
+      if(pixels != out) nexuspng_free(pixels);
+      nexuspng_free(scanlines);
+      nexuspng_free(decodes);
+      nexuspng_free(segments);
+      return 0;
+    }
+  }
+
+  if(!state->error && state->decoder.remember_filters && firstrow == 0 && endrow == h)
+  {
+    state->error = rememberFilters(state, scanlines, linebytes, h);
+  }
+  if(!state->error && pixels != out)
+  {
+    if(padded)
+    {
+      out[((size_t)w * bpp * (endrow - firstrow) - 1) / 8] = 0; /*the unused bits of the last byte*/
+      removePaddingBits(out, &pixels[(firstrow - r0) * linebytes], w * bpp, linebytes * 8, endrow - firstrow);
+    }
+    else memcpy(out, &pixels[(firstrow - r0) * linebytes], (endrow - firstrow) * linebytes);
+  }
+
+  if(pixels != out) nexuspng_free(pixels);
+  nexuspng_free(scanlines);
+  nexuspng_free(decodes);
+  nexuspng_free(segments);
+  return 1;
+}
+#endif /*NEXUS_PNG_COMPILE_ZLIB*/
+
 static unsigned readChunk_PLTE(NexusPNGColorMode* color, const unsigned char* data, size_t chunkLength)
 {
   unsigned pos = 0, i;
@@ -4491,9 +5866,11 @@ static unsigned readChunk_pHYs(NexusPNGInfo* info, const unsigned char* data, si
 #endif /*NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS*/
 
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+/*decodes rows firstrow up to endrow (at most the height) of the image into *out*/
 static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
                           NexusPNGState* state,
-                          const unsigned char* in, size_t insize)
+                          const unsigned char* in, size_t insize,
+                          unsigned firstrow, unsigned endrow)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
@@ -4503,6 +5880,9 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   size_t predict;
   size_t numpixels;
   size_t outsize = 0;
+  const unsigned char* index = 0; /*the data of the nxIX chunk, see SegmentInfo*/
+  unsigned indexsize = 0;
+  unsigned segmented = 0;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4517,6 +5897,8 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   if(state->error) return;
 
   numpixels = *w * *h;
+  if(endrow > *h) endrow = *h;
+  if(firstrow >= endrow) CERROR_RETURN(state->error, 95);
 
   /*multiplication overflow*/
   if(*h != 0 && numpixels / *h != *w) CERROR_RETURN(state->error, 92);
@@ -4630,6 +6012,12 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       if(!nexuspng_chunk_ancillary(chunk)) CERROR_BREAK(state->error, 69);
 
       unknown = 1;
+      if(nexuspng_chunk_type_equals(chunk, "nxIX") && idat.size == 0
+         && (state->decoder.ignore_crc || !nexuspng_chunk_check_crc(chunk)))
+      {
+        index = data;
+        indexsize = chunkLength;
+      }
 #ifdef NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS
       if(state->decoder.remember_unknown_chunks)
       {
@@ -4669,8 +6057,22 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(*w > 1) predict += nexuspng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
     predict += nexuspng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
   }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
   if(!state->error)
+  {
+    /*the whole image, the wanted rows are taken from it at the end unless the image data is segmented*/
+    outsize = nexuspng_get_raw_size(*w, *h, &state->info_png.color);
+    *out = (unsigned char*)nexuspng_malloc(outsize);
+    if(!*out) state->error = 83; /*alloc fail*/
+  }
+#ifdef NEXUS_PNG_COMPILE_ZLIB
+  if(!state->error && index && state->info_png.interlace_method == 0
+     && !state->decoder.zlibsettings.custom_zlib && !state->decoder.zlibsettings.custom_inflate)
+  {
+    segmented = decodeSegmentedRows(*out, state, idat.data, idat.size, index, indexsize, *w, *h, firstrow, endrow);
+  }
+#endif /*NEXUS_PNG_COMPILE_ZLIB*/
+  if(!state->error && !segmented && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
+  if(!state->error && !segmented)
   {
     state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
                                    idat.size, &state->decoder.zlibsettings);
@@ -4678,27 +6080,35 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   }
   ucvector_cleanup(&idat);
 
-  if(!state->error)
+  if(!state->error && !segmented && state->decoder.remember_filters && state->info_png.interlace_method == 0)
   {
-    outsize = nexuspng_get_raw_size(*w, *h, &state->info_png.color);
-    *out = (unsigned char*)nexuspng_malloc(outsize);
-    if(!*out) state->error = 83; /*alloc fail*/
+    /*the filter type is the first byte of each scanline, read it before unfiltering overwrites it*/
+    size_t linebytes = (*w * (size_t)nexuspng_get_bpp(&state->info_png.color) + 7) / 8;
+    state->error = rememberFilters(state, scanlines.data, linebytes, *h);
   }
-  if(!state->error)
+  if(!state->error && !segmented)
   {
     for(i = 0; i < outsize; i++) (*out)[i] = 0;
     state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    if(!state->error && (firstrow != 0 || endrow != *h))
+    {
+      copyRawRows(*out, *out, *w * (size_t)nexuspng_get_bpp(&state->info_png.color), firstrow, endrow - firstrow);
+    }
   }
   ucvector_cleanup(&scanlines);
 }
 
-unsigned nexuspng_decode(unsigned char** out, unsigned* w, unsigned* h,
-                        NexusPNGState* state,
-                        const unsigned char* in, size_t insize)
+/*decodes rows firstrow up to endrow and converts them to the color type of state->info_raw*/
+static unsigned decodeRows(unsigned char** out, unsigned* w, unsigned* h,
+                           NexusPNGState* state,
+                           const unsigned char* in, size_t insize,
+                           unsigned firstrow, unsigned endrow)
 {
+  unsigned rows;
   *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
+  decodeGeneric(out, w, h, state, in, insize, firstrow, endrow);
   if(state->error) return state->error;
+  rows = (endrow < *h ? endrow : *h) - firstrow;
   if(!state->decoder.color_convert || nexuspng_color_mode_equal(&state->info_raw, &state->info_png.color))
   {
     /*same color type, no copying or converting of data needed*/
@@ -4724,19 +6134,35 @@ unsigned nexuspng_decode(unsigned char** out, unsigned* w, unsigned* h,
       return 56; /*unsupported color mode conversion*/
     }
 
-    outsize = nexuspng_get_raw_size(*w, *h, &state->info_raw);
+    outsize = nexuspng_get_raw_size(*w, rows, &state->info_raw);
     *out = (unsigned char*)nexuspng_malloc(outsize);
     if(!(*out))
     {
       state->error = 83; /*alloc fail*/
     }
     else state->error = nexuspng_convert(*out, data, &state->info_raw,
-                                        &state->info_png.color, *w, *h);
+                                        &state->info_png.color, *w, rows);
     nexuspng_free(data);
   }
   return state->error;
 }
 
+unsigned nexuspng_decode(unsigned char** out, unsigned* w, unsigned* h,
+                        NexusPNGState* state,
+                        const unsigned char* in, size_t insize)
+{
+  return decodeRows(out, w, h, state, in, insize, 0, (unsigned)(-1));
+}
+
+unsigned nexuspng_decode_rows(unsigned char** out, unsigned* w, unsigned* h,
+                             NexusPNGState* state,
+                             const unsigned char* in, size_t insize,
+                             unsigned firstrow, unsigned numrows)
+{
+  if(numrows == 0 || firstrow + numrows < firstrow) return 95;
+  return decodeRows(out, w, h, state, in, insize, firstrow, firstrow + numrows);
+}
+
 unsigned nexuspng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, NexusPNGColorType colortype, unsigned bitdepth)
 {
@@ -4787,6 +6213,8 @@ unsigned nexuspng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, c
 void nexuspng_decoder_settings_init(NexusPNGDecoderSettings* settings)
 {
   settings->color_convert = 1;
+  settings->remember_filters = 0;
+  settings->numthreads = 0;
 #ifdef NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
@@ -4809,6 +6237,8 @@ void nexuspng_state_init(NexusPNGState* state)
 #endif /*NEXUS_PNG_COMPILE_ENCODER*/
   nexuspng_color_mode_init(&state->info_raw);
   nexuspng_info_init(&state->info_png);
+  state->filters = 0;
+  state->numfilters = 0;
   state->error = 1;
 }
 
@@ -4816,6 +6246,9 @@ void nexuspng_state_cleanup(NexusPNGState* state)
 {
   nexuspng_color_mode_cleanup(&state->info_raw);
   nexuspng_info_cleanup(&state->info_png);
+  nexuspng_free(state->filters);
+  state->filters = 0;
+  state->numfilters = 0;
 }
 
 void nexuspng_state_copy(NexusPNGState* dest, const NexusPNGState* source)
@@ -4824,8 +6257,17 @@ void nexuspng_state_copy(NexusPNGState* dest, const NexusPNGState* source)
   *dest = *source;
   nexuspng_color_mode_init(&dest->info_raw);
   nexuspng_info_init(&dest->info_png);
+  dest->filters = 0;
+  dest->numfilters = 0;
   dest->error = nexuspng_color_mode_copy(&dest->info_raw, &source->info_raw); if(dest->error) return;
   dest->error = nexuspng_info_copy(&dest->info_png, &source->info_png); if(dest->error) return;
+  if(source->numfilters)
+  {
+    dest->filters = (unsigned char*)nexuspng_malloc(source->numfilters);
+    if(!dest->filters) { dest->error = 83; return; } /*alloc fail*/
+    memcpy(dest->filters, source->filters, source->numfilters);
+    dest->numfilters = source->numfilters;
+  }
 }
 
 #endif /* defined(NEXUS_PNG_COMPILE_DECODER) || defined(NEXUS_PNG_COMPILE_ENCODER) */
@@ -4955,6 +6397,139 @@ static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t d
   return error;
 }
 
+#ifdef NEXUS_PNG_COMPILE_ZLIB
+/*a segment of the image data that is being compressed, see SegmentInfo*/
+typedef struct IDATSegment
+{
+  const unsigned char* data; /*the filtered scanlines*/
+  size_t size;
+  const NexusPNGCompressSettings* settings;
+  ucvector out; /*the compressed segment*/
+  unsigned error;
+} IDATSegment;
+
+static void compressIDATSegment(void* context, size_t index)
+{
+  IDATSegment* segment = &((IDATSegment*)context)[index];
+  segment->error = zlib_compress_segment(&segment->out, segment->data, segment->size, segment->settings);
+}
+
+/*compresses the segments, in parallel: each segment is compressed by one thread*/
+static unsigned compressIDATSegments(IDATSegment* segments, size_t numsegments,
+                                     const NexusPNGCompressSettings* zlibsettings)
+{
+  NexusPNGCompressSettings segmentsettings = *zlibsettings;
+  size_t i;
+  if(numsegments > 1) segmentsettings.numthreads = 1;
+  for(i = 0; i != numsegments; ++i)
+  {
+    ucvector_init(&segments[i].out);
+    segments[i].settings = &segmentsettings;
+    segments[i].error = 0;
+  }
+  nexuspng_parallel_for(numsegments, zlibsettings->numthreads, compressIDATSegment, segments);
+  for(i = 0; i != numsegments; ++i)
+  {
+    if(segments[i].error) return segments[i].error;
+  }
+  return 0;
+}
+
+static void cleanupIDATSegments(IDATSegment* segments, size_t numsegments)
+{
+  size_t i;
+  for(i = 0; i != numsegments; ++i) ucvector_cleanup(&segments[i].out);
+}
+
+static unsigned addChunk_nxIX(ucvector* out, const SegmentInfo* segments, size_t numsegments, unsigned flags)
+{
+  unsigned error = 0;
+  size_t i;
+  ucvector data;
+  ucvector_init(&data);
+  ucvector_push_back(&data, SEGMENT_INDEX_VERSION);
+  ucvector_push_back(&data, (unsigned char)flags);
+  for(i = 0; i != numsegments; ++i)
+  {
+    nexuspng_add32bitInt(&data, segments[i].row);
+    nexuspng_add32bitInt(&data, segments[i].compressedsize);
+    nexuspng_add32bitInt(&data, segments[i].size);
+    nexuspng_add32bitInt(&data, segments[i].adler);
+  }
+  if(data.size != 2 + numsegments * 16) error = 83; /*alloc fail*/
+  if(!error) error = addChunk(out, "nxIX", data.data, data.size);
+  ucvector_cleanup(&data);
+  return error;
+}
+
+static unsigned addChunk_IDAT_zlibheader(ucvector* out)
+{
+  /*CMF 120: deflate with a 32K window, FLG 1: no dictionary, lowest level, and the check bits*/
+  unsigned char header[2] = {120, 1};
+  return addChunk(out, "IDAT", header, 2);
+}
+
+/*the final block and the adler32 of the whole stream, combined from those of the segments*/
+static unsigned addChunk_IDAT_trailer(ucvector* out, const SegmentInfo* segments, size_t numsegments)
+{
+  unsigned char trailer[6];
+  unsigned adler = 1;
+  size_t i;
+  for(i = 0; i != numsegments; ++i) adler = adler32_combine(adler, segments[i].adler, segments[i].size);
+  /*empty fixed huffman block: BFINAL 1, BTYPE 01 and the 7-bit end code 0*/
+  trailer[0] = 3;
+  trailer[1] = 0;
+  nexuspng_set32bitInt(&trailer[2], adler);
+  return addChunk(out, "IDAT", trailer, 6);
+}
+
+/*the nxIX chunk and the segmented IDAT chunks of a non-interlaced image*/
+static unsigned addChunks_IDAT_segmented(ucvector* out, const unsigned char* data, unsigned h,
+                                         size_t scanlinesize, unsigned restart_rows,
+                                         const NexusPNGCompressSettings* zlibsettings)
+{
+  unsigned error = 0;
+  size_t numsegments = (h + restart_rows - 1) / restart_rows, i;
+  IDATSegment* segments = (IDATSegment*)nexuspng_malloc(sizeof(IDATSegment) * numsegments);
+  SegmentInfo* index = (SegmentInfo*)nexuspng_malloc(sizeof(SegmentInfo) * numsegments);
+  if(!segments || !index)
+  {
+    nexuspng_free(segments);
+    nexuspng_free(index);
+    return 83; /*alloc fail*/
+  }
+
+  for(i = 0; i != numsegments; ++i)
+  {
+    unsigned row = (unsigned)(i * restart_rows);
+    unsigned rows = h - row < restart_rows ? h - row : restart_rows;
+    segments[i].data = &data[row * scanlinesize];
+    segments[i].size = rows * scanlinesize;
+    index[i].row = row;
+    index[i].size = (unsigned)segments[i].size;
+  }
+  error = compressIDATSegments(segments, numsegments, zlibsettings);
+
+  for(i = 0; i != numsegments && !error; ++i)
+  {
+    index[i].compressedsize = (unsigned)segments[i].out.size;
+    index[i].adler = adler32(segments[i].data, (unsigned)segments[i].size);
+  }
+  if(!error) error = addChunk_nxIX(out, index, numsegments, SEGMENT_INDEX_INDEPENDENT);
+  if(!error) error = addChunk_IDAT_zlibheader(out);
+  for(i = 0; i != numsegments && !error; ++i)
+  {
+    error = addChunk(out, "IDAT", segments[i].out.data, segments[i].out.size);
+  }
+  if(!error) error = addChunk_IDAT_trailer(out, index, numsegments);
+
+  cleanupIDATSegments(segments, numsegments);
+  nexuspng_free(segments);
+  nexuspng_free(index);
+  return error;
+}
+#endif /*NEXUS_PNG_COMPILE_ZLIB*/
+
 static unsigned addChunk_IEND(ucvector* out)
 {
   unsigned error = 0;
@@ -5482,6 +7057,26 @@ static void Adam7_interlace(unsigned char* out, const unsigned char* in, unsigne
 
 /*out must be buffer big enough to contain uncompressed IDAT chunk data, and in must contain the full image.
 return value is error**/
+/*
+Changes the filter of the first scanline of every segment of restart_rows scanlines to one that doesn't
+use the scanline above, see SEGMENT_INDEX_INDEPENDENT: Up becomes None, Average and Paeth become Sub,
+which is what Paeth is without a scanline above. in are the unfiltered scanlines, with padding bits.
+*/
+static void restartFilters(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                           unsigned bpp, unsigned restart_rows)
+{
+  size_t linebytes = (w * bpp + 7) / 8;
+  size_t bytewidth = (bpp + 7) / 8;
+  unsigned y;
+  for(y = restart_rows; y < h; y += restart_rows)
+  {
+    unsigned char* line = &out[y * (linebytes + 1)];
+    if(line[0] < 2) continue;
+    line[0] = line[0] == 2 ? 0 : 1;
+    filterScanline(&line[1], &in[y * linebytes], 0, linebytes, bytewidth, line[0]);
+  }
+}
+
 static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in,
                                     unsigned w, unsigned h,
                                     const NexusPNGInfo* info_png, const NexusPNGEncoderSettings* settings)
@@ -5511,6 +7106,7 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
         {
           addPaddingBits(padded, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
           error = filter(*out, padded, w, h, &info_png->color, settings);
+          if(!error && settings->restart_rows) restartFilters(*out, padded, w, h, bpp, settings->restart_rows);
         }
         nexuspng_free(padded);
       }
@@ -5518,6 +7114,7 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
       {
         /*we can immediately filter into the out buffer, no other steps needed*/
         error = filter(*out, in, w, h, &info_png->color, settings);
+        if(!error && settings->restart_rows) restartFilters(*out, in, w, h, bpp, settings->restart_rows);
       }
     }
   }
@@ -5601,8 +7198,12 @@ static unsigned addUnknownChunks(ucvector* out, unsigned char* data, size_t data
   unsigned char* inchunk = data;
   while((size_t)(inchunk - data) < datasize)
   {
-    CERROR_TRY_RETURN(nexuspng_chunk_append(&out->data, &out->size, inchunk));
-    out->allocsize = out->size; /*fix the allocsize again*/
+    /*an old segment index doesn't describe the new image data*/
+    if(!nexuspng_chunk_type_equals(inchunk, "nxIX"))
+    {
+      CERROR_TRY_RETURN(nexuspng_chunk_append(&out->data, &out->size, inchunk));
+      out->allocsize = out->size; /*fix the allocsize again*/
+    }
     inchunk = nexuspng_chunk_next(inchunk);
   }
   return 0;
@@ -5719,6 +7320,15 @@ unsigned nexuspng_encode(unsigned char** out, size_t* outsize,
     }
 #endif /*NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS*/
     /*IDAT (multiple IDAT chunks must be consecutive)*/
+#ifdef NEXUS_PNG_COMPILE_ZLIB
+    if(state->encoder.restart_rows && info.interlace_method == 0
+       && !state->encoder.zlibsettings.custom_zlib && !state->encoder.zlibsettings.custom_deflate)
+    {
+      state->error = addChunks_IDAT_segmented(&outv, data, h, datasize / h, state->encoder.restart_rows,
+                                              &state->encoder.zlibsettings);
+    }
+    else
+#endif /*NEXUS_PNG_COMPILE_ZLIB*/
     state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
     if(state->error) break;
 #ifdef NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS
@@ -5802,6 +7412,210 @@ unsigned nexuspng_encode(unsigned char** out, size_t* outsize,
   return state->error;
 }
 
+#ifdef NEXUS_PNG_COMPILE_ZLIB
+static unsigned ucvector_append(ucvector* p, const unsigned char* data, size_t size)
+{
+  if(!ucvector_resize(p, p->size + size)) return 83; /*alloc fail*/
+  if(size) memcpy(&p->data[p->size - size], data, size);
+  return 0;
+}
+
+/*
+The chunks of cover that nexuspng_encode_partial keeps. Returns 0 if cover can't be patched: it has
+no (valid) segment index, another size, interlacing, a palette or a color key.
+*/
+static unsigned findPatchableSegments(SegmentInfo** segments, size_t* numsegments, NexusPNGColorMode* color,
+                                      const unsigned char** indexchunk, const unsigned char** segmentchunks,
+                                      const unsigned char** trailerchunk,
+                                      const unsigned char* cover, size_t coversize, unsigned w, unsigned h)
+{
+  const unsigned char* chunk;
+  const unsigned char* end = cover + coversize;
+  size_t scanlinesize;
+  unsigned flags, i;
+
+  if(coversize < 33 || cover[0] != 137 || cover[1] != 80 || cover[2] != 78 || cover[3] != 71
+     || !nexuspng_chunk_type_equals(cover + 8, "IHDR") || nexuspng_chunk_length(cover + 8) != 13) return 0;
+  if(nexuspng_read32bitInt(&cover[16]) != w || nexuspng_read32bitInt(&cover[20]) != h || cover[28] != 0) return 0;
+  color->bitdepth = cover[24];
+  color->colortype = (NexusPNGColorType)cover[25];
+  if(checkColorValidity(color->colortype, color->bitdepth) || color->colortype == LCT_PALETTE) return 0;
+  scanlinesize = 1 + ((size_t)w * nexuspng_get_bpp(color) + 7) / 8;
+
+  *indexchunk = 0;
+  for(chunk = cover + 8; end - chunk >= 12; chunk = nexuspng_chunk_next_const(chunk))
+  {
+    if((size_t)(end - chunk - 12) < nexuspng_chunk_length(chunk)) return 0;
+    if(nexuspng_chunk_type_equals(chunk, "tRNS")) return 0;
+    if(nexuspng_chunk_type_equals(chunk, "nxIX")) *indexchunk = chunk;
+    if(nexuspng_chunk_type_equals(chunk, "IDAT")) break;
+  }
+  if(!*indexchunk || end - chunk < 12 || nexuspng_chunk_next_const(*indexchunk) != chunk) return 0;
+  if(!readSegmentIndex(segments, numsegments, &flags, nexuspng_chunk_data_const(*indexchunk),
+                       nexuspng_chunk_length(*indexchunk), h, scanlinesize)) return 0;
+
+  /*the IDAT chunks must be exactly the zlib header, the segments and the trailer*/
+  i = 0;
+  if(nexuspng_chunk_length(chunk) == 2) chunk = nexuspng_chunk_next_const(chunk);
+  else i = (unsigned)*numsegments + 1;
+  for(; i < *numsegments && (size_t)(end - chunk) >= 12; ++i)
+  {
+    if(!nexuspng_chunk_type_equals(chunk, "IDAT") || nexuspng_chunk_length(chunk) != (*segments)[i].compressedsize
+       || (size_t)(end - chunk - 12) < (*segments)[i].compressedsize) break;
+    segmentchunks[i] = chunk;
+    chunk = nexuspng_chunk_next_const(chunk);
+  }
+  if(i == *numsegments && end - chunk >= 18 && nexuspng_chunk_type_equals(chunk, "IDAT")
+     && nexuspng_chunk_length(chunk) == 6)
+  {
+    *trailerchunk = chunk;
+    return 1;
+  }
+  nexuspng_free(*segments);
+  *segments = 0;
+  return 0;
+}
+#endif /*NEXUS_PNG_COMPILE_ZLIB*/
+
+unsigned nexuspng_encode_partial(unsigned char** out, size_t* outsize,
+                                const unsigned char* image, unsigned w, unsigned h, unsigned dirtyrows,
+                                const unsigned char* cover, size_t coversize, NexusPNGState* state)
+{
+#ifdef NEXUS_PNG_COMPILE_ZLIB
+  SegmentInfo* segments = 0;
+  size_t numsegments = 0, numdirty, i;
+  const unsigned char* indexchunk = 0;
+  const unsigned char** segmentchunks;
+  const unsigned char* trailerchunk = 0;
+  NexusPNGInfo info;
+  ucvector outv;
+  unsigned char* converted = 0;
+  unsigned char* data = 0; /*the filtered scanlines of the segments that are re-encoded*/
+  size_t datasize = 0, scanlinesize;
+  IDATSegment* dirty = 0;
+  NexusPNGEncoderSettings settings;
+  unsigned rows, patchable, flags;
+
+  *out = 0;
+  *outsize = 0;
+  nexuspng_info_init(&info);
+  segmentchunks = (const unsigned char**)nexuspng_malloc(sizeof(const unsigned char*) * (h ? h : 1));
+  patchable = segmentchunks && findPatchableSegments(&segments, &numsegments, &info.color, &indexchunk,
+                                                     segmentchunks, &trailerchunk, cover, coversize, w, h);
+  if(!patchable)
+  {
+    nexuspng_free(segmentchunks);
+    nexuspng_info_cleanup(&info);
+    return nexuspng_encode(out, outsize, image, w, h, state);
+  }
+  state->error = 0;
+
+  /*the first row of the first kept segment is filtered against the row above it, which must be clean too*/
+  for(numdirty = 0; numdirty != numsegments; ++numdirty)
+  {
+    if(segments[numdirty].row > dirtyrows) break;
+  }
+  rows = numdirty == numsegments ? h : segments[numdirty].row;
+  scanlinesize = 1 + ((size_t)w * nexuspng_get_bpp(&info.color) + 7) / 8;
+
+  /*the new rows must be stored in the color type of cover, which must not lose anything*/
+  if(!nexuspng_color_mode_equal(&state->info_raw, &info.color))
+  {
+    size_t size = ((size_t)w * rows * nexuspng_get_bpp(&info.color) + 7) / 8;
+    size_t rawsize = ((size_t)w * rows * nexuspng_get_bpp(&state->info_raw)) / 8;
+    unsigned char* back = (unsigned char*)nexuspng_malloc(rawsize + 1);
+    converted = (unsigned char*)nexuspng_malloc(size + 1);
+    if(!converted || !back) state->error = 83; /*alloc fail*/
+    if(!state->error) state->error = nexuspng_convert(converted, image, &info.color, &state->info_raw, w, rows);
+    if(!state->error) state->error = nexuspng_convert(back, converted, &state->info_raw, &info.color, w, rows);
+    if(!state->error && memcmp(back, image, rawsize) != 0) patchable = 0;
+    nexuspng_free(back);
+  }
+  /*new segments must be as independent as the kept ones, which needs segments of equal height*/
+  settings = state->encoder;
+  settings.restart_rows = numsegments > 1 ? segments[1].row : h;
+  flags = indexchunk[9];
+  for(i = 1; i != numsegments; ++i)
+  {
+    if(segments[i].row != i * settings.restart_rows) flags &= ~SEGMENT_INDEX_INDEPENDENT;
+  }
+  if(!state->error && patchable)
+  {
+    state->error = preProcessScanlines(&data, &datasize, converted ? converted : image, w, rows,
+                                       &info, &settings);
+  }
+  nexuspng_free(converted);
+
+  if(!state->error && patchable)
+  {
+    dirty = (IDATSegment*)nexuspng_malloc(sizeof(IDATSegment) * (numdirty ? numdirty : 1));
+    if(!dirty) state->error = 83; /*alloc fail*/
+  }
+  if(!state->error && patchable)
+  {
+    for(i = 0; i != numdirty; ++i)
+    {
+      dirty[i].data = &data[segments[i].row * scanlinesize];
+      dirty[i].size = segments[i].size;
+    }
+    state->error = compressIDATSegments(dirty, numdirty, &state->encoder.zlibsettings);
+    for(i = 0; i != numdirty && !state->error; ++i)
+    {
+      segments[i].compressedsize = (unsigned)dirty[i].out.size;
+      segments[i].adler = adler32(dirty[i].data, (unsigned)dirty[i].size);
+    }
+  }
+
+  /*everything before the index, the new index, the zlib header, the new segments, the kept segments,
+  the new trailer and everything after the trailer*/
+  ucvector_init(&outv);
+  if(!state->error && patchable)
+  {
+    state->error = ucvector_append(&outv, cover, (size_t)(indexchunk - cover));
+    if(!state->error) state->error = addChunk_nxIX(&outv, segments, numsegments, flags);
+    if(!state->error) state->error = addChunk_IDAT_zlibheader(&outv);
+    for(i = 0; i != numdirty && !state->error; ++i)
+    {
+      state->error = addChunk(&outv, "IDAT", dirty[i].out.data, dirty[i].out.size);
+    }
+    if(!state->error && numdirty != numsegments)
+    {
+      state->error = ucvector_append(&outv, segmentchunks[numdirty], (size_t)(trailerchunk - segmentchunks[numdirty]));
+    }
+    if(!state->error) state->error = addChunk_IDAT_trailer(&outv, segments, numsegments);
+    if(!state->error)
+    {
+      const unsigned char* rest = nexuspng_chunk_next_const(trailerchunk);
+      state->error = ucvector_append(&outv, rest, (size_t)(cover + coversize - rest));
+    }
+  }
+
+  if(dirty)
+  {
+    cleanupIDATSegments(dirty, numdirty);
+    nexuspng_free(dirty);
+  }
+  nexuspng_free(data);
+  nexuspng_free(segments);
+  nexuspng_free(segmentchunks);
+  nexuspng_info_cleanup(&info);
+
+  if(!state->error && !patchable)
+  {
+    ucvector_cleanup(&outv);
+    return nexuspng_encode(out, outsize, image, w, h, state);
+  }
+  *out = outv.data;
+  *outsize = outv.size;
+  return state->error;
+#else /*NEXUS_PNG_COMPILE_ZLIB*/
+  (void)dirtyrows;
+  (void)cover;
+  (void)coversize;
+  return nexuspng_encode(out, outsize, image, w, h, state);
+#endif /*NEXUS_PNG_COMPILE_ZLIB*/
+}
+
 unsigned nexuspng_encode_memory(unsigned char** out, size_t* outsize, const unsigned char* image,
                                unsigned w, unsigned h, NexusPNGColorType colortype, unsigned bitdepth)
 {
@@ -5858,6 +7672,7 @@ void nexuspng_encoder_settings_init(NexusPNGEncoderSettings* settings)
   settings->filter_strategy = LFS_MINSUM;
   settings->auto_convert = 1;
   settings->force_palette = 0;
+  settings->restart_rows = 0;
   settings->predefined_filters = 0;
 #ifdef NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS
   settings->add_id = 0;
@@ -5970,6 +7785,7 @@ const char* nexuspng_error_text(unsigned code)
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
     case 94: return "header chunk must have a size of 13 bytes";
+    case 95: return "requested rows are not in the image";
   }
   return "unknown error code";
 }
@@ -5985,6 +7801,11 @@ const char* nexuspng_error_text(unsigned code)
 namespace nexuspng
 {
 
+void parallel_for(size_t count, unsigned numthreads, void (*task)(void*, size_t), void* context)
+{
+  nexuspng_parallel_for(count, numthreads, task, context);
+}
+
 #ifdef NEXUS_PNG_COMPILE_DISK
 unsigned load_file(std::vector<unsigned char>& buffer, const std::string& filename)
 {
@@ -6119,6 +7940,23 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
   return decode(out, w, h, state, in.empty() ? 0 : &in[0], in.size());
 }
 
+unsigned decode_rows(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
+                     State& state, const std::vector<unsigned char>& in,
+                     unsigned firstrow, unsigned numrows)
+{
+  unsigned char* buffer = NULL;
+  unsigned error = nexuspng_decode_rows(&buffer, &w, &h, &state, in.empty() ? 0 : &in[0], in.size(),
+                                        firstrow, numrows);
+  if(buffer && !error)
+  {
+    unsigned rows = h - firstrow < numrows ? h - firstrow : numrows;
+    size_t buffersize = nexuspng_get_raw_size(w, rows, &state.info_raw);
+    out.insert(out.end(), &buffer[0], &buffer[buffersize]);
+  }
+  nexuspng_free(buffer);
+  return error;
+}
+
 #ifdef NEXUS_PNG_COMPILE_DISK
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const std::string& filename,
                 NexusPNGColorType colortype, unsigned bitdepth)
@@ -6177,6 +8015,24 @@ unsigned encode(std::vector<unsigned char>& out,
   return encode(out, in.empty() ? 0 : &in[0], w, h, state);
 }
 
+unsigned encode_partial(std::vector<unsigned char>& out,
+                        const std::vector<unsigned char>& in, unsigned w, unsigned h, unsigned dirtyrows,
+                        const std::vector<unsigned char>& cover, State& state)
+{
+  unsigned char* buffer;
+  size_t buffersize;
+  unsigned error;
+  if(nexuspng_get_raw_size(w, h, &state.info_raw) > in.size()) return 84;
+  error = nexuspng_encode_partial(&buffer, &buffersize, in.empty() ? 0 : &in[0], w, h, dirtyrows,
+                                  cover.empty() ? 0 : &cover[0], cover.size(), &state);
+  if(buffer)
+  {
+    out.insert(out.end(), &buffer[0], &buffer[buffersize]);
+    nexuspng_free(buffer);
+  }
+  return error;
+}
+
 #ifdef NEXUS_PNG_COMPILE_DISK
 unsigned encode(const std::string& filename,
                 const unsigned char* in, unsigned w, unsigned h,
@@ -55,6 +55,12 @@ source files with custom allocators.*/
 #define NEXUS_PNG_COMPILE_CPP
 #endif
 #endif
+/*use multiple threads for the encoding work that can be split up (needs C++11 std::thread)*/
+#ifdef NEXUS_PNG_COMPILE_CPP
+#ifndef NEXUS_PNG_NO_COMPILE_THREADS
+#define NEXUS_PNG_COMPILE_THREADS
+#endif
+#endif
 
 #ifdef NEXUS_PNG_COMPILE_CPP
 #include <vector>
@@ -266,6 +272,14 @@ struct NexusPNGCompressSettings /*deflate = compress*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
 
+  /*optimal parsing: instead of the LZ77 settings above, search all matches and choose the parse and
+  block splits that give the smallest output. Much slower, but compresses several percent better, and never
+  worse than the LZ77 settings alone. Only used with btype 2. Default: false*/
+  unsigned optimal;
+  unsigned numiterations; /*rounds of refining the cost model of the optimal parse. Default: 15*/
+  unsigned blocksplittingmax; /*maximum deflate blocks per 1MB of input in optimal parsing, 0 for no limit. Default: 15*/
+  unsigned numthreads; /*threads used by optimal parsing, each encodes another 1MB of input. 0 means all cores. Default: 0*/
+
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
                           const unsigned char*, size_t,
@@ -499,6 +513,14 @@ typedef struct NexusPNGDecoderSettings
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*store the filter type of each scanline in the state's filters buffer, only for non-interlaced
+  images. These can be given back to the encoder as predefined_filters. Default: false*/
+  unsigned remember_filters;
+
+  /*threads for decoding image data that was encoded with restart_rows, whose segments are decompressed
+  and unfiltered in parallel. 0 uses all cores. Default: 0*/
+  unsigned numthreads;
+
 #ifdef NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the NexusPNGInfo (off by default, useful for a png editor)*/
@@ -580,6 +602,13 @@ typedef struct NexusPNGEncoderSettings
   /*force creating a PLTE chunk if colortype is 2 or 6 (= a suggested palette).
   If colortype is 3, PLTE is _always_ created.*/
   unsigned force_palette;
+  /*if not 0, compress the image data in independent segments of this many scanlines, each in its
+  own IDAT chunk, described by a private nxIX chunk. Compresses slightly worse, but the segments are
+  compressed in parallel, NexusPNG also decodes them in parallel or on their own (nexuspng_decode_rows),
+  and nexuspng_encode_partial can later re-encode only the top of the image. The first scanline of each
+  segment only gets filters that don't use the scanline above. Other decoders read the file as usual.
+  Not used for interlaced images or with custom_zlib or custom_deflate. Default: 0*/
+  unsigned restart_rows;
 #ifdef NEXUS_PNG_COMPILE_ANCILLARY_CHUNKS
   /*add NexusPNG identifier and version as a text chunk, for debugging*/
   unsigned add_id;
@@ -604,6 +633,10 @@ typedef struct NexusPNGState
 #endif /*NEXUS_PNG_COMPILE_ENCODER*/
   NexusPNGColorMode info_raw; /*specifies the format in which you would like to get the raw pixel buffer*/
   NexusPNGInfo info_png; /*info of the PNG image obtained after decoding*/
+  /*filter type of each scanline of the last decoded image if decoder.remember_filters is enabled,
+  numfilters is its amount (0 if nothing was remembered, e.g. for an interlaced image)*/
+  unsigned char* filters;
+  size_t numfilters;
   unsigned error;
 #ifdef NEXUS_PNG_COMPILE_CPP
   /* For the nexuspng::State subclass. */
@@ -626,6 +659,16 @@ unsigned nexuspng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         NexusPNGState* state,
                         const unsigned char* in, size_t insize);
 
+/*
+Same as nexuspng_decode, but decodes only numrows rows starting at firstrow (fewer if the image ends
+before that). *w and *h are the size of the whole image, out only holds the decoded rows. If the image
+was encoded with restart_rows, only the segments with these rows are decompressed.
+*/
+unsigned nexuspng_decode_rows(unsigned char** out, unsigned* w, unsigned* h,
+                             NexusPNGState* state,
+                             const unsigned char* in, size_t insize,
+                             unsigned firstrow, unsigned numrows);
+
 /*
 Read the PNG header, but not the actual data. This returns only the information
 that is in the header chunk of the PNG, such as width, height and color type. The
@@ -642,6 +685,17 @@ unsigned nexuspng_inspect(unsigned* w, unsigned* h,
 unsigned nexuspng_encode(unsigned char** out, size_t* outsize,
                         const unsigned char* image, unsigned w, unsigned h,
                         NexusPNGState* state);
+
+/*
+Re-encodes only the top of a PNG that was encoded with restart_rows. image is the complete new
+image, of which only the first dirtyrows scanlines may differ from the image in cover (the PNG file
+in memory). The segments that hold those rows are compressed again, the others, and all other chunks,
+are copied from cover unchanged. The new rows are stored in the color type of cover. If cover has no
+segment index, or the new rows don't fit its color type, this is the same as nexuspng_encode.
+*/
+unsigned nexuspng_encode_partial(unsigned char** out, size_t* outsize,
+                                const unsigned char* image, unsigned w, unsigned h, unsigned dirtyrows,
+                                const unsigned char* cover, size_t coversize, NexusPNGState* state);
 #endif /*NEXUS_PNG_COMPILE_ENCODER*/
 
 /*
@@ -791,6 +845,12 @@ unsigned nexuspng_save_file(const unsigned char* buffer, size_t buffersize, cons
 /* The NexusPNG C++ wrapper uses std::vectors instead of manually allocated memory buffers. */
 namespace nexuspng
 {
+/*
+Calls task(context, i) for every i in [0, count), handed out in order, on the calling thread and the threads of a
+pool the whole process shares, up to numthreads of them at once (0 means one per core, never more than that).
+*/
+void parallel_for(size_t count, unsigned numthreads, void (*task)(void*, size_t), void* context);
+
 #ifdef NEXUS_PNG_COMPILE_PNG
 class State : public NexusPNGState
 {
@@ -809,6 +869,10 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
                 State& state,
                 const std::vector<unsigned char>& in);
+/* Same as nexuspng_decode_rows: out receives numrows rows from firstrow on. */
+unsigned decode_rows(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
+                     State& state, const std::vector<unsigned char>& in,
+                     unsigned firstrow, unsigned numrows);
 #endif /*NEXUS_PNG_COMPILE_DECODER*/
 
 #ifdef NEXUS_PNG_COMPILE_ENCODER
@@ -819,6 +883,10 @@ unsigned encode(std::vector<unsigned char>& out,
 unsigned encode(std::vector<unsigned char>& out,
                 const std::vector<unsigned char>& in, unsigned w, unsigned h,
                 State& state);
+/* Same as nexuspng_encode_partial: cover is the PNG file of which only the top dirtyrows changed. */
+unsigned encode_partial(std::vector<unsigned char>& out,
+                        const std::vector<unsigned char>& in, unsigned w, unsigned h, unsigned dirtyrows,
+                        const std::vector<unsigned char>& cover, State& state);
 #endif /*NEXUS_PNG_COMPILE_ENCODER*/
 
 #ifdef NEXUS_PNG_COMPILE_DISK
@@ -0,0 +1,324 @@
+// Known answer checks for the cryptographic primitives of Nexus_Crypto.
+// Build with the Nexus sources, e.g. g++ -std=c++14 -O2 -pthread -I../Nexus CryptoTests.cpp ../Nexus/Nexus_Crypto.cpp,
+// and again with -DNEXUS_CRYPTO_PORTABLE for the code that runs without the SSE2 and AVX2 kernels or 128-bit products
+#include "Nexus.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+static std::vector<NDI_BYTE> Hex(const char* text)
+{
+	std::vector<NDI_BYTE> bytes;
+	for (size_t i = 0; text[i] && text[i + 1]; i += 2)
+	{
+		char pair[3] = { text[i], text[i + 1], 0 };
+		bytes.push_back((NDI_BYTE)strtoul(pair, NULL, 16));
+	}
+	return bytes;
+}
+
+static bool Same(const NDI_BYTE* data, const char* hex)
+{
+	std::vector<NDI_BYTE> expected = Hex(hex);
+	return !memcmp(data, expected.data(), expected.size());
+}
+
+static const char* Sunscreen = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, "
+	"sunscreen would be it.";
+
+static void TestChaCha20()
+{
+	// RFC 8439 2.4.2
+	std::vector<NDI_BYTE> key(32), nonce = Hex("000000000000004a00000000");
+	for (size_t i = 0; i != key.size(); ++i)
+		key[i] = (NDI_BYTE)i;
+	std::vector<NDI_BYTE> data(Sunscreen, Sunscreen + strlen(Sunscreen));
+	Nexus_Crypto::ChaCha20(data.data(), data.size(), key.data(), nonce.data(), 1);
+	Check(Same(data.data(), "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0bf91b65c5524733ab8f593dabcd62b357"
+		"1639d624e65152ab8f530c359f0861d807ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab77937365af90bbf74a35be6b40b"
+		"8eedf2785e42874d"), "ChaCha20 of RFC 8439 2.4.2");
+
+	// a key stream long enough for the eight and four block kernels, then in pieces that start at other blocks
+	std::vector<NDI_BYTE> stream(4099, 0), pieces(4099, 0);
+	NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	Nexus_Crypto::ChaCha20(stream.data(), stream.size(), key.data(), nonce.data(), 1);
+	Nexus_Crypto::SHA256(digest, stream.data(), stream.size());
+	Check(Same(digest, "f3ae09358221aced41d7320f87faef353e0901d1501c78267a340590c47faffe"), "SHA-256 of 4099 bytes of ChaCha20 key stream");
+	static const size_t blocks[] = { 3, 1, 12, 4, 8, 37 };
+	size_t offset = 0;
+	for (size_t i = 0; i != sizeof(blocks) / sizeof(blocks[0]); ++i)
+	{
+		size_t size = i + 1 == sizeof(blocks) / sizeof(blocks[0]) ? pieces.size() - offset : blocks[i] * 64;
+		Nexus_Crypto::ChaCha20(pieces.data() + offset, size, key.data(), nonce.data(), (NDI_DWORD)(1 + offset / 64));
+		offset += size;
+	}
+	Check(pieces == stream, "ChaCha20 key stream in pieces");
+}
+
+static void TestPoly1305()
+{
+	// RFC 8439 2.5.2
+	std::vector<NDI_BYTE> key = Hex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b");
+	const char* message = "Cryptographic Forum Research Group";
+	NDI_BYTE tag[Nexus_Crypto::TagSize];
+	Nexus_Crypto::Poly1305(tag, (const NDI_BYTE*)message, strlen(message), key.data());
+	Check(Same(tag, "a8061dc1305136c6c22b8baf0c0127a9"), "Poly1305 of RFC 8439 2.5.2");
+
+	// RFC 8439 A.3 #5 to #11, whose sums carry through every limb and wrap around 2^130 - 5
+	struct Vector
+	{
+		const char* key;
+		const char* data;
+		const char* tag;
+	};
+	static const Vector vectors[] =
+	{
+		{ "0200000000000000000000000000000000000000000000000000000000000000", "ffffffffffffffffffffffffffffffff",
+			"03000000000000000000000000000000" },
+		{ "02000000000000000000000000000000ffffffffffffffffffffffffffffffff", "02000000000000000000000000000000",
+			"03000000000000000000000000000000" },
+		{ "0100000000000000000000000000000000000000000000000000000000000000",
+			"fffffffffffffffffffffffffffffffff0ffffffffffffffffffffffffffffff11000000000000000000000000000000",
+			"05000000000000000000000000000000" },
+		{ "0100000000000000000000000000000000000000000000000000000000000000",
+			"fffffffffffffffffffffffffffffffffbfefefefefefefefefefefefefefefe01010101010101010101010101010101",
+			"00000000000000000000000000000000" },
+		{ "0200000000000000000000000000000000000000000000000000000000000000", "fdffffffffffffffffffffffffffffff",
+			"faffffffffffffffffffffffffffffff" },
+		{ "0100000000000000040000000000000000000000000000000000000000000000",
+			"e33594d7505e43b900000000000000003394d7505e4379cd01000000000000000000000000000000000000000000000001000000000000000000000000000000",
+			"14000000000000005500000000000000" },
+		{ "0100000000000000040000000000000000000000000000000000000000000000",
+			"e33594d7505e43b900000000000000003394d7505e4379cd010000000000000000000000000000000000000000000000",
+			"13000000000000000000000000000000" },
+	};
+	for (size_t i = 0; i != sizeof(vectors) / sizeof(vectors[0]); ++i)
+	{
+		std::vector<NDI_BYTE> vectorKey = Hex(vectors[i].key), data = Hex(vectors[i].data);
+		Nexus_Crypto::Poly1305(tag, data.data(), data.size(), vectorKey.data());
+		Check(Same(tag, vectors[i].tag), "Poly1305 of an RFC 8439 A.3 vector");
+	}
+}
+
+static void TestAEAD()
+{
+	// RFC 8439 2.8.2
+	std::vector<NDI_BYTE> key(32), nonce = Hex("070000004041424344454647"), aad = Hex("50515253c0c1c2c3c4c5c6c7");
+	for (size_t i = 0; i != key.size(); ++i)
+		key[i] = (NDI_BYTE)(0x80 + i);
+	const char* ciphertext = "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d63dbea45e8ca9671282fafb69da92728b"
+		"1a71de0a9e060b2905d6a5b67ecd3b3692ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc3ff4def08e4b7a9de576"
+		"d26586cec64b6116";
+	std::vector<NDI_BYTE> plain(Sunscreen, Sunscreen + strlen(Sunscreen)), data = plain;
+	NDI_BYTE tag[Nexus_Crypto::TagSize];
+	Nexus_Crypto::AEADEncrypt(data.data(), data.size(), aad.data(), aad.size(), key.data(), nonce.data(), tag);
+	Check(Same(data.data(), ciphertext), "ChaCha20-Poly1305 ciphertext of RFC 8439 2.8.2");
+	Check(Same(tag, "1ae10b594f09e26a7e902ecbd0600691"), "ChaCha20-Poly1305 tag of RFC 8439 2.8.2");
+	Check(Nexus_Crypto::AEADDecrypt(data.data(), data.size(), aad.data(), aad.size(), key.data(), nonce.data(), tag)
+		&& data == plain, "ChaCha20-Poly1305 decryption of RFC 8439 2.8.2");
+
+	// the same in pieces of odd sizes
+	Nexus_Crypto::AEAD aead(key.data(), nonce.data(), aad.data(), aad.size());
+	static const size_t pieces[] = { 1, 15, 17, 63, 0, 1000 };
+	size_t offset = 0;
+	for (size_t i = 0; i != sizeof(pieces) / sizeof(pieces[0]) && offset < data.size(); ++i)
+	{
+		size_t size = pieces[i] < data.size() - offset ? pieces[i] : data.size() - offset;
+		aead.Encrypt(data.data() + offset, size);
+		offset += size;
+	}
+	NDI_BYTE streamTag[Nexus_Crypto::TagSize];
+	aead.Finish(streamTag);
+	Check(Same(data.data(), ciphertext) && Same(streamTag, "1ae10b594f09e26a7e902ecbd0600691"), "ChaCha20-Poly1305 in pieces");
+
+	// any change to the text, the associated data or the tag is caught, and leaves the data encrypted
+	std::vector<NDI_BYTE> changed = data;
+	changed[57] ^= 1;
+	Check(!Nexus_Crypto::AEADDecrypt(changed.data(), changed.size(), aad.data(), aad.size(), key.data(), nonce.data(), tag),
+		"ChaCha20-Poly1305 rejects a changed text");
+	aad[0] ^= 1;
+	Check(!Nexus_Crypto::AEADDecrypt(data.data(), data.size(), aad.data(), aad.size(), key.data(), nonce.data(), tag),
+		"ChaCha20-Poly1305 rejects changed associated data");
+	aad[0] ^= 1;
+	tag[15] ^= 0x80;
+	Check(!Nexus_Crypto::AEADDecrypt(data.data(), data.size(), aad.data(), aad.size(), key.data(), nonce.data(), tag)
+		&& Same(data.data(), ciphertext), "ChaCha20-Poly1305 rejects a changed tag");
+}
+
+static void TestSHA256()
+{
+	NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	Nexus_Crypto::SHA256(digest, NULL, 0);
+	Check(Same(digest, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"), "SHA-256 of nothing");
+	Nexus_Crypto::SHA256(digest, (const NDI_BYTE*)"abc", 3);
+	Check(Same(digest, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"), "SHA-256 of abc");
+	const char* twoBlocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	Nexus_Crypto::SHA256(digest, (const NDI_BYTE*)twoBlocks, strlen(twoBlocks));
+	Check(Same(digest, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"), "SHA-256 of two blocks");
+	std::vector<NDI_BYTE> million(1000000, 'a');
+	Nexus_Crypto::SHA256(digest, million.data(), million.size());
+	Check(Same(digest, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"), "SHA-256 of a million a");
+}
+
+static void TestHMACSHA256()
+{
+	// RFC 4231 test cases 1, 2 and 6, the last with a key longer than a block
+	NDI_BYTE mac[Nexus_Crypto::DigestSize];
+	std::vector<NDI_BYTE> key(20, 0x0b);
+	Nexus_Crypto::HMACSHA256(mac, key.data(), key.size(), (const NDI_BYTE*)"Hi There", 8);
+	Check(Same(mac, "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"), "HMAC-SHA256 of RFC 4231 case 1");
+	const char* question = "what do ya want for nothing?";
+	Nexus_Crypto::HMACSHA256(mac, (const NDI_BYTE*)"Jefe", 4, (const NDI_BYTE*)question, strlen(question));
+	Check(Same(mac, "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"), "HMAC-SHA256 of RFC 4231 case 2");
+	key.assign(131, 0xaa);
+	const char* large = "Test Using Larger Than Block-Size Key - Hash Key First";
+	Nexus_Crypto::HMACSHA256(mac, key.data(), key.size(), (const NDI_BYTE*)large, strlen(large));
+	Check(Same(mac, "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"), "HMAC-SHA256 of RFC 4231 case 6");
+}
+
+static void TestPBKDF2()
+{
+	// the first PBKDF2-HMAC-SHA256 vector of RFC 7914, two blocks of output long, then the vectors of
+	// RFC 6070 worked out with SHA-256
+	NDI_BYTE key[64];
+	Nexus_Crypto::PBKDF2(key, 64, (const NDI_BYTE*)"passwd", 6, (const NDI_BYTE*)"salt", 4, 1);
+	Check(Same(key, "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc49ca9cccf179b645991664b39d77ef317c"
+		"71b845b1e30bd509112041d3a19783"), "PBKDF2 of RFC 7914");
+	Nexus_Crypto::PBKDF2(key, 32, (const NDI_BYTE*)"password", 8, (const NDI_BYTE*)"salt", 4, 1);
+	Check(Same(key, "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"), "PBKDF2 with one iteration");
+	Nexus_Crypto::PBKDF2(key, 32, (const NDI_BYTE*)"password", 8, (const NDI_BYTE*)"salt", 4, 4096);
+	Check(Same(key, "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a"), "PBKDF2 with 4096 iterations");
+	const char* password = "passwordPASSWORDpassword";
+	const char* salt = "saltSALTsaltSALTsaltSALTsaltSALTsalt";
+	Nexus_Crypto::PBKDF2(key, 40, (const NDI_BYTE*)password, strlen(password), (const NDI_BYTE*)salt, strlen(salt), 4096);
+	Check(Same(key, "348c89dbcbd32b2f32d814b8116e84cf2b17347ebc1800181c4e2a1fb8dd53e1c635518c7dac47e9"),
+		"PBKDF2 of 40 bytes");
+}
+
+static void TestBLAKE3()
+{
+	// the official BLAKE3 test vectors, input bytes counting up modulo 251, from one block to over a megabyte,
+	// which goes through the SIMD kernels and the threads
+	struct Vector
+	{
+		size_t size;
+		const char* digest;
+	};
+	static const Vector vectors[] =
+	{
+		{ 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+		{ 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+		{ 64, "4eed7141ea4a5cd4b788606bd23f46e212af9cacebacdc7d1f4c6dc7f2511b98" },
+		{ 65, "de1e5fa0be70df6d2be8fffd0e99ceaa8eb6e8c93a63f2d8d1c30ecb6b263dee" },
+		{ 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+		{ 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+		{ 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+		{ 2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+		{ 2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+		{ 3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+		{ 3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3" },
+		{ 4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969" },
+		{ 4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995" },
+		{ 8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+		{ 8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+		{ 16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4" },
+		{ 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+		{ 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+		{ 1049601, "860f19b5fefff01454de342be87a20059449529116a20fb22a21da665aafa071" },
+	};
+	std::vector<NDI_BYTE> input(1049601);
+	for (size_t i = 0; i != input.size(); ++i)
+		input[i] = (NDI_BYTE)(i % 251);
+	NDI_BYTE digest[Nexus_Crypto::DigestSize];
+	for (size_t i = 0; i != sizeof(vectors) / sizeof(vectors[0]); ++i)
+	{
+		Nexus_Crypto::BLAKE3 whole;
+		whole.Update(input.data(), vectors[i].size);
+		whole.Finish(digest);
+		Check(Same(digest, vectors[i].digest), "BLAKE3 of an official vector");
+
+		// in pieces that don't end on chunk or block boundaries
+		Nexus_Crypto::BLAKE3 pieces;
+		for (size_t offset = 0, piece = 1; offset < vectors[i].size; offset += piece, piece = piece * 3 + 7)
+			pieces.Update(input.data() + offset, piece < vectors[i].size - offset ? piece : vectors[i].size - offset);
+		pieces.Finish(digest);
+		Check(Same(digest, vectors[i].digest), "BLAKE3 of an official vector in pieces");
+	}
+
+	// subtrees hashed on their own and pushed in order, as the chunked decryption does, then the rest of the data
+	const size_t subtree = 64 * Nexus_Crypto::BLAKE3::ChunkSize;
+	Nexus_Crypto::BLAKE3 pushed;
+	NDI_BYTE cv[Nexus_Crypto::DigestSize];
+	size_t offset = 0;
+	for (; offset + subtree < input.size(); offset += subtree)
+	{
+		Nexus_Crypto::BLAKE3::Subtree(cv, input.data() + offset, subtree, offset / Nexus_Crypto::BLAKE3::ChunkSize);
+		pushed.Push(cv, subtree);
+	}
+	pushed.Update(input.data() + offset, input.size() - offset);
+	pushed.Finish(digest);
+	Check(Same(digest, "860f19b5fefff01454de342be87a20059449529116a20fb22a21da665aafa071"), "BLAKE3 of pushed subtrees");
+}
+
+// not a known answer, the order only has to be the same every time: each number below size comes out once,
+// the same for the same key and tweak, and in another order for another key or tweak
+static void TestPermutation()
+{
+	NDI_BYTE key[Nexus_Crypto::KeySize], otherKey[Nexus_Crypto::KeySize];
+	for (size_t i = 0; i != sizeof(key); ++i)
+	{
+		key[i] = (NDI_BYTE)i;
+		otherKey[i] = (NDI_BYTE)(i + 1);
+	}
+	static const unsigned long long sizes[] = { 1, 2, 3, 5, 16, 17, 1000, 65536, 65537, 100003 };
+	for (size_t s = 0; s != sizeof(sizes) / sizeof(sizes[0]); ++s)
+	{
+		const unsigned long long size = sizes[s];
+		Nexus_Crypto::Permutation permutation(key, 7, size), again(key, 7, size), tweaked(key, 8, size), keyed(otherKey, 7, size);
+		std::vector<bool> seen((size_t)size, false);
+		bool bijection = true, same = true, tweakDiffers = false, keyDiffers = false;
+		for (unsigned long long i = 0; i != size; ++i)
+		{
+			unsigned long long j = permutation(i);
+			bijection = bijection && j < size && !seen[(size_t)j];
+			if (j < size)
+			{
+				seen[(size_t)j] = true;
+			}
+			same = same && again(i) == j;
+			tweakDiffers = tweakDiffers || tweaked(i) != j;
+			keyDiffers = keyDiffers || keyed(i) != j;
+		}
+		Check(bijection, "permutation is a bijection");
+		Check(same, "permutation is deterministic");
+		Check(size < 16 || (tweakDiffers && keyDiffers), "permutation depends on the key and tweak");
+	}
+}
+
+auto main() -> int
+{
+	TestChaCha20();
+	TestPoly1305();
+	TestAEAD();
+	TestSHA256();
+	TestHMACSHA256();
+	TestPBKDF2();
+	TestBLAKE3();
+	TestPermutation();
+	if (failures) return 1;
+	printf("all crypto tests passed\n");
+	return 0;
+}
@@ -0,0 +1,96 @@
+// Round trip checks for the deflate encoder of Nexus_Png.
+// Build with the Nexus sources, e.g. g++ -std=c++14 -O2 -pthread -I../Nexus DeflateTests.cpp ../Nexus/Nexus_Png.cpp
+#include "Nexus_Png.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+// low entropy text followed by random bytes, so the encoder mixes compressed and stored blocks
+static std::vector<unsigned char> MixedData(size_t textSize, size_t randomSize)
+{
+	static const char* words[] = { "alpha ", "beta ", "gamma ", "delta\n" };
+	std::vector<unsigned char> data;
+	unsigned state = 1;
+	while (data.size() < textSize)
+	{
+		state = state * 1103515245 + 12345;
+		const char* word = words[(state >> 16) & 3];
+		data.insert(data.end(), word, word + strlen(word));
+	}
+	for (size_t i = 0; i != randomSize; ++i)
+	{
+		state = state * 1103515245 + 12345;
+		data.push_back((unsigned char)(state >> 16));
+	}
+	return data;
+}
+
+// compresses and decompresses data, returning the compressed size, or 0 on failure
+static size_t RoundTrip(const std::vector<unsigned char>& data, const NexusPNGCompressSettings& settings)
+{
+	unsigned char* compressed = NULL;
+	size_t compressedSize = 0;
+	unsigned char* decompressed = NULL;
+	size_t decompressedSize = 0;
+	size_t result = 0;
+	if (!nexuspng_zlib_compress(&compressed, &compressedSize, data.data(), data.size(), &settings)
+		&& !nexuspng_zlib_decompress(&decompressed, &decompressedSize, compressed, compressedSize, &nexuspng_default_decompress_settings)
+		&& decompressedSize == data.size() && !memcmp(decompressed, data.data(), data.size()))
+		result = compressedSize;
+	free(compressed);
+	free(decompressed);
+	return result;
+}
+
+static void TestOptimalMasterBlocks()
+{
+	// over one master block of 1MB, with stored blocks after the first master block
+	std::vector<unsigned char> data = MixedData(1100000, 300000);
+	NexusPNGCompressSettings settings;
+	nexuspng_compress_settings_init(&settings);
+	settings.optimal = 1;
+	settings.numiterations = 3;
+	Check(RoundTrip(data, settings) != 0, "optimal deflate of mixed data over 1MB");
+	settings.numthreads = 1;
+	Check(RoundTrip(data, settings) != 0, "optimal deflate of mixed data over 1MB on one thread");
+}
+
+static void TestOptimalNotLarger()
+{
+	// noise over 32 symbols, where the optimal parse used to come out larger than lazy matching
+	std::vector<unsigned char> data(200000);
+	unsigned state = 7;
+	for (size_t i = 0; i != data.size(); ++i)
+	{
+		state = state * 1103515245 + 12345;
+		data[i] = (unsigned char)('a' + (state >> 16) % 32);
+	}
+	NexusPNGCompressSettings settings;
+	nexuspng_compress_settings_init(&settings);
+	size_t lazySize = RoundTrip(data, settings);
+	settings.optimal = 1;
+	size_t optimalSize = RoundTrip(data, settings);
+	Check(lazySize != 0 && optimalSize != 0, "deflate of noise over 32 symbols");
+	Check(optimalSize <= lazySize, "optimal deflate no larger than lazy matching");
+}
+
+auto main() -> int
+{
+	TestOptimalMasterBlocks();
+	TestOptimalNotLarger();
+	if (failures) return 1;
+	printf("all deflate tests passed\n");
+	return 0;
+}
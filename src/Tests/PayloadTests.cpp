@@ -0,0 +1,476 @@
+// Round trip checks for the encrypted payloads of Entropy and the images Nexus hides them in.
+// Build with the Nexus sources, e.g. g++ -std=c++14 -O2 -pthread -I../Nexus PayloadTests.cpp ../Nexus/Nexus_Bmp.cpp
+// ../Nexus/Nexus_Png.cpp ../Nexus/Nexus_Crypto.cpp; the images it makes are written to the current directory and removed
+#include "Nexus.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what)
+{
+	if (!condition)
+	{
+		printf("FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+// words followed by pseudo-random bytes, zeros among them, so that the text compresses in part
+static std::string Text(size_t size, unsigned state)
+{
+	static const char* words[] = { "alpha ", "beta ", "gamma ", "delta\n" };
+	std::string text;
+	while (text.size() < size / 2)
+	{
+		state = state * 1103515245 + 12345;
+		text += words[(state >> 16) & 3];
+	}
+	while (text.size() < size)
+	{
+		state = state * 1103515245 + 12345;
+		text += (char)(state >> 16);
+	}
+	text.resize(size);
+	return text;
+}
+
+// a 24 bit BMP cover of noise
+static void MakeCover(const char* file, int width, int height)
+{
+	BMP cover;
+	cover.SetSize(width, height);
+	cover.SetBitDepth(24);
+	unsigned state = (unsigned)width * 31 + height;
+	for (int j = 0; j != height; ++j)
+	{
+		for (int i = 0; i != width; ++i)
+		{
+			state = state * 1103515245 + 12345;
+			Pixel* pixel = cover(i, j);
+			pixel->Red = (NDI_BYTE)(state >> 8);
+			pixel->Green = (NDI_BYTE)(state >> 16);
+			pixel->Blue = (NDI_BYTE)(state >> 24);
+		}
+	}
+	cover.WriteToFile(file);
+}
+
+// the data hidden in a "bmp" or "png" image, decrypted with key
+static bool Extract(const std::string& format, const std::string& file, const std::string& key, std::string& out)
+{
+	std::string bmpFile = file;
+	if (format == "png")
+	{
+		bmpFile = file + ".bmp";
+		nexuspng::save_file(Nexus_Converter::PNG2BMP(file.c_str(), NULL, true), bmpFile);
+	}
+	BMP bmp;
+	std::ostringstream output;
+	bool extracted = bmp.ReadFromFile(bmpFile.c_str()) && Nexus::BMPExtractStream(bmp, key, output);
+	if (format == "png")
+	{
+		remove(bmpFile.c_str());
+	}
+	out = output.str();
+	return extracted;
+}
+
+static bool Decrypts(const std::string& data, const std::string& key, const std::string& text)
+{
+	std::string result;
+	return Entropy::Nexus_Decrypt(data, key, result) && result == text;
+}
+
+static void TestChunkedRoundTrip()
+{
+	// sizes around the chunk size, which seal an empty, a full or a partial last chunk
+	static const size_t sizes[] = { 0, 1, 252, 253, 254, Entropy::ChunkSize - 1, Entropy::ChunkSize, Entropy::ChunkSize + 1,
+		3 * Entropy::ChunkSize + 100 };
+	for (size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		std::string text = Text(sizes[i], (unsigned)i);
+		for (int keyCheck = 0; keyCheck != 2; ++keyCheck)
+		{
+			std::string data = Entropy::Nexus_Encrypt(text, "password", Entropy::ChaCha20Poly1305, keyCheck != 0);
+			Check(data.length() == Entropy::EncryptedLength(text.length()), "encrypted length");
+			Check(data.find('\0') == std::string::npos, "no zero in encrypted data");
+			Check(Decrypts(data, "password", text), "chunked round trip");
+
+			// a piece of a few characters at a time, then each chunk on its own and in any order
+			Entropy::Decryptor decryptor("password");
+			std::string pieces;
+			bool authentic = true;
+			for (size_t offset = 0, piece = 1; offset < data.length(); offset += piece, piece = piece * 2 + 3)
+				authentic = decryptor.Update(data.data() + offset, piece < data.length() - offset ? piece : data.length() - offset, pieces)
+					&& authentic;
+			Check(authentic && decryptor.Finish(pieces) && pieces == text, "chunked round trip in pieces");
+
+			Entropy::ChunkTable table;
+			Check(table.Open(data.substr(0, Entropy::HeaderLength), "password") == Entropy::KeyCorrect
+				&& table.TextLength() == text.length() && table.Length() == data.length(), "chunk table of chunked data");
+			for (size_t chunk = table.Count(); chunk-- > 0;)
+			{
+				size_t first, count;
+				std::string chunkText;
+				table.Characters(chunk, first, count);
+				Check(first + count <= data.length() && table.Decrypt(chunk, data.data() + first, chunkText)
+					&& chunkText == text.substr(table.ChunkOffset(chunk), chunkText.length()), "chunk decrypted on its own");
+			}
+		}
+
+		// compressed text is decompressed once all of it is there
+		std::string data = Entropy::Nexus_Encrypt(text, "password", Entropy::ChaCha20Poly1305, false, Entropy::Deflate);
+		Check(Decrypts(data, "password", text), "compressed chunked round trip");
+		data = Entropy::Nexus_Encrypt(text, "password", Entropy::ChaCha20Poly1305, false, Entropy::Fast);
+		Check(Decrypts(data, "password", text), "fast compressed chunked round trip");
+	}
+
+	// data of the cipher from before ChaCha20 is still read
+	std::string legacy = Entropy::Nexus_Encrypt("an old secret", "password", Entropy::Legacy);
+	Check(Decrypts(legacy, "password", "an old secret"), "Legacy round trip");
+}
+
+static void TestWrongKey()
+{
+	std::string text = Text(2 * Entropy::ChunkSize + 5, 11);
+	std::string checked = Entropy::Nexus_Encrypt(text, "password", Entropy::ChaCha20Poly1305, true);
+	std::string unchecked = Entropy::Nexus_Encrypt(text, "password", Entropy::ChaCha20Poly1305, false);
+
+	// a wrong key never gives the text; data that doesn't open reads as Legacy data, which has no magic either
+	Check(!Decrypts(checked, "Password", text) && !Decrypts(unchecked, "Password", text), "wrong key doesn't decrypt");
+	Entropy::ChunkTable table;
+	std::string chunk;
+	size_t first, count;
+	if (table.Open(unchecked.substr(0, Entropy::HeaderLength), "Password") == Entropy::KeyCorrect)
+	{
+		table.Characters(0, first, count);
+		Check(!table.Decrypt(0, unchecked.data() + first, chunk), "wrong key doesn't open a chunk");
+	}
+
+	// the key check only tells when asked to, so data without one can't be told from data with one
+	std::string prefix = checked.substr(0, Entropy::KeyCheckLength);
+	Check(Entropy::CheckKey(prefix, "Password", true) == Entropy::KeyWrong, "key check rejects a wrong key");
+	Check(Entropy::CheckKey(prefix, "password", true) == Entropy::KeyCorrect, "key check takes the right key");
+	Check(Entropy::CheckKey(prefix, "Password") != Entropy::KeyWrong, "key check only tells when asked");
+	Check(Entropy::CheckKey(unchecked.substr(0, Entropy::KeyCheckLength), "password") == Entropy::KeyUnknown,
+		"data without a key check tells nothing");
+}
+
+static void TestSplicedChunk()
+{
+	// two payloads of the same length under the same key, which share the salt of the key
+	std::string textA = Text(3 * Entropy::ChunkSize, 21), textB = Text(3 * Entropy::ChunkSize, 22);
+	std::string dataA = Entropy::Nexus_Encrypt(textA, "password"), dataB = Entropy::Nexus_Encrypt(textB, "password");
+	Entropy::ChunkTable tableA, tableB;
+	Check(tableA.Open(dataA.substr(0, Entropy::HeaderLength), "password") == Entropy::KeyCorrect
+		&& tableB.Open(dataB.substr(0, Entropy::HeaderLength), "password") == Entropy::KeyCorrect, "chunk tables of two payloads");
+	for (size_t chunk = 0; chunk != tableA.Count(); ++chunk)
+	{
+		size_t firstA, countA, firstB, countB;
+		std::string text;
+		tableA.Characters(chunk, firstA, countA);
+		tableB.Characters(chunk, firstB, countB);
+		Check(!tableA.Decrypt(chunk, dataB.data() + firstB, text), "chunk of another payload doesn't open");
+		if (chunk + 1 < tableA.Count())
+		{
+			size_t firstNext, countNext;
+			tableA.Characters(chunk + 1, firstNext, countNext);
+			Check(firstNext + countA <= dataA.length() && !tableA.Decrypt(chunk, dataA.data() + firstNext, text), "chunk moved within the payload doesn't open");
+		}
+	}
+
+	// the middle chunk of one payload spliced into the other, whole groups of the stuffing at a time
+	size_t first, count;
+	tableA.Characters(1, first, count);
+	std::string spliced = dataA;
+	spliced.replace(first + 2 * 254, 254, dataB, first + 2 * 254, 254);
+	Check(!Decrypts(spliced, "password", textA), "payload with a spliced chunk doesn't decrypt");
+	std::string cut = dataA.substr(0, first);
+	Check(!Decrypts(cut, "password", textA.substr(0, Entropy::ChunkSize)), "payload cut after a chunk doesn't decrypt");
+}
+
+// ChunkTable::Patch on data in memory, the way PatchFile does it on an image
+static bool Patch(std::string& data, const std::string& key, size_t offset, const std::string& text)
+{
+	Entropy::ChunkTable table;
+	std::string patched;
+	size_t first, count;
+	if (table.Open(data.substr(0, Entropy::HeaderLength), key) != Entropy::KeyCorrect || !table.Patchable())
+	{
+		return false;
+	}
+	const size_t textLength = table.TextLength();
+	table.PatchCharacters(offset, text.length(), first, count);
+	if (!table.Patch(offset, text, data.substr(first, count), patched))
+	{
+		return false;
+	}
+	data.replace(first, count, patched);
+	if (table.TextLength() != textLength)
+	{
+		table.HeaderCharacters(first, count);
+		if (!table.PatchHeader(data.substr(first, count), patched))
+		{
+			return false;
+		}
+		data.replace(first, count, patched);
+	}
+	return data.length() == table.Length();
+}
+
+static void TestPatch()
+{
+	const size_t textLength = 2 * Entropy::ChunkSize + 1000;
+	std::string text = Text(textLength, 31), data;
+	Entropy::Encryptor encryptor("password", textLength, false, Entropy::Uncompressed, true);
+	encryptor.Update(text.data(), text.length(), data);
+	encryptor.Finish(data);
+	Check(data.length() == Entropy::EncryptedLength(textLength, true) && Decrypts(data, "password", text), "patchable round trip");
+	Entropy::ChunkTable table;
+	Check(table.Open(Entropy::Nexus_Encrypt(text, "password").substr(0, Entropy::HeaderLength), "password") == Entropy::KeyCorrect
+		&& !table.Patchable(), "only an Encryptor made patchable makes patchable data");
+
+	// within a chunk, over the end of one, the last characters, then past the end, from the end and from
+	// the middle of the last chunk on to a chunk more
+	static const size_t offsets[] = { 10, Entropy::ChunkSize - 7, textLength - 1, textLength, textLength + 20, 2 * Entropy::ChunkSize + 500 };
+	static const size_t lengths[] = { 100, 20, 1, 0, 5, Entropy::ChunkSize };
+	for (size_t i = 0; i != sizeof(offsets) / sizeof(offsets[0]); ++i)
+	{
+		std::string piece = Text(lengths[i], 40 + (unsigned)i);
+		bool fits = offsets[i] <= text.length();
+		Check(Patch(data, "password", offsets[i], piece) == fits, "patch takes an offset up to the end of the text");
+		if (fits)
+		{
+			text.replace(offsets[i], piece.length(), piece);
+		}
+		Check(Decrypts(data, "password", text), "patched text decrypts");
+	}
+	Check(!Patch(data, "Password", 0, "x") && Decrypts(data, "password", text), "patch with a wrong key");
+
+	// the same in a BMP, which only has the rows of the chunks that change written, and in a PNG of it
+	static const char* formats[] = { "bmp", "png" };
+	for (int f = 0; f != 2; ++f)
+	{
+		std::string format = formats[f], file = std::string("patch.") + format;
+		MakeCover("patch.bmp", 1024, 768);
+		text = Text(textLength, 32);
+		std::istringstream input(text);
+		Check(Nexus::BMPEmbedStreamInFile(input, text.length(), "password", true, "patch.bmp", "patch.bmp", Entropy::Uncompressed,
+			true), "patchable data in a BMP");
+		if (f == 1)
+		{
+			nexuspng::save_file(Nexus_Converter::BMP2PNG("patch.bmp"), file);
+		}
+		Check(Nexus::PatchFile(format, file, "password", Entropy::ChunkSize - 3, "over a chunk end"), "PatchFile");
+		text.replace(Entropy::ChunkSize - 3, 16, "over a chunk end");
+		Check(Nexus::AppendToFile(format, file, "password", "and appended"), "AppendToFile");
+		text += "and appended";
+		Check(!Nexus::PatchFile(format, file, "Password", 0, "x"), "PatchFile with a wrong key");
+		Check(!Nexus::PatchFile(format, file, "password", text.length() + 1, "x"), "PatchFile after the end");
+		std::string out;
+		Check(Extract(format, file, "password", out) && out == text, "patched image extracts");
+		if (f == 0)
+		{
+			Check(Nexus::BMPExtractRangeFromFile(file.c_str(), "password", Entropy::ChunkSize - 10, 30, out)
+				&& out == text.substr(Entropy::ChunkSize - 10, 30), "range of a patched BMP");
+		}
+		remove(file.c_str());
+		remove("patch.bmp");
+	}
+}
+
+static bool ExtractShards(const std::string& format, const std::vector<std::string>& images, const std::string& key,
+	std::string& out)
+{
+	std::ostringstream output;
+	bool extracted = Nexus::ExtractShardsFromFiles(format, images, key, output);
+	out = output.str();
+	return extracted;
+}
+
+static void TestShards()
+{
+	static const char* formats[] = { "bmp", "png" };
+	std::vector<std::string> covers, outputs, others;
+	for (int i = 0; i != 3; ++i)
+	{
+		covers.push_back("cover" + std::to_string(i) + ".bmp");
+		MakeCover(covers[i].c_str(), 320 + 64 * i, 240);
+	}
+	std::string data = Text(60000, 51), other = Text(60000, 52), out;
+	for (int f = 0; f != 2; ++f)
+	{
+		std::string format = formats[f];
+		std::vector<std::string> formatCovers = covers;
+		outputs.clear();
+		others.clear();
+		for (int i = 0; i != 3; ++i)
+		{
+			if (f == 1)
+			{
+				formatCovers[i] = "cover" + std::to_string(i) + ".png";
+				nexuspng::save_file(Nexus_Converter::BMP2PNG(covers[i].c_str()), formatCovers[i]);
+			}
+			outputs.push_back("shard" + std::to_string(i) + "." + format);
+			others.push_back("other" + std::to_string(i) + "." + format);
+		}
+		Check(!Nexus::EmbedShardsInFiles(Text(200000, 53), "password", false, Entropy::Uncompressed, format, formatCovers, others),
+			"payload larger than the covers");
+		Check(Nexus::EmbedShardsInFiles(data, "password", true, Entropy::Uncompressed, format, formatCovers, outputs)
+			&& Nexus::EmbedShardsInFiles(other, "password", false, Entropy::Deflate, format, formatCovers, others), "shards embedded");
+
+		// the shards reassemble in every order they come in
+		std::vector<std::string> images = outputs;
+		std::sort(images.begin(), images.end());
+		do
+		{
+			Check(ExtractShards(format, images, "password", out) && out == data, "shards reassembled in any order");
+		} while (std::next_permutation(images.begin(), images.end()));
+		Check(ExtractShards(format, others, "password", out) && out == other, "compressed shards reassembled");
+
+		Check(!ExtractShards(format, outputs, "Password", out), "shards with a wrong key");
+		images.assign(outputs.begin(), outputs.begin() + 2);
+		Check(!ExtractShards(format, images, "password", out), "shards with one missing");
+		images = outputs;
+		images[1] = others[1];
+		Check(!ExtractShards(format, images, "password", out), "shards with one from another payload");
+		images[1] = outputs[0];
+		Check(!ExtractShards(format, images, "password", out), "shards with one twice");
+		for (int i = 0; i != 3; ++i)
+		{
+			remove(outputs[i].c_str());
+			remove(others[i].c_str());
+			if (f == 1)
+			{
+				remove(formatCovers[i].c_str());
+			}
+		}
+	}
+	for (int i = 0; i != 3; ++i)
+	{
+		remove(covers[i].c_str());
+	}
+}
+
+static void TestVolume()
+{
+	// an empty entry, a small one, one that compresses and one that spans chunks
+	std::vector<std::string> names, contents;
+	names.push_back("empty");
+	contents.push_back("");
+	names.push_back("notes.txt");
+	contents.push_back("a few words");
+	names.push_back("words");
+	contents.push_back(std::string(50000, 'w') + Text(1000, 61));
+	names.push_back("dir/noise.bin");
+	contents.push_back(Text(2 * Entropy::ChunkSize + 300, 62));
+
+	// the volume itself, in memory
+	std::string volume = Entropy::MakeVolume(names, contents, Entropy::Deflate);
+	std::vector<Entropy::VolumeEntry> entries;
+	size_t directoryLength = Entropy::VolumeDirectoryLength(volume.substr(0, Entropy::VolumeHeaderSize));
+	Check(directoryLength != 0 && Entropy::ReadVolumeDirectory(volume.substr(0, directoryLength), entries)
+		&& entries.size() == names.size(), "volume directory");
+	for (size_t i = 0; i != entries.size() && i != names.size(); ++i)
+	{
+		std::string out;
+		Check(entries[i].name == names[i] && entries[i].size == contents[i].length()
+			&& Entropy::OpenVolumeEntry(entries[i], volume.substr((size_t)entries[i].offset, (size_t)entries[i].length), out)
+			&& out == contents[i], "volume entry in memory");
+		if (entries[i].length != 0)
+		{
+			std::string damaged = volume.substr((size_t)entries[i].offset, (size_t)entries[i].length);
+			damaged[damaged.length() / 2] ^= 1;
+			Check(!Entropy::OpenVolumeEntry(entries[i], damaged, out), "damaged volume entry");
+		}
+	}
+	Check(Entropy::VolumeDirectoryLength(Text(Entropy::VolumeHeaderSize, 63)) == 0, "text that isn't a volume");
+
+	// and hidden in an image, each entry read on its own
+	static const char* formats[] = { "bmp", "png" };
+	MakeCover("volume.bmp", 1024, 768);
+	for (int f = 0; f != 2; ++f)
+	{
+		std::string format = formats[f], cover = "volume.bmp", file = std::string("volume-out.") + format;
+		if (f == 1)
+		{
+			cover = "volume.png";
+			nexuspng::save_file(Nexus_Converter::BMP2PNG("volume.bmp"), cover);
+		}
+		Check(Nexus::EmbedVolumeInFile(names, contents, "password", f == 0, Entropy::Fast, format, cover, file), "volume embedded");
+		entries.clear();
+		Check(Nexus::ReadVolumeFromFile(format, file, "password", entries) && entries.size() == names.size(),
+			"volume directory from an image");
+		for (size_t i = names.size(); i-- > 0;)
+		{
+			std::string out;
+			Check(Nexus::ExtractEntryFromFile(format, file, "password", names[i], out) && out == contents[i], "volume entry extracted");
+		}
+		std::string out;
+		Check(!Nexus::ExtractEntryFromFile(format, file, "password", "missing", out), "volume entry that isn't there");
+		Check(!Nexus::ReadVolumeFromFile(format, file, "Password", entries), "volume directory with a wrong key");
+		Check(!Nexus::ExtractEntryFromFile(format, file, "Password", names[1], out), "volume entry with a wrong key");
+		remove(file.c_str());
+		if (f == 1)
+		{
+			remove(cover.c_str());
+		}
+	}
+
+	// an image that holds text, not a volume
+	std::istringstream input("just text");
+	Check(Nexus::BMPEmbedStreamInFile(input, 9, "password", false, "volume.bmp", "volume.bmp"), "text embedded");
+	Check(!Nexus::ReadVolumeFromFile("bmp", "volume.bmp", "password", entries), "image without a volume");
+	remove("volume.bmp");
+}
+
+static void TestScatter()
+{
+	MakeCover("scatter.bmp", 1000, 700);
+	static const size_t sizes[] = { 0, 1, 5000, Entropy::ChunkSize + 17, 200000 };
+	for (size_t i = 0; i != sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		std::string text = Text(sizes[i], 70 + (unsigned)i), out;
+		BMP bmp;
+		bmp.ReadFromFile("scatter.bmp");
+		std::istringstream input(text);
+		Check(Nexus::BMPEmbedScattered(input, text.length(), "password", i % 2 == 0, bmp, Entropy::Uncompressed), "scattered data");
+
+		// the top rows hold no readable text, so the data is looked for in the order of the key
+		Check(Nexus::BMPExtractText(bmp, 16) != text.substr(0, 16) || text.length() < 16, "scattered data isn't at the top");
+		std::ostringstream output;
+		Check(Nexus::BMPExtractStream(bmp, "password", output) && output.str() == text, "scatter round trip");
+		// with a wrong key nothing opens, and the top of the image reads as Legacy data
+		std::ostringstream wrong;
+		Check(!Nexus::BMPExtractStream(bmp, "Password", wrong) || wrong.str() != text || text.empty(), "scattered data with a wrong key");
+	}
+
+	// scattering takes a key, and data that fits
+	BMP bmp;
+	bmp.ReadFromFile("scatter.bmp");
+	std::string text = Text(300000, 79);
+	std::istringstream input(text), empty;
+	Check(!Nexus::BMPEmbedScattered(input, text.length(), "password", false, bmp), "scattered data that doesn't fit");
+	Check(!Nexus::BMPEmbedScattered(empty, 0, "", false, bmp), "scattering without a key");
+	remove("scatter.bmp");
+}
+
+auto main() -> int
+{
+	TestChunkedRoundTrip();
+	TestWrongKey();
+	TestSplicedChunk();
+	TestPatch();
+	TestShards();
+	TestVolume();
+	TestScatter();
+	if (failures) return 1;
+	printf("all payload tests passed\n");
+	return 0;
+}